@@ -0,0 +1,820 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "cgen.c"
+
+// ---------------- x86-64 汇编后端 ----------------
+
+// 把 IR 直接翻译为 GNU as 语法的 x86-64 汇编 (System V 调用约定), 用 as 汇编后与运行时对象
+// runtime.o 链接为可执行文件, 程序本身不经过 C 编译器
+//
+// 一个 Value 16 字节, 按 System V 约定占两个整数寄存器 (类型, 数据), 因此可以直接调用 value.c
+// 栈帧布局在编译时确定, rbp 之下依次是保存的 rbx r12 r13 r14, 然后是 16 字节的槽:
+//   [局部变量 (形参在前) | 内存寄存器 | 溢出槽 | 暂存槽]
+// 临时变量的位置来自寄存器分配: 0 号寄存器是 rbx:r12, 1 号是 r13:r14 (被调用者保存, 跨调用不变),
+// 其余编号的寄存器放在栈帧里; 溢出的临时变量由分配器插入的 spill / reload 读写溢出槽
+// 实参区, 调用深度和错误信息与虚拟机相同, 尾调用恢复栈帧后直接 jmp 到被调函数
+// 调用深度 x_depth 是线程局部变量 (并行循环的线程各有一份), 通过 %fs 段访问
+
+// 寄存器分配使用的寄存器数, 前 ASM_MACHINE_REGISTERS 个在机器寄存器中
+int asm_register_count = 16;
+#define ASM_MACHINE_REGISTERS 2
+
+// 运行时对象, 不存在时从 runtime.c 编译一次
+const char *asm_runtime_object = "runtime.o";
+
+// 槽区之上保存的寄存器占的字节数
+#define ASM_SAVED_BYTES 32
+
+typedef struct
+{
+    char tag[48];
+    char payload[48];
+} AsmLocation;
+
+typedef struct
+{
+    FILE *out;
+    StringMap globals;
+    StringMap functions;
+    StringMap locals; // 局部变量 -> 槽
+    StringMap labels; // 标签 -> 编号
+    StringMap keys;   // 字符串常量临时变量 -> load_const 的位置
+    int function_index;
+    int local_count;
+    int register_count; // 放在栈帧里的寄存器数
+    int spill_count;
+    int slot_count;
+    int label_count;
+    int string_count;
+    int cache_count;
+    int internal_label; // 快速路径用到的内部标签
+} AsmGen;
+
+// 输出一行缩进的指令
+void asm_line(AsmGen *g, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    fputs("    ", g->out);
+    vfprintf(g->out, format, args);
+    fputc('\n', g->out);
+    va_end(args);
+}
+
+// 槽 k 相对 rbp 的偏移
+int asm_slot_offset(AsmGen *g, int k)
+{
+    return -(ASM_SAVED_BYTES + 16 * g->slot_count) + 16 * k;
+}
+
+void asm_slot(AsmGen *g, int k, AsmLocation *loc)
+{
+    int offset = asm_slot_offset(g, k);
+    sprintf(loc->tag, "%d(%%rbp)", offset);
+    sprintf(loc->payload, "%d(%%rbp)", offset + 8);
+}
+
+// 临时变量的位置
+void asm_temp(AsmGen *g, const char *temp, AsmLocation *loc)
+{
+    static const char *machine[ASM_MACHINE_REGISTERS][2] = {{"%rbx", "%r12"}, {"%r13", "%r14"}};
+    int t = temp_index(temp);
+    int reg = t < temp_register_capacity ? temp_register[t] : -1;
+    if (reg < 0)
+        asm_slot(g, g->slot_count - 1, loc);
+    else if (reg < ASM_MACHINE_REGISTERS)
+    {
+        strcpy(loc->tag, machine[reg][0]);
+        strcpy(loc->payload, machine[reg][1]);
+    }
+    else
+        asm_slot(g, g->local_count + reg - ASM_MACHINE_REGISTERS, loc);
+}
+
+// 变量的位置: 全局变量在 .bss 中, 局部变量在槽中
+void asm_variable(AsmGen *g, const char *name, AsmLocation *loc)
+{
+    if (string_map_get(&g->globals, name) >= 0)
+    {
+        sprintf(loc->tag, ".Lg_%s(%%rip)", name);
+        sprintf(loc->payload, ".Lg_%s+8(%%rip)", name);
+    }
+    else
+        asm_slot(g, string_map_get(&g->locals, name), loc);
+}
+
+// 溢出槽 sN
+void asm_spill(AsmGen *g, const char *slot, AsmLocation *loc)
+{
+    asm_slot(g, g->local_count + g->register_count + atoi(slot + 1), loc);
+}
+
+void asm_load(AsmGen *g, AsmLocation *loc, const char *tag, const char *payload)
+{
+    if (strcmp(loc->tag, tag) != 0)
+        asm_line(g, "movq %s, %s", loc->tag, tag);
+    if (strcmp(loc->payload, payload) != 0)
+        asm_line(g, "movq %s, %s", loc->payload, payload);
+}
+
+void asm_store(AsmGen *g, AsmLocation *loc, const char *tag, const char *payload)
+{
+    if (strcmp(loc->tag, tag) != 0)
+        asm_line(g, "movq %s, %s", tag, loc->tag);
+    if (strcmp(loc->payload, payload) != 0)
+        asm_line(g, "movq %s, %s", payload, loc->payload);
+}
+
+void asm_load_temp(AsmGen *g, const char *temp, const char *tag, const char *payload)
+{
+    AsmLocation loc;
+    asm_temp(g, temp, &loc);
+    asm_load(g, &loc, tag, payload);
+}
+
+void asm_store_temp(AsmGen *g, const char *temp, const char *tag, const char *payload)
+{
+    AsmLocation loc;
+    asm_temp(g, temp, &loc);
+    asm_store(g, &loc, tag, payload);
+}
+
+// 把字节串写成 .string 的参数
+void asm_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (const unsigned char *p = (const unsigned char *)s; *p; p++)
+    {
+        if (*p == '"' || *p == '\\')
+            fprintf(out, "\\%c", *p);
+        else if (*p < 32 || *p >= 127)
+            fprintf(out, "\\%03o", *p);
+        else
+            fputc(*p, out);
+    }
+    fputc('"', out);
+}
+
+// 在只读数据段放一个字符串, 返回它的编号
+int asm_string_constant(AsmGen *g, const char *s)
+{
+    fprintf(g->out, "    .pushsection .rodata\n.LS%d:\n    .string ", g->string_count);
+    asm_string(g->out, s);
+    fprintf(g->out, "\n    .popsection\n");
+    return g->string_count++;
+}
+
+// 在 .bss 放一个字段访问的内联缓存, 返回它的编号
+int asm_field_cache(AsmGen *g)
+{
+    fprintf(g->out, "    .pushsection .bss\n    .balign 8\n.LIC%d:\n    .zero %d\n    .popsection\n", g->cache_count,
+            (int)sizeof(FieldCache));
+    return g->cache_count++;
+}
+
+// 常量放进 rax:rdx
+void asm_constant(AsmGen *g, const char *text)
+{
+    Value v = value_from_constant(text);
+    asm_line(g, "movl $%d, %%eax", (int)v.type);
+    if (v.type == VAL_STRING)
+        asm_line(g, "leaq .LS%d(%%rip), %%rdx", asm_string_constant(g, v.as.s));
+    else if (v.type == VAL_NIL)
+        asm_line(g, "xorl %%edx, %%edx");
+    else
+    {
+        unsigned long long bits;
+        memcpy(&bits, &v.as, sizeof(bits));
+        asm_line(g, "movabsq $%llu, %%rdx", bits);
+    }
+}
+
+void asm_epilogue(AsmGen *g)
+{
+    asm_line(g, "leaq -%d(%%rbp), %%rsp", ASM_SAVED_BYTES);
+    asm_line(g, "popq %%r14");
+    asm_line(g, "popq %%r13");
+    asm_line(g, "popq %%r12");
+    asm_line(g, "popq %%rbx");
+    asm_line(g, "popq %%rbp");
+}
+
+void asm_callee(AsmGen *g, const char *name, char *buffer)
+{
+    if (strcmp(name, "print") == 0 || strcmp(name, "read") == 0)
+        sprintf(buffer, "x_%s", name);
+    else if (strcmp(name, "$vector") == 0)
+        strcpy(buffer, "x_vector");
+    else if (string_map_get(&g->functions, name) >= 0)
+        sprintf(buffer, "xf_%s", name);
+    else
+    {
+        fprintf(stderr, "Compile error: undefined function %s\n", name);
+        exit(1);
+    }
+}
+
+// 类型推断改写出的专用运算: 只用两个操作数的数据字, 结果的类型在编译时已知
+void asm_typed_binary(AsmGen *g, IRInstruction *ins)
+{
+    static const char *ops[][2] = {{"add_i64", "addq"}, {"sub_i64", "subq"},  {"mul_i64", "imulq"},
+                                   {"lt_i64", "setl"},  {"gt_i64", "setg"},   {"le_i64", "setle"},
+                                   {"ge_i64", "setge"}, {"eq_i64", "sete"},   {"add_f64", "addsd"},
+                                   {"sub_f64", "subsd"}, {"mul_f64", "mulsd"}, {"div_f64", "divsd"}};
+    if (strcmp(ins->op, "concat") == 0)
+    {
+        asm_load_temp(g, ins->arg1, "%rdi", "%rsi");
+        asm_load_temp(g, ins->arg2, "%rdx", "%rcx");
+        asm_line(g, "call value_concat");
+        asm_store_temp(g, ins->result, "%rax", "%rdx");
+        return;
+    }
+    int k = 0;
+    while (strcmp(ins->op, ops[k][0]) != 0)
+        k++;
+    AsmLocation a;
+    AsmLocation b;
+    asm_temp(g, ins->arg1, &a);
+    asm_temp(g, ins->arg2, &b);
+    if (k < 3)
+    {
+        asm_line(g, "movq %s, %%rdx", a.payload);
+        asm_line(g, "%s %s, %%rdx", ops[k][1], b.payload);
+        asm_line(g, "movl $%d, %%eax", VAL_INT);
+    }
+    else if (k < 8)
+    {
+        asm_line(g, "movq %s, %%rsi", a.payload);
+        asm_line(g, "xorl %%edx, %%edx");
+        asm_line(g, "cmpq %s, %%rsi", b.payload);
+        asm_line(g, "%s %%dl", ops[k][1]);
+        asm_line(g, "movl $%d, %%eax", VAL_INT);
+    }
+    else
+    {
+        asm_line(g, "movq %s, %%xmm0", a.payload);
+        asm_line(g, "movq %s, %%xmm1", b.payload);
+        asm_line(g, "%s %%xmm1, %%xmm0", ops[k][1]);
+        asm_line(g, "movq %%xmm0, %%rdx");
+        asm_line(g, "movl $%d, %%eax", VAL_FLOAT);
+    }
+    asm_store_temp(g, ins->result, "%rax", "%rdx");
+}
+
+// 二元运算: 两个操作数放进 rdi:rsi 和 rdx:rcx, 结果在 rax:rdx
+// 整数的加减和比较内联快速路径, 其余调用 value.c
+void asm_binary(AsmGen *g, IRInstruction *ins)
+{
+    static const char *names[] = {"add", "sub", "mul", "div", "lt", "gt", "le", "ge", "eq"};
+    static const char *functions[] = {"value_add", "value_sub", "value_mul", "value_div", "value_lt",
+                                      "value_gt", "value_le", "value_ge", "value_eq"};
+    static const char *fast[] = {"addq", "subq", NULL, NULL, "setl", "setg", "setle", "setge", "sete"};
+    int k = 0;
+    while (k < 9 && strcmp(ins->op, names[k]) != 0)
+        k++;
+    if (k == 9)
+    {
+        asm_typed_binary(g, ins);
+        return;
+    }
+    asm_load_temp(g, ins->arg1, "%rdi", "%rsi");
+    asm_load_temp(g, ins->arg2, "%rdx", "%rcx");
+    if (fast[k] == NULL)
+        asm_line(g, "call %s", functions[k]);
+    else
+    {
+        int slow = g->internal_label++;
+        int done = g->internal_label++;
+        asm_line(g, "cmpl $%d, %%edi", VAL_INT);
+        asm_line(g, "jne .LI%d", slow);
+        asm_line(g, "cmpl $%d, %%edx", VAL_INT);
+        asm_line(g, "jne .LI%d", slow);
+        if (k < 2)
+        {
+            asm_line(g, "movq %%rsi, %%rdx");
+            asm_line(g, "%s %%rcx, %%rdx", fast[k]);
+        }
+        else
+        {
+            asm_line(g, "xorl %%edx, %%edx");
+            asm_line(g, "cmpq %%rcx, %%rsi");
+            asm_line(g, "%s %%dl", fast[k]);
+        }
+        asm_line(g, "movl $%d, %%eax", VAL_INT);
+        asm_line(g, "jmp .LI%d", done);
+        fprintf(g->out, ".LI%d:\n", slow);
+        asm_line(g, "call %s", functions[k]);
+        fprintf(g->out, ".LI%d:\n", done);
+    }
+    asm_store_temp(g, ins->result, "%rax", "%rdx");
+}
+
+// 已证明不越界的数组读写: 数组和整数下标时直接访问元素, 否则调用 value.c
+void asm_unchecked(AsmGen *g, IRInstruction *ins, int store)
+{
+    int slow = g->internal_label++;
+    int done = g->internal_label++;
+    int packed = g->internal_label++;
+    asm_load_temp(g, store ? ins->result : ins->arg1, "%rdi", "%rsi");
+    asm_load_temp(g, store ? ins->arg1 : ins->arg2, "%rdx", "%rcx");
+    if (store)
+        asm_load_temp(g, ins->arg2, "%r8", "%r9");
+    asm_line(g, "cmpl $%d, %%edi", VAL_ARRAY);
+    asm_line(g, "jne .LI%d", slow);
+    asm_line(g, "cmpl $%d, %%edx", VAL_INT);
+    asm_line(g, "jne .LI%d", slow);
+    // 紧凑数组的 kind 就是元素的类型标签
+    asm_line(g, "movl %d(%%rsi), %%eax", (int)offsetof(Array, kind));
+    asm_line(g, "testl %%eax, %%eax");
+    asm_line(g, "jnz .LI%d", packed);
+    asm_line(g, "movq (%%rsi), %%rax");
+    asm_line(g, "shlq $4, %%rcx");
+    if (store)
+    {
+        asm_line(g, "movq %%r8, (%%rax,%%rcx)");
+        asm_line(g, "movq %%r9, 8(%%rax,%%rcx)");
+        asm_line(g, "jmp .LI%d", done);
+        fprintf(g->out, ".LI%d:\n", packed);
+        asm_line(g, "cmpl %%eax, %%r8d");
+        asm_line(g, "jne .LI%d", slow);
+        asm_line(g, "movq (%%rsi), %%rax");
+        asm_line(g, "movq %%r9, (%%rax,%%rcx,8)");
+        asm_line(g, "jmp .LI%d", done);
+        fprintf(g->out, ".LI%d:\n", slow);
+        asm_line(g, "call value_set_index");
+        fprintf(g->out, ".LI%d:\n", done);
+        return;
+    }
+    asm_line(g, "movq 8(%%rax,%%rcx), %%rdx");
+    asm_line(g, "movq (%%rax,%%rcx), %%rax");
+    asm_line(g, "jmp .LI%d", done);
+    fprintf(g->out, ".LI%d:\n", packed);
+    asm_line(g, "movq (%%rsi), %%rdx");
+    asm_line(g, "movq (%%rdx,%%rcx,8), %%rdx");
+    asm_line(g, "jmp .LI%d", done);
+    fprintf(g->out, ".LI%d:\n", slow);
+    asm_line(g, "call value_get_index");
+    fprintf(g->out, ".LI%d:\n", done);
+    asm_store_temp(g, ins->result, "%rax", "%rdx");
+}
+
+// 把 IR 区间 [start, end) 翻译为函数 symbol
+void asm_function(AsmGen *g, const char *name, const char *symbol, int start, int end)
+{
+    string_map_init(&g->locals, 16);
+    string_map_init(&g->labels, 16);
+    string_constant_temps(&g->keys, start, end);
+    g->local_count = 0;
+    g->label_count = 0;
+
+    // 栈帧布局: 局部变量的槽, 用到的寄存器数和溢出槽数
+    int param_count = 0;
+    int registers = 0;
+    int spills = 0;
+    for (int i = start; i < end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (ir_is(ins, "param"))
+        {
+            string_map_put(&g->locals, ins->arg1, g->local_count++);
+            param_count++;
+        }
+        char **fields[3];
+        int uses = instruction_uses(ins, fields);
+        for (int k = 0; k < uses; k++)
+        {
+            int t = temp_index(*fields[k]);
+            if (t < temp_register_capacity && temp_register[t] + 1 > registers)
+                registers = temp_register[t] + 1;
+        }
+        if (ir_has_def(ins->op) && is_temp(ins->result))
+        {
+            int t = temp_index(ins->result);
+            if (t < temp_register_capacity && temp_register[t] + 1 > registers)
+                registers = temp_register[t] + 1;
+        }
+        if (ir_is(ins, "spill") && atoi(ins->result + 1) + 1 > spills)
+            spills = atoi(ins->result + 1) + 1;
+    }
+    for (int i = start; i < end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        const char *variable = ir_is(ins, "load") ? ins->arg1 : ir_is(ins, "store") ? ins->result : NULL;
+        if (variable != NULL && string_map_get(&g->globals, variable) < 0 &&
+            string_map_get(&g->locals, variable) < 0)
+            string_map_put(&g->locals, variable, g->local_count++);
+    }
+    g->register_count = registers > ASM_MACHINE_REGISTERS ? registers - ASM_MACHINE_REGISTERS : 0;
+    g->spill_count = spills;
+    g->slot_count = g->local_count + g->register_count + spills + 1;
+
+    FILE *out = g->out;
+    fprintf(out, "\n# %s\n", name);
+    fprintf(out, "    .pushsection .rodata\n.LN%d:\n    .string ", g->function_index);
+    asm_string(out, name);
+    fprintf(out, "\n    .popsection\n");
+    fprintf(out, "    .type %s, @function\n%s:\n", symbol, symbol);
+    asm_line(g, "pushq %%rbp");
+    asm_line(g, "movq %%rsp, %%rbp");
+    asm_line(g, "pushq %%rbx");
+    asm_line(g, "pushq %%r12");
+    asm_line(g, "pushq %%r13");
+    asm_line(g, "pushq %%r14");
+    asm_line(g, "subq $%d, %%rsp", 16 * g->slot_count);
+    asm_line(g, "movl %%edi, %%ecx");
+    asm_line(g, "leaq %d(%%rbp), %%rdi", asm_slot_offset(g, 0));
+    asm_line(g, "movl $%d, %%esi", g->local_count);
+    asm_line(g, "movl $%d, %%edx", param_count);
+    asm_line(g, "leaq .LN%d(%%rip), %%r8", g->function_index);
+    asm_line(g, "call x_asm_enter");
+
+    char callee[256];
+    AsmLocation loc;
+    for (int i = start; i < end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        const char *op = ins->op;
+        int key;
+
+        if (strcmp(op, "load_const") == 0)
+        {
+            asm_constant(g, ins->arg1);
+            asm_store_temp(g, ins->result, "%rax", "%rdx");
+        }
+        else if (strcmp(op, "load") == 0)
+        {
+            asm_variable(g, ins->arg1, &loc);
+            asm_load(g, &loc, "%rax", "%rdx");
+            asm_store_temp(g, ins->result, "%rax", "%rdx");
+        }
+        else if (strcmp(op, "store") == 0)
+        {
+            asm_load_temp(g, ins->arg1, "%rax", "%rdx");
+            asm_variable(g, ins->result, &loc);
+            asm_store(g, &loc, "%rax", "%rdx");
+        }
+        else if (ir_is_binary(op))
+            asm_binary(g, ins);
+        else if (strcmp(op, "move") == 0)
+        {
+            asm_load_temp(g, ins->arg1, "%rax", "%rdx");
+            asm_store_temp(g, ins->result, "%rax", "%rdx");
+        }
+        else if (strcmp(op, "string_builder") == 0)
+        {
+            asm_load_temp(g, ins->arg1, "%rdi", "%rsi");
+            asm_line(g, "call string_builder");
+            asm_store_temp(g, ins->result, "%rax", "%rdx");
+        }
+        else if (strcmp(op, "string_append") == 0)
+        {
+            asm_load_temp(g, ins->arg1, "%rdi", "%rsi");
+            asm_load_temp(g, ins->arg2, "%rdx", "%rcx");
+            asm_line(g, "call string_append");
+            asm_store_temp(g, ins->result, "%rax", "%rdx");
+        }
+        else if (strcmp(op, "spill") == 0)
+        {
+            asm_load_temp(g, ins->arg1, "%rax", "%rdx");
+            asm_spill(g, ins->result, &loc);
+            asm_store(g, &loc, "%rax", "%rdx");
+        }
+        else if (strcmp(op, "reload") == 0)
+        {
+            asm_spill(g, ins->arg1, &loc);
+            asm_load(g, &loc, "%rax", "%rdx");
+            asm_store_temp(g, ins->result, "%rax", "%rdx");
+        }
+        else if (strcmp(op, "new_array") == 0 || strcmp(op, "new_map") == 0)
+        {
+            asm_line(g, "movl $%d, %%edi", atoi(ins->arg1));
+            asm_line(g, "call %s", strcmp(op, "new_array") == 0 ? "value_new_array" : "value_new_map");
+            asm_store_temp(g, ins->result, "%rax", "%rdx");
+        }
+        else if ((strcmp(op, "array_store") == 0 || strcmp(op, "key_value_pair") == 0) &&
+                 (key = string_map_get(&g->keys, ins->arg1)) >= 0)
+        {
+            // 常量键: map_set_field(container, key, cache, value)
+            asm_load_temp(g, ins->result, "%rdi", "%rsi");
+            asm_load_temp(g, ins->arg2, "%r8", "%r9");
+            asm_line(g, "leaq .LS%d(%%rip), %%rdx", asm_string_constant(g, value_from_constant(ir_code[key].arg1).as.s));
+            asm_line(g, "leaq .LIC%d(%%rip), %%rcx", asm_field_cache(g));
+            asm_line(g, "call map_set_field");
+        }
+        else if (strcmp(op, "array_access") == 0 && (key = string_map_get(&g->keys, ins->arg2)) >= 0)
+        {
+            // 常量键: map_get_field(container, key, cache)
+            asm_load_temp(g, ins->arg1, "%rdi", "%rsi");
+            asm_line(g, "leaq .LS%d(%%rip), %%rdx", asm_string_constant(g, value_from_constant(ir_code[key].arg1).as.s));
+            asm_line(g, "leaq .LIC%d(%%rip), %%rcx", asm_field_cache(g));
+            asm_line(g, "call map_get_field");
+            asm_store_temp(g, ins->result, "%rax", "%rdx");
+        }
+        else if (strcmp(op, "array_store") == 0 || strcmp(op, "key_value_pair") == 0)
+        {
+            asm_load_temp(g, ins->result, "%rdi", "%rsi");
+            asm_load_temp(g, ins->arg1, "%rdx", "%rcx");
+            asm_load_temp(g, ins->arg2, "%r8", "%r9");
+            asm_line(g, "call value_set_index");
+        }
+        else if (strcmp(op, "array_store_unchecked") == 0)
+            asm_unchecked(g, ins, 1);
+        else if (strcmp(op, "array_access") == 0)
+        {
+            asm_load_temp(g, ins->arg1, "%rdi", "%rsi");
+            asm_load_temp(g, ins->arg2, "%rdx", "%rcx");
+            asm_line(g, "call value_get_index");
+            asm_store_temp(g, ins->result, "%rax", "%rdx");
+        }
+        else if (strcmp(op, "array_access_unchecked") == 0)
+            asm_unchecked(g, ins, 0);
+        else if (strcmp(op, "array_length") == 0)
+        {
+            asm_load_temp(g, ins->arg1, "%rdi", "%rsi");
+            asm_line(g, "call value_length");
+            asm_store_temp(g, ins->result, "%rax", "%rdx");
+        }
+        else if (strcmp(op, "arg") == 0)
+        {
+            asm_load_temp(g, ins->arg1, "%rdi", "%rsi");
+            asm_line(g, "call x_asm_push");
+        }
+        else if (strcmp(op, "call_function") == 0)
+        {
+            asm_callee(g, ins->arg1, callee);
+            asm_line(g, "movl $%d, %%edi", atoi(ins->arg2));
+            asm_line(g, "call %s", callee);
+            asm_store_temp(g, ins->result, "%rax", "%rdx");
+        }
+        else if (strcmp(op, "parallel_for") == 0)
+        {
+            asm_callee(g, ins->arg1, callee);
+            asm_line(g, "leaq %s(%%rip), %%rdi", callee);
+            asm_line(g, "movl $%d, %%esi", atoi(ins->arg2));
+            asm_line(g, "call x_parallel_for");
+            asm_store_temp(g, ins->result, "%rax", "%rdx");
+        }
+        else if (strcmp(op, "parallel_apply") == 0)
+        {
+            if (string_map_get(&g->functions, ins->arg1) < 0)
+            {
+                fprintf(stderr, "Compile error: undefined function %s\n", ins->arg1);
+                exit(1);
+            }
+            asm_line(g, "leaq xf_%s(%%rip), %%rdi", ins->arg1);
+            asm_line(g, "movl $%d, %%esi", atoi(ins->arg2));
+            asm_line(g, "call x_parallel_apply");
+            asm_store_temp(g, ins->result, "%rax", "%rdx");
+        }
+        else if (strcmp(op, "spawn") == 0)
+        {
+            if (string_map_get(&g->functions, ins->arg1) < 0)
+            {
+                fprintf(stderr, "Compile error: %s %s\n",
+                        strcmp(ins->arg1, "print") == 0 || strcmp(ins->arg1, "read") == 0 ? "cannot spawn builtin"
+                                                                                            : "undefined function",
+                        ins->arg1);
+                exit(1);
+            }
+            asm_line(g, "leaq xf_%s(%%rip), %%rdi", ins->arg1);
+            asm_line(g, "movl $%d, %%esi", atoi(ins->arg2));
+            asm_line(g, "call x_spawn");
+            asm_store_temp(g, ins->result, "%rax", "%rdx");
+        }
+        else if (strcmp(op, "await") == 0)
+        {
+            asm_load_temp(g, ins->arg1, "%rdi", "%rsi");
+            asm_line(g, "call x_await");
+            asm_store_temp(g, ins->result, "%rax", "%rdx");
+        }
+        else if (strcmp(op, "tail_call") == 0)
+        {
+            // 与虚拟机复用栈帧一样: 退出当前函数的调用深度, 恢复栈帧后跳到被调函数
+            asm_callee(g, ins->arg1, callee);
+            asm_line(g, "decl %%fs:x_depth@tpoff");
+            asm_line(g, "movl $%d, %%edi", atoi(ins->arg2));
+            if (strncmp(callee, "xf_", 3) == 0)
+            {
+                asm_epilogue(g);
+                asm_line(g, "jmp %s", callee);
+            }
+            else
+            {
+                asm_line(g, "call %s", callee);
+                asm_epilogue(g);
+                asm_line(g, "ret");
+            }
+        }
+        else if (strcmp(op, "label") == 0)
+        {
+            if (string_map_get(&g->labels, ins->arg1) < 0)
+                string_map_put(&g->labels, ins->arg1, g->label_count++);
+            fprintf(out, ".L%d_%d:\n", g->function_index, string_map_get(&g->labels, ins->arg1));
+        }
+        else if (strcmp(op, "goto") == 0 || strcmp(op, "if_false") == 0)
+        {
+            const char *label = strcmp(op, "goto") == 0 ? ins->arg1 : ins->arg2;
+            if (string_map_get(&g->labels, label) < 0)
+                string_map_put(&g->labels, label, g->label_count++);
+            int target = string_map_get(&g->labels, label);
+            if (strcmp(op, "goto") == 0)
+            {
+                asm_line(g, "jmp .L%d_%d", g->function_index, target);
+                continue;
+            }
+            // 整数条件直接测试, 其他类型调用 value_truthy
+            int slow = g->internal_label++;
+            int done = g->internal_label++;
+            asm_load_temp(g, ins->arg1, "%rdi", "%rsi");
+            asm_line(g, "cmpl $%d, %%edi", VAL_INT);
+            asm_line(g, "jne .LI%d", slow);
+            asm_line(g, "testq %%rsi, %%rsi");
+            asm_line(g, "jz .L%d_%d", g->function_index, target);
+            asm_line(g, "jmp .LI%d", done);
+            fprintf(out, ".LI%d:\n", slow);
+            asm_line(g, "call value_truthy");
+            asm_line(g, "testl %%eax, %%eax");
+            asm_line(g, "jz .L%d_%d", g->function_index, target);
+            fprintf(out, ".LI%d:\n", done);
+        }
+        else if (strcmp(op, "return") == 0)
+        {
+            if (ins->arg1 != NULL)
+                asm_load_temp(g, ins->arg1, "%rax", "%rdx");
+            else
+            {
+                asm_line(g, "xorl %%eax, %%eax");
+                asm_line(g, "xorl %%edx, %%edx");
+            }
+            asm_line(g, "decl %%fs:x_depth@tpoff");
+            asm_epilogue(g);
+            asm_line(g, "ret");
+        }
+        // param / alloc / nop 不生成代码
+    }
+    asm_line(g, "xorl %%eax, %%eax");
+    asm_line(g, "xorl %%edx, %%edx");
+    asm_line(g, "decl %%fs:x_depth@tpoff");
+    asm_epilogue(g);
+    asm_line(g, "ret");
+    fprintf(out, "    .size %s, .-%s\n", symbol, symbol);
+
+    string_map_free(&g->locals);
+    string_map_free(&g->labels);
+    string_map_free(&g->keys);
+    g->function_index++;
+}
+
+// 把当前的 IR (已经优化) 翻译为汇编程序, 寄存器分配在这里进行
+void asm_emit(FILE *out)
+{
+    RegAllocConfig config = {asm_register_count};
+    allocate_registers(config);
+
+    AsmGen g;
+    memset(&g, 0, sizeof(g));
+    g.out = out;
+    string_map_init(&g.globals, 16);
+    string_map_init(&g.functions, 16);
+
+    fprintf(out, "# 由 X 编译器生成, 与 runtime.o 链接\n    .text\n");
+
+    // 全局变量和函数表
+    int depth = 0;
+    int has_global_code = 0;
+    for (int i = 0; i < ir_count; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (ir_is(ins, "function"))
+        {
+            depth++;
+            string_map_put(&g.functions, ins->arg1, 1);
+        }
+        else if (ir_is(ins, "end_function"))
+            depth--;
+        else if (depth == 0 && !ir_is(ins, "nop"))
+        {
+            has_global_code = 1;
+            if (ir_is(ins, "alloc") && string_map_get(&g.globals, ins->arg1) < 0)
+            {
+                string_map_put(&g.globals, ins->arg1, 1);
+                fprintf(out, "    .pushsection .bss\n    .balign 16\n.Lg_%s:\n    .zero 16\n    .popsection\n", ins->arg1);
+            }
+        }
+    }
+
+    // 全局代码在 IR 的开头, 函数之前
+    if (has_global_code)
+    {
+        int start = 0;
+        while (start < ir_count && ir_is(&ir_code[start], "nop"))
+            start++;
+        int end = start;
+        while (end < ir_count && !ir_is(&ir_code[end], "function"))
+            end++;
+        asm_function(&g, "(global)", "x_global_code", start, end);
+    }
+    int i = 0;
+    while (i < ir_count)
+    {
+        if (ir_is(&ir_code[i], "function"))
+        {
+            char symbol[256];
+            snprintf(symbol, sizeof(symbol), "xf_%s", ir_code[i].arg1);
+            int end = find_function_end(i);
+            asm_function(&g, ir_code[i].arg1, symbol, i + 1, end);
+            i = end + 1;
+        }
+        else
+            i++;
+    }
+
+    // 程序入口: 切换到运行时分配的栈, 先执行全局代码, 再执行 main
+    fprintf(out, "\n    .globl main\n    .type main, @function\nmain:\n");
+    fprintf(out, "    pushq %%rbp\n    movq %%rsp, %%rbp\n    pushq %%rbx\n    subq $8, %%rsp\n");
+    fprintf(out, "    call x_asm_stack\n    movq %%rsp, %%rbx\n    movq %%rax, %%rsp\n");
+    if (has_global_code)
+        fprintf(out, "    xorl %%edi, %%edi\n    call x_global_code\n");
+    if (string_map_get(&g.functions, "main") >= 0)
+        fprintf(out, "    xorl %%edi, %%edi\n    call xf_main\n");
+    // 没有结束的任务执行完之后程序才结束
+    fprintf(out, "    call task_wait_all\n    call io_flush\n    movq %%rbx, %%rsp\n    xorl %%edi, %%edi\n    call fflush\n");
+    fprintf(out, "    xorl %%eax, %%eax\n    movq -8(%%rbp), %%rbx\n    leave\n    ret\n    .size main, .-main\n");
+    fprintf(out, "    .section .note.GNU-stack,\"\",@progbits\n");
+
+    string_map_free(&g.globals);
+    string_map_free(&g.functions);
+}
+
+// 汇编 s_path 并与运行时对象链接为 exe_path, 成功返回 1
+int asm_build(const char *s_path, const char *exe_path)
+{
+    const char *cc = getenv("CC") != NULL ? getenv("CC") : cgen_cc;
+    size_t size = strlen(cc) + 2 * strlen(cgen_runtime_dir) + strlen(asm_runtime_object) + strlen(s_path) +
+                  2 * strlen(exe_path) + 128;
+    char *command = malloc(size);
+
+    // 运行时对象只编译一次
+    char *object = malloc(size);
+    snprintf(object, size, "%s/%s", cgen_runtime_dir, asm_runtime_object);
+    FILE *exists = fopen(object, "rb");
+    int ok = 1;
+    if (exists != NULL)
+        fclose(exists);
+    else
+    {
+        snprintf(command, size, "%s -O2 -std=c99 -pthread -c \"%s/runtime.c\" -o \"%s\"", cc, cgen_runtime_dir, object);
+        ok = system(command) == 0;
+    }
+    if (ok)
+    {
+        snprintf(command, size, "as -o \"%s.o\" \"%s\"", exe_path, s_path);
+        ok = system(command) == 0;
+    }
+    if (ok)
+    {
+        snprintf(command, size, "%s -pthread -o \"%s\" \"%s.o\" \"%s\"", cc, exe_path, exe_path, object);
+        ok = system(command) == 0;
+    }
+    free(object);
+    free(command);
+    return ok;
+}
+
+// 源程序 -> 汇编文件; exe_path 不为 NULL 时再汇编链接为可执行文件, 失败返回 0
+int asm_compile_source(const char *source, const char *s_path, const char *exe_path, int optimize)
+{
+    int token_count = 0;
+    Token *tokens = lexer(source, &token_count);
+    ASTNode *root = parse_program(&tokens, token_count);
+    generateIR(root);
+    if (optimize)
+        optimize_ir();
+
+    FILE *out = fopen(s_path, "w");
+    if (out == NULL)
+    {
+        fprintf(stderr, "Cannot write %s\n", s_path);
+        return 0;
+    }
+    asm_emit(out);
+    fclose(out);
+    return exe_path == NULL || asm_build(s_path, exe_path);
+}
+
+// // 测试输入
+// int main()
+// {
+//     freopen("input.txt", "r", stdin);
+//     int fsize = 1000;
+
+//     char source[1000] = {0};
+//     fread(source, 1, fsize, stdin);
+
+//     asm_compile_source(source, "output_asm.txt", NULL, 1);
+
+//     return 0;
+// }
\ No newline at end of file
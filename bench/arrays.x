@@ -0,0 +1,31 @@
+# 数组读写
+
+primes = [0];
+
+function sieve(n)
+{
+    flags = primes;
+    for (i: 0, n)
+    {
+        flags[i] = 1;
+    }
+    count = 0;
+    for (i: 2, n)
+    {
+        if (flags[i] == 1)
+        {
+            count = count + 1;
+            for (j: 0, n / i)
+            {
+                flags[(i * j) + i] = 0;
+            }
+        }
+    }
+    return count;
+}
+
+main()
+{
+    print(sieve(300000));
+    print(primes[97], primes[99]);
+}
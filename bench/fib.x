@@ -0,0 +1,13 @@
+# 递归调用
+
+function fib(n)
+{
+    if (n < 2)
+        return n;
+    return fib(n - 1) + fib(n - 2);
+}
+
+main()
+{
+    print(fib(27));
+}
@@ -0,0 +1,29 @@
+# 嵌套循环与算术
+
+total = 0;
+
+function collatz(n)
+{
+    steps = 0;
+    for (k: 0, 1000)
+    {
+        if (n == 1)
+            return steps;
+        half = n / 2;
+        if ((half * 2) == n)
+            n = half;
+        else
+            n = (3 * n) + 1;
+        steps = steps + 1;
+    }
+    return steps;
+}
+
+main()
+{
+    for (i: 1, 30000)
+    {
+        total = total + collatz(i);
+    }
+    print(total);
+}
@@ -0,0 +1,552 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "interp.c"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// ---------------- 预编译字节码文件 (.xbc) ----------------
+
+// 文件布局, 全部为小端序, 各段按 8 字节对齐:
+//   XbcHeader
+//   常量段   XbcConstant[constant_count]
+//   函数段   XbcFunction[function_count]
+//   全局段   uint32_t[global_count]       全局变量名在字符串段中的偏移
+//   代码段   Instruction[code_count]      所有函数的指令依次排列
+//   字符串段 以 '\0' 结尾的字符串
+// 代码段和字符串段直接在映射的内存中使用, 不需要复制; 只有字符串常量复制为驻留的字符串 (见 value.c)
+
+#define XBC_MAGIC 0x00434258 // "XBC\0"
+// 文件格式或指令集有变化时增加版本号
+#define XBC_VERSION 7
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t opcode_count; // 生成文件时的操作码个数
+    uint32_t file_size;
+    uint64_t source_checksum;
+    uint64_t body_checksum; // 文件头之后全部内容的校验和
+    uint32_t constant_offset, constant_count;
+    uint32_t function_offset, function_count;
+    uint32_t global_offset, global_count;
+    uint32_t code_offset, code_count;
+    uint32_t string_offset, string_size;
+    int32_t entry;
+    int32_t main_function;
+} XbcHeader;
+
+typedef struct
+{
+    uint32_t type;   // ValueType
+    uint32_t unused;
+    uint64_t bits;   // 整数, 浮点数的位, 或字符串在字符串段中的偏移
+} XbcConstant;
+
+typedef struct
+{
+    uint32_t name; // 字符串段中的偏移
+    uint32_t param_count;
+    uint32_t local_count;
+    uint32_t register_count;
+    uint32_t spill_count;
+    uint32_t frame_size;
+    uint32_t code_start; // 代码段中的指令下标
+    uint32_t code_length;
+} XbcFunction;
+
+// 加载后的文件: 映射的内存和从中建立的模块
+typedef struct
+{
+    unsigned char *data;
+    size_t size;
+    int mapped;
+    XbcHeader *header;
+    VMModule *module;
+} XbcFile;
+
+// 最近一次加载失败的原因
+const char *xbc_error = NULL;
+
+// FNV-1a 校验和
+uint64_t xbc_hash(const unsigned char *data, size_t length)
+{
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// 源码的校验和, 用于判断 .xbc 是否过期
+uint64_t xbc_checksum(const char *source)
+{
+    return xbc_hash((const unsigned char *)source, strlen(source));
+}
+
+// ---------------- 写入 ----------------
+
+typedef struct
+{
+    unsigned char *data;
+    size_t length;
+    size_t capacity;
+} XbcBuffer;
+
+size_t xbc_append(XbcBuffer *buffer, const void *data, size_t length)
+{
+    if (buffer->length + length > buffer->capacity)
+    {
+        while (buffer->length + length > buffer->capacity)
+            buffer->capacity = buffer->capacity == 0 ? 256 : buffer->capacity * 2;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+    size_t offset = buffer->length;
+    memcpy(buffer->data + offset, data, length);
+    buffer->length += length;
+    return offset;
+}
+
+void xbc_align(XbcBuffer *buffer)
+{
+    static const unsigned char zero[8] = {0};
+    xbc_append(buffer, zero, (8 - buffer->length % 8) % 8);
+}
+
+uint32_t xbc_string(XbcBuffer *strings, const char *s)
+{
+    return (uint32_t)xbc_append(strings, s, strlen(s) + 1);
+}
+
+// 把模块写入 .xbc 文件, 成功返回 1
+int xbc_write(const char *path, VMModule *m, const char *source)
+{
+    XbcHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = XBC_MAGIC;
+    header.version = XBC_VERSION;
+    header.opcode_count = OP_COUNT;
+    header.source_checksum = xbc_checksum(source);
+    header.entry = m->entry;
+    header.main_function = m->main_function;
+
+    XbcBuffer strings = {NULL, 0, 0};
+    XbcBuffer body = {NULL, 0, 0};
+    xbc_append(&body, &header, sizeof(header));
+    xbc_align(&body);
+
+    header.constant_offset = body.length;
+    header.constant_count = m->constant_count;
+    for (int k = 0; k < m->constant_count; k++)
+    {
+        Value v = m->constants[k];
+        XbcConstant c = {v.type, 0, 0};
+        if (v.type == VAL_INT)
+            c.bits = (uint64_t)v.as.i;
+        else if (v.type == VAL_FLOAT)
+            memcpy(&c.bits, &v.as.f, sizeof(double));
+        else if (v.type == VAL_STRING)
+            c.bits = xbc_string(&strings, v.as.s);
+        xbc_append(&body, &c, sizeof(c));
+    }
+    xbc_align(&body);
+
+    header.function_offset = body.length;
+    header.function_count = m->function_count;
+    uint32_t code_start = 0;
+    for (int i = 0; i < m->function_count; i++)
+    {
+        VMFunction *f = &m->functions[i];
+        XbcFunction entry = {xbc_string(&strings, f->name), f->param_count, f->local_count, f->register_count,
+                             f->spill_count, f->frame_size, code_start, f->code_length};
+        xbc_append(&body, &entry, sizeof(entry));
+        code_start += f->code_length;
+    }
+    xbc_align(&body);
+
+    header.global_offset = body.length;
+    header.global_count = m->global_count;
+    for (int g = 0; g < m->global_count; g++)
+    {
+        uint32_t name = xbc_string(&strings, m->global_names[g]);
+        xbc_append(&body, &name, sizeof(name));
+    }
+    xbc_align(&body);
+
+    header.code_offset = body.length;
+    header.code_count = code_start;
+    for (int i = 0; i < m->function_count; i++)
+        xbc_append(&body, m->functions[i].code, sizeof(Instruction) * m->functions[i].code_length);
+    xbc_align(&body);
+
+    header.string_offset = body.length;
+    header.string_size = strings.length;
+    if (strings.length > 0)
+        xbc_append(&body, strings.data, strings.length);
+    header.file_size = body.length;
+    header.body_checksum = xbc_hash(body.data + sizeof(header), body.length - sizeof(header));
+    memcpy(body.data, &header, sizeof(header));
+
+    FILE *file = fopen(path, "wb");
+    int ok = file != NULL && fwrite(body.data, 1, body.length, file) == body.length;
+    if (file != NULL && fclose(file) != 0)
+        ok = 0;
+    free(body.data);
+    free(strings.data);
+    return ok;
+}
+
+// ---------------- 加载与校验 ----------------
+
+int xbc_fail(const char *reason)
+{
+    xbc_error = reason;
+    return 0;
+}
+
+int xbc_section_ok(XbcFile *x, uint32_t offset, uint32_t count, size_t item_size)
+{
+    return offset % 8 == 0 && offset <= x->size && count <= (x->size - offset) / item_size;
+}
+
+const char *xbc_string_at(XbcFile *x, uint32_t offset)
+{
+    return (const char *)x->data + x->header->string_offset + offset;
+}
+
+// 字符串的偏移在字符串段内, 且在段内以 '\0' 结尾
+int xbc_string_ok(XbcFile *x, uint64_t offset)
+{
+    XbcHeader *h = x->header;
+    return offset < h->string_size && memchr(xbc_string_at(x, offset), 0, h->string_size - offset) != NULL;
+}
+
+// 字段访问的键是字符串常量
+int xbc_key_ok(XbcFile *x, int k)
+{
+    return k < (int)x->header->constant_count && x->module->constants[k].type == VAL_STRING;
+}
+
+// 检查指令的操作数, 保证执行时不会越界访问
+int xbc_code_ok(XbcFile *x, XbcFunction *f, Instruction *code)
+{
+    XbcHeader *h = x->header;
+    for (uint32_t pc = 0; pc < f->code_length; pc++)
+    {
+        Instruction *ins = &code[pc];
+        int a_slot = 1;
+        int b_slot = 0;
+        int c_slot = 0;
+        switch (ins->op)
+        {
+        case OP_LOADK:
+            if (ins->b >= h->constant_count)
+                return 0;
+            break;
+        case OP_GETGLOBAL:
+        case OP_SETGLOBAL:
+            if (ins->b >= h->global_count)
+                return 0;
+            break;
+        case OP_MOVE:
+        case OP_LEN:
+        case OP_AWAIT:
+        case OP_BUILDER:
+            b_slot = 1;
+            break;
+        case OP_GETFIELD:
+            if (!xbc_key_ok(x, ins->c))
+                return 0;
+            b_slot = 1;
+            break;
+        case OP_SETFIELD:
+            if (!xbc_key_ok(x, ins->b))
+                return 0;
+            c_slot = 1;
+            break;
+        case OP_NEWARRAY:
+        case OP_NEWMAP:
+        case OP_RET:
+        case OP_ARG:
+            break;
+        case OP_CALL:
+        case OP_TAILCALL:
+        case OP_PARALLEL:
+        case OP_APPLY:
+        case OP_SPAWN:
+            if (ins->b >= h->function_count)
+                return 0;
+            a_slot = ins->op != OP_TAILCALL;
+            break;
+        case OP_BUILTIN:
+            if (ins->b > BUILTIN_VECTOR)
+                return 0;
+            break;
+        case OP_JMP:
+        case OP_JMPF:
+            if (ins->b >= f->code_length)
+                return 0;
+            a_slot = ins->op == OP_JMPF;
+            break;
+        case OP_NOP:
+        case OP_RETNIL:
+            a_slot = 0;
+            break;
+        default:
+            if (ins->op >= OP_COUNT)
+                return 0;
+            // 二元运算和下标操作的三个操作数都是槽
+            b_slot = c_slot = 1;
+            break;
+        }
+        if ((a_slot && ins->a >= f->frame_size) || (b_slot && ins->b >= f->frame_size) ||
+            (c_slot && ins->c >= f->frame_size))
+            return 0;
+    }
+    // 最后一条指令必须是跳转或返回, 执行不会越过函数末尾
+    int last = f->code_length > 0 ? code[f->code_length - 1].op : OP_NOP;
+    return last == OP_RET || last == OP_RETNIL || last == OP_JMP || last == OP_TAILCALL;
+}
+
+// 校验文件头与各段, 并建立模块; 只做一次线性扫描
+int xbc_validate(XbcFile *x)
+{
+    if (x->size < sizeof(XbcHeader))
+        return xbc_fail("file too small");
+    XbcHeader *h = x->header = (XbcHeader *)x->data;
+    if (h->magic != XBC_MAGIC)
+        return xbc_fail("bad magic");
+    if (h->version != XBC_VERSION || h->opcode_count != OP_COUNT)
+        return xbc_fail("unsupported version");
+    if (h->file_size != x->size)
+        return xbc_fail("truncated file");
+    // 已消除边界检查的指令信任编译器的证明, 内容损坏的文件在这里拒绝
+    if (h->body_checksum != xbc_hash(x->data + sizeof(XbcHeader), x->size - sizeof(XbcHeader)))
+        return xbc_fail("checksum mismatch");
+    if (!xbc_section_ok(x, h->constant_offset, h->constant_count, sizeof(XbcConstant)) ||
+        !xbc_section_ok(x, h->function_offset, h->function_count, sizeof(XbcFunction)) ||
+        !xbc_section_ok(x, h->global_offset, h->global_count, sizeof(uint32_t)) ||
+        !xbc_section_ok(x, h->code_offset, h->code_count, sizeof(Instruction)) ||
+        h->string_offset > x->size || h->string_size > x->size - h->string_offset)
+        return xbc_fail("section out of range");
+    if (h->entry < -1 || h->entry >= (int32_t)h->function_count || h->main_function < -1 ||
+        h->main_function >= (int32_t)h->function_count)
+        return xbc_fail("bad entry point");
+
+    VMModule *m = calloc(1, sizeof(VMModule));
+    x->module = m;
+    m->entry = h->entry;
+    m->main_function = h->main_function;
+
+    XbcConstant *constants = (XbcConstant *)(x->data + h->constant_offset);
+    m->constant_count = h->constant_count;
+    m->constants = malloc(sizeof(Value) * (h->constant_count + 1));
+    for (uint32_t k = 0; k < h->constant_count; k++)
+    {
+        XbcConstant *c = &constants[k];
+        Value v = value_nil();
+        if (c->type == VAL_INT)
+            v = value_int((long long)c->bits);
+        else if (c->type == VAL_FLOAT)
+        {
+            v.type = VAL_FLOAT;
+            memcpy(&v.as.f, &c->bits, sizeof(double));
+        }
+        else if (c->type == VAL_STRING)
+        {
+            if (!xbc_string_ok(x, c->bits))
+                return xbc_fail("bad string constant");
+            v = value_string(string_intern(xbc_string_at(x, c->bits)));
+        }
+        else if (c->type != VAL_NIL)
+            return xbc_fail("bad constant type");
+        m->constants[k] = v;
+    }
+
+    uint32_t *globals = (uint32_t *)(x->data + h->global_offset);
+    m->global_count = h->global_count;
+    m->global_names = malloc(sizeof(char *) * (h->global_count + 1));
+    for (uint32_t g = 0; g < h->global_count; g++)
+    {
+        if (!xbc_string_ok(x, globals[g]))
+            return xbc_fail("bad global name");
+        m->global_names[g] = (char *)xbc_string_at(x, globals[g]);
+    }
+
+    XbcFunction *functions = (XbcFunction *)(x->data + h->function_offset);
+    Instruction *code = (Instruction *)(x->data + h->code_offset);
+    m->function_count = h->function_count;
+    m->functions = calloc(h->function_count + 1, sizeof(VMFunction));
+    for (uint32_t i = 0; i < h->function_count; i++)
+    {
+        XbcFunction *f = &functions[i];
+        if (!xbc_string_ok(x, f->name))
+            return xbc_fail("bad function name");
+        if (f->code_start > h->code_count || f->code_length > h->code_count - f->code_start)
+            return xbc_fail("function code out of range");
+        // 槽的布局放得进栈帧, 最后一个槽是暂存槽
+        if (f->frame_size > 0xffff || f->local_count > 0xffff || f->register_count > 0xffff ||
+            f->spill_count > 0xffff || f->param_count > f->local_count ||
+            f->local_count + f->register_count + f->spill_count >= f->frame_size)
+            return xbc_fail("bad frame layout");
+        if (!xbc_code_ok(x, f, code + f->code_start))
+            return xbc_fail("bad instruction");
+
+        VMFunction *vf = &m->functions[i];
+        vf->name = (char *)xbc_string_at(x, f->name);
+        vf->param_count = f->param_count;
+        vf->local_count = f->local_count;
+        vf->register_count = f->register_count;
+        vf->spill_count = f->spill_count;
+        vf->frame_size = f->frame_size;
+        vf->code = code + f->code_start;
+        vf->code_length = f->code_length;
+    }
+    return 1;
+}
+
+void xbc_close(XbcFile *x)
+{
+    if (x == NULL)
+        return;
+    if (x->module != NULL)
+    {
+        for (int i = 0; i < x->module->function_count; i++)
+        {
+            free(x->module->functions[i].threaded);
+            free(x->module->functions[i].caches);
+        }
+        free(x->module->functions);
+        free(x->module->constants);
+        free(x->module->global_names);
+        free(x->module);
+    }
+#if !defined(_WIN32)
+    if (x->mapped)
+        munmap(x->data, x->size);
+    else
+#endif
+        free(x->data);
+    free(x);
+}
+
+// 映射 .xbc 文件并校验, 失败时返回 NULL, 原因在 xbc_error 中
+XbcFile *xbc_load(const char *path)
+{
+    XbcFile *x = calloc(1, sizeof(XbcFile));
+#if !defined(_WIN32)
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        free(x);
+        xbc_fail("cannot open file");
+        return NULL;
+    }
+    x->size = st.st_size;
+    x->data = mmap(NULL, x->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (x->data == MAP_FAILED)
+    {
+        free(x);
+        xbc_fail("cannot map file");
+        return NULL;
+    }
+    x->mapped = 1;
+#else
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        free(x);
+        xbc_fail("cannot open file");
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    x->size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    x->data = malloc(x->size + 1);
+    x->size = fread(x->data, 1, x->size, file);
+    fclose(file);
+#endif
+
+    if (!xbc_validate(x))
+    {
+        xbc_close(x);
+        return NULL;
+    }
+    return x;
+}
+
+// .xbc 是否由这份源码生成
+int xbc_matches_source(XbcFile *x, const char *source)
+{
+    return x->header->source_checksum == xbc_checksum(source);
+}
+
+// 打印文件头和反汇编
+void xbc_dump(FILE *out, XbcFile *x)
+{
+    XbcHeader *h = x->header;
+    fprintf(out, "xbc version %u, %u bytes, source checksum %016llx\n", h->version, h->file_size,
+            (unsigned long long)h->source_checksum);
+    fprintf(out, "constants %u, functions %u, globals %u, instructions %u, strings %u bytes\n\n", h->constant_count,
+            h->function_count, h->global_count, h->code_count, h->string_size);
+    vm_disassemble(out, x->module);
+}
+
+// 运行源程序, 优先使用与源码匹配的 .xbc, 不存在或已过期时重新编译并写入
+void xbc_run_cached(const char *source, const char *xbc_path)
+{
+    XbcFile *x = xbc_load(xbc_path);
+    if (x != NULL && xbc_matches_source(x, source))
+    {
+        vm_run(x->module);
+        xbc_close(x);
+        return;
+    }
+    xbc_close(x);
+
+    VMModule *module = vm_compile_source(source, 1);
+    if (!xbc_write(xbc_path, module, source))
+        fprintf(stderr, "Warning: cannot write %s\n", xbc_path);
+    vm_run(module);
+}
+
+// // 测试输入
+// int main()
+// {
+//     freopen("input.txt", "r", stdin);
+//     int fsize = 1000;
+
+//     char source[1000] = {0};
+//     fread(source, 1, fsize, stdin);
+
+//     VMModule *module = vm_compile_source(source, 1);
+//     xbc_write("input.xbc", module, source);
+
+//     XbcFile *x = xbc_load("input.xbc");
+//     if (x == NULL)
+//     {
+//         fprintf(stderr, "Error: %s\n", xbc_error);
+//         return 1;
+//     }
+
+//     freopen("output_bytecode.txt", "w", stdout);
+//     xbc_dump(stdout, x);
+//     vm_run(x->module);
+//     xbc_close(x);
+
+//     return 0;
+// }
\ No newline at end of file
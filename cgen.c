@@ -0,0 +1,516 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "jit.c"
+
+// ---------------- C 后端 (提前编译) ----------------
+
+// 把优化后的 IR 翻译为可移植的 C99 程序, 再交给本机的 C 编译器生成可执行文件
+// 每个 X 函数对应一个 C 函数, 局部变量和临时变量都是 C 的局部变量, 寄存器分配交给 C 编译器;
+// 全局变量是 C 的全局变量, 标签和跳转直接对应 C 的标签和 goto
+// 值的表示和运算来自 runtime.h (即 value.c), 调用约定, 调用深度限制和错误信息都与虚拟机相同,
+// 因此编译出的程序与解释执行的输出完全一致
+// 尾调用先退出当前函数的调用深度再调用, 没有取地址的局部变量, C 编译器在 -O2 下会生成跳转
+
+// 调用的 C 编译器, 环境变量 CC 优先
+const char *cgen_cc = "cc";
+// runtime.h 和 value.c 所在的目录
+const char *cgen_runtime_dir = ".";
+
+typedef struct
+{
+    FILE *out;
+    StringMap globals;   // 全局变量 -> 下标
+    StringMap functions; // 函数名 -> 下标
+    StringMap locals;    // 局部变量 -> 下标
+    StringMap labels;    // 标签 -> 下标
+    StringMap keys;      // 字符串常量临时变量 -> load_const 的位置
+    int local_count;
+    int label_count;
+    int cache_count; // 字段访问的内联缓存, 每个访问位置一个静态变量
+} CGen;
+
+// 把字节串写成 C 字符串字面量, 不可打印字符用八进制转义, ? 转义以免构成三字符组
+void cgen_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (const unsigned char *p = (const unsigned char *)s; *p; p++)
+    {
+        if (*p == '"' || *p == '\\' || *p == '?')
+            fprintf(out, "\\%c", *p);
+        else if (*p < 32 || *p >= 127)
+            fprintf(out, "\\%03o", *p);
+        else
+            fputc(*p, out);
+    }
+    fputc('"', out);
+}
+
+// 常量在编译时求值, 生成的代码直接构造值
+void cgen_constant(FILE *out, const char *text)
+{
+    Value v = value_from_constant(text);
+    if (v.type == VAL_STRING)
+    {
+        fprintf(out, "value_string((char *)");
+        cgen_string(out, v.as.s);
+        fprintf(out, ")");
+    }
+    else if (v.type == VAL_FLOAT)
+    {
+        if (isinf(v.as.f))
+            fprintf(out, "value_float(HUGE_VAL)");
+        else
+            fprintf(out, "value_float(%.17g)", v.as.f);
+    }
+    else if (v.type == VAL_INT)
+    {
+        if (v.as.i == -9223372036854775807LL - 1)
+            fprintf(out, "value_int(-9223372036854775807LL - 1)");
+        else
+            fprintf(out, "value_int(%lldLL)", v.as.i);
+    }
+    else
+        fprintf(out, "value_nil()");
+}
+
+int cgen_local(CGen *g, const char *name)
+{
+    int index = string_map_get(&g->locals, name);
+    if (index < 0)
+    {
+        index = g->local_count++;
+        string_map_put(&g->locals, name, index);
+    }
+    return index;
+}
+
+int cgen_label(CGen *g, const char *name)
+{
+    int index = string_map_get(&g->labels, name);
+    if (index < 0)
+    {
+        index = g->label_count++;
+        string_map_put(&g->labels, name, index);
+    }
+    return index;
+}
+
+// 变量在 C 中的名字: 全局变量 g_名字, 局部变量按下标命名 (内联产生的名字带点号)
+void cgen_variable(CGen *g, const char *name, char *buffer)
+{
+    if (string_map_get(&g->globals, name) >= 0)
+        sprintf(buffer, "g_%s", name);
+    else
+        sprintf(buffer, "v%d", cgen_local(g, name));
+}
+
+// 临时变量 %N 在 C 中命名为 tN, 改写指令的副本
+void cgen_temp_names(IRInstruction *ins, char names[3][32])
+{
+    char **fields[3] = {&ins->arg1, &ins->arg2, &ins->result};
+    for (int k = 0; k < 3; k++)
+    {
+        if (is_temp(*fields[k]))
+        {
+            sprintf(names[k], "t%d", temp_index(*fields[k]));
+            *fields[k] = names[k];
+        }
+    }
+}
+
+// 调用: 内置函数或用户函数, 未定义的函数是编译错误
+void cgen_callee(CGen *g, const char *name, const char *argc)
+{
+    if (strcmp(name, "print") == 0 || strcmp(name, "read") == 0)
+        fprintf(g->out, "x_%s(%s)", name, argc);
+    else if (strcmp(name, "$vector") == 0)
+        fprintf(g->out, "x_vector(%s)", argc);
+    else if (string_map_get(&g->functions, name) >= 0)
+        fprintf(g->out, "x_fn_%s(%s)", name, argc);
+    else
+    {
+        fprintf(stderr, "Compile error: undefined function %s\n", name);
+        exit(1);
+    }
+}
+
+// 类型推断改写出的专用运算直接读写数据字, 不检查类型标签
+void cgen_typed_binary(FILE *out, const char *op, const char *a, const char *b)
+{
+    static const char *ops[][2] = {{"add_i64", "+"}, {"sub_i64", "-"}, {"mul_i64", "*"}, {"lt_i64", "<"},
+                                   {"gt_i64", ">"},  {"le_i64", "<="}, {"ge_i64", ">="}, {"eq_i64", "=="},
+                                   {"add_f64", "+"}, {"sub_f64", "-"}, {"mul_f64", "*"}, {"div_f64", "/"}};
+    if (strcmp(op, "concat") == 0)
+    {
+        fprintf(out, "value_concat(%s, %s)", a, b);
+        return;
+    }
+    int k = 0;
+    while (strcmp(op, ops[k][0]) != 0)
+        k++;
+    if (k < 3)
+        fprintf(out, "value_int((long long)((unsigned long long)%s.as.i %s (unsigned long long)%s.as.i))", a,
+                ops[k][1], b);
+    else if (k < 8)
+        fprintf(out, "value_int(%s.as.i %s %s.as.i)", a, ops[k][1], b);
+    else
+        fprintf(out, "value_float(%s.as.f %s %s.as.f)", a, ops[k][1], b);
+}
+
+// 把 IR 区间 [start, end) 翻译为 C 函数 c_name
+void cgen_function(CGen *g, const char *name, const char *c_name, int start, int end)
+{
+    FILE *out = g->out;
+    string_map_init(&g->locals, 16);
+    string_map_init(&g->labels, 16);
+    string_constant_temps(&g->keys, start, end);
+    g->local_count = 0;
+    g->label_count = 0;
+
+    // 形参在最前面, 然后是其他局部变量, 最后是临时变量
+    int param_count = 0;
+    for (int i = start; i < end; i++)
+    {
+        if (ir_is(&ir_code[i], "param"))
+        {
+            cgen_local(g, ir_code[i].arg1);
+            param_count++;
+        }
+    }
+    for (int i = start; i < end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (ir_is(ins, "load") && string_map_get(&g->globals, ins->arg1) < 0)
+            cgen_local(g, ins->arg1);
+        else if (ir_is(ins, "store") && string_map_get(&g->globals, ins->result) < 0)
+            cgen_local(g, ins->result);
+    }
+    int temp_count = 0;
+    for (int i = start; i < end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (ir_has_def(ins->op) && is_temp(ins->result) && temp_index(ins->result) + 1 > temp_count)
+            temp_count = temp_index(ins->result) + 1;
+    }
+    char *defined = calloc(temp_count + 1, 1);
+    for (int i = start; i < end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (ir_has_def(ins->op) && is_temp(ins->result))
+            defined[temp_index(ins->result)] = 1;
+    }
+
+    fprintf(out, "// %s\nValue %s(int argc)\n{\n", name, c_name);
+    fprintf(out, param_count > 0 ? "    Value *args = x_enter(" : "    x_enter(");
+    cgen_string(out, name);
+    fprintf(out, ", argc);\n");
+    char **names = malloc(sizeof(char *) * (g->local_count + 1));
+    for (int k = 0; k < g->locals.capacity; k++)
+    {
+        if (g->locals.keys[k] != NULL)
+            names[g->locals.values[k]] = g->locals.keys[k];
+    }
+    for (int k = 0; k < g->local_count; k++)
+    {
+        if (k < param_count)
+            fprintf(out, "    Value v%d = x_param(args, argc, %d); // %s\n", k, k, names[k]);
+        else
+            fprintf(out, "    Value v%d = value_nil(); // %s\n", k, names[k]);
+    }
+    free(names);
+    int declared = 0;
+    for (int t = 0; t < temp_count; t++)
+    {
+        if (!defined[t])
+            continue;
+        if (declared % 12 != 0)
+            fprintf(out, ", t%d", t);
+        else
+            fprintf(out, declared == 0 ? "    Value t%d" : ";\n    Value t%d", t);
+        declared++;
+    }
+    if (declared > 0)
+        fprintf(out, ";\n");
+    free(defined);
+    fprintf(out, "    x_arg_count -= argc;\n");
+
+    char a[256];
+    char temp_names[3][32];
+    for (int i = start; i < end; i++)
+    {
+        IRInstruction copy = ir_code[i];
+        IRInstruction *ins = &copy;
+        cgen_temp_names(ins, temp_names);
+        const char *op = ins->op;
+        int key;
+
+        if (strcmp(op, "load_const") == 0)
+        {
+            fprintf(out, "    %s = ", ins->result);
+            cgen_constant(out, ins->arg1);
+            fprintf(out, ";\n");
+        }
+        else if (strcmp(op, "load") == 0)
+        {
+            cgen_variable(g, ins->arg1, a);
+            fprintf(out, "    %s = %s;\n", ins->result, a);
+        }
+        else if (strcmp(op, "store") == 0)
+        {
+            cgen_variable(g, ins->result, a);
+            fprintf(out, "    %s = %s;\n", a, ins->arg1);
+        }
+        else if (ir_is_binary(op))
+        {
+            static const char *names[] = {"add", "sub", "mul", "div", "lt", "gt", "le", "ge", "eq"};
+            static const char *functions[] = {"x_add", "x_sub", "value_mul", "value_div", "x_lt",
+                                              "x_gt", "value_le", "value_ge", "x_eq"};
+            const char *function = NULL;
+            for (int k = 0; k < 9; k++)
+            {
+                if (strcmp(op, names[k]) == 0)
+                    function = functions[k];
+            }
+            if (function != NULL)
+                fprintf(out, "    %s = %s(%s, %s);\n", ins->result, function, ins->arg1, ins->arg2);
+            else
+            {
+                fprintf(out, "    %s = ", ins->result);
+                cgen_typed_binary(out, op, ins->arg1, ins->arg2);
+                fprintf(out, ";\n");
+            }
+        }
+        else if (strcmp(op, "move") == 0)
+            fprintf(out, "    %s = %s;\n", ins->result, ins->arg1);
+        else if (strcmp(op, "string_builder") == 0)
+            fprintf(out, "    %s = string_builder(%s);\n", ins->result, ins->arg1);
+        else if (strcmp(op, "string_append") == 0)
+            fprintf(out, "    %s = string_append(%s, %s);\n", ins->result, ins->arg1, ins->arg2);
+        else if (strcmp(op, "new_array") == 0)
+            fprintf(out, "    %s = value_new_array(%d);\n", ins->result, atoi(ins->arg1));
+        else if (strcmp(op, "new_map") == 0)
+            fprintf(out, "    %s = value_new_map(%d);\n", ins->result, atoi(ins->arg1));
+        else if ((strcmp(op, "array_store") == 0 || strcmp(op, "key_value_pair") == 0) &&
+                 (key = string_map_get(&g->keys, ir_code[i].arg1)) >= 0)
+        {
+            fprintf(out, "    static FieldCache ic%d;\n    map_set_field(%s, ", g->cache_count, ins->result);
+            cgen_string(out, value_from_constant(ir_code[key].arg1).as.s);
+            fprintf(out, ", &ic%d, %s);\n", g->cache_count++, ins->arg2);
+        }
+        else if (strcmp(op, "array_access") == 0 && (key = string_map_get(&g->keys, ir_code[i].arg2)) >= 0)
+        {
+            fprintf(out, "    static FieldCache ic%d;\n    %s = map_get_field(%s, ", g->cache_count, ins->result, ins->arg1);
+            cgen_string(out, value_from_constant(ir_code[key].arg1).as.s);
+            fprintf(out, ", &ic%d);\n", g->cache_count++);
+        }
+        else if (strcmp(op, "array_store") == 0 || strcmp(op, "key_value_pair") == 0)
+            fprintf(out, "    value_set_index(%s, %s, %s);\n", ins->result, ins->arg1, ins->arg2);
+        else if (strcmp(op, "array_store_unchecked") == 0)
+            fprintf(out, "    x_set_unchecked(%s, %s, %s);\n", ins->result, ins->arg1, ins->arg2);
+        else if (strcmp(op, "array_access") == 0)
+            fprintf(out, "    %s = value_get_index(%s, %s);\n", ins->result, ins->arg1, ins->arg2);
+        else if (strcmp(op, "array_access_unchecked") == 0)
+            fprintf(out, "    %s = x_get_unchecked(%s, %s);\n", ins->result, ins->arg1, ins->arg2);
+        else if (strcmp(op, "array_length") == 0)
+            fprintf(out, "    %s = value_length(%s);\n", ins->result, ins->arg1);
+        else if (strcmp(op, "arg") == 0)
+            fprintf(out, "    x_push(%s);\n", ins->arg1);
+        else if (strcmp(op, "call_function") == 0)
+        {
+            fprintf(out, "    %s = ", ins->result);
+            cgen_callee(g, ins->arg1, ins->arg2);
+            fprintf(out, ";\n");
+        }
+        else if (strcmp(op, "parallel_for") == 0)
+        {
+            if (string_map_get(&g->functions, ins->arg1) < 0)
+            {
+                fprintf(stderr, "Compile error: undefined function %s\n", ins->arg1);
+                exit(1);
+            }
+            fprintf(out, "    %s = x_parallel_for(x_fn_%s, %d);\n", ins->result, ins->arg1, atoi(ins->arg2));
+        }
+        else if (strcmp(op, "parallel_apply") == 0)
+        {
+            if (string_map_get(&g->functions, ins->arg1) < 0)
+            {
+                fprintf(stderr, "Compile error: undefined function %s\n", ins->arg1);
+                exit(1);
+            }
+            fprintf(out, "    %s = x_parallel_apply(x_fn_%s, %d);\n", ins->result, ins->arg1, atoi(ins->arg2));
+        }
+        else if (strcmp(op, "spawn") == 0)
+        {
+            if (string_map_get(&g->functions, ins->arg1) < 0)
+            {
+                fprintf(stderr, "Compile error: %s %s\n",
+                        strcmp(ins->arg1, "print") == 0 || strcmp(ins->arg1, "read") == 0 ? "cannot spawn builtin"
+                                                                                            : "undefined function",
+                        ins->arg1);
+                exit(1);
+            }
+            fprintf(out, "    %s = x_spawn(x_fn_%s, %d);\n", ins->result, ins->arg1, atoi(ins->arg2));
+        }
+        else if (strcmp(op, "await") == 0)
+            fprintf(out, "    %s = x_await(%s);\n", ins->result, ins->arg1);
+        else if (strcmp(op, "tail_call") == 0)
+        {
+            // 与虚拟机复用栈帧一样, 被调函数不占用当前函数的调用深度
+            fprintf(out, "    x_depth--;\n    return ");
+            cgen_callee(g, ins->arg1, ins->arg2);
+            fprintf(out, ";\n");
+        }
+        else if (strcmp(op, "label") == 0)
+            fprintf(out, "L%d:;\n", cgen_label(g, ins->arg1));
+        else if (strcmp(op, "goto") == 0)
+            fprintf(out, "    goto L%d;\n", cgen_label(g, ins->arg1));
+        else if (strcmp(op, "if_false") == 0)
+            fprintf(out, "    if (!x_truthy(%s))\n        goto L%d;\n", ins->arg1, cgen_label(g, ins->arg2));
+        else if (strcmp(op, "return") == 0)
+            fprintf(out, "    x_depth--;\n    return %s;\n", ins->arg1 != NULL ? ins->arg1 : "value_nil()");
+        // param / alloc / nop 不生成代码
+    }
+    fprintf(out, "    x_depth--;\n    return value_nil();\n}\n\n");
+
+    string_map_free(&g->locals);
+    string_map_free(&g->labels);
+    string_map_free(&g->keys);
+}
+
+// 把当前的 IR (已经优化) 翻译为一个完整的 C 程序
+void cgen_emit(FILE *out)
+{
+    CGen g;
+    memset(&g, 0, sizeof(g));
+    g.out = out;
+    string_map_init(&g.globals, 16);
+    string_map_init(&g.functions, 16);
+
+    // 用到并行或任务时才包含线程池和任务调度器 (见 runtime.h)
+    int uses_tasks = 0;
+    for (int i = 0; i < ir_count; i++)
+    {
+        if (ir_is(&ir_code[i], "parallel_for") || ir_is(&ir_code[i], "parallel_apply") || ir_is(&ir_code[i], "spawn") ||
+            ir_is(&ir_code[i], "await"))
+            uses_tasks = 1;
+    }
+    fprintf(out, "// 由 X 编译器生成\n%s#include \"runtime.h\"\n\n", uses_tasks ? "#define X_TASKS\n" : "");
+
+    // 全局变量和函数原型
+    int depth = 0;
+    int has_global_code = 0;
+    for (int i = 0; i < ir_count; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (ir_is(ins, "function"))
+        {
+            depth++;
+            if (string_map_get(&g.functions, ins->arg1) < 0)
+            {
+                string_map_put(&g.functions, ins->arg1, 1);
+                fprintf(out, "Value x_fn_%s(int argc);\n", ins->arg1);
+            }
+        }
+        else if (ir_is(ins, "end_function"))
+            depth--;
+        else if (depth == 0 && !ir_is(ins, "nop"))
+        {
+            has_global_code = 1;
+            if (ir_is(ins, "alloc") && string_map_get(&g.globals, ins->arg1) < 0)
+            {
+                string_map_put(&g.globals, ins->arg1, 1);
+                fprintf(out, "Value g_%s;\n", ins->arg1);
+            }
+        }
+    }
+    fprintf(out, "\n");
+
+    // 全局代码在 IR 的开头, 函数之前
+    if (has_global_code)
+    {
+        int start = 0;
+        while (start < ir_count && ir_is(&ir_code[start], "nop"))
+            start++;
+        int end = start;
+        while (end < ir_count && !ir_is(&ir_code[end], "function"))
+            end++;
+        cgen_function(&g, "(global)", "x_global_code", start, end);
+    }
+    int i = 0;
+    while (i < ir_count)
+    {
+        if (ir_is(&ir_code[i], "function"))
+        {
+            char c_name[256];
+            snprintf(c_name, sizeof(c_name), "x_fn_%s", ir_code[i].arg1);
+            int end = find_function_end(i);
+            cgen_function(&g, ir_code[i].arg1, c_name, i + 1, end);
+            i = end + 1;
+        }
+        else
+            i++;
+    }
+
+    fprintf(out, "int main()\n{\n");
+    if (has_global_code)
+        fprintf(out, "    x_global_code(0);\n");
+    if (string_map_get(&g.functions, "main") >= 0)
+        fprintf(out, "    x_fn_main(0);\n");
+    // 没有结束的任务执行完之后程序才结束
+    if (uses_tasks)
+        fprintf(out, "    task_wait_all();\n");
+    fprintf(out, "    io_flush();\n    fflush(stdout);\n    return 0;\n}\n");
+
+    string_map_free(&g.globals);
+    string_map_free(&g.functions);
+}
+
+// 调用 C 编译器把 c_path 编译为 exe_path, 成功返回 1
+int cgen_build(const char *c_path, const char *exe_path)
+{
+    const char *cc = getenv("CC") != NULL ? getenv("CC") : cgen_cc;
+    size_t size = strlen(cc) + strlen(cgen_runtime_dir) + strlen(c_path) + strlen(exe_path) + 64;
+    char *command = malloc(size);
+    snprintf(command, size, "%s -O2 -std=c99 -pthread -I\"%s\" -o \"%s\" \"%s\"", cc, cgen_runtime_dir, exe_path, c_path);
+    int status = system(command);
+    free(command);
+    return status == 0;
+}
+
+// 源程序 -> C 文件; exe_path 不为 NULL 时再编译为可执行文件, 失败返回 0
+int cgen_compile_source(const char *source, const char *c_path, const char *exe_path, int optimize)
+{
+    int token_count = 0;
+    Token *tokens = lexer(source, &token_count);
+    ASTNode *root = parse_program(&tokens, token_count);
+    generateIR(root);
+    if (optimize)
+        optimize_ir();
+
+    FILE *out = fopen(c_path, "w");
+    if (out == NULL)
+    {
+        fprintf(stderr, "Cannot write %s\n", c_path);
+        return 0;
+    }
+    cgen_emit(out);
+    fclose(out);
+    return exe_path == NULL || cgen_build(c_path, exe_path);
+}
+
+// // 测试输入
+// int main()
+// {
+//     freopen("input.txt", "r", stdin);
+//     int fsize = 1000;
+
+//     char source[1000] = {0};
+//     fread(source, 1, fsize, stdin);
+
+//     cgen_compile_source(source, "output_cgen.txt", NULL, 1);
+
+//     return 0;
+// }
\ No newline at end of file
@@ -0,0 +1,503 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vm.c"
+
+// ---------------- 朴素的 AST 解释器 ----------------
+
+// 作为对照的基准: 直接遍历语法树, 变量按名字线性查找, 每次调用都按名字查找函数
+// 语义与生成的 IR 相同: 顶层声明的变量是全局变量, 其余都是所在函数的局部变量
+
+typedef struct
+{
+    char **names;
+    Value *values;
+    int count;
+} Environment;
+
+typedef struct
+{
+    ASTNode *program;
+    Environment *globals; // 所有任务共享
+    int returning; // 正在执行 return
+    Value return_value;
+    int depth;
+} Interpreter;
+
+#define INTERP_MAX_DEPTH 10000
+
+Value *env_find(Environment *env, const char *name)
+{
+    for (int i = 0; i < env->count; i++)
+    {
+        if (strcmp(env->names[i], name) == 0)
+            return &env->values[i];
+    }
+    return NULL;
+}
+
+void env_set(Environment *env, const char *name, Value value)
+{
+    Value *slot = env_find(env, name);
+    if (slot != NULL)
+    {
+        *slot = value;
+        return;
+    }
+    env->names = realloc(env->names, sizeof(char *) * (env->count + 1));
+    env->values = realloc(env->values, sizeof(Value) * (env->count + 1));
+    env->names[env->count] = (char *)name;
+    env->values[env->count++] = value;
+}
+
+void env_free(Environment *env)
+{
+    free(env->names);
+    free(env->values);
+}
+
+// 全局变量优先, 与 IR 中按 alloc 区分全局变量一致; 与全局变量同名的形参已经改名 (见 pseudo.c 的 rename_shadowing_params)
+Value interp_get_var(Interpreter *in, Environment *env, const char *name)
+{
+    Value *slot = env_find(in->globals, name);
+    if (slot == NULL && env != NULL)
+        slot = env_find(env, name);
+    return slot != NULL ? *slot : value_nil();
+}
+
+void interp_set_var(Interpreter *in, Environment *env, const char *name, Value value)
+{
+    Value *slot = env_find(in->globals, name);
+    if (slot != NULL || env == NULL)
+        env_set(in->globals, name, value);
+    else
+        env_set(env, name, value);
+}
+
+Value interp_expr(Interpreter *in, Environment *env, ASTNode *node);
+void interp_statement(Interpreter *in, Environment *env, ASTNode *node);
+
+Value interp_array_literal(Interpreter *in, Environment *env, ASTNode *list)
+{
+    int n = list != NULL ? list->children_count : 0;
+    Value array = value_new_array(n);
+    for (int i = 0; i < n; i++)
+        value_set_index(array, value_int(i), interp_expr(in, env, list->children[i]));
+    return array;
+}
+
+Value interp_map_literal(Interpreter *in, Environment *env, ASTNode *node, int first)
+{
+    Value map = value_new_map(node->children_count - first);
+    for (int i = first; i < node->children_count; i++)
+    {
+        ASTNode *pair = node->children[i];
+        if (pair->children_count < 2)
+            continue;
+        Value key = interp_expr(in, env, pair->children[0]);
+        Value value = interp_expr(in, env, pair->children[1]);
+        value_set_index(map, key, value);
+    }
+    return map;
+}
+
+Value interp_binary(const char *op, Value a, Value b)
+{
+    if (strcmp(op, "+") == 0)
+        return value_add(a, b);
+    if (strcmp(op, "-") == 0)
+        return value_sub(a, b);
+    if (strcmp(op, "*") == 0)
+        return value_mul(a, b);
+    if (strcmp(op, "/") == 0)
+        return value_div(a, b);
+    if (strcmp(op, ">") == 0)
+        return value_gt(a, b);
+    if (strcmp(op, "<") == 0)
+        return value_lt(a, b);
+    if (strcmp(op, ">=") == 0)
+        return value_ge(a, b);
+    if (strcmp(op, "<=") == 0)
+        return value_le(a, b);
+    if (strcmp(op, "==") == 0)
+        return value_eq(a, b);
+    runtime_error("unknown operator", op);
+    return value_nil();
+}
+
+ASTNode *interp_find_function(Interpreter *in, const char *name)
+{
+    for (int i = 0; i < in->program->children_count; i++)
+    {
+        ASTNode *node = in->program->children[i];
+        if (node->type == NODE_FUNCTION && strcmp(node->data.function.name, name) == 0)
+            return node;
+        if (node->type == NODE_MAIN && strcmp(name, "main") == 0)
+            return node;
+    }
+    return NULL;
+}
+
+// 调用函数, 实参已经计算好; 多余的实参丢弃, 缺少的形参为 nil
+Value interp_call(Interpreter *in, ASTNode *function, Value *args, int argc)
+{
+    if (++in->depth > INTERP_MAX_DEPTH)
+        runtime_error("stack overflow in", function->type == NODE_MAIN ? "main" : function->data.function.name);
+
+    Environment env = {NULL, NULL, 0};
+    ASTNode *params = function->type == NODE_FUNCTION ? function->data.function.param_list : NULL;
+    int param_count = params != NULL ? params->children_count : 0;
+    for (int i = 0; i < param_count; i++)
+        env_set(&env, params->children[i]->data.identifier.name, i < argc ? args[i] : value_nil());
+
+    for (int i = 0; i < function->children_count && !in->returning; i++)
+        interp_statement(in, &env, function->children[i]);
+
+    Value result = in->returning ? in->return_value : value_nil();
+    in->returning = 0;
+    in->depth--;
+    env_free(&env);
+    return result;
+}
+
+// pmap / pfilter / preduce: 线程池中的每个线程用自己的解释器状态调用函数
+typedef struct
+{
+    Interpreter *in;
+    ASTNode *function;
+    Interpreter *workers;
+} InterpApply;
+
+Value interp_apply_call(void *context, int worker, Value *args, int argc)
+{
+    InterpApply *apply = context;
+    return interp_call(worker < 0 ? apply->in : &apply->workers[worker], apply->function, args, argc);
+}
+
+Value interp_parallel_apply(Interpreter *in, Environment *env, ASTNode *node, int kind)
+{
+    ASTNode *list = node->children[1];
+    const char *name = list->children[1]->data.identifier.name;
+    ASTNode *function = interp_find_function(in, name);
+    if (function == NULL)
+        runtime_error("undefined function", name);
+    Value args[4];
+    args[0] = interp_expr(in, env, list->children[0]);
+    args[1] = kind == PARALLEL_REDUCE ? interp_expr(in, env, list->children[2]) : value_nil();
+    args[2] = value_int(kind);
+    args[3] = value_int(ast_function_pure(in->program, name));
+
+    ParallelApply apply;
+    int workers = parallel_apply_prepare(&apply, args, 4);
+    InterpApply context = {in, function, NULL};
+    if (workers > 1)
+    {
+        context.workers = calloc(workers, sizeof(Interpreter));
+        for (int w = 0; w < workers; w++)
+        {
+            context.workers[w].program = in->program;
+            context.workers[w].globals = in->globals;
+        }
+    }
+    Value result = parallel_apply(&apply, workers, interp_apply_call, &context);
+    free(context.workers);
+    return result;
+}
+
+Value interp_function_call(Interpreter *in, Environment *env, ASTNode *node)
+{
+    int kind = parallel_builtin_kind(in->program, node);
+    if (kind >= 0)
+        return interp_parallel_apply(in, env, node, kind);
+    const char *name = node->children[0]->data.identifier.name;
+    ASTNode *list = node->children_count == 2 ? node->children[1] : NULL;
+    int argc = list != NULL ? list->children_count : 0;
+    Value *args = malloc(sizeof(Value) * (argc + 1));
+    for (int i = 0; i < argc; i++)
+        args[i] = interp_expr(in, env, list->children[i]);
+
+    Value result = value_nil();
+    if (strcmp(name, "print") == 0)
+        io_print(vm_output, args, argc);
+    else if (strcmp(name, "read") == 0)
+        result = io_read();
+    else
+    {
+        ASTNode *function = interp_find_function(in, name);
+        if (function == NULL)
+            runtime_error("undefined function", name);
+        result = interp_call(in, function, args, argc);
+    }
+    free(args);
+    return result;
+}
+
+// 任务用自己的解释器状态执行函数, 与创建它的解释器共享程序和全局变量
+typedef struct
+{
+    Interpreter in;
+    ASTNode *function;
+    int argc;
+    Value args[];
+} InterpTask;
+
+Value interp_task_body(void *data)
+{
+    InterpTask *task = data;
+    Value result = interp_call(&task->in, task->function, task->args, task->argc);
+    free(task);
+    return result;
+}
+
+Value interp_spawn(Interpreter *in, Environment *env, ASTNode *node)
+{
+    ASTNode *call = node->children[0];
+    const char *name = call->children[0]->data.identifier.name;
+    ASTNode *function = interp_find_function(in, name);
+    if (function == NULL)
+        runtime_error(strcmp(name, "print") == 0 || strcmp(name, "read") == 0 ? "cannot spawn builtin"
+                                                                              : "undefined function",
+                      name);
+    ASTNode *list = call->children_count == 2 ? call->children[1] : NULL;
+    int argc = list != NULL ? list->children_count : 0;
+    InterpTask *task = malloc(sizeof(InterpTask) + sizeof(Value) * (argc + 1));
+    memset(&task->in, 0, sizeof(Interpreter));
+    task->in.program = in->program;
+    task->in.globals = in->globals;
+    task->function = function;
+    task->argc = argc;
+    for (int i = 0; i < argc; i++)
+        task->args[i] = interp_expr(in, env, list->children[i]);
+    return value_task(task_spawn(interp_task_body, task));
+}
+
+Value interp_expr(Interpreter *in, Environment *env, ASTNode *node)
+{
+    if (node == NULL)
+        return value_nil();
+
+    switch (node->type)
+    {
+    case NODE_INT:
+    case NODE_FLOAT:
+    case NODE_LITERAL:
+        return value_from_constant(node->data.literal.value);
+
+    case NODE_STRING:
+        return value_string_literal(node->data.string_node.value, strlen(node->data.string_node.value));
+
+    case NODE_IDENTIFIER:
+        return interp_get_var(in, env, node->data.identifier.name);
+
+    case NODE_EXPRESSION:
+        if (node->children_count >= 3)
+        {
+            Value left = interp_expr(in, env, node->children[0]);
+            Value right = interp_expr(in, env, node->children[2]);
+            return interp_binary(node->children[1]->data.operator_node.op, left, right);
+        }
+        return interp_expr(in, env, node->children[0]);
+
+    case NODE_ARRAY_ACCESS:
+    {
+        Value array = interp_expr(in, env, node->children[0]);
+        Value index = interp_expr(in, env, node->children[1]);
+        return value_get_index(array, index);
+    }
+
+    case NODE_FUNCTION_CALL:
+        return interp_function_call(in, env, node);
+
+    case NODE_SPAWN:
+        return interp_spawn(in, env, node);
+
+    case NODE_AWAIT:
+        return task_await(interp_expr(in, env, node->children[0]));
+
+    case NODE_ARRAY_DECL:
+        return interp_array_literal(in, env, node->children_count > 0 ? node->children[node->children_count - 1] : NULL);
+
+    case NODE_KEY_VALUE_DECL:
+        return interp_map_literal(in, env, node, 0);
+
+    default:
+        runtime_error("unsupported expression", NULL);
+        return value_nil();
+    }
+}
+
+void interp_statement(Interpreter *in, Environment *env, ASTNode *node)
+{
+    if (node == NULL || in->returning)
+        return;
+
+    switch (node->type)
+    {
+    case NODE_VAR_DECL:
+        interp_set_var(in, env, node->data.var_decl.name, interp_expr(in, env, node->data.var_decl.value));
+        break;
+
+    case NODE_ARRAY_DECL:
+        interp_set_var(in, env, node->children[0]->data.identifier.name,
+                       interp_array_literal(in, env, node->children_count > 1 ? node->children[1] : NULL));
+        break;
+
+    case NODE_KEY_VALUE_DECL:
+        interp_set_var(in, env, node->children[0]->data.identifier.name, interp_map_literal(in, env, node, 1));
+        break;
+
+    case NODE_STATEMENT:
+        for (int i = 0; i < node->children_count && !in->returning; i++)
+            interp_statement(in, env, node->children[i]);
+        break;
+
+    case NODE_ASSIGNMENT:
+    {
+        ASTNode *target = node->children[0];
+        const char *name = target->data.identifier.name;
+        if (target->children_count > 0)
+        {
+            Value array = interp_get_var(in, env, name);
+            Value index = interp_expr(in, env, target->children[0]);
+            Value value = interp_expr(in, env, node->children[1]);
+            value_set_index(array, index, value);
+        }
+        else
+            interp_set_var(in, env, name, interp_expr(in, env, node->children[1]));
+        break;
+    }
+
+    case NODE_IF_STATEMENT:
+        if (value_truthy(interp_expr(in, env, node->children[0])))
+            interp_statement(in, env, node->children[1]);
+        else if (node->children_count > 2 && node->children[2]->type == NODE_ELSE_STATEMENT)
+            interp_statement(in, env, node->children[2]->children[0]);
+        break;
+
+    case NODE_FOR_LOOP:
+    {
+        // 边界只计算一次, 每轮重新读取循环变量
+        const char *var = node->data.for_loop.var_name;
+        interp_set_var(in, env, var, interp_expr(in, env, node->data.for_loop.start_expr));
+        Value end = interp_expr(in, env, node->data.for_loop.end_expr);
+        while (value_truthy(value_lt(interp_get_var(in, env, var), end)))
+        {
+            for (int i = 0; i < node->children_count && !in->returning; i++)
+                interp_statement(in, env, node->children[i]);
+            if (in->returning)
+                break;
+            interp_set_var(in, env, var, value_add(interp_get_var(in, env, var), value_int(1)));
+        }
+        break;
+    }
+
+    case NODE_RETURN_STATEMENT:
+        in->return_value = interp_expr(in, env, node->data.return_statement.expression);
+        in->returning = 1;
+        break;
+
+    default:
+        interp_expr(in, env, node);
+        break;
+    }
+}
+
+// 先执行全局声明, 再调用 main
+void interp_run(ASTNode *program)
+{
+    Interpreter in;
+    Environment globals = {NULL, NULL, 0};
+    memset(&in, 0, sizeof(in));
+    rename_shadowing_params(program);
+    in.program = program;
+    in.globals = &globals;
+    if (vm_output == NULL)
+        vm_output = stdout;
+
+    for (int i = 0; i < program->children_count; i++)
+    {
+        NodeType type = program->children[i]->type;
+        if (type != NODE_FUNCTION && type != NODE_MAIN)
+            interp_statement(&in, NULL, program->children[i]);
+    }
+    ASTNode *main_function = interp_find_function(&in, "main");
+    if (main_function != NULL)
+        interp_call(&in, main_function, NULL, 0);
+    task_wait_all();
+    io_flush();
+    fflush(vm_output);
+    env_free(&globals);
+}
+
+// ---------------- 基准测试 ----------------
+
+// 同一个程序分别用 AST 解释器和字节码虚拟机执行 repeat 次, 比较耗时并检查两者输出一致
+// 编译 (词法, 语法, IR, 优化, 寄存器分配) 不计入虚拟机的执行时间
+void benchmark(FILE *out, const char *name, const char *source, int repeat)
+{
+    int token_count = 0;
+    Token *tokens = lexer(source, &token_count);
+    ASTNode *root = parse_program(&tokens, token_count);
+
+    ir_count = 0;
+    generateIR(root);
+    optimize_ir();
+    VMModule *module = vm_compile_ir();
+
+    FILE *saved = vm_output;
+    FILE *interp_out = tmpfile();
+    FILE *vm_out = tmpfile();
+
+    clock_t start = clock();
+    vm_output = interp_out;
+    for (int r = 0; r < repeat; r++)
+        interp_run(root);
+    double interp_time = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    start = clock();
+    vm_output = vm_out;
+    for (int r = 0; r < repeat; r++)
+        vm_run(module);
+    double vm_time = (double)(clock() - start) / CLOCKS_PER_SEC;
+    vm_output = saved;
+
+    // 比较两者的输出
+    rewind(interp_out);
+    rewind(vm_out);
+    int same = 1;
+    int a, b;
+    do
+    {
+        a = fgetc(interp_out);
+        b = fgetc(vm_out);
+        if (a != b)
+            same = 0;
+    } while (same && a != EOF);
+    fclose(interp_out);
+    fclose(vm_out);
+
+    fprintf(out, "%-12s ast %8.3fs  vm %8.3fs  speedup %6.2fx  %s\n", name, interp_time, vm_time,
+            vm_time > 0 ? interp_time / vm_time : 0.0, same ? "output ok" : "OUTPUT MISMATCH");
+}
+
+// // 测试输入
+// int main()
+// {
+//     const char *programs[] = {"bench/fib.x", "bench/loops.x", "bench/arrays.x"};
+//     freopen("output_benchmark.txt", "w", stdout);
+//
+//     for (int i = 0; i < 3; i++)
+//     {
+//         FILE *file = fopen(programs[i], "rb");
+//         static char source[65536];
+//         int length = fread(source, 1, sizeof(source) - 1, file);
+//         source[length] = 0;
+//         fclose(file);
+//
+//         benchmark(stdout, programs[i], source, 5);
+//     }
+//
+//     return 0;
+// }
\ No newline at end of file
@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "value.c"
+
+// ---------------- print() 和 read() 的缓冲 I/O ----------------
+
+// print 不经过 stdio: 每个线程把输出格式化到自己的缓冲区, 积累到一定量后用一次 writev 写出
+// 长字符串不复制, 直接作为 writev 的一段 (字符串创建后不再修改), 垃圾回收之前写出 (见 vm.c 的 vm_gc_roots)
+// 写出的时机:
+//   - 缓冲区满, 或者换了输出文件 (基准测试把输出重定向到临时文件)
+//   - 输出是终端时每次 print 之后, 与 stdio 的行缓冲相同
+//   - 释放调度器的锁之前 (见 task.c), 所以不同线程上的任务的输出仍按 print 执行的顺序排列
+//   - 程序结束: vm_run, interp_run 和 C 后端的 main 显式调用 io_flush;
+//     runtime_error 等直接 exit 的路径由 atexit 注册的 io_flush_all 写出所有线程的缓冲区
+// read 直接读标准输入的文件描述符: 普通文件整个 mmap, 管道和终端按块读入;
+// 单词在缓冲区中原地切分, 只有结果是字符串时才分配内存
+
+#define IO_BUFFER_SIZE (1 << 20)
+#define IO_MAX_SEGMENTS 64    // 一次 writev 最多写出的段数
+#define IO_DIRECT_STRING 4096 // 不短于这个长度的字符串不复制
+#define IO_MAX_WORD 1023      // read 的单词最长 1023 个字符, 更长的分成几次读 (与 "%1023s" 相同)
+
+typedef struct IOBuffer IOBuffer;
+
+struct IOBuffer
+{
+    FILE *file; // 缓冲的内容属于这个文件
+    int tty;
+    char *data;
+    size_t used;
+    struct iovec segments[IO_MAX_SEGMENTS];
+    int segment_count;
+    IOBuffer *next; // 所有线程的缓冲区串成一个链表, 程序结束时写出
+};
+
+__thread IOBuffer *io_buffer = NULL;
+IOBuffer *io_buffers = NULL;
+pthread_mutex_t io_buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// 把缓冲的段按顺序写出; 同一文件上 stdio 还没写出的内容在前
+void io_write_segments(IOBuffer *b)
+{
+    if (b->segment_count > 0)
+    {
+        fflush(b->file);
+        int fd = fileno(b->file);
+        struct iovec *segment = b->segments;
+        int count = b->segment_count;
+        while (count > 0)
+        {
+            ssize_t n = writev(fd, segment, count);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            // 只写出了一部分: 跳过已经写完的段, 从没写完的段的剩余部分继续
+            while (count > 0 && (size_t)n >= segment->iov_len)
+            {
+                n -= segment->iov_len;
+                segment++;
+                count--;
+            }
+            if (count > 0)
+            {
+                segment->iov_base = (char *)segment->iov_base + n;
+                segment->iov_len -= n;
+            }
+        }
+    }
+    b->segment_count = 0;
+    b->used = 0;
+}
+
+void io_flush_all()
+{
+    pthread_mutex_lock(&io_buffers_lock);
+    for (IOBuffer *b = io_buffers; b != NULL; b = b->next)
+        io_write_segments(b);
+    pthread_mutex_unlock(&io_buffers_lock);
+}
+
+// 写出当前线程的缓冲区
+void io_flush()
+{
+    if (io_buffer != NULL)
+        io_write_segments(io_buffer);
+}
+
+IOBuffer *io_buffer_new()
+{
+    IOBuffer *b = calloc(1, sizeof(IOBuffer));
+    b->data = malloc(IO_BUFFER_SIZE);
+    if (b->data == NULL)
+        runtime_error("out of memory for output buffer", NULL);
+    pthread_mutex_lock(&io_buffers_lock);
+    if (io_buffers == NULL)
+        atexit(io_flush_all);
+    b->next = io_buffers;
+    io_buffers = b;
+    pthread_mutex_unlock(&io_buffers_lock);
+    io_buffer = b;
+    return b;
+}
+
+// 当前线程写到 out 的缓冲区
+IOBuffer *io_buffer_for(FILE *out)
+{
+    IOBuffer *b = io_buffer != NULL ? io_buffer : io_buffer_new();
+    if (b->file != out)
+    {
+        if (b->file != NULL)
+            io_write_segments(b);
+        b->file = out;
+        b->tty = isatty(fileno(out));
+    }
+    return b;
+}
+
+void io_append(IOBuffer *b, const char *data, size_t n)
+{
+    if (n >= IO_DIRECT_STRING)
+    {
+        if (b->segment_count == IO_MAX_SEGMENTS)
+            io_write_segments(b);
+        b->segments[b->segment_count].iov_base = (char *)data;
+        b->segments[b->segment_count].iov_len = n;
+        b->segment_count++;
+        return;
+    }
+    if (b->used + n > IO_BUFFER_SIZE)
+        io_write_segments(b);
+    // 接在最后一段后面时直接延长它, 否则开始新的一段
+    struct iovec *last = b->segment_count > 0 ? &b->segments[b->segment_count - 1] : NULL;
+    if (last == NULL || (char *)last->iov_base + last->iov_len != b->data + b->used)
+    {
+        if (b->segment_count == IO_MAX_SEGMENTS)
+            io_write_segments(b);
+        last = &b->segments[b->segment_count++];
+        last->iov_base = b->data + b->used;
+        last->iov_len = 0;
+    }
+    memcpy(b->data + b->used, data, n);
+    b->used += n;
+    last->iov_len += n;
+}
+
+void io_append_int(IOBuffer *b, long long i)
+{
+    char buffer[24];
+    char *p = buffer + sizeof(buffer);
+    unsigned long long u = i < 0 ? 0ULL - (unsigned long long)i : (unsigned long long)i;
+    do
+    {
+        *--p = (char)('0' + u % 10);
+        u /= 10;
+    } while (u != 0);
+    if (i < 0)
+        *--p = '-';
+    io_append(b, p, buffer + sizeof(buffer) - p);
+}
+
+// 格式与 value_print 相同
+void io_append_value(IOBuffer *b, Value v)
+{
+    char buffer[64];
+    switch (v.type)
+    {
+    case VAL_NIL:
+        io_append(b, "nil", 3);
+        break;
+    case VAL_INT:
+        io_append_int(b, v.as.i);
+        break;
+    case VAL_FLOAT:
+        format_double(v.as.f, buffer);
+        io_append(b, buffer, strlen(buffer));
+        break;
+    case VAL_STRING:
+        io_append(b, v.as.s, strlen(v.as.s));
+        break;
+    case VAL_ARRAY:
+        io_append(b, "[", 1);
+        for (int i = 0; i < v.as.array->length; i++)
+        {
+            if (i > 0)
+                io_append(b, ", ", 2);
+            io_append_value(b, array_get(v.as.array, i));
+        }
+        io_append(b, "]", 1);
+        break;
+    case VAL_MAP:
+        io_append(b, "{", 1);
+        for (int i = 0; i < v.as.map->count; i++)
+        {
+            if (i > 0)
+                io_append(b, ", ", 2);
+            io_append_value(b, v.as.map->keys[i]);
+            io_append(b, ": ", 2);
+            io_append_value(b, v.as.map->values[i]);
+        }
+        io_append(b, "}", 1);
+        break;
+    case VAL_TASK:
+        io_append(b, "<task>", 6);
+        break;
+    }
+}
+
+// print(args...): 以空格分隔, 以换行结束
+void io_print(FILE *out, Value *args, int argc)
+{
+    IOBuffer *b = io_buffer_for(out);
+    for (int i = 0; i < argc; i++)
+    {
+        if (i > 0)
+            io_append(b, " ", 1);
+        io_append_value(b, args[i]);
+    }
+    io_append(b, "\n", 1);
+    if (b->tty)
+        io_write_segments(b);
+}
+
+// 标准输入: data[position, length) 是还没有读取的内容
+typedef struct
+{
+    pthread_mutex_t lock; // read 在释放调度器的锁之后执行, 多个任务可能同时读
+    int started;
+    int mapped; // data 是 mmap 的整个文件
+    char *data;
+    size_t position;
+    size_t length;
+} IOInput;
+
+IOInput io_input = {PTHREAD_MUTEX_INITIALIZER};
+// 阻塞的操作前后调用, 任务调度器启动时设置 (见 task.c), 没有调度器时为 NULL
+void (*io_block_begin)() = NULL;
+void (*io_block_end)() = NULL;
+
+void io_input_start(IOInput *in)
+{
+    struct stat st;
+    in->started = 1;
+    if (fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        off_t offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+        if (data != MAP_FAILED && offset >= 0)
+        {
+            in->mapped = 1;
+            in->data = data;
+            in->position = offset < st.st_size ? (size_t)offset : (size_t)st.st_size;
+            in->length = st.st_size;
+            return;
+        }
+        if (data != MAP_FAILED)
+            munmap(data, st.st_size);
+    }
+    in->data = malloc(IO_BUFFER_SIZE);
+    if (in->data == NULL)
+        runtime_error("out of memory for input buffer", NULL);
+}
+
+// 读入下一块, 没有读取的内容移到缓冲区开头; 文件结束返回 0
+int io_fill(IOInput *in)
+{
+    if (in->mapped)
+        return 0;
+    memmove(in->data, in->data + in->position, in->length - in->position);
+    in->length -= in->position;
+    in->position = 0;
+    for (;;)
+    {
+        ssize_t n = read(STDIN_FILENO, in->data + in->length, IO_BUFFER_SIZE - in->length);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        in->length += n;
+        return 1;
+    }
+}
+
+// 跳过空白, 返回下一个单词的长度, *word 指向缓冲区中的单词; 文件结束返回 0
+size_t io_next_word(IOInput *in, const char **word)
+{
+    for (;;)
+    {
+        while (in->position < in->length && isspace((unsigned char)in->data[in->position]))
+            in->position++;
+        if (in->position < in->length)
+            break;
+        if (!io_fill(in))
+            return 0;
+    }
+    size_t n = 0;
+    for (;;)
+    {
+        while (n < IO_MAX_WORD && in->position + n < in->length &&
+               !isspace((unsigned char)in->data[in->position + n]))
+            n++;
+        // 单词在缓冲区末尾结束时, 后面可能还有它的一部分
+        if (n == IO_MAX_WORD || in->position + n < in->length || !io_fill(in))
+            break;
+    }
+    *word = in->data + in->position;
+    in->position += n;
+    return n;
+}
+
+// read(): 读取一个以空白分隔的单词, 能解析为数字时返回数字; 文件结束返回 nil
+// 读取时释放调度器的锁, 阻塞期间其他任务可以执行; 重新加锁之后才创建字符串
+Value io_read()
+{
+    IOInput *in = &io_input;
+    char buffer[IO_MAX_WORD + 1];
+    const char *word = NULL;
+    if (io_block_begin != NULL)
+        io_block_begin();
+    pthread_mutex_lock(&in->lock);
+    if (!in->started)
+        io_input_start(in);
+    size_t n = io_next_word(in, &word);
+    if (n > 0)
+        memcpy(buffer, word, n);
+    pthread_mutex_unlock(&in->lock);
+    if (io_block_end != NULL)
+        io_block_end();
+    if (n == 0)
+        return value_nil();
+    buffer[n] = '\0';
+    char *end;
+    long long i = strtoll(buffer, &end, 10);
+    if (*end == '\0')
+        return value_int(i);
+    double f = strtod(buffer, &end);
+    if (*end == '\0')
+        return value_float(f);
+    return value_string(string_copy(buffer));
+}
+
+// // 测试输入
+// int main()
+// {
+//     Value args[2];
+//     for (Value v = io_read(); v.type != VAL_NIL; v = io_read())
+//     {
+//         args[0] = v;
+//         args[1] = value_int(v.type);
+//         io_print(stdout, args, 2);
+//     }
+//     io_flush();
+//     return 0;
+// }
\ No newline at end of file
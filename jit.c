@@ -0,0 +1,801 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "bytecode.c"
+
+// ---------------- x86-64 模板 JIT ----------------
+
+// 把一个函数的寄存器字节码逐条翻译为 x86-64 机器码, 每种指令一个模板
+// 机器码直接读写栈帧里的 Value 槽, 与解释器共用同一个栈帧布局, 因此可以在任意一条指令处
+// 进出机器码: 循环回跳时从循环头进入 (OSR), 调用解释执行的函数时直接交给解释器
+// 整数的算术, 比较, 条件跳转和已消除边界检查的数组读写内联为快速路径, 类型不符时调用
+// 与解释器相同的 C 函数, 因此结果与解释执行完全一致
+//
+// 只支持 System V x86-64 (Linux, macOS 等), 其他平台 jit_enable 返回 0, 照常解释执行
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define JIT_SUPPORTED 1
+#endif
+
+// 统计
+int jit_compiled_functions = 0;
+int jit_code_bytes = 0;
+
+// 机器码中调用的辅助函数: 执行一条没有快速路径的非控制流指令, 语义与解释器相同
+void jit_step(VM *vm, Value *base, const Instruction *ins)
+{
+    VMModule *m = vm->module;
+    switch (ins->op)
+    {
+    case OP_LOADK:
+        base[ins->a] = m->constants[ins->b];
+        break;
+    case OP_GETGLOBAL:
+        base[ins->a] = vm->globals[ins->b];
+        break;
+    case OP_SETGLOBAL:
+        vm->globals[ins->b] = base[ins->a];
+        break;
+    case OP_ADD:
+        base[ins->a] = value_add(base[ins->b], base[ins->c]);
+        break;
+    case OP_SUB:
+        base[ins->a] = value_sub(base[ins->b], base[ins->c]);
+        break;
+    case OP_MUL:
+        base[ins->a] = value_mul(base[ins->b], base[ins->c]);
+        break;
+    case OP_DIV:
+        base[ins->a] = value_div(base[ins->b], base[ins->c]);
+        break;
+    case OP_LT:
+        base[ins->a] = value_lt(base[ins->b], base[ins->c]);
+        break;
+    case OP_GT:
+        base[ins->a] = value_gt(base[ins->b], base[ins->c]);
+        break;
+    case OP_LE:
+        base[ins->a] = value_le(base[ins->b], base[ins->c]);
+        break;
+    case OP_GE:
+        base[ins->a] = value_ge(base[ins->b], base[ins->c]);
+        break;
+    case OP_EQ:
+        base[ins->a] = value_eq(base[ins->b], base[ins->c]);
+        break;
+    case OP_CONCAT:
+        base[ins->a] = value_concat(base[ins->b], base[ins->c]);
+        break;
+    case OP_BUILDER:
+        base[ins->a] = string_builder(base[ins->b]);
+        break;
+    case OP_APPEND:
+        base[ins->a] = string_append(base[ins->b], base[ins->c]);
+        break;
+    case OP_NEWARRAY:
+        base[ins->a] = value_new_array(ins->b);
+        break;
+    case OP_NEWMAP:
+        base[ins->a] = value_new_map(ins->b);
+        break;
+    case OP_GETINDEX:
+    case OP_GETINDEX_UNCHECKED:
+        base[ins->a] = value_get_index(base[ins->b], base[ins->c]);
+        break;
+    case OP_SETINDEX:
+    case OP_SETINDEX_UNCHECKED:
+        value_set_index(base[ins->a], base[ins->b], base[ins->c]);
+        break;
+    case OP_LEN:
+        base[ins->a] = value_length(base[ins->b]);
+        break;
+    case OP_ARG:
+        if (vm->arg_count == VM_MAX_ARGS)
+            runtime_error("too many arguments", NULL);
+        vm->args[vm->arg_count++] = base[ins->a];
+        break;
+    case OP_BUILTIN:
+    {
+        Value value = vm_builtin(vm, ins->b, ins->c);
+        base[ins->a] = value;
+        break;
+    }
+    case OP_SPAWN:
+    {
+        Value value = vm_spawn(vm, ins->b, ins->c);
+        base[ins->a] = value;
+        break;
+    }
+    case OP_AWAIT:
+    {
+        // 任务在自己的栈上执行, 挂起时机器码的栈帧原样保留
+        Value value = task_await(base[ins->b]);
+        base[ins->a] = value;
+        break;
+    }
+    default:
+        break;
+    }
+    gc_safepoint();
+}
+
+// 字段访问的慢速路径: 缓存未命中或者不是有形状的键值对, 语义与解释器相同
+void jit_field(VM *vm, Value *base, const Instruction *ins, FieldCache *cache)
+{
+    Value *k = vm->module->constants;
+    if (ins->op == OP_GETFIELD)
+        base[ins->a] = map_get_field(base[ins->b], k[ins->c].as.s, cache);
+    else
+        map_set_field(base[ins->a], k[ins->b].as.s, cache, base[ins->c]);
+}
+
+// 直接调用: 建立被调函数的栈帧, 有机器码时执行机器码, 否则解释执行
+void jit_call(VM *vm, Value *base, const Instruction *ins, VMFunction *caller)
+{
+    VMFunction *callee = &vm->module->functions[ins->b];
+    Value *callee_base = base + caller->frame_size;
+    int argc = ins->c;
+    // 快速路径不经过 vm_enter, 在这里进入安全点
+    gc_safepoint();
+
+    // 快速路径: 被调函数已有机器码, 参数个数相同, 各种限制都没有达到
+    if (callee->native != NULL && argc == callee->param_count && argc <= vm->arg_count &&
+        vm->native_depth < VM_MAX_NATIVE_DEPTH && vm->frame_count < VM_MAX_FRAMES &&
+        callee_base + callee->frame_size <= vm->stack + VM_STACK_SIZE)
+    {
+        vm->arg_count -= argc;
+        memcpy(callee_base, &vm->args[vm->arg_count], sizeof(Value) * argc);
+        for (int i = argc; i < callee->local_count; i++)
+            callee_base[i] = value_nil();
+        if (callee_base + callee->frame_size > vm->stack_high)
+            vm->stack_high = callee_base + callee->frame_size;
+        vm->native_depth++;
+        vm->frames[vm->frame_count].function = callee;
+        vm->frames[vm->frame_count].base = callee_base;
+        vm->frame_count++;
+        Value value = ((NativeCode)callee->native)(vm, callee_base, callee->native_pc[0]);
+        vm->frame_count--;
+        vm->native_depth--;
+        if (vm->tail_call != NULL)
+        {
+            VMFunction *next = vm->tail_call;
+            vm->tail_call = NULL;
+            value = vm_invoke(vm, next, callee_base, vm_native_entry(vm, next));
+        }
+        base[ins->a] = value;
+        return;
+    }
+
+    if (vm->frame_count == VM_MAX_FRAMES)
+        runtime_error("stack overflow in", callee->name);
+    vm_enter(vm, callee, callee_base, argc);
+    Value value = vm_invoke(vm, callee, callee_base, vm_native_entry(vm, callee));
+    base[ins->a] = value;
+}
+
+// 并行循环: 与解释器相同, 由 vm_parallel_for 决定并行还是顺序执行
+void jit_parallel(VM *vm, Value *base, const Instruction *ins, VMFunction *caller)
+{
+    Value value = vm_parallel_for(vm, ins->b, ins->c, base + caller->frame_size);
+    base[ins->a] = value;
+}
+
+// pmap / pfilter / preduce: 由 vm_parallel_apply 决定并行还是在当前虚拟机中顺序调用
+void jit_apply(VM *vm, Value *base, const Instruction *ins, VMFunction *caller)
+{
+    Value value = vm_parallel_apply(vm, ins->b, ins->c, base + caller->frame_size);
+    base[ins->a] = value;
+}
+
+// 尾调用: 在当前栈帧上建立被调函数的参数, 机器码返回后由 vm_invoke 接着执行被调函数
+void jit_tail_call(VM *vm, Value *base, const Instruction *ins)
+{
+    VMFunction *callee = &vm->module->functions[ins->b];
+    vm_enter(vm, callee, base, ins->c);
+    vm->tail_call = callee;
+}
+
+#ifdef JIT_SUPPORTED
+
+typedef struct
+{
+    unsigned char *code;
+    int length;
+    int capacity;
+    int *jump_sites;   // 跳到其他指令的 rel32 位置
+    int *jump_targets; // 对应的字节码下标
+    int jump_count;
+} JitBuffer;
+
+// x86-64 寄存器编号
+enum
+{
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RBX = 3,
+    RSI = 6,
+    RDI = 7
+};
+
+#define SLOT(x) ((x) * (int)sizeof(Value))
+#define PAYLOAD 8 // Value 中联合体的偏移
+
+void jit_bytes(JitBuffer *b, const unsigned char *bytes, int n)
+{
+    if (b->length + n > b->capacity)
+    {
+        b->capacity = (b->length + n) * 2 + 256;
+        b->code = realloc(b->code, b->capacity);
+    }
+    memcpy(b->code + b->length, bytes, n);
+    b->length += n;
+}
+
+void jit_byte(JitBuffer *b, unsigned char x)
+{
+    jit_bytes(b, &x, 1);
+}
+
+void jit_u32(JitBuffer *b, unsigned int x)
+{
+    unsigned char bytes[4] = {x, x >> 8, x >> 16, x >> 24};
+    jit_bytes(b, bytes, 4);
+}
+
+void jit_u64(JitBuffer *b, unsigned long long x)
+{
+    jit_u32(b, (unsigned int)x);
+    jit_u32(b, (unsigned int)(x >> 32));
+}
+
+// op reg, [rbx + disp32]; prefix 为 0 时不加 REX.W
+void jit_mem(JitBuffer *b, int rex_w, int op, int reg, int disp)
+{
+    if (rex_w)
+        jit_byte(b, 0x48);
+    if (op > 0xff)
+        jit_byte(b, op >> 8);
+    jit_byte(b, op & 0xff);
+    jit_byte(b, 0x80 | (reg << 3) | RBX);
+    jit_u32(b, disp);
+}
+
+// op reg, [r12 + disp32], r12 保存 vm
+void jit_mem_vm(JitBuffer *b, int rex_w, int op, int reg, int disp)
+{
+    jit_byte(b, 0x41 | (rex_w ? 0x08 : 0));
+    jit_byte(b, op);
+    jit_byte(b, 0x80 | (reg << 3) | 4);
+    jit_byte(b, 0x24);
+    jit_u32(b, disp);
+}
+
+// mov reg, imm64
+void jit_mov_imm64(JitBuffer *b, int reg, const void *value)
+{
+    jit_byte(b, 0x48);
+    jit_byte(b, 0xb8 + reg);
+    jit_u64(b, (unsigned long long)(size_t)value);
+}
+
+// cmp dword [rbx + disp], imm8 (比较 Value 的类型)
+void jit_cmp_type(JitBuffer *b, int slot, int type)
+{
+    jit_mem(b, 0, 0x83, 7, SLOT(slot));
+    jit_byte(b, type);
+}
+
+// jcc rel32, 返回待回填的位置
+int jit_jcc(JitBuffer *b, int cc)
+{
+    jit_byte(b, 0x0f);
+    jit_byte(b, cc);
+    jit_u32(b, 0);
+    return b->length - 4;
+}
+
+int jit_jmp(JitBuffer *b)
+{
+    jit_byte(b, 0xe9);
+    jit_u32(b, 0);
+    return b->length - 4;
+}
+
+// 把 rel32 的目标设为当前位置
+void jit_patch_here(JitBuffer *b, int site)
+{
+    int rel = b->length - (site + 4);
+    memcpy(b->code + site, &rel, 4);
+}
+
+// 跳到字节码下标 target, 全部指令生成后回填
+void jit_jump_to(JitBuffer *b, int cc, int target)
+{
+    int site = cc == 0 ? jit_jmp(b) : jit_jcc(b, cc);
+    b->jump_sites = realloc(b->jump_sites, sizeof(int) * (b->jump_count + 1));
+    b->jump_targets = realloc(b->jump_targets, sizeof(int) * (b->jump_count + 1));
+    b->jump_sites[b->jump_count] = site;
+    b->jump_targets[b->jump_count++] = target;
+}
+
+// 调用 helper(vm, base, ins, extra)
+void jit_call_helper(JitBuffer *b, const void *helper, const Instruction *ins, const void *extra)
+{
+    static const unsigned char mov_rdi_r12[] = {0x4c, 0x89, 0xe7};
+    static const unsigned char mov_rsi_rbx[] = {0x48, 0x89, 0xde};
+    static const unsigned char call_rax[] = {0xff, 0xd0};
+    jit_bytes(b, mov_rdi_r12, 3);
+    jit_bytes(b, mov_rsi_rbx, 3);
+    jit_mov_imm64(b, RDX, ins);
+    if (extra != NULL)
+        jit_mov_imm64(b, RCX, extra);
+    jit_mov_imm64(b, RAX, helper);
+    jit_bytes(b, call_rax, 2);
+}
+
+// 返回 rax:rdx 中的 Value
+void jit_epilogue(JitBuffer *b)
+{
+    static const unsigned char epilogue[] = {0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3}; // pop r13; pop r12; pop rbx; ret
+    jit_bytes(b, epilogue, sizeof(epilogue));
+}
+
+// 把 [rbx + from] 的 16 字节复制到 [rbx + to]
+void jit_copy_slot(JitBuffer *b, int to, int from)
+{
+    jit_mem(b, 1, 0x8b, RAX, SLOT(from));
+    jit_mem(b, 1, 0x8b, RDX, SLOT(from) + PAYLOAD);
+    jit_mem(b, 1, 0x89, RAX, SLOT(to));
+    jit_mem(b, 1, 0x89, RDX, SLOT(to) + PAYLOAD);
+}
+
+// 把 rax 作为整数写入槽 a
+void jit_store_int(JitBuffer *b, int a)
+{
+    jit_mem(b, 1, 0x89, RAX, SLOT(a) + PAYLOAD);
+    jit_mem(b, 0, 0xc7, 0, SLOT(a));
+    jit_u32(b, VAL_INT);
+}
+
+// 生成一条指令的模板
+void jit_instruction(JitBuffer *b, VMModule *m, VMFunction *f, const Instruction *ins, int pc)
+{
+    int slow[2];
+    int done;
+
+    switch (ins->op)
+    {
+    case OP_NOP:
+        break;
+
+    case OP_LOADK:
+    {
+        Value *k = &m->constants[ins->b];
+        if (k->type == VAL_INT)
+        {
+            jit_mov_imm64(b, RAX, (const void *)(size_t)k->as.i);
+            jit_store_int(b, ins->a);
+        }
+        else
+        {
+            static const unsigned char load[] = {0x48, 0x8b, 0x01, 0x48, 0x8b, 0x51, 0x08}; // mov rax, [rcx]; mov rdx, [rcx + 8]
+            jit_mov_imm64(b, RCX, k);
+            jit_bytes(b, load, sizeof(load));
+            jit_mem(b, 1, 0x89, RAX, SLOT(ins->a));
+            jit_mem(b, 1, 0x89, RDX, SLOT(ins->a) + PAYLOAD);
+        }
+        break;
+    }
+
+    case OP_MOVE:
+        jit_copy_slot(b, ins->a, ins->b);
+        break;
+
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_LT:
+    case OP_GT:
+    case OP_LE:
+    case OP_GE:
+    case OP_EQ:
+    {
+        // 两个操作数都是整数时直接计算, 整数运算按 64 位补码回绕, 与解释器一致
+        jit_cmp_type(b, ins->b, VAL_INT);
+        slow[0] = jit_jcc(b, 0x85);
+        jit_cmp_type(b, ins->c, VAL_INT);
+        slow[1] = jit_jcc(b, 0x85);
+        jit_mem(b, 1, 0x8b, RAX, SLOT(ins->b) + PAYLOAD);
+        if (ins->op == OP_ADD)
+            jit_mem(b, 1, 0x03, RAX, SLOT(ins->c) + PAYLOAD);
+        else if (ins->op == OP_SUB)
+            jit_mem(b, 1, 0x2b, RAX, SLOT(ins->c) + PAYLOAD);
+        else if (ins->op == OP_MUL)
+            jit_mem(b, 1, 0x0faf, RAX, SLOT(ins->c) + PAYLOAD);
+        else
+        {
+            static const unsigned char setcc[] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0x9c, 0x9f, 0x9e, 0x9d, 0x94};
+            unsigned char compare[] = {0x0f, setcc[ins->op], 0xc0, 0x0f, 0xb6, 0xc0}; // setcc al; movzx eax, al
+            jit_mem(b, 1, 0x3b, RAX, SLOT(ins->c) + PAYLOAD);
+            jit_bytes(b, compare, sizeof(compare));
+        }
+        jit_store_int(b, ins->a);
+        done = jit_jmp(b);
+        jit_patch_here(b, slow[0]);
+        jit_patch_here(b, slow[1]);
+        jit_call_helper(b, jit_step, ins, NULL);
+        jit_patch_here(b, done);
+        break;
+    }
+
+    case OP_ADD_I64:
+    case OP_SUB_I64:
+    case OP_MUL_I64:
+    case OP_LT_I64:
+    case OP_GT_I64:
+    case OP_LE_I64:
+    case OP_GE_I64:
+    case OP_EQ_I64:
+    {
+        // 类型已确定为整数: 只读写数据字, 没有类型检查和慢速路径
+        jit_mem(b, 1, 0x8b, RAX, SLOT(ins->b) + PAYLOAD);
+        if (ins->op == OP_ADD_I64)
+            jit_mem(b, 1, 0x03, RAX, SLOT(ins->c) + PAYLOAD);
+        else if (ins->op == OP_SUB_I64)
+            jit_mem(b, 1, 0x2b, RAX, SLOT(ins->c) + PAYLOAD);
+        else if (ins->op == OP_MUL_I64)
+            jit_mem(b, 1, 0x0faf, RAX, SLOT(ins->c) + PAYLOAD);
+        else
+        {
+            static const unsigned char setcc[] = {0x9c, 0x9f, 0x9e, 0x9d, 0x94}; // LT GT LE GE EQ
+            unsigned char compare[] = {0x0f, setcc[ins->op - OP_LT_I64], 0xc0, 0x0f, 0xb6, 0xc0};
+            jit_mem(b, 1, 0x3b, RAX, SLOT(ins->c) + PAYLOAD);
+            jit_bytes(b, compare, sizeof(compare));
+        }
+        jit_store_int(b, ins->a);
+        break;
+    }
+
+    case OP_ADD_F64:
+    case OP_SUB_F64:
+    case OP_MUL_F64:
+    case OP_DIV_F64:
+    {
+        // 类型已确定为浮点数: movsd xmm0, [b]; addsd/subsd/mulsd/divsd xmm0, [c]; movsd [a], xmm0
+        static const int sse[] = {0x0f58, 0x0f5c, 0x0f59, 0x0f5e};
+        jit_byte(b, 0xf2);
+        jit_mem(b, 0, 0x0f10, 0, SLOT(ins->b) + PAYLOAD);
+        jit_byte(b, 0xf2);
+        jit_mem(b, 0, sse[ins->op - OP_ADD_F64], 0, SLOT(ins->c) + PAYLOAD);
+        jit_byte(b, 0xf2);
+        jit_mem(b, 0, 0x0f11, 0, SLOT(ins->a) + PAYLOAD);
+        jit_mem(b, 0, 0xc7, 0, SLOT(ins->a));
+        jit_u32(b, VAL_FLOAT);
+        break;
+    }
+
+    case OP_GETINDEX_UNCHECKED:
+    case OP_SETINDEX_UNCHECKED:
+    {
+        // 下标已证明不越界: 数组和整数下标时直接读写第 i 个元素
+        // 装箱数组读写 16 字节的 Value; 紧凑数组读写 8 字节, kind 就是元素的类型标签, 写入的值类型不同时交给辅助函数
+        // 写入字符串, 数组等对象时需要写屏障, 也交给辅助函数
+        int array = ins->op == OP_GETINDEX_UNCHECKED ? ins->b : ins->a;
+        int index = ins->op == OP_GETINDEX_UNCHECKED ? ins->c : ins->b;
+        static const unsigned char address[] = {0x48, 0x8b, 0x00, 0x48, 0xc1, 0xe1, 0x04, 0x48, 0x01, 0xc8}; // mov rax, [rax]; shl rcx, 4; add rax, rcx
+        unsigned char kind[] = {0x8b, 0x50, (unsigned char)offsetof(Array, kind), 0x85, 0xd2}; // mov edx, [rax + kind]; test edx, edx
+        int packed;
+        int mismatch = -1;
+        int pointer = -1;
+        jit_cmp_type(b, array, VAL_ARRAY);
+        slow[0] = jit_jcc(b, 0x85);
+        jit_cmp_type(b, index, VAL_INT);
+        slow[1] = jit_jcc(b, 0x85);
+        jit_mem(b, 1, 0x8b, RAX, SLOT(array) + PAYLOAD);
+        jit_mem(b, 1, 0x8b, RCX, SLOT(index) + PAYLOAD);
+        jit_bytes(b, kind, sizeof(kind));
+        packed = jit_jcc(b, 0x85);
+        jit_bytes(b, address, sizeof(address));
+        if (ins->op == OP_GETINDEX_UNCHECKED)
+        {
+            static const unsigned char load[] = {0x48, 0x8b, 0x08, 0x48, 0x8b, 0x50, 0x08}; // mov rcx, [rax]; mov rdx, [rax + 8]
+            static const unsigned char load_packed[] = {0x48, 0x8b, 0x00, 0x48, 0x8b, 0x0c, 0xc8}; // mov rax, [rax]; mov rcx, [rax + rcx * 8]
+            jit_bytes(b, load, sizeof(load));
+            jit_mem(b, 1, 0x89, RCX, SLOT(ins->a));
+            jit_mem(b, 1, 0x89, RDX, SLOT(ins->a) + PAYLOAD);
+            done = jit_jmp(b);
+            jit_patch_here(b, packed);
+            jit_bytes(b, load_packed, sizeof(load_packed));
+            jit_mem(b, 0, 0x89, RDX, SLOT(ins->a));
+            jit_mem(b, 1, 0x89, RCX, SLOT(ins->a) + PAYLOAD);
+        }
+        else
+        {
+            static const unsigned char store[] = {0x48, 0x89, 0x08, 0x48, 0x89, 0x50, 0x08}; // mov [rax], rcx; mov [rax + 8], rdx
+            static const unsigned char compare_pointer[] = {0x83, 0xf9, VAL_STRING};         // cmp ecx, VAL_STRING
+            static const unsigned char store_packed[] = {0x48, 0x8b, 0x00, 0x48, 0x89, 0x14, 0xc8}; // mov rax, [rax]; mov [rax + rcx * 8], rdx
+            jit_mem(b, 1, 0x8b, RCX, SLOT(ins->c));
+            jit_mem(b, 1, 0x8b, RDX, SLOT(ins->c) + PAYLOAD);
+            jit_bytes(b, compare_pointer, sizeof(compare_pointer));
+            pointer = jit_jcc(b, 0x83);
+            jit_bytes(b, store, sizeof(store));
+            done = jit_jmp(b);
+            jit_patch_here(b, packed);
+            jit_mem(b, 0, 0x3b, RDX, SLOT(ins->c));
+            mismatch = jit_jcc(b, 0x85);
+            jit_mem(b, 1, 0x8b, RDX, SLOT(ins->c) + PAYLOAD);
+            jit_bytes(b, store_packed, sizeof(store_packed));
+        }
+        int packed_done = jit_jmp(b);
+        jit_patch_here(b, slow[0]);
+        jit_patch_here(b, slow[1]);
+        if (mismatch >= 0)
+            jit_patch_here(b, mismatch);
+        if (pointer >= 0)
+            jit_patch_here(b, pointer);
+        jit_call_helper(b, jit_step, ins, NULL);
+        jit_patch_here(b, done);
+        jit_patch_here(b, packed_done);
+        break;
+    }
+
+    case OP_GETFIELD:
+    case OP_SETFIELD:
+    {
+        // 单态内联缓存: 键值对的形状等于缓存的第一个形状时按缓存的槽位直接读写 values[slot],
+        // 其余情况 (未命中, 多态, 键不存在, 写入需要写屏障的对象) 交给辅助函数
+        FieldCache *cache = &f->caches[pc];
+        int map = ins->op == OP_GETFIELD ? ins->b : ins->a;
+        unsigned char shape[] = {0x48, 0x8b, 0x48, (unsigned char)offsetof(Map, shape), // mov rcx, [rax + shape]
+                                 0x48, 0x85, 0xc9};                                     // test rcx, rcx
+        static const unsigned char compare[] = {0x48, 0x3b, 0x0a};                     // cmp rcx, [rdx]
+        unsigned char slot[] = {0x48, 0x63, 0x4a, (unsigned char)offsetof(FieldCache, slots), // movsxd rcx, [rdx + slots]
+                                0x48, 0x85, 0xc9};                                            // test rcx, rcx
+        unsigned char address[] = {0x48, 0x8b, 0x40, (unsigned char)offsetof(Map, values), // mov rax, [rax + values]
+                                   0x48, 0xc1, 0xe1, 0x04, 0x48, 0x01, 0xc8};             // shl rcx, 4; add rax, rcx
+        int miss[4] = {-1, -1, -1, -1};
+        jit_cmp_type(b, map, VAL_MAP);
+        slow[0] = jit_jcc(b, 0x85);
+        jit_mem(b, 1, 0x8b, RAX, SLOT(map) + PAYLOAD);
+        jit_mov_imm64(b, RDX, cache);
+        jit_bytes(b, shape, sizeof(shape));
+        miss[0] = jit_jcc(b, 0x84);
+        jit_bytes(b, compare, sizeof(compare));
+        miss[1] = jit_jcc(b, 0x85);
+        jit_bytes(b, slot, sizeof(slot));
+        miss[2] = jit_jcc(b, 0x88);
+        jit_bytes(b, address, sizeof(address));
+        if (ins->op == OP_GETFIELD)
+        {
+            static const unsigned char load[] = {0x48, 0x8b, 0x08, 0x48, 0x8b, 0x50, 0x08}; // mov rcx, [rax]; mov rdx, [rax + 8]
+            jit_bytes(b, load, sizeof(load));
+            jit_mem(b, 1, 0x89, RCX, SLOT(ins->a));
+            jit_mem(b, 1, 0x89, RDX, SLOT(ins->a) + PAYLOAD);
+        }
+        else
+        {
+            static const unsigned char store[] = {0x48, 0x89, 0x08, 0x48, 0x89, 0x50, 0x08}; // mov [rax], rcx; mov [rax + 8], rdx
+            static const unsigned char compare_pointer[] = {0x83, 0xf9, VAL_STRING};         // cmp ecx, VAL_STRING
+            jit_mem(b, 1, 0x8b, RCX, SLOT(ins->c));
+            jit_mem(b, 1, 0x8b, RDX, SLOT(ins->c) + PAYLOAD);
+            jit_bytes(b, compare_pointer, sizeof(compare_pointer));
+            miss[3] = jit_jcc(b, 0x83);
+            jit_bytes(b, store, sizeof(store));
+        }
+        done = jit_jmp(b);
+        jit_patch_here(b, slow[0]);
+        for (int k = 0; k < 4; k++)
+        {
+            if (miss[k] >= 0)
+                jit_patch_here(b, miss[k]);
+        }
+        jit_call_helper(b, jit_field, ins, cache);
+        jit_patch_here(b, done);
+        break;
+    }
+
+    case OP_ARG:
+    {
+        // vm->args[vm->arg_count++] = R[a], 实参区满时交给辅助函数报错
+        static const unsigned char address[] = {0x48, 0xc1, 0xe0, 0x04, 0x4c, 0x01, 0xe0}; // shl rax, 4; add rax, r12
+        jit_mem_vm(b, 0, 0x8b, RAX, offsetof(VM, arg_count));
+        jit_byte(b, 0x3d);
+        jit_u32(b, VM_MAX_ARGS);
+        slow[0] = jit_jcc(b, 0x84);
+        jit_mem_vm(b, 0, 0x83, 0, offsetof(VM, arg_count));
+        jit_byte(b, 1);
+        jit_bytes(b, address, sizeof(address));
+        jit_mem(b, 1, 0x8b, RCX, SLOT(ins->a));
+        jit_mem(b, 1, 0x8b, RDX, SLOT(ins->a) + PAYLOAD);
+        jit_byte(b, 0x48);
+        jit_byte(b, 0x89);
+        jit_byte(b, 0x88);
+        jit_u32(b, offsetof(VM, args)); // mov [rax + args], rcx
+        jit_byte(b, 0x48);
+        jit_byte(b, 0x89);
+        jit_byte(b, 0x90);
+        jit_u32(b, offsetof(VM, args) + PAYLOAD); // mov [rax + args + 8], rdx
+        done = jit_jmp(b);
+        jit_patch_here(b, slow[0]);
+        jit_call_helper(b, jit_step, ins, NULL);
+        jit_patch_here(b, done);
+        break;
+    }
+
+    case OP_CALL:
+        jit_call_helper(b, jit_call, ins, f);
+        break;
+
+    case OP_PARALLEL:
+        jit_call_helper(b, jit_parallel, ins, f);
+        break;
+
+    case OP_APPLY:
+        jit_call_helper(b, jit_apply, ins, f);
+        break;
+
+    case OP_TAILCALL:
+    {
+        static const unsigned char nil[] = {0x31, 0xc0, 0x31, 0xd2}; // xor eax, eax; xor edx, edx
+        jit_call_helper(b, jit_tail_call, ins, NULL);
+        jit_bytes(b, nil, sizeof(nil));
+        jit_epilogue(b);
+        break;
+    }
+
+    case OP_JMP:
+        jit_jump_to(b, 0, ins->b);
+        break;
+
+    case OP_JMPF:
+    {
+        // 整数直接判断是否为 0, 其他类型调用 value_truthy
+        static const unsigned char test[] = {0x85, 0xc0}; // test eax, eax
+        jit_cmp_type(b, ins->a, VAL_INT);
+        slow[0] = jit_jcc(b, 0x85);
+        jit_mem(b, 1, 0x83, 7, SLOT(ins->a) + PAYLOAD);
+        jit_byte(b, 0);
+        jit_jump_to(b, 0x84, ins->b);
+        done = jit_jmp(b);
+        jit_patch_here(b, slow[0]);
+        jit_mem(b, 1, 0x8b, RDI, SLOT(ins->a));
+        jit_mem(b, 1, 0x8b, RSI, SLOT(ins->a) + PAYLOAD);
+        jit_mov_imm64(b, RAX, value_truthy);
+        jit_byte(b, 0xff);
+        jit_byte(b, 0xd0);
+        jit_bytes(b, test, sizeof(test));
+        jit_jump_to(b, 0x84, ins->b);
+        jit_patch_here(b, done);
+        break;
+    }
+
+    case OP_RET:
+        jit_mem(b, 1, 0x8b, RAX, SLOT(ins->a));
+        jit_mem(b, 1, 0x8b, RDX, SLOT(ins->a) + PAYLOAD);
+        jit_epilogue(b);
+        break;
+
+    case OP_RETNIL:
+    {
+        static const unsigned char nil[] = {0x31, 0xc0, 0x31, 0xd2};
+        jit_bytes(b, nil, sizeof(nil));
+        jit_epilogue(b);
+        break;
+    }
+
+    default:
+        jit_call_helper(b, jit_step, ins, NULL);
+        break;
+    }
+}
+
+// 编译函数 f, 成功返回 1
+int jit_compile_function(VMModule *m, VMFunction *f)
+{
+    JitBuffer b;
+    memset(&b, 0, sizeof(b));
+    int *offsets = malloc(sizeof(int) * (f->code_length + 1));
+
+    // 入口: 保存 callee-saved 寄存器, r12 = vm, rbx = base, 然后跳到 entry
+    static const unsigned char prologue[] = {
+        0x53,             // push rbx
+        0x41, 0x54,       // push r12
+        0x41, 0x55,       // push r13 (保持栈 16 字节对齐)
+        0x49, 0x89, 0xfc, // mov r12, rdi
+        0x48, 0x89, 0xf3, // mov rbx, rsi
+        0xff, 0xe2        // jmp rdx
+    };
+    jit_bytes(&b, prologue, sizeof(prologue));
+
+    for (int pc = 0; pc < f->code_length; pc++)
+    {
+        offsets[pc] = b.length;
+        jit_instruction(&b, m, f, &f->code[pc], pc);
+    }
+    offsets[f->code_length] = b.length;
+
+    for (int k = 0; k < b.jump_count; k++)
+    {
+        int rel = offsets[b.jump_targets[k]] - (b.jump_sites[k] + 4);
+        memcpy(b.code + b.jump_sites[k], &rel, 4);
+    }
+
+    // 先写入再改为只读可执行
+    size_t size = (b.length + 4095) & ~(size_t)4095;
+    unsigned char *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    int ok = memory != MAP_FAILED;
+    if (ok)
+    {
+        memcpy(memory, b.code, b.length);
+        ok = mprotect(memory, size, PROT_READ | PROT_EXEC) == 0;
+    }
+    if (ok)
+    {
+        f->native_pc = malloc(sizeof(void *) * (f->code_length + 1));
+        for (int pc = 0; pc <= f->code_length; pc++)
+            f->native_pc[pc] = memory + offsets[pc];
+        f->native = memory;
+        jit_compiled_functions++;
+        jit_code_bytes += b.length;
+    }
+    else if (memory != MAP_FAILED)
+        munmap(memory, size);
+
+    free(offsets);
+    free(b.code);
+    free(b.jump_sites);
+    free(b.jump_targets);
+    return ok;
+}
+
+#endif
+
+// 打开 JIT, 当前平台不支持时返回 0
+int jit_enable()
+{
+#ifdef JIT_SUPPORTED
+    vm_jit_compile = jit_compile_function;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void jit_disable()
+{
+    vm_jit_compile = NULL;
+}
+
+// // 测试输入
+// int main()
+// {
+//     const char *programs[] = {"input.txt",      "bench/fib.x",   "bench/loops.x",  "bench/arrays.x",
+//                               "tests/shadow.x", "tests/temps.x", "tests/bounds.x", "tests/parallel_for.x",
+//                               "tests/tasks.x",  "tests/pmap.x",  "tests/gc.x",     "tests/strings.x"};
+//     freopen("output_jit.txt", "w", stdout);
+//     jit_enable();
+//     vm_jit_call_threshold = 0;
+//     vm_jit_loop_threshold = 0;
+//
+//     // 每个程序在 JIT 下的输出, 之后是为它编译的函数个数和机器码字节数
+//     for (int i = 0; i < (int)(sizeof(programs) / sizeof(programs[0])); i++)
+//     {
+//         FILE *file = fopen(programs[i], "rb");
+//         static char source[65536];
+//         int length = fread(source, 1, sizeof(source) - 1, file);
+//         source[length] = 0;
+//         fclose(file);
+//
+//         printf("== %s\n", programs[i]);
+//         int functions = jit_compiled_functions;
+//         int bytes = jit_code_bytes;
+//         ir_count = 0;
+//         vm_run(vm_compile_source(source, 1));
+//         printf("jit: %d functions, %d bytes\n", jit_compiled_functions - functions, jit_code_bytes - bytes);
+//     }
+//
+//     return 0;
+// }
\ No newline at end of file
@@ -41,6 +41,8 @@ typedef enum
     TOKEN_IF,       // if 条件关键字
     TOKEN_ELSE,     // else 条件关键字
     TOKEN_RETURN,   // return 关键字
+    TOKEN_SPAWN,    // spawn 关键字
+    TOKEN_AWAIT,    // await 关键字
 
     TOKEN_EOF,    // 文件结束标记
     TOKEN_UNKNOWN // 未知
@@ -94,6 +96,10 @@ TokenType check_keyword(const char *start, int length)
         return TOKEN_ELSE;
     if (length == 6 && strncmp(start, "return", 6) == 0)
         return TOKEN_RETURN;
+    if (length == 5 && strncmp(start, "spawn", 5) == 0)
+        return TOKEN_SPAWN;
+    if (length == 5 && strncmp(start, "await", 5) == 0)
+        return TOKEN_AWAIT;
     return TOKEN_IDENTIFIER;
 }
 
@@ -372,6 +378,12 @@ void print_token(Token token)
     case TOKEN_RETURN:
         printf("TOKEN_RETURN: %s\n", token.value);
         break;
+    case TOKEN_SPAWN:
+        printf("TOKEN_SPAWN: %s\n", token.value);
+        break;
+    case TOKEN_AWAIT:
+        printf("TOKEN_AWAIT: %s\n", token.value);
+        break;
     case TOKEN_EOF:
         printf("TOKEN_EOF: %s\n", token.value);
         break;
@@ -0,0 +1,445 @@
+#include <stdint.h>
+#include <time.h>
+
+#include "value.c"
+
+// ---------------- NaN-boxing 的值表示 ----------------
+
+// value.c 的 Value 是带标签的联合体, 占 16 字节; 这里把同样的值压缩进 8 字节:
+// 不是 NaN 的浮点数直接保存, 其余类型放在符号位为 1 的 quiet NaN 空间里,
+// 高 16 位是标签, 低 48 位是载荷 (x86-64 用户态指针只有 48 位)
+//
+//   0x0000... ~ 0xFFF0...  浮点数 (所有 NaN 统一为 0x7FF8000000000000)
+//   0xFFF9 | 48 位整数     nil
+//   0xFFFA | 48 位整数     小整数, 按有符号数扩展
+//   0xFFFB | 指针          字符串
+//   0xFFFC | 指针          数组
+//   0xFFFD | 指针          键值对
+//   0xFFFE | 指针          放不进 48 位的整数, 装箱在堆上
+//
+// 数组元素和栈帧的大小减半, 整数和浮点数的运算不需要访问内存
+typedef uint64_t NanValue;
+
+#define NAN_CANONICAL 0x7FF8000000000000ULL
+#define NAN_TAGGED 0xFFF9000000000000ULL
+#define NAN_PAYLOAD 0x0000FFFFFFFFFFFFULL
+
+#define NAN_TAG_NIL 0xFFF9000000000000ULL
+#define NAN_TAG_INT 0xFFFA000000000000ULL
+#define NAN_TAG_STRING 0xFFFB000000000000ULL
+#define NAN_TAG_ARRAY 0xFFFC000000000000ULL
+#define NAN_TAG_MAP 0xFFFD000000000000ULL
+#define NAN_TAG_BIGINT 0xFFFE000000000000ULL
+
+// 小整数的范围
+#define NAN_INT_MIN (-(1LL << 47))
+#define NAN_INT_MAX ((1LL << 47) - 1)
+
+#define NAN_NIL NAN_TAG_NIL
+
+static inline NanValue nan_tag(NanValue v)
+{
+    return v & ~NAN_PAYLOAD;
+}
+
+static inline void *nan_pointer(NanValue v)
+{
+    return (void *)(uintptr_t)(v & NAN_PAYLOAD);
+}
+
+static inline int nan_is_float(NanValue v)
+{
+    return v < NAN_TAGGED;
+}
+
+static inline int nan_is_small_int(NanValue v)
+{
+    return nan_tag(v) == NAN_TAG_INT;
+}
+
+static inline int nan_is_int(NanValue v)
+{
+    return nan_tag(v) == NAN_TAG_INT || nan_tag(v) == NAN_TAG_BIGINT;
+}
+
+static inline NanValue nan_float(double f)
+{
+    NanValue v;
+    if (f != f)
+        return NAN_CANONICAL;
+    memcpy(&v, &f, sizeof(v));
+    return v;
+}
+
+static inline double nan_as_float(NanValue v)
+{
+    double f;
+    memcpy(&f, &v, sizeof(f));
+    return f;
+}
+
+// 超出 48 位的整数装箱到堆上; 回收器只管理 Value 引用的字符串, 数组和键值对, 装箱的整数不回收
+NanValue nan_box_int(long long i)
+{
+    long long *box = malloc(sizeof(long long));
+    *box = i;
+    return NAN_TAG_BIGINT | (uint64_t)(uintptr_t)box;
+}
+
+static inline NanValue nan_int(long long i)
+{
+    if (i >= NAN_INT_MIN && i <= NAN_INT_MAX)
+        return NAN_TAG_INT | ((uint64_t)i & NAN_PAYLOAD);
+    return nan_box_int(i);
+}
+
+static inline long long nan_as_small_int(NanValue v)
+{
+    return (long long)(v << 16) >> 16;
+}
+
+static inline long long nan_as_int(NanValue v)
+{
+    if (nan_is_small_int(v))
+        return nan_as_small_int(v);
+    return *(long long *)nan_pointer(v);
+}
+
+static inline NanValue nan_pointer_value(NanValue tag, void *p)
+{
+    if ((uintptr_t)p > NAN_PAYLOAD)
+        runtime_error("pointer does not fit in a NaN-boxed value", NULL);
+    return tag | (uint64_t)(uintptr_t)p;
+}
+
+ValueType nan_type(NanValue v)
+{
+    if (nan_is_float(v))
+        return VAL_FLOAT;
+    switch (nan_tag(v))
+    {
+    case NAN_TAG_INT:
+    case NAN_TAG_BIGINT:
+        return VAL_INT;
+    case NAN_TAG_STRING:
+        return VAL_STRING;
+    case NAN_TAG_ARRAY:
+        return VAL_ARRAY;
+    case NAN_TAG_MAP:
+        return VAL_MAP;
+    default:
+        return VAL_NIL;
+    }
+}
+
+// 与 value.c 之间的转换, 慢路径借助它们复用 value.c 的语义
+NanValue nan_from_value(Value v)
+{
+    switch (v.type)
+    {
+    case VAL_INT:
+        return nan_int(v.as.i);
+    case VAL_FLOAT:
+        return nan_float(v.as.f);
+    case VAL_STRING:
+        return nan_pointer_value(NAN_TAG_STRING, v.as.s);
+    case VAL_ARRAY:
+        return nan_pointer_value(NAN_TAG_ARRAY, v.as.array);
+    case VAL_MAP:
+        return nan_pointer_value(NAN_TAG_MAP, v.as.map);
+    default:
+        return NAN_NIL;
+    }
+}
+
+Value nan_to_value(NanValue v)
+{
+    Value result;
+    result.type = nan_type(v);
+    switch (result.type)
+    {
+    case VAL_INT:
+        result.as.i = nan_as_int(v);
+        break;
+    case VAL_FLOAT:
+        result.as.f = nan_as_float(v);
+        break;
+    case VAL_NIL:
+        result.as.i = 0;
+        break;
+    default:
+        result.as.s = nan_pointer(v);
+        break;
+    }
+    return result;
+}
+
+// ---------------- 运算 ----------------
+
+// 覆盖 TokenType 中的全部运算符: + - * / < > <= >= ==
+// 两边都是小整数或都是浮点数时直接计算, 其余转换为 Value 交给 value.c, 结果与其他执行方式一致
+
+static inline NanValue nan_add(NanValue a, NanValue b)
+{
+    if (nan_is_small_int(a) && nan_is_small_int(b))
+        return nan_int(nan_as_small_int(a) + nan_as_small_int(b));
+    if (nan_is_float(a) && nan_is_float(b))
+        return nan_float(nan_as_float(a) + nan_as_float(b));
+    return nan_from_value(value_add(nan_to_value(a), nan_to_value(b)));
+}
+
+static inline NanValue nan_sub(NanValue a, NanValue b)
+{
+    if (nan_is_small_int(a) && nan_is_small_int(b))
+        return nan_int(nan_as_small_int(a) - nan_as_small_int(b));
+    if (nan_is_float(a) && nan_is_float(b))
+        return nan_float(nan_as_float(a) - nan_as_float(b));
+    return nan_from_value(value_sub(nan_to_value(a), nan_to_value(b)));
+}
+
+// 乘积可能超出 64 位, 与 value_mul 一样按无符号数回绕
+static inline NanValue nan_mul(NanValue a, NanValue b)
+{
+    if (nan_is_small_int(a) && nan_is_small_int(b))
+        return nan_int((long long)((unsigned long long)nan_as_small_int(a) * (unsigned long long)nan_as_small_int(b)));
+    if (nan_is_float(a) && nan_is_float(b))
+        return nan_float(nan_as_float(a) * nan_as_float(b));
+    return nan_from_value(value_mul(nan_to_value(a), nan_to_value(b)));
+}
+
+// 整数除法的除零和 -1 由 value_div 处理
+static inline NanValue nan_div(NanValue a, NanValue b)
+{
+    if (nan_is_small_int(a) && nan_is_small_int(b) && nan_as_small_int(b) > 0)
+        return nan_int(nan_as_small_int(a) / nan_as_small_int(b));
+    if (nan_is_float(a) && nan_is_float(b))
+        return nan_float(nan_as_float(a) / nan_as_float(b));
+    return nan_from_value(value_div(nan_to_value(a), nan_to_value(b)));
+}
+
+// 比较结果是整数 0 / 1; 小整数的编码保持有符号顺序, 但标签在高位, 仍需先解码
+static inline NanValue nan_lt(NanValue a, NanValue b)
+{
+    if (nan_is_small_int(a) && nan_is_small_int(b))
+        return nan_int(nan_as_small_int(a) < nan_as_small_int(b));
+    if (nan_is_float(a) && nan_is_float(b))
+        return nan_int(nan_as_float(a) < nan_as_float(b));
+    return nan_from_value(value_lt(nan_to_value(a), nan_to_value(b)));
+}
+
+static inline NanValue nan_gt(NanValue a, NanValue b)
+{
+    if (nan_is_small_int(a) && nan_is_small_int(b))
+        return nan_int(nan_as_small_int(a) > nan_as_small_int(b));
+    if (nan_is_float(a) && nan_is_float(b))
+        return nan_int(nan_as_float(a) > nan_as_float(b));
+    return nan_from_value(value_gt(nan_to_value(a), nan_to_value(b)));
+}
+
+static inline NanValue nan_le(NanValue a, NanValue b)
+{
+    if (nan_is_small_int(a) && nan_is_small_int(b))
+        return nan_int(nan_as_small_int(a) <= nan_as_small_int(b));
+    if (nan_is_float(a) && nan_is_float(b))
+        return nan_int(nan_as_float(a) <= nan_as_float(b));
+    return nan_from_value(value_le(nan_to_value(a), nan_to_value(b)));
+}
+
+static inline NanValue nan_ge(NanValue a, NanValue b)
+{
+    if (nan_is_small_int(a) && nan_is_small_int(b))
+        return nan_int(nan_as_small_int(a) >= nan_as_small_int(b));
+    if (nan_is_float(a) && nan_is_float(b))
+        return nan_int(nan_as_float(a) >= nan_as_float(b));
+    return nan_from_value(value_ge(nan_to_value(a), nan_to_value(b)));
+}
+
+// 两个小整数的编码相同当且仅当值相同
+static inline NanValue nan_eq(NanValue a, NanValue b)
+{
+    if (nan_is_small_int(a) && nan_is_small_int(b))
+        return nan_int(a == b);
+    if (nan_is_float(a) && nan_is_float(b))
+        return nan_int(nan_as_float(a) == nan_as_float(b));
+    return nan_from_value(value_eq(nan_to_value(a), nan_to_value(b)));
+}
+
+static inline int nan_truthy(NanValue v)
+{
+    if (nan_is_small_int(v))
+        return (v & NAN_PAYLOAD) != 0;
+    if (nan_is_float(v))
+        return nan_as_float(v) != 0;
+    return value_truthy(nan_to_value(v));
+}
+
+void nan_print(FILE *out, NanValue v)
+{
+    value_print(out, nan_to_value(v));
+}
+
+// 打印编码: 浮点数和小整数是完整的 64 位, 指向堆的值只打印标签, 地址每次运行都不同
+void nan_print_encoding(FILE *out, NanValue v)
+{
+    if (nan_is_float(v) || nan_is_small_int(v) || v == NAN_NIL)
+        fprintf(out, "%016llx", (unsigned long long)v);
+    else
+        fprintf(out, "%04llx............", (unsigned long long)(nan_tag(v) >> 48));
+}
+
+// ---------------- 微基准 ----------------
+
+// 同一组运算分别在 Value 数组和 NanValue 数组上执行, 比较耗时; 两种表示的结果必须相同
+// 结果写到 out, 耗时写到 timing (每次运行都不同, 不放在输出文件中)
+#define NAN_BENCH_LENGTH (1 << 22)
+#define NAN_BENCH_ROUNDS 8
+
+double nan_bench_seconds(clock_t start)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+void nan_bench_report(FILE *out, FILE *timing, const char *name, double tagged, double boxed, int same)
+{
+    fprintf(out, "%-14s %s\n", name, same ? "same result" : "MISMATCH");
+    fprintf(timing, "%-14s value.c %8.3f ms   nanbox %8.3f ms   %.2fx\n", name, tagged * 1000, boxed * 1000,
+            boxed > 0 ? tagged / boxed : 0.0);
+}
+
+void nan_benchmark(FILE *out, FILE *timing)
+{
+    int n = NAN_BENCH_LENGTH;
+    Value *tagged = malloc(sizeof(Value) * n);
+    NanValue *boxed = malloc(sizeof(NanValue) * n);
+    clock_t start;
+    double t1, t2;
+
+    fprintf(out, "sizeof(Value) = %d, sizeof(NanValue) = %d\n", (int)sizeof(Value), (int)sizeof(NanValue));
+    fprintf(out, "array of %d values: %d MB vs %d MB\n\n", n, (int)(sizeof(Value) * n >> 20),
+            (int)(sizeof(NanValue) * n >> 20));
+
+    // 整数求和
+    for (int i = 0; i < n; i++)
+    {
+        tagged[i] = value_int(i % 1000);
+        boxed[i] = nan_int(i % 1000);
+    }
+    Value sum = value_int(0);
+    start = clock();
+    for (int r = 0; r < NAN_BENCH_ROUNDS; r++)
+        for (int i = 0; i < n; i++)
+            sum = value_add(sum, tagged[i]);
+    t1 = nan_bench_seconds(start);
+    NanValue nsum = nan_int(0);
+    start = clock();
+    for (int r = 0; r < NAN_BENCH_ROUNDS; r++)
+        for (int i = 0; i < n; i++)
+            nsum = nan_add(nsum, boxed[i]);
+    t2 = nan_bench_seconds(start);
+    nan_bench_report(out, timing, "int sum", t1, t2, value_equals(sum, nan_to_value(nsum)));
+
+    // 整数比较计数
+    Value count = value_int(0);
+    Value pivot = value_int(500);
+    start = clock();
+    for (int r = 0; r < NAN_BENCH_ROUNDS; r++)
+        for (int i = 0; i < n; i++)
+            if (value_truthy(value_lt(tagged[i], pivot)))
+                count = value_add(count, value_int(1));
+    t1 = nan_bench_seconds(start);
+    NanValue ncount = nan_int(0);
+    NanValue npivot = nan_int(500);
+    start = clock();
+    for (int r = 0; r < NAN_BENCH_ROUNDS; r++)
+        for (int i = 0; i < n; i++)
+            if (nan_truthy(nan_lt(boxed[i], npivot)))
+                ncount = nan_add(ncount, nan_int(1));
+    t2 = nan_bench_seconds(start);
+    nan_bench_report(out, timing, "int compare", t1, t2, value_equals(count, nan_to_value(ncount)));
+
+    // 浮点数点积
+    for (int i = 0; i < n; i++)
+    {
+        tagged[i] = value_float((i % 100) * 0.25);
+        boxed[i] = nan_float((i % 100) * 0.25);
+    }
+    Value dot = value_float(0);
+    start = clock();
+    for (int r = 0; r < NAN_BENCH_ROUNDS; r++)
+        for (int i = 0; i < n; i++)
+            dot = value_add(dot, value_mul(tagged[i], tagged[n - 1 - i]));
+    t1 = nan_bench_seconds(start);
+    NanValue ndot = nan_float(0);
+    start = clock();
+    for (int r = 0; r < NAN_BENCH_ROUNDS; r++)
+        for (int i = 0; i < n; i++)
+            ndot = nan_add(ndot, nan_mul(boxed[i], boxed[n - 1 - i]));
+    t2 = nan_bench_seconds(start);
+    nan_bench_report(out, timing, "float dot", t1, t2, value_equals(dot, nan_to_value(ndot)));
+
+    // 数组复制: 只搬运内存, 差别全部来自值的大小
+    Value *tagged_copy = malloc(sizeof(Value) * n);
+    NanValue *boxed_copy = malloc(sizeof(NanValue) * n);
+    start = clock();
+    for (int r = 0; r < NAN_BENCH_ROUNDS; r++)
+        for (int i = 0; i < n; i++)
+            tagged_copy[i] = tagged[(i + r) & (n - 1)];
+    t1 = nan_bench_seconds(start);
+    start = clock();
+    for (int r = 0; r < NAN_BENCH_ROUNDS; r++)
+        for (int i = 0; i < n; i++)
+            boxed_copy[i] = boxed[(i + r) & (n - 1)];
+    t2 = nan_bench_seconds(start);
+    nan_bench_report(out, timing, "array copy", t1, t2,
+                     value_equals(tagged_copy[n / 2], nan_to_value(boxed_copy[n / 2])));
+
+    fprintf(out, "\n");
+    fprintf(out, "int sum = ");
+    nan_print(out, nsum);
+    fprintf(out, ", count = ");
+    nan_print(out, ncount);
+    fprintf(out, ", dot = ");
+    nan_print(out, ndot);
+    fprintf(out, "\n");
+
+    free(tagged);
+    free(boxed);
+    free(tagged_copy);
+    free(boxed_copy);
+}
+
+// // 测试输入
+// int main()
+// {
+//     freopen("output_nanbox.txt", "w", stdout);
+//
+//     // 编码的边界: 48 位整数, 装箱的大整数, NaN, 负零
+//     long long ints[] = {0, -1, NAN_INT_MAX, NAN_INT_MIN, NAN_INT_MAX + 1, NAN_INT_MIN - 1, 9223372036854775807LL};
+//     for (int i = 0; i < 7; i++)
+//     {
+//         NanValue v = nan_int(ints[i]);
+//         nan_print_encoding(stdout, v);
+//         printf(" ");
+//         nan_print(stdout, v);
+//         printf("\n");
+//     }
+//     double floats[] = {0.0, -0.0, 1.5, 0.0 / 0.0, -1.0 / 0.0};
+//     for (int i = 0; i < 5; i++)
+//     {
+//         NanValue v = nan_float(floats[i]);
+//         nan_print_encoding(stdout, v);
+//         printf(" ");
+//         nan_print(stdout, v);
+//         printf("\n");
+//     }
+//     nan_print(stdout, nan_add(nan_int(NAN_INT_MAX), nan_int(1)));
+//     printf(" ");
+//     nan_print(stdout, nan_add(nan_from_value(value_string("a")), nan_float(2.5)));
+//     printf(" ");
+//     nan_print(stdout, nan_div(nan_int(7), nan_int(0 - 2)));
+//     printf("\n\n");
+//
+//     nan_benchmark(stdout, stderr);
+//
+//     return 0;
+// }
\ No newline at end of file
@@ -0,0 +1,3997 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pseudo.c"
+
+// 字符串到整数的哈希表 (开放寻址)
+typedef struct
+{
+    char **keys;
+    int *values;
+    int capacity;
+    int count;
+} StringMap;
+
+// 基本块
+typedef struct
+{
+    int start; // 第一条指令
+    int end;   // 最后一条指令之后
+    int *succs;
+    int succ_count;
+    int *preds;
+    int pred_count;
+    int idom; // 直接支配者, 入口块为自身, 不可达块为 -1
+    int rpo;  // 逆后序编号
+    int *dom_children;
+    int dom_child_count;
+} BasicBlock;
+
+// 控制流图, 对应 IR 中的一段区间 (一个函数体或全局代码)
+typedef struct
+{
+    int start;
+    int end;
+    BasicBlock *blocks;
+    int block_count;
+    int *order; // 逆后序排列的块
+    int order_count;
+} ControlFlowGraph;
+
+unsigned int hash_string(const char *s)
+{
+    unsigned int h = 2166136261u;
+    while (*s)
+    {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void string_map_init(StringMap *map, int capacity)
+{
+    map->capacity = 16;
+    while (map->capacity < capacity * 2)
+    {
+        map->capacity *= 2;
+    }
+    map->keys = calloc(map->capacity, sizeof(char *));
+    map->values = calloc(map->capacity, sizeof(int));
+    map->count = 0;
+}
+
+void string_map_free(StringMap *map)
+{
+    for (int i = 0; i < map->capacity; i++)
+    {
+        free(map->keys[i]);
+    }
+    free(map->keys);
+    free(map->values);
+}
+
+// 查找 key, 不存在返回 -1
+int string_map_get(StringMap *map, const char *key)
+{
+    unsigned int i = hash_string(key) & (map->capacity - 1);
+    while (map->keys[i] != NULL)
+    {
+        if (strcmp(map->keys[i], key) == 0)
+        {
+            return map->values[i];
+        }
+        i = (i + 1) & (map->capacity - 1);
+    }
+    return -1;
+}
+
+void string_map_put(StringMap *map, const char *key, int value)
+{
+    if ((map->count + 1) * 2 > map->capacity)
+    {
+        StringMap bigger;
+        string_map_init(&bigger, map->capacity);
+        for (int j = 0; j < map->capacity; j++)
+        {
+            if (map->keys[j] != NULL)
+            {
+                string_map_put(&bigger, map->keys[j], map->values[j]);
+            }
+        }
+        string_map_free(map);
+        *map = bigger;
+    }
+
+    unsigned int i = hash_string(key) & (map->capacity - 1);
+    while (map->keys[i] != NULL)
+    {
+        if (strcmp(map->keys[i], key) == 0)
+        {
+            map->values[i] = value;
+            return;
+        }
+        i = (i + 1) & (map->capacity - 1);
+    }
+    map->keys[i] = strdup(key);
+    map->values[i] = value;
+    map->count++;
+}
+
+int ir_is(IRInstruction *ins, const char *op)
+{
+    return strcmp(ins->op, op) == 0;
+}
+
+// 是否是纯算术/比较操作
+int ir_is_binary(const char *op)
+{
+    static const char *ops[] = {"add", "sub", "mul", "div", "gt", "lt", "ge", "le", "eq",
+                                // 类型推断改写出的专用指令
+                                "add_i64", "sub_i64", "mul_i64", "lt_i64", "gt_i64", "le_i64", "ge_i64", "eq_i64",
+                                "add_f64", "sub_f64", "mul_f64", "div_f64", "concat"};
+    for (int i = 0; i < (int)(sizeof(ops) / sizeof(ops[0])); i++)
+    {
+        if (strcmp(op, ops[i]) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 通用的 add 在有一边是字符串时是拼接, 不能交换; 只有证明了是数值的 add_i64 / add_f64 可以交换
+int ir_is_commutative(const char *op)
+{
+    static const char *ops[] = {"mul", "eq", "add_i64", "mul_i64", "eq_i64", "add_f64", "mul_f64"};
+    for (int i = 0; i < (int)(sizeof(ops) / sizeof(ops[0])); i++)
+    {
+        if (strcmp(op, ops[i]) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 数组/键值对读取, unchecked 版本已证明下标不越界
+int ir_is_array_load(const char *op)
+{
+    return strcmp(op, "array_access") == 0 || strcmp(op, "array_access_unchecked") == 0;
+}
+
+// 数组/键值对写入
+int ir_is_heap_store(const char *op)
+{
+    return strcmp(op, "array_store") == 0 || strcmp(op, "array_store_unchecked") == 0 ||
+           strcmp(op, "key_value_pair") == 0;
+}
+
+// 指令中哪些字段是临时变量的使用: 1 = arg1, 2 = arg2, 4 = result
+int ir_use_mask(const char *op)
+{
+    if (ir_is_binary(op) || ir_is_array_load(op) || strcmp(op, "string_append") == 0)
+        return 1 | 2;
+    if (ir_is_heap_store(op))
+        return 1 | 2 | 4;
+    if (strcmp(op, "store") == 0 || strcmp(op, "arg") == 0 || strcmp(op, "if_false") == 0 ||
+        strcmp(op, "return") == 0 || strcmp(op, "move") == 0 || strcmp(op, "array_length") == 0 ||
+        strcmp(op, "spill") == 0 || strcmp(op, "await") == 0 || strcmp(op, "string_builder") == 0)
+        return 1;
+    return 0;
+}
+
+// 指令是否定义 result 临时变量
+int ir_has_def(const char *op)
+{
+    return ir_is_binary(op) || strcmp(op, "load_const") == 0 || strcmp(op, "load") == 0 ||
+           ir_is_array_load(op) || strcmp(op, "new_array") == 0 || strcmp(op, "new_map") == 0 ||
+           strcmp(op, "call_function") == 0 || strcmp(op, "parallel_for") == 0 || strcmp(op, "spawn") == 0 ||
+           strcmp(op, "parallel_apply") == 0 || strcmp(op, "await") == 0 || strcmp(op, "move") == 0 || strcmp(op, "array_length") == 0 ||
+           strcmp(op, "phi") == 0 || strcmp(op, "reload") == 0 || strcmp(op, "string_builder") == 0 ||
+           strcmp(op, "string_append") == 0;
+}
+
+// 区间 [start, end) 中只由一条 load_const 定义为字符串常量的临时变量 -> 该指令的位置, 其他定义记为 -2
+// 后端把以这些临时变量为键的下标访问编译为带内联缓存的字段访问
+void string_constant_temps(StringMap *keys, int start, int end)
+{
+    string_map_init(keys, 16);
+    for (int i = start; i < end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (!ir_has_def(ins->op) || !is_temp(ins->result))
+            continue;
+        if (ir_is(ins, "load_const") && ins->arg1[0] == '"' && string_map_get(keys, ins->result) == -1)
+            string_map_put(keys, ins->result, i);
+        else
+            string_map_put(keys, ins->result, -2);
+    }
+}
+
+// 是否结束基本块
+int ir_is_branch(IRInstruction *ins)
+{
+    return ir_is(ins, "goto") || ir_is(ins, "if_false") || ir_is(ins, "return") || ir_is(ins, "tail_call");
+}
+
+// 是否离开函数 (没有后继块)
+int ir_is_exit(IRInstruction *ins)
+{
+    return ir_is(ins, "return") || ir_is(ins, "tail_call");
+}
+
+// 调用: call_function, 多次调用循环体函数 arg1 的 parallel_for (见 pseudo.c 的并行循环),
+// 对数组的每个元素调用函数 arg1 的 parallel_apply (pmap / pfilter / preduce),
+// 创建执行函数 arg1 的任务的 spawn, 以及等待期间其他任务可能执行任意代码的 await (见 task.c)
+int ir_is_call(IRInstruction *ins)
+{
+    return ir_is(ins, "call_function") || ir_is(ins, "parallel_for") || ir_is(ins, "parallel_apply") ||
+           ir_is(ins, "spawn") || ir_is(ins, "await");
+}
+
+// 是否是不会修改变量和数组的内置函数
+int is_pure_builtin(const char *name)
+{
+    return strcmp(name, "print") == 0 || strcmp(name, "read") == 0;
+}
+
+void ir_set(IRInstruction *ins, const char *op, const char *arg1, const char *arg2, const char *result)
+{
+    ins->op = strdup(op);
+    ins->arg1 = arg1 ? strdup(arg1) : NULL;
+    ins->arg2 = arg2 ? strdup(arg2) : NULL;
+    ins->result = result ? strdup(result) : NULL;
+}
+
+void ir_make_nop(IRInstruction *ins)
+{
+    ir_set(ins, "nop", NULL, NULL, NULL);
+}
+
+// 删除 nop 指令
+void ir_remove_nops()
+{
+    int count = 0;
+    for (int i = 0; i < ir_count; i++)
+    {
+        if (!ir_is(&ir_code[i], "nop"))
+        {
+            ir_code[count++] = ir_code[i];
+        }
+    }
+    ir_count = count;
+}
+
+// 查找函数结尾 end_function 的位置
+int find_function_end(int start)
+{
+    for (int i = start + 1; i < ir_count; i++)
+    {
+        if (ir_is(&ir_code[i], "end_function"))
+        {
+            return i;
+        }
+    }
+    return ir_count;
+}
+
+void add_edge(ControlFlowGraph *cfg, int from, int to)
+{
+    BasicBlock *a = &cfg->blocks[from];
+    BasicBlock *b = &cfg->blocks[to];
+    for (int i = 0; i < a->succ_count; i++)
+    {
+        if (a->succs[i] == to)
+            return;
+    }
+    a->succs = realloc(a->succs, sizeof(int) * (a->succ_count + 1));
+    a->succs[a->succ_count++] = to;
+    b->preds = realloc(b->preds, sizeof(int) * (b->pred_count + 1));
+    b->preds[b->pred_count++] = from;
+}
+
+int cfg_block_of_label(ControlFlowGraph *cfg, const char *label)
+{
+    for (int b = 0; b < cfg->block_count; b++)
+    {
+        IRInstruction *first = &ir_code[cfg->blocks[b].start];
+        if (ir_is(first, "label") && strcmp(first->arg1, label) == 0)
+        {
+            return b;
+        }
+    }
+    return -1;
+}
+
+void cfg_postorder(ControlFlowGraph *cfg, int b, int *visited, int *post, int *post_count)
+{
+    visited[b] = 1;
+    for (int i = 0; i < cfg->blocks[b].succ_count; i++)
+    {
+        int s = cfg->blocks[b].succs[i];
+        if (!visited[s])
+        {
+            cfg_postorder(cfg, s, visited, post, post_count);
+        }
+    }
+    post[(*post_count)++] = b;
+}
+
+int dominator_intersect(ControlFlowGraph *cfg, int a, int b)
+{
+    while (a != b)
+    {
+        while (cfg->blocks[a].rpo > cfg->blocks[b].rpo)
+            a = cfg->blocks[a].idom;
+        while (cfg->blocks[b].rpo > cfg->blocks[a].rpo)
+            b = cfg->blocks[b].idom;
+    }
+    return a;
+}
+
+// 计算支配树 (Cooper-Harvey-Kennedy 迭代算法)
+void compute_dominators(ControlFlowGraph *cfg)
+{
+    int *visited = calloc(cfg->block_count, sizeof(int));
+    int *post = malloc(sizeof(int) * cfg->block_count);
+    int post_count = 0;
+
+    cfg_postorder(cfg, 0, visited, post, &post_count);
+
+    cfg->order = malloc(sizeof(int) * post_count);
+    cfg->order_count = post_count;
+    for (int i = 0; i < post_count; i++)
+    {
+        cfg->order[i] = post[post_count - 1 - i];
+        cfg->blocks[cfg->order[i]].rpo = i;
+    }
+
+    for (int b = 0; b < cfg->block_count; b++)
+    {
+        cfg->blocks[b].idom = -1;
+    }
+    cfg->blocks[0].idom = 0;
+
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        for (int i = 1; i < cfg->order_count; i++)
+        {
+            BasicBlock *block = &cfg->blocks[cfg->order[i]];
+            int new_idom = -1;
+            for (int p = 0; p < block->pred_count; p++)
+            {
+                int pred = block->preds[p];
+                if (cfg->blocks[pred].idom == -1)
+                    continue;
+                new_idom = new_idom == -1 ? pred : dominator_intersect(cfg, pred, new_idom);
+            }
+            if (new_idom != block->idom)
+            {
+                block->idom = new_idom;
+                changed = 1;
+            }
+        }
+    }
+
+    for (int i = 1; i < cfg->order_count; i++)
+    {
+        int b = cfg->order[i];
+        BasicBlock *parent = &cfg->blocks[cfg->blocks[b].idom];
+        parent->dom_children = realloc(parent->dom_children, sizeof(int) * (parent->dom_child_count + 1));
+        parent->dom_children[parent->dom_child_count++] = b;
+    }
+
+    free(visited);
+    free(post);
+}
+
+// a 是否支配 b
+int dominates(ControlFlowGraph *cfg, int a, int b)
+{
+    if (cfg->blocks[b].idom == -1)
+        return 0;
+    while (b != a && b != 0)
+    {
+        b = cfg->blocks[b].idom;
+    }
+    return a == b;
+}
+
+// 为 [start, end) 区间建立控制流图
+ControlFlowGraph *build_cfg(int start, int end)
+{
+    ControlFlowGraph *cfg = calloc(1, sizeof(ControlFlowGraph));
+    cfg->start = start;
+    cfg->end = end;
+
+    // 划分基本块: 区间起点, 标签, 跳转之后的指令
+    int *leader = calloc(end - start + 1, sizeof(int));
+    leader[0] = 1;
+    for (int i = start; i < end; i++)
+    {
+        if (ir_is(&ir_code[i], "label"))
+            leader[i - start] = 1;
+        if (ir_is_branch(&ir_code[i]) && i + 1 < end)
+            leader[i + 1 - start] = 1;
+    }
+
+    for (int i = start; i < end; i++)
+    {
+        if (leader[i - start])
+            cfg->block_count++;
+    }
+    if (cfg->block_count == 0)
+        cfg->block_count = 1;
+    cfg->blocks = calloc(cfg->block_count, sizeof(BasicBlock));
+
+    int b = -1;
+    for (int i = start; i < end; i++)
+    {
+        if (leader[i - start])
+        {
+            b++;
+            cfg->blocks[b].start = i;
+        }
+        cfg->blocks[b].end = i + 1;
+    }
+    if (b == -1)
+    {
+        cfg->blocks[0].start = start;
+        cfg->blocks[0].end = end;
+    }
+    free(leader);
+
+    for (b = 0; b < cfg->block_count; b++)
+    {
+        BasicBlock *block = &cfg->blocks[b];
+        IRInstruction *last = block->end > block->start ? &ir_code[block->end - 1] : NULL;
+
+        if (last != NULL && ir_is(last, "goto"))
+        {
+            int target = cfg_block_of_label(cfg, last->arg1);
+            if (target >= 0)
+                add_edge(cfg, b, target);
+        }
+        else if (last != NULL && ir_is(last, "if_false"))
+        {
+            int target = cfg_block_of_label(cfg, last->arg2);
+            if (target >= 0)
+                add_edge(cfg, b, target);
+            if (b + 1 < cfg->block_count)
+                add_edge(cfg, b, b + 1);
+        }
+        else if (last == NULL || !ir_is_exit(last))
+        {
+            if (b + 1 < cfg->block_count)
+                add_edge(cfg, b, b + 1);
+        }
+    }
+
+    compute_dominators(cfg);
+    return cfg;
+}
+
+void free_cfg(ControlFlowGraph *cfg)
+{
+    for (int b = 0; b < cfg->block_count; b++)
+    {
+        free(cfg->blocks[b].succs);
+        free(cfg->blocks[b].preds);
+        free(cfg->blocks[b].dom_children);
+    }
+    free(cfg->blocks);
+    free(cfg->order);
+    free(cfg);
+}
+
+// 临时变量的编号
+int temp_index(const char *name)
+{
+    return atoi(name + 1);
+}
+
+// 用替换表重写指令中对临时变量的使用
+void rewrite_uses(IRInstruction *ins, char **replacement)
+{
+    int mask = ir_use_mask(ins->op);
+    char **fields[3] = {&ins->arg1, &ins->arg2, &ins->result};
+    for (int f = 0; f < 3; f++)
+    {
+        char **field = fields[f];
+        if ((mask & (1 << f)) && is_temp(*field) && replacement[temp_index(*field)] != NULL)
+        {
+            *field = replacement[temp_index(*field)];
+        }
+    }
+}
+
+// ---------------- 全局值编号 (GVN) ----------------
+
+// 带作用域的值表, 沿支配树进入子树时压栈, 退出时弹出
+typedef struct
+{
+    char *key;
+    char *temp;
+    int next; // 同一个桶里的上一个表项
+} ValueEntry;
+
+typedef struct
+{
+    ValueEntry *entries;
+    int count;
+    int capacity;
+    int *buckets;
+    int bucket_count;
+} ValueTable;
+
+typedef struct
+{
+    ControlFlowGraph *cfg;
+    ValueTable table;
+    char **replacement; // 冗余临时变量 -> 等价的先前临时变量
+    StringMap vars;     // 变量名 -> 编号
+    int var_count;
+    int *versions;      // 每个变量当前的内存版本, 最后一个槽位是数组/键值对堆
+    int *global;        // 是否是全局变量
+    int next_version;
+    int removed;
+} GVNState;
+
+char *value_table_lookup(ValueTable *table, const char *key)
+{
+    int i = table->buckets[hash_string(key) & (table->bucket_count - 1)];
+    while (i >= 0)
+    {
+        if (strcmp(table->entries[i].key, key) == 0)
+            return table->entries[i].temp;
+        i = table->entries[i].next;
+    }
+    return NULL;
+}
+
+void value_table_insert(ValueTable *table, const char *key, char *temp)
+{
+    if (table->count >= table->capacity)
+    {
+        table->capacity = table->capacity == 0 ? 64 : table->capacity * 2;
+        table->entries = realloc(table->entries, sizeof(ValueEntry) * table->capacity);
+    }
+    int bucket = hash_string(key) & (table->bucket_count - 1);
+    table->entries[table->count].key = strdup(key);
+    table->entries[table->count].temp = temp;
+    table->entries[table->count].next = table->buckets[bucket];
+    table->buckets[bucket] = table->count;
+    table->count++;
+}
+
+// 弹出到 mark 为止的表项
+void value_table_pop(ValueTable *table, int mark)
+{
+    while (table->count > mark)
+    {
+        ValueEntry *entry = &table->entries[--table->count];
+        table->buckets[hash_string(entry->key) & (table->bucket_count - 1)] = entry->next;
+        free(entry->key);
+    }
+}
+
+int gvn_var(GVNState *state, const char *name)
+{
+    return string_map_get(&state->vars, name);
+}
+
+// 修改变量后给它一个新的内存版本
+void gvn_clobber(GVNState *state, int var)
+{
+    state->versions[var] = ++state->next_version;
+}
+
+// 标记从 b 的直接支配者出口到 b 入口之间会执行的块中修改的变量
+void gvn_clobber_paths(GVNState *state, int b)
+{
+    ControlFlowGraph *cfg = state->cfg;
+    int idom = cfg->blocks[b].idom;
+    int heap = state->var_count;
+    int *seen = calloc(cfg->block_count, sizeof(int));
+    int *stack = malloc(sizeof(int) * cfg->block_count);
+    int *kill = calloc(state->var_count + 1, sizeof(int));
+    int top = 0;
+
+    for (int p = 0; p < cfg->blocks[b].pred_count; p++)
+    {
+        int pred = cfg->blocks[b].preds[p];
+        if (pred != idom && !seen[pred] && cfg->blocks[pred].idom != -1)
+        {
+            seen[pred] = 1;
+            stack[top++] = pred;
+        }
+    }
+    while (top > 0)
+    {
+        int x = stack[--top];
+        for (int i = cfg->blocks[x].start; i < cfg->blocks[x].end; i++)
+        {
+            IRInstruction *ins = &ir_code[i];
+            if (ir_is(ins, "store"))
+            {
+                kill[gvn_var(state, ins->result)] = 1;
+            }
+            else if (ir_is_heap_store(ins->op))
+            {
+                kill[heap] = 1;
+            }
+            else if (ir_is_call(ins) && !is_pure_builtin(ins->arg1))
+            {
+                kill[heap] = 1;
+                for (int v = 0; v < state->var_count; v++)
+                {
+                    if (state->global[v])
+                        kill[v] = 1;
+                }
+            }
+        }
+        for (int p = 0; p < cfg->blocks[x].pred_count; p++)
+        {
+            int pred = cfg->blocks[x].preds[p];
+            if (pred != idom && !seen[pred] && cfg->blocks[pred].idom != -1)
+            {
+                seen[pred] = 1;
+                stack[top++] = pred;
+            }
+        }
+    }
+
+    for (int v = 0; v <= state->var_count; v++)
+    {
+        if (kill[v])
+            gvn_clobber(state, v);
+    }
+    free(seen);
+    free(stack);
+    free(kill);
+}
+
+void gvn_block(GVNState *state, int b)
+{
+    BasicBlock *block = &state->cfg->blocks[b];
+    int mark = state->table.count;
+    int heap = state->var_count;
+    int *saved = malloc(sizeof(int) * (state->var_count + 1));
+    memcpy(saved, state->versions, sizeof(int) * (state->var_count + 1));
+
+    // 汇合点与循环头: 从支配者出口到这里的路径上可能修改过的变量换成新版本
+    gvn_clobber_paths(state, b);
+
+    for (int i = block->start; i < block->end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        char key[1024];
+        key[0] = '\0';
+
+        rewrite_uses(ins, state->replacement);
+
+        if (ir_is(ins, "load_const"))
+        {
+            snprintf(key, sizeof(key), "const|%s", ins->arg1);
+        }
+        else if (ir_is_binary(ins->op))
+        {
+            const char *a = ins->arg1;
+            const char *c = ins->arg2;
+            if (ir_is_commutative(ins->op) && strcmp(a, c) > 0)
+            {
+                a = ins->arg2;
+                c = ins->arg1;
+            }
+            snprintf(key, sizeof(key), "%s|%s|%s", ins->op, a, c);
+        }
+        else if (ir_is(ins, "load"))
+        {
+            int v = gvn_var(state, ins->arg1);
+            snprintf(key, sizeof(key), "load|%s|%d", ins->arg1, state->versions[v]);
+        }
+        else if (ir_is_array_load(ins->op))
+        {
+            snprintf(key, sizeof(key), "array_access|%s|%s|%d", ins->arg1, ins->arg2, state->versions[heap]);
+        }
+        else if (ir_is(ins, "store"))
+        {
+            // 存储后的读取直接使用存入的值
+            int v = gvn_var(state, ins->result);
+            gvn_clobber(state, v);
+            snprintf(key, sizeof(key), "load|%s|%d", ins->result, state->versions[v]);
+            value_table_insert(&state->table, key, ins->arg1);
+            continue;
+        }
+        else if (ir_is_heap_store(ins->op))
+        {
+            gvn_clobber(state, heap);
+        }
+        else if (ir_is_call(ins) && !is_pure_builtin(ins->arg1))
+        {
+            gvn_clobber(state, heap);
+            for (int v = 0; v < state->var_count; v++)
+            {
+                if (state->global[v])
+                    gvn_clobber(state, v);
+            }
+        }
+
+        if (key[0] == '\0')
+            continue;
+
+        char *existing = value_table_lookup(&state->table, key);
+        if (existing != NULL)
+        {
+            state->replacement[temp_index(ins->result)] = existing;
+            ir_make_nop(ins);
+            state->removed++;
+        }
+        else
+        {
+            value_table_insert(&state->table, key, ins->result);
+        }
+    }
+
+    for (int c = 0; c < block->dom_child_count; c++)
+    {
+        gvn_block(state, block->dom_children[c]);
+    }
+
+    value_table_pop(&state->table, mark);
+    memcpy(state->versions, saved, sizeof(int) * (state->var_count + 1));
+    free(saved);
+}
+
+// 对 [start, end) 区间做全局值编号, 返回删除的指令数
+int gvn_range(int start, int end)
+{
+    GVNState state;
+    memset(&state, 0, sizeof(state));
+
+    // 收集变量
+    string_map_init(&state.vars, 16);
+    for (int i = start; i < end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        const char *name = ir_is(ins, "load") ? ins->arg1 : ir_is(ins, "store") ? ins->result : NULL;
+        if (name != NULL && string_map_get(&state.vars, name) < 0)
+            string_map_put(&state.vars, name, state.var_count++);
+    }
+
+    state.versions = calloc(state.var_count + 1, sizeof(int));
+    state.global = calloc(state.var_count + 1, sizeof(int));
+    for (int i = 0; i < state.vars.capacity; i++)
+    {
+        if (state.vars.keys[i] != NULL)
+            state.global[state.vars.values[i]] = is_global_var(state.vars.keys[i]);
+    }
+
+    state.table.bucket_count = 256;
+    state.table.buckets = malloc(sizeof(int) * state.table.bucket_count);
+    for (int i = 0; i < state.table.bucket_count; i++)
+        state.table.buckets[i] = -1;
+    state.replacement = calloc(temp_counter + 1, sizeof(char *));
+
+    state.cfg = build_cfg(start, end);
+    gvn_block(&state, 0);
+
+    // 不可达块中的使用也一并改写
+    for (int i = start; i < end; i++)
+    {
+        rewrite_uses(&ir_code[i], state.replacement);
+    }
+
+    free_cfg(state.cfg);
+    value_table_pop(&state.table, 0);
+    free(state.table.entries);
+    free(state.table.buckets);
+    free(state.replacement);
+    free(state.versions);
+    free(state.global);
+    string_map_free(&state.vars);
+    return state.removed;
+}
+
+// 对每个函数和全局代码运行 pass, 返回 pass 结果之和
+// pass 可以插入指令, 每次都重新定位区间
+int for_each_function(int (*pass)(int start, int end))
+{
+    int total = 0;
+    int i = 0;
+    while (i < ir_count)
+    {
+        if (ir_is(&ir_code[i], "function"))
+        {
+            total += pass(i + 1, find_function_end(i));
+            i = find_function_end(i) + 1;
+        }
+        else
+        {
+            int end = i;
+            while (end < ir_count && !ir_is(&ir_code[end], "function"))
+                end++;
+            total += pass(i, end);
+            while (i < ir_count && !ir_is(&ir_code[i], "function"))
+                i++;
+        }
+    }
+    return total;
+}
+
+int global_value_numbering()
+{
+    int removed = for_each_function(gvn_range);
+    ir_remove_nops();
+    return removed;
+}
+
+// ---------------- 循环优化 ----------------
+
+// 自然循环
+typedef struct
+{
+    int header;     // 循环头块
+    int latch;      // 回边的来源块
+    int *in_loop;   // 块是否属于循环
+    int size;       // 循环包含的块数
+    int preheader;  // 唯一的循环外前驱, 顺序落入循环头; 没有则为 -1
+    int insert_at;  // 前置块中可插入指令的位置
+} NaturalLoop;
+
+// 在 pos 处插入 n 条指令
+void ir_insert(int pos, IRInstruction *list, int n)
+{
+    if (n <= 0)
+        return;
+    while (ir_count + n > ir_capacity)
+    {
+        ir_capacity = ir_capacity == 0 ? 64 : ir_capacity * 2;
+        ir_code = realloc(ir_code, sizeof(IRInstruction) * ir_capacity);
+    }
+    memmove(&ir_code[pos + n], &ir_code[pos], sizeof(IRInstruction) * (ir_count - pos));
+    memcpy(&ir_code[pos], list, sizeof(IRInstruction) * n);
+    ir_count += n;
+}
+
+// 追加一条指令到临时列表
+void ir_list_append(IRInstruction **list, int *count, const char *op, const char *arg1, const char *arg2, const char *result)
+{
+    *list = realloc(*list, sizeof(IRInstruction) * (*count + 1));
+    ir_set(&(*list)[*count], op, arg1, arg2, result);
+    (*count)++;
+}
+
+// 找出所有自然循环, 按循环大小从内到外排列
+NaturalLoop *find_loops(ControlFlowGraph *cfg, int *loop_count)
+{
+    NaturalLoop *loops = NULL;
+    *loop_count = 0;
+
+    for (int b = 0; b < cfg->block_count; b++)
+    {
+        BasicBlock *block = &cfg->blocks[b];
+        for (int s = 0; s < block->succ_count; s++)
+        {
+            int h = block->succs[s];
+            if (!dominates(cfg, h, b))
+                continue;
+
+            // 回边 b -> h, 从 b 反向搜索到 h 得到循环体
+            NaturalLoop loop;
+            loop.header = h;
+            loop.latch = b;
+            loop.in_loop = calloc(cfg->block_count, sizeof(int));
+            loop.in_loop[h] = 1;
+            loop.size = 1;
+            int *stack = malloc(sizeof(int) * cfg->block_count);
+            int top = 0;
+            if (!loop.in_loop[b])
+            {
+                loop.in_loop[b] = 1;
+                loop.size++;
+                stack[top++] = b;
+            }
+            while (top > 0)
+            {
+                int x = stack[--top];
+                for (int p = 0; p < cfg->blocks[x].pred_count; p++)
+                {
+                    int pred = cfg->blocks[x].preds[p];
+                    if (!loop.in_loop[pred] && cfg->blocks[pred].idom != -1)
+                    {
+                        loop.in_loop[pred] = 1;
+                        loop.size++;
+                        stack[top++] = pred;
+                    }
+                }
+            }
+            free(stack);
+
+            // 前置块: 循环头唯一的循环外前驱, 且在代码中紧挨着循环头
+            loop.preheader = -1;
+            loop.insert_at = -1;
+            int outside = 0;
+            int candidate = -1;
+            for (int p = 0; p < cfg->blocks[h].pred_count; p++)
+            {
+                if (!loop.in_loop[cfg->blocks[h].preds[p]])
+                {
+                    outside++;
+                    candidate = cfg->blocks[h].preds[p];
+                }
+            }
+            if (outside == 1 && candidate == h - 1)
+            {
+                BasicBlock *pre = &cfg->blocks[candidate];
+                IRInstruction *last = &ir_code[pre->end - 1];
+                loop.preheader = candidate;
+                loop.insert_at = ir_is_branch(last) ? pre->end - 1 : pre->end;
+            }
+
+            loops = realloc(loops, sizeof(NaturalLoop) * (*loop_count + 1));
+            loops[(*loop_count)++] = loop;
+        }
+    }
+
+    for (int i = 1; i < *loop_count; i++)
+    {
+        NaturalLoop key = loops[i];
+        int j = i - 1;
+        while (j >= 0 && loops[j].size > key.size)
+        {
+            loops[j + 1] = loops[j];
+            j--;
+        }
+        loops[j + 1] = key;
+    }
+    return loops;
+}
+
+void free_loops(NaturalLoop *loops, int loop_count)
+{
+    for (int i = 0; i < loop_count; i++)
+        free(loops[i].in_loop);
+    free(loops);
+}
+
+// 每条指令所在的基本块
+int *instruction_blocks(ControlFlowGraph *cfg)
+{
+    int *block_of = malloc(sizeof(int) * (cfg->end - cfg->start + 1));
+    for (int b = 0; b < cfg->block_count; b++)
+    {
+        for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++)
+            block_of[i - cfg->start] = b;
+    }
+    return block_of;
+}
+
+// 每个临时变量的定义位置, 区间外定义的为 -1
+int *temp_definitions(int start, int end)
+{
+    int *def_at = malloc(sizeof(int) * (temp_counter + 1));
+    for (int t = 0; t <= temp_counter; t++)
+        def_at[t] = -1;
+    for (int i = start; i < end; i++)
+    {
+        if (ir_has_def(ir_code[i].op) && is_temp(ir_code[i].result))
+            def_at[temp_index(ir_code[i].result)] = i;
+    }
+    return def_at;
+}
+
+// 循环中是否存储变量 name
+int loop_stores_var(ControlFlowGraph *cfg, NaturalLoop *loop, const char *name)
+{
+    for (int b = 0; b < cfg->block_count; b++)
+    {
+        if (!loop->in_loop[b])
+            continue;
+        for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++)
+        {
+            if (ir_is(&ir_code[i], "store") && strcmp(ir_code[i].result, name) == 0)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+// 循环中是否调用用户函数
+int loop_has_call(ControlFlowGraph *cfg, NaturalLoop *loop)
+{
+    for (int b = 0; b < cfg->block_count; b++)
+    {
+        if (!loop->in_loop[b])
+            continue;
+        for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++)
+        {
+            if (ir_is_call(&ir_code[i]) && !is_pure_builtin(ir_code[i].arg1))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+// 定义 temp 的指令是否是 op, 是则返回该指令
+IRInstruction *defined_by(int *def_at, const char *temp, const char *op)
+{
+    if (!is_temp(temp) || def_at[temp_index(temp)] < 0)
+        return NULL;
+    IRInstruction *ins = &ir_code[def_at[temp_index(temp)]];
+    return ir_is(ins, op) ? ins : NULL;
+}
+
+// 整数常量
+int is_int_constant(IRInstruction *ins)
+{
+    if (ins == NULL || !ir_is(ins, "load_const"))
+        return 0;
+    const char *p = ins->arg1[0] == '-' ? ins->arg1 + 1 : ins->arg1;
+    return is_digit(p[0]) && strspn(p, "0123456789") == strlen(p);
+}
+
+// 数值常量 (整数或浮点数)
+int is_number_constant(IRInstruction *ins)
+{
+    if (ins == NULL || !ir_is(ins, "load_const"))
+        return 0;
+    const char *p = ins->arg1[0] == '-' ? ins->arg1 + 1 : ins->arg1;
+    return is_digit(p[0]) && strspn(p, "0123456789.") == strlen(p);
+}
+
+int strength_reduction_counter = 0;
+
+// 对一个循环做强度削弱, 返回处理的乘法数
+int reduce_loop(ControlFlowGraph *cfg, NaturalLoop *loop, int start, int end)
+{
+    int *def_at = temp_definitions(start, end);
+    int *block_of = instruction_blocks(cfg);
+    int reduced = 0;
+
+    // 插入列表: 位置和指令, 最后从后往前插入
+    int *insert_pos = NULL;
+    IRInstruction **insert_list = NULL;
+    int *insert_len = NULL;
+    int insert_count = 0;
+
+    for (int i = start; i < end && loop->preheader >= 0; i++)
+    {
+        IRInstruction *mul = &ir_code[i];
+        if (!loop->in_loop[block_of[i - start]] || !ir_is(mul, "mul"))
+            continue;
+
+        // mul (load i) c
+        IRInstruction *load = defined_by(def_at, mul->arg1, "load");
+        IRInstruction *constant = defined_by(def_at, mul->arg2, "load_const");
+        if (load == NULL || constant == NULL)
+        {
+            load = defined_by(def_at, mul->arg2, "load");
+            constant = defined_by(def_at, mul->arg1, "load_const");
+        }
+        if (load == NULL || !is_int_constant(constant))
+            continue;
+
+        int load_at = load - ir_code;
+        char *var = load->arg1;
+        if (block_of[load_at - start] != block_of[i - start])
+            continue;
+
+        // 读取与乘法之间不能修改循环变量
+        int safe = 1;
+        int global = is_global_var(var);
+        for (int k = load_at + 1; k < i; k++)
+        {
+            if ((ir_is(&ir_code[k], "store") && strcmp(ir_code[k].result, var) == 0) ||
+                (global && ir_is_call(&ir_code[k]) && !is_pure_builtin(ir_code[k].arg1)))
+                safe = 0;
+        }
+        if (!safe)
+            continue;
+
+        // 循环变量必须是基本归纳变量: 循环中所有存储都是 var = var + k
+        int *steps = NULL;
+        int *step_at = NULL;
+        int step_count = 0;
+        for (int k = start; k < end && safe; k++)
+        {
+            IRInstruction *store = &ir_code[k];
+            if (!loop->in_loop[block_of[k - start]] || !ir_is(store, "store") || strcmp(store->result, var) != 0)
+                continue;
+
+            IRInstruction *add = defined_by(def_at, store->arg1, "add");
+            IRInstruction *base = add ? defined_by(def_at, add->arg1, "load") : NULL;
+            IRInstruction *step = add ? defined_by(def_at, add->arg2, "load_const") : NULL;
+            if (add && (base == NULL || step == NULL))
+            {
+                base = defined_by(def_at, add->arg2, "load");
+                step = defined_by(def_at, add->arg1, "load_const");
+            }
+            if (base == NULL || strcmp(base->arg1, var) != 0 || !is_int_constant(step))
+            {
+                safe = 0;
+                break;
+            }
+            steps = realloc(steps, sizeof(int) * (step_count + 1));
+            step_at = realloc(step_at, sizeof(int) * (step_count + 1));
+            steps[step_count] = atoi(step->arg1);
+            step_at[step_count] = k + 1;
+            step_count++;
+        }
+        if (!safe || step_count == 0)
+        {
+            free(steps);
+            free(step_at);
+            continue;
+        }
+
+        // 新变量 s = var * c, 在前置块初始化, 每次 var 自增后 s 增加 c * k
+        char name[256];
+        char value[64];
+        int c = atoi(constant->arg1);
+        snprintf(name, sizeof(name), "%s.sr%d", var, ++strength_reduction_counter);
+
+        IRInstruction *init = NULL;
+        int init_count = 0;
+        char *t1 = new_temp();
+        char *t2 = new_temp();
+        char *t3 = new_temp();
+        ir_list_append(&init, &init_count, "load", var, NULL, t1);
+        ir_list_append(&init, &init_count, "load_const", constant->arg1, NULL, t2);
+        ir_list_append(&init, &init_count, "mul", t1, t2, t3);
+        ir_list_append(&init, &init_count, "store", t3, NULL, name);
+
+        insert_pos = realloc(insert_pos, sizeof(int) * (insert_count + step_count + 1));
+        insert_list = realloc(insert_list, sizeof(IRInstruction *) * (insert_count + step_count + 1));
+        insert_len = realloc(insert_len, sizeof(int) * (insert_count + step_count + 1));
+        insert_pos[insert_count] = loop->insert_at;
+        insert_list[insert_count] = init;
+        insert_len[insert_count] = init_count;
+        insert_count++;
+
+        for (int k = 0; k < step_count; k++)
+        {
+            IRInstruction *update = NULL;
+            int update_count = 0;
+            char *u1 = new_temp();
+            char *u2 = new_temp();
+            char *u3 = new_temp();
+            sprintf(value, "%d", c * steps[k]);
+            ir_list_append(&update, &update_count, "load", name, NULL, u1);
+            ir_list_append(&update, &update_count, "load_const", value, NULL, u2);
+            ir_list_append(&update, &update_count, "add", u1, u2, u3);
+            ir_list_append(&update, &update_count, "store", u3, NULL, name);
+            insert_pos[insert_count] = step_at[k];
+            insert_list[insert_count] = update;
+            insert_len[insert_count] = update_count;
+            insert_count++;
+        }
+
+        // 乘法改为读取 s
+        char *result = mul->result;
+        ir_set(mul, "load", name, NULL, result);
+        reduced++;
+        free(steps);
+        free(step_at);
+
+        // 同一循环一次只削弱一个乘法, 插入后重新分析
+        break;
+    }
+
+    for (int k = insert_count - 1; k >= 0; k--)
+    {
+        // 位置相同时先插入的放在前面
+        int best = k;
+        for (int j = 0; j < insert_count; j++)
+        {
+            if (insert_len[j] >= 0 && (insert_len[best] < 0 || insert_pos[j] > insert_pos[best]))
+                best = j;
+        }
+        ir_insert(insert_pos[best], insert_list[best], insert_len[best]);
+        free(insert_list[best]);
+        insert_len[best] = -1;
+    }
+
+    free(insert_pos);
+    free(insert_list);
+    free(insert_len);
+    free(def_at);
+    free(block_of);
+    return reduced;
+}
+
+// 对 [start, end) 中的循环做强度削弱
+int strength_reduction_range(int start, int end)
+{
+    int total = 0;
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        ControlFlowGraph *cfg = build_cfg(start, end);
+        int loop_count = 0;
+        NaturalLoop *loops = find_loops(cfg, &loop_count);
+        for (int l = 0; l < loop_count && !changed; l++)
+        {
+            int before = ir_count;
+            if (reduce_loop(cfg, &loops[l], start, end) > 0)
+            {
+                end += ir_count - before;
+                total++;
+                changed = 1;
+            }
+        }
+        free_loops(loops, loop_count);
+        free_cfg(cfg);
+    }
+    return total;
+}
+
+// 区间中定义的临时变量的位置: 只为区间中定义过的编号 [base, base + count) 分配空间
+// 与 temp_definitions 不同, 大小与区间成正比, 不随整个程序的临时变量数增长
+typedef struct
+{
+    int base;
+    int count;
+    int *at;
+} RangeDefinitions;
+
+void range_definitions(RangeDefinitions *defs, int start, int end)
+{
+    int low = -1;
+    int high = -1;
+    for (int i = start; i < end; i++)
+    {
+        if (ir_has_def(ir_code[i].op) && is_temp(ir_code[i].result))
+        {
+            int t = temp_index(ir_code[i].result);
+            if (low < 0 || t < low)
+                low = t;
+            if (t > high)
+                high = t;
+        }
+    }
+    defs->base = low < 0 ? 0 : low;
+    defs->count = low < 0 ? 0 : high - low + 1;
+    defs->at = malloc(sizeof(int) * (defs->count + 1));
+    for (int t = 0; t < defs->count; t++)
+        defs->at[t] = -1;
+    for (int i = start; i < end; i++)
+    {
+        if (ir_has_def(ir_code[i].op) && is_temp(ir_code[i].result))
+            defs->at[temp_index(ir_code[i].result) - defs->base] = i;
+    }
+}
+
+// temp 的定义位置, 不是区间中定义的临时变量为 -1
+int range_definition(RangeDefinitions *defs, const char *temp)
+{
+    if (!is_temp(temp))
+        return -1;
+    int t = temp_index(temp) - defs->base;
+    return t >= 0 && t < defs->count ? defs->at[t] : -1;
+}
+
+// 标出循环中的不变量: 不依赖迭代的纯计算, invariant 按区间中的位置编号
+void licm_mark(ControlFlowGraph *cfg, NaturalLoop *loop, RangeDefinitions *defs, int *block_of, int *invariant)
+{
+    int start = cfg->start;
+    int has_call = loop_has_call(cfg, loop);
+
+    // 按程序顺序迭代到不动点
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        for (int b = 0; b < cfg->block_count; b++)
+        {
+            if (!loop->in_loop[b])
+                continue;
+            for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++)
+            {
+                IRInstruction *ins = &ir_code[i];
+                if (invariant[i - start])
+                    continue;
+
+                int candidate = 0;
+                if (ir_is(ins, "load_const"))
+                {
+                    candidate = 1;
+                }
+                else if (ir_is(ins, "load"))
+                {
+                    candidate = !loop_stores_var(cfg, loop, ins->arg1) && !(has_call && is_global_var(ins->arg1));
+                }
+                else if (ir_is_binary(ins->op) && !ir_is(ins, "div"))
+                {
+                    // 运行时的算术和比较不会出错, 可以提前执行; 除法可能除零, 不外提
+                    candidate = 1;
+                    const char *operands[2] = {ins->arg1, ins->arg2};
+                    for (int k = 0; k < 2; k++)
+                    {
+                        int d = range_definition(defs, operands[k]);
+                        if (d >= 0 && loop->in_loop[block_of[d - start]] && !invariant[d - start])
+                            candidate = 0;
+                    }
+                }
+
+                if (candidate)
+                {
+                    invariant[i - start] = 1;
+                    changed = 1;
+                }
+            }
+        }
+    }
+}
+
+// 循环不变量外提: 把循环中不依赖迭代的纯计算移到前置块
+// 每个函数只建一次控制流图和定义表; 从内到外逐个循环标出不变量, 每条指令移到它不变的最外层循环的前置块,
+// 最后按插入位置从后往前一次插入, 前面的位置不受影响
+int licm_range(int start, int end)
+{
+    ControlFlowGraph *cfg = build_cfg(start, end);
+    int loop_count = 0;
+    NaturalLoop *loops = find_loops(cfg, &loop_count);
+    int *block_of = instruction_blocks(cfg);
+    RangeDefinitions defs;
+    range_definitions(&defs, start, end);
+
+    int *target = malloc(sizeof(int) * (end - start + 1));
+    int *invariant = malloc(sizeof(int) * (end - start + 1));
+    for (int i = start; i < end; i++)
+        target[i - start] = -1;
+    for (int l = 0; l < loop_count; l++)
+    {
+        if (loops[l].preheader < 0)
+            continue;
+        memset(invariant, 0, sizeof(int) * (end - start + 1));
+        licm_mark(cfg, &loops[l], &defs, block_of, invariant);
+        // 循环按大小从内到外排列, 外层循环覆盖内层的结果
+        for (int i = start; i < end; i++)
+        {
+            if (invariant[i - start])
+                target[i - start] = l;
+        }
+    }
+
+    // 每个循环外提的指令保持原来的顺序, 原位置改为 nop
+    IRInstruction **hoisted = calloc(loop_count + 1, sizeof(IRInstruction *));
+    int *hoisted_count = calloc(loop_count + 1, sizeof(int));
+    int total = 0;
+    for (int i = start; i < end; i++)
+    {
+        int l = target[i - start];
+        if (l < 0)
+            continue;
+        IRInstruction *ins = &ir_code[i];
+        ir_list_append(&hoisted[l], &hoisted_count[l], ins->op, ins->arg1, ins->arg2, ins->result);
+        ir_make_nop(ins);
+        total++;
+    }
+
+    // 插入位置从后往前; 位置相同 (循环头相同) 时先插入内层的, 外层的指令排在前面
+    int *done = calloc(loop_count + 1, sizeof(int));
+    for (int k = 0; k < loop_count; k++)
+    {
+        int best = -1;
+        for (int l = 0; l < loop_count; l++)
+        {
+            if (!done[l] && (best < 0 || loops[l].insert_at > loops[best].insert_at))
+                best = l;
+        }
+        done[best] = 1;
+        ir_insert(loops[best].insert_at, hoisted[best], hoisted_count[best]);
+        free(hoisted[best]);
+    }
+
+    free(done);
+    free(hoisted);
+    free(hoisted_count);
+    free(target);
+    free(invariant);
+    free(defs.at);
+    free(block_of);
+    free_loops(loops, loop_count);
+    free_cfg(cfg);
+    return total;
+}
+
+// ---------------- 数组越界检查消除 ----------------
+
+// 计数循环: 循环头为 load i -> tI; lt tI tE -> tC; if_false tC exit
+typedef struct
+{
+    char *var;         // 循环变量
+    char *current;     // 循环头读取的 tI
+    char *start;       // 进入循环前存入循环变量的值 tS
+    char *end;         // 循环边界 tE, 在循环外定义
+    int step;          // 每次迭代循环变量的增量之和
+    int max_offset;    // tE 为整数时 tI 的最大值为 tE - max_offset
+} CountedLoop;
+
+int index_offset(int *def_at, const char *base, const char *temp, int *offset);
+
+// 已经处理过的循环头标签
+StringMap bce_done;
+int bce_initialized = 0;
+int bce_counter = 0;
+
+int in_loop_at(ControlFlowGraph *cfg, NaturalLoop *loop, int *block_of, int index)
+{
+    return index >= cfg->start && index < cfg->end && loop->in_loop[block_of[index - cfg->start]];
+}
+
+// 识别计数循环, 失败返回 0
+int analyze_counted_loop(ControlFlowGraph *cfg, NaturalLoop *loop, int *def_at, int *block_of, CountedLoop *info)
+{
+    BasicBlock *header = &cfg->blocks[loop->header];
+    IRInstruction *branch = &ir_code[header->end - 1];
+    if (!ir_is(branch, "if_false") || loop->preheader < 0)
+        return 0;
+
+    IRInstruction *compare = defined_by(def_at, branch->arg1, "lt");
+    if (compare == NULL || block_of[compare - ir_code - cfg->start] != loop->header)
+        return 0;
+    IRInstruction *load = defined_by(def_at, compare->arg1, "load");
+    if (load == NULL || block_of[load - ir_code - cfg->start] != loop->header)
+        return 0;
+    int end_at = is_temp(compare->arg2) ? def_at[temp_index(compare->arg2)] : -1;
+    if (end_at < 0 || in_loop_at(cfg, loop, block_of, end_at))
+        return 0;
+
+    info->var = load->arg1;
+    info->current = compare->arg1;
+    info->end = compare->arg2;
+
+    // 循环中对循环变量的写入都必须是 i = i + k, k > 0; 写入 tI 加常量时 (如 SSA 之后展开的循环) 步长就是该常量
+    info->step = 0;
+    for (int i = cfg->start; i < cfg->end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (!in_loop_at(cfg, loop, block_of, i))
+            continue;
+        if (ir_is_call(ins) && !is_pure_builtin(ins->arg1) && is_global_var(info->var))
+            return 0;
+        if (!ir_is(ins, "store") || strcmp(ins->result, info->var) != 0)
+            continue;
+
+        IRInstruction *add = defined_by(def_at, ins->arg1, "add");
+        if (add == NULL)
+            return 0;
+        IRInstruction *step = defined_by(def_at, add->arg2, "load_const");
+        const char *base = add->arg1;
+        if (!is_int_constant(step))
+        {
+            step = defined_by(def_at, add->arg1, "load_const");
+            base = add->arg2;
+        }
+        if (!is_int_constant(step) || atoi(step->arg1) <= 0)
+            return 0;
+        IRInstruction *base_load = defined_by(def_at, base, "load");
+        int offset = 0;
+        if (base_load != NULL && strcmp(base_load->arg1, info->var) == 0)
+            info->step += atoi(step->arg1);
+        else if (index_offset(def_at, info->current, base, &offset))
+            info->step = offset + atoi(step->arg1);
+        else
+            return 0;
+    }
+    if (info->step <= 0)
+        return 0;
+
+    // 前置块中最后一次存入循环变量的值
+    info->start = NULL;
+    BasicBlock *pre = &cfg->blocks[loop->preheader];
+    for (int i = pre->end - 1; i >= pre->start; i--)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (ir_is(ins, "store") && strcmp(ins->result, info->var) == 0)
+        {
+            info->start = ins->arg1;
+            break;
+        }
+        if (ir_is_call(ins) && !is_pure_builtin(ins->arg1) && is_global_var(info->var))
+            break;
+    }
+    if (info->start == NULL)
+        return 0;
+
+    // 边界都是常量且跨度是步长的整数倍时, tI 的最大值正好是 tE - step
+    info->max_offset = 1;
+    IRInstruction *start_const = defined_by(def_at, info->start, "load_const");
+    IRInstruction *end_const = defined_by(def_at, info->end, "load_const");
+    if (is_int_constant(start_const) && is_int_constant(end_const) &&
+        (atoi(end_const->arg1) - atoi(start_const->arg1)) % info->step == 0)
+        info->max_offset = info->step;
+    return 1;
+}
+
+// temp 是否等于 base 加常量偏移
+int index_offset(int *def_at, const char *base, const char *temp, int *offset)
+{
+    if (!is_temp(temp))
+        return 0;
+    if (strcmp(temp, base) == 0)
+    {
+        *offset = 0;
+        return 1;
+    }
+
+    IRInstruction *ins = def_at[temp_index(temp)] >= 0 ? &ir_code[def_at[temp_index(temp)]] : NULL;
+    if (ins == NULL || (!ir_is(ins, "add") && !ir_is(ins, "sub")))
+        return 0;
+
+    IRInstruction *constant = defined_by(def_at, ins->arg2, "load_const");
+    const char *rest = ins->arg1;
+    int sign = ir_is(ins, "sub") ? -1 : 1;
+    if (!is_int_constant(constant) && ir_is(ins, "add"))
+    {
+        constant = defined_by(def_at, ins->arg1, "load_const");
+        rest = ins->arg2;
+    }
+    if (!is_int_constant(constant) || !index_offset(def_at, base, rest, offset))
+        return 0;
+    *offset += sign * atoi(constant->arg1);
+    return 1;
+}
+
+// 全局数组在程序中的最小长度: 只在全局代码中用数组字面量赋值一次, 数组只会增长
+int static_array_length(const char *name)
+{
+    int length = -1;
+    int stores = 0;
+    int depth = 0;
+    int *def_at = temp_definitions(0, ir_count);
+
+    if (!is_global_var(name))
+    {
+        free(def_at);
+        return -1;
+    }
+    for (int i = 0; i < ir_count; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (ir_is(ins, "function"))
+            depth++;
+        else if (ir_is(ins, "end_function"))
+            depth--;
+        else if (depth == 0 && ir_is_call(ins) && !is_pure_builtin(ins->arg1))
+            stores = 2;
+        else if (ir_is(ins, "store") && strcmp(ins->result, name) == 0)
+        {
+            stores++;
+            IRInstruction *array = defined_by(def_at, ins->arg1, "new_array");
+            length = depth == 0 && array != NULL ? atoi(array->arg1) : -1;
+        }
+    }
+    free(def_at);
+    return stores == 1 ? length : -1;
+}
+
+// 循环中的一次数组访问
+typedef struct
+{
+    int at;       // 指令位置
+    char *array;  // 数组临时变量
+    int offset;   // 下标 = tI + offset
+} LoopAccess;
+
+// 复制循环区间 [from, to), 重命名其中定义的临时变量和标签
+// 跳出区间的分支改为跳到 exit_label, 返回复制的指令
+IRInstruction *clone_region(int from, int to, const char *suffix, const char *exit_label, char ***renamed_from, char ***renamed_to, int *renamed_count)
+{
+    StringMap temps;
+    StringMap labels;
+    string_map_init(&temps, 64);
+    string_map_init(&labels, 16);
+    char **new_names = NULL;
+    int new_count = 0;
+
+    for (int i = from; i < to; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (ir_has_def(ins->op) && is_temp(ins->result) && string_map_get(&temps, ins->result) < 0)
+        {
+            new_names = realloc(new_names, sizeof(char *) * (new_count + 1));
+            new_names[new_count] = new_temp();
+            string_map_put(&temps, ins->result, new_count++);
+            *renamed_from = realloc(*renamed_from, sizeof(char *) * (*renamed_count + 1));
+            *renamed_to = realloc(*renamed_to, sizeof(char *) * (*renamed_count + 1));
+            (*renamed_from)[*renamed_count] = ins->result;
+            (*renamed_to)[*renamed_count] = new_names[new_count - 1];
+            (*renamed_count)++;
+        }
+        if (ir_is(ins, "label"))
+            string_map_put(&labels, ins->arg1, 1);
+    }
+
+    IRInstruction *copy = malloc(sizeof(IRInstruction) * (to - from));
+    for (int i = from; i < to; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        IRInstruction *out = &copy[i - from];
+        ir_set(out, ins->op, ins->arg1, ins->arg2, ins->result);
+
+        int mask = ir_use_mask(ins->op) | (ir_has_def(ins->op) ? 4 : 0);
+        char **fields[3] = {&out->arg1, &out->arg2, &out->result};
+        for (int f = 0; f < 3; f++)
+        {
+            int index = (mask & (1 << f)) && is_temp(*fields[f]) ? string_map_get(&temps, *fields[f]) : -1;
+            if (index >= 0)
+                *fields[f] = new_names[index];
+        }
+
+        char **label = ir_is(out, "label") || ir_is(out, "goto") ? &out->arg1 : ir_is(out, "if_false") ? &out->arg2 : NULL;
+        if (label != NULL)
+        {
+            char buffer[256];
+            if (string_map_get(&labels, *label) >= 0)
+            {
+                snprintf(buffer, sizeof(buffer), "%s_%s", *label, suffix);
+                *label = strdup(buffer);
+            }
+            else
+            {
+                *label = strdup(exit_label);
+            }
+        }
+    }
+
+    free(new_names);
+    string_map_free(&temps);
+    string_map_free(&labels);
+    return copy;
+}
+
+// 对一个计数循环做越界检查消除, 返回改写的访问数
+int bce_loop(ControlFlowGraph *cfg, NaturalLoop *loop, int start, int end)
+{
+    int *def_at = temp_definitions(start, end);
+    int *block_of = instruction_blocks(cfg);
+    CountedLoop info;
+    LoopAccess *accesses = NULL;
+    int access_count = 0;
+    int rewritten = 0;
+
+    if (!analyze_counted_loop(cfg, loop, def_at, block_of, &info))
+        goto done;
+
+    // 收集下标为 tI + 常量, 数组在循环外定义的访问
+    for (int i = start; i < end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (!loop->in_loop[block_of[i - start]])
+            continue;
+
+        const char *array = NULL;
+        const char *index = NULL;
+        if (ir_is(ins, "array_access"))
+        {
+            array = ins->arg1;
+            index = ins->arg2;
+        }
+        else if (ir_is(ins, "array_store"))
+        {
+            array = ins->result;
+            index = ins->arg1;
+        }
+        else
+        {
+            continue;
+        }
+
+        int offset = 0;
+        int array_at = is_temp(array) ? def_at[temp_index(array)] : -1;
+        if (array_at < 0 || loop->in_loop[block_of[array_at - start]] || !index_offset(def_at, info.current, index, &offset))
+            continue;
+
+        accesses = realloc(accesses, sizeof(LoopAccess) * (access_count + 1));
+        accesses[access_count].at = i;
+        accesses[access_count].array = (char *)array;
+        accesses[access_count].offset = offset;
+        access_count++;
+    }
+    if (access_count == 0)
+        goto done;
+
+    // 下界: tS + min_offset >= 0; 上界: tI 的最大值 + offset < length
+    int min_offset = accesses[0].offset;
+    for (int a = 1; a < access_count; a++)
+    {
+        if (accesses[a].offset < min_offset)
+            min_offset = accesses[a].offset;
+    }
+
+    IRInstruction *start_const = defined_by(def_at, info.start, "load_const");
+    IRInstruction *end_const = defined_by(def_at, info.end, "load_const");
+    int lower_proven = is_int_constant(start_const) && atoi(start_const->arg1) + min_offset >= 0;
+    int all_proven = lower_proven;
+    int *proven = calloc(access_count, sizeof(int));
+    for (int a = 0; a < access_count; a++)
+    {
+        IRInstruction *array_load = defined_by(def_at, accesses[a].array, "load");
+        int length = array_load != NULL ? static_array_length(array_load->arg1) : -1;
+        proven[a] = lower_proven && length >= 0 && is_int_constant(end_const) &&
+                    atoi(end_const->arg1) - info.max_offset + accesses[a].offset < length;
+        all_proven = all_proven && proven[a];
+    }
+
+    if (all_proven)
+    {
+        for (int a = 0; a < access_count; a++)
+        {
+            IRInstruction *ins = &ir_code[accesses[a].at];
+            ins->op = strdup(ir_is(ins, "array_access") ? "array_access_unchecked" : "array_store_unchecked");
+            rewritten++;
+        }
+        free(proven);
+        goto done;
+    }
+
+    // 循环区间必须连续, 并以回边 goto 结束
+    int from = cfg->blocks[loop->header].start;
+    int to = cfg->blocks[loop->latch].end;
+    for (int b = loop->header; b <= loop->latch; b++)
+    {
+        if (!loop->in_loop[b])
+        {
+            free(proven);
+            goto done;
+        }
+    }
+    if (loop->latch - loop->header + 1 != loop->size || !ir_is(&ir_code[to - 1], "goto"))
+    {
+        free(proven);
+        goto done;
+    }
+
+    // 跳出循环的目标只能有一个
+    char *exit_target = NULL;
+    for (int i = from; i < to; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        char *label = ir_is(ins, "goto") ? ins->arg1 : ir_is(ins, "if_false") ? ins->arg2 : NULL;
+        if (label == NULL)
+            continue;
+        int target = cfg_block_of_label(cfg, label);
+        if (target >= 0 && loop->in_loop[target])
+            continue;
+        if (exit_target != NULL && strcmp(exit_target, label) != 0)
+        {
+            free(proven);
+            goto done;
+        }
+        exit_target = label;
+    }
+    if (exit_target == NULL)
+    {
+        free(proven);
+        goto done;
+    }
+
+    // 循环版本化: 前置块中做一次范围检查, 通过则执行无检查的副本
+    char suffix[32];
+    char *slow_label;
+    char *exit_label;
+    sprintf(suffix, "fast%d", ++bce_counter);
+    slow_label = new_label("loop_checked", bce_counter);
+    exit_label = new_label("loop_exit", bce_counter);
+
+    IRInstruction *guard = NULL;
+    int guard_count = 0;
+    char value[64];
+    if (!lower_proven)
+    {
+        char *t1 = new_temp();
+        char *t2 = new_temp();
+        // tS >= -min_offset, 不在 tS 上做加法, 免得溢出
+        sprintf(value, "%d", -min_offset);
+        ir_list_append(&guard, &guard_count, "load_const", value, NULL, t1);
+        ir_list_append(&guard, &guard_count, "ge", info.start, t1, t2);
+        ir_list_append(&guard, &guard_count, "if_false", t2, slow_label, NULL);
+    }
+    for (int a = 0; a < access_count; a++)
+    {
+        // 同一个数组只检查最大偏移
+        int max = accesses[a].offset;
+        int first = 1;
+        for (int b = 0; b < access_count; b++)
+        {
+            if (strcmp(accesses[b].array, accesses[a].array) != 0 || proven[b])
+                continue;
+            if (b < a)
+                first = 0;
+            if (accesses[b].offset > max)
+                max = accesses[b].offset;
+        }
+        if (proven[a] || !first)
+            continue;
+
+        // tE 不一定是整数: 整数 tI < 浮点数 tE 时 tI 最大为 ceil(tE) - 1, 所以检查 tE <= length - (max - max_offset + 1),
+        // tE 是整数时与 tE - max_offset + max < length 相同; 在长度上做减法也不会溢出
+        char *t1 = new_temp();
+        char *t2 = new_temp();
+        char *t3 = new_temp();
+        char *t4 = new_temp();
+        sprintf(value, "%d", max - info.max_offset + 1);
+        ir_list_append(&guard, &guard_count, "load_const", value, NULL, t1);
+        ir_list_append(&guard, &guard_count, "array_length", accesses[a].array, NULL, t2);
+        ir_list_append(&guard, &guard_count, "sub", t2, t1, t3);
+        ir_list_append(&guard, &guard_count, "le", info.end, t3, t4);
+        ir_list_append(&guard, &guard_count, "if_false", t4, slow_label, NULL);
+    }
+
+    char **renamed_from = NULL;
+    char **renamed_to = NULL;
+    int renamed_count = 0;
+    IRInstruction *fast = clone_region(from, to, suffix, exit_label, &renamed_from, &renamed_to, &renamed_count);
+    for (int a = 0; a < access_count; a++)
+    {
+        IRInstruction *ins = &fast[accesses[a].at - from];
+        ins->op = strdup(ir_is(ins, "array_access") ? "array_access_unchecked" : "array_store_unchecked");
+        if (proven[a])
+            ir_code[accesses[a].at].op = strdup(ins->op);
+        rewritten++;
+    }
+
+    // 副本的出口: 把循环后仍会用到的临时变量复制回原名
+    IRInstruction *tail = NULL;
+    int tail_count = 0;
+    ir_list_append(&tail, &tail_count, "label", exit_label, NULL, NULL);
+    for (int r = 0; r < renamed_count; r++)
+    {
+        int used_outside = 0;
+        for (int i = start; i < end && !used_outside; i++)
+        {
+            if (i >= from && i < to)
+                continue;
+            IRInstruction *ins = &ir_code[i];
+            int mask = ir_use_mask(ins->op);
+            used_outside = ((mask & 1) && ins->arg1 && strcmp(ins->arg1, renamed_from[r]) == 0) ||
+                           ((mask & 2) && ins->arg2 && strcmp(ins->arg2, renamed_from[r]) == 0) ||
+                           ((mask & 4) && ins->result && strcmp(ins->result, renamed_from[r]) == 0);
+        }
+        if (used_outside)
+            ir_list_append(&tail, &tail_count, "move", renamed_to[r], NULL, renamed_from[r]);
+    }
+    ir_list_append(&tail, &tail_count, "goto", exit_target, NULL, NULL);
+    ir_list_append(&tail, &tail_count, "label", slow_label, NULL, NULL);
+
+    // 依次插入: 检查, 副本, 出口; 原循环作为检查失败时的慢路径
+    int at = loop->insert_at;
+    ir_insert(at, tail, tail_count);
+    ir_insert(at, fast, to - from);
+    ir_insert(at, guard, guard_count);
+
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s_%s", ir_code[at + guard_count].arg1, suffix);
+    string_map_put(&bce_done, buffer, 1);
+
+    free(proven);
+    free(guard);
+    free(fast);
+    free(tail);
+    free(renamed_from);
+    free(renamed_to);
+
+done:
+    string_map_put(&bce_done, ir_code[cfg->blocks[loop->header].start].arg1, 1);
+    free(accesses);
+    free(def_at);
+    free(block_of);
+    return rewritten;
+}
+
+int bce_range(int start, int end)
+{
+    int total = 0;
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        ControlFlowGraph *cfg = build_cfg(start, end);
+        int loop_count = 0;
+        NaturalLoop *loops = find_loops(cfg, &loop_count);
+        for (int l = 0; l < loop_count && !changed; l++)
+        {
+            IRInstruction *first = &ir_code[cfg->blocks[loops[l].header].start];
+            if (!ir_is(first, "label") || string_map_get(&bce_done, first->arg1) >= 0)
+                continue;
+
+            int before = ir_count;
+            total += bce_loop(cfg, &loops[l], start, end);
+            end += ir_count - before;
+            changed = 1;
+        }
+        free_loops(loops, loop_count);
+        free_cfg(cfg);
+    }
+    return total;
+}
+
+int bounds_check_elimination()
+{
+    if (!bce_initialized)
+    {
+        string_map_init(&bce_done, 16);
+        bce_initialized = 1;
+    }
+    return for_each_function(bce_range);
+}
+
+// ---------------- 函数内联 ----------------
+
+// 被内联函数的指令数上限, 以及内联的轮数
+int inline_max_size = 32;
+int inline_max_rounds = 3;
+int inline_counter = 0;
+
+typedef struct
+{
+    char *name;
+    int start;       // function 指令的位置
+    int end;         // end_function 指令的位置
+    char **params;
+    int param_count;
+    int size;        // 除 param 和 label 外的指令数
+    int recursive;   // 是否直接或间接调用自身
+} FunctionInfo;
+
+// 收集全部函数
+FunctionInfo *collect_functions(int *count)
+{
+    FunctionInfo *functions = NULL;
+    *count = 0;
+    for (int i = 0; i < ir_count; i++)
+    {
+        if (!ir_is(&ir_code[i], "function"))
+            continue;
+
+        FunctionInfo info;
+        memset(&info, 0, sizeof(info));
+        info.name = ir_code[i].arg1;
+        info.start = i;
+        info.end = find_function_end(i);
+        for (int k = i + 1; k < info.end; k++)
+        {
+            IRInstruction *ins = &ir_code[k];
+            if (ir_is(ins, "param"))
+            {
+                info.params = realloc(info.params, sizeof(char *) * (info.param_count + 1));
+                info.params[info.param_count++] = ins->arg1;
+            }
+            else if (!ir_is(ins, "label") && !ir_is(ins, "nop"))
+            {
+                info.size++;
+            }
+        }
+
+        functions = realloc(functions, sizeof(FunctionInfo) * (*count + 1));
+        functions[(*count)++] = info;
+        i = info.end;
+    }
+    return functions;
+}
+
+int find_function_info(FunctionInfo *functions, int count, const char *name)
+{
+    for (int f = 0; f < count; f++)
+    {
+        if (strcmp(functions[f].name, name) == 0)
+            return f;
+    }
+    return -1;
+}
+
+// 从 from 出发能否沿调用图到达 target
+int calls_reach(FunctionInfo *functions, int count, int from, int target, int *visited)
+{
+    if (visited[from])
+        return 0;
+    visited[from] = 1;
+    for (int i = functions[from].start; i < functions[from].end; i++)
+    {
+        if (!ir_is_call(&ir_code[i]) && !ir_is(&ir_code[i], "tail_call"))
+            continue;
+        int callee = find_function_info(functions, count, ir_code[i].arg1);
+        if (callee == target)
+            return 1;
+        if (callee >= 0 && calls_reach(functions, count, callee, target, visited))
+            return 1;
+    }
+    return 0;
+}
+
+void mark_recursive_functions(FunctionInfo *functions, int count)
+{
+    int *visited = malloc(sizeof(int) * (count + 1));
+    for (int f = 0; f < count; f++)
+    {
+        memset(visited, 0, sizeof(int) * (count + 1));
+        functions[f].recursive = calls_reach(functions, count, f, f, visited);
+    }
+    free(visited);
+}
+
+// 在 call 处内联函数 callee
+void inline_call(FunctionInfo *callee, int call)
+{
+    int id = ++inline_counter;
+    int argc = callee->param_count;
+    int first_arg = call - argc;
+    char *result = ir_code[call].result;
+    char suffix[32];
+    char name[256];
+    sprintf(suffix, "inl%d", id);
+    char *end_label = new_label("inline_end", id);
+
+    // 被调函数的局部变量 (形参和非全局变量) 改名, 避免与调用者冲突
+    StringMap locals;
+    string_map_init(&locals, 16);
+    char **local_names = NULL;
+    int local_count = 0;
+    for (int i = callee->start + 1; i < callee->end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        const char *var = ir_is(ins, "param") || ir_is(ins, "load") ? ins->arg1 : ir_is(ins, "store") ? ins->result : NULL;
+        if (var == NULL || string_map_get(&locals, var) >= 0 || is_global_var(var))
+            continue;
+        snprintf(name, sizeof(name), "%s.%s.%d", callee->name, var, id);
+        local_names = realloc(local_names, sizeof(char *) * (local_count + 1));
+        local_names[local_count] = strdup(name);
+        string_map_put(&locals, var, local_count++);
+    }
+    snprintf(name, sizeof(name), "%s.return.%d", callee->name, id);
+    char *return_var = strdup(name);
+
+    char **from = NULL;
+    char **to = NULL;
+    int renamed = 0;
+    int body_start = callee->start + 1;
+    int body_end = callee->end;
+    IRInstruction *body = clone_region(body_start, body_end, suffix, end_label, &from, &to, &renamed);
+
+    IRInstruction *code = NULL;
+    int code_count = 0;
+
+    // 实参存入形参; 与全局变量同名的形参生成 IR 前已经改名, 不在局部变量中的形参只可能来自手写的 IR, 跳过
+    for (int k = 0; k < argc; k++)
+    {
+        int index = string_map_get(&locals, callee->params[k]);
+        if (index < 0)
+            continue;
+        ir_list_append(&code, &code_count, "store", ir_code[first_arg + k].arg1, NULL, local_names[index]);
+    }
+
+    int falls_through = 1;
+    for (int i = 0; i < body_end - body_start; i++)
+    {
+        IRInstruction *ins = &body[i];
+        int index;
+        if (ir_is(ins, "param"))
+            continue;
+        if (ir_is(ins, "load") && (index = string_map_get(&locals, ins->arg1)) >= 0)
+            ins->arg1 = local_names[index];
+        if (ir_is(ins, "store") && (index = string_map_get(&locals, ins->result)) >= 0)
+            ins->result = local_names[index];
+
+        if (ir_is(ins, "return"))
+        {
+            // return v 改为存入返回值变量并跳到内联结尾
+            if (ins->arg1 != NULL)
+                ir_list_append(&code, &code_count, "store", ins->arg1, NULL, return_var);
+            else
+            {
+                char *nil = new_temp();
+                ir_list_append(&code, &code_count, "load_const", "nil", NULL, nil);
+                ir_list_append(&code, &code_count, "store", nil, NULL, return_var);
+            }
+            ir_list_append(&code, &code_count, "goto", end_label, NULL, NULL);
+            falls_through = 0;
+            continue;
+        }
+        if (ir_is(ins, "tail_call"))
+        {
+            // 内联后尾调用不再位于调用者的尾部, 改为普通调用
+            char *value = new_temp();
+            ir_list_append(&code, &code_count, "call_function", ins->arg1, ins->arg2, value);
+            ir_list_append(&code, &code_count, "store", value, NULL, return_var);
+            ir_list_append(&code, &code_count, "goto", end_label, NULL, NULL);
+            falls_through = 0;
+            continue;
+        }
+        if (!ir_is(ins, "label"))
+            falls_through = !ir_is(ins, "goto");
+        else
+            falls_through = 1;
+        ir_list_append(&code, &code_count, ins->op, ins->arg1, ins->arg2, ins->result);
+    }
+
+    // 没有 return 的路径返回 nil
+    if (falls_through)
+    {
+        char *nil = new_temp();
+        ir_list_append(&code, &code_count, "load_const", "nil", NULL, nil);
+        ir_list_append(&code, &code_count, "store", nil, NULL, return_var);
+    }
+    ir_list_append(&code, &code_count, "label", end_label, NULL, NULL);
+    ir_list_append(&code, &code_count, "load", return_var, NULL, result);
+
+    // 用内联代码替换 arg ... call_function
+    for (int i = first_arg; i <= call; i++)
+        ir_make_nop(&ir_code[i]);
+    ir_insert(call + 1, code, code_count);
+
+    free(code);
+    free(body);
+    free(from);
+    free(to);
+    free(local_names);
+    string_map_free(&locals);
+}
+
+// 把小函数内联到调用处, 返回内联次数
+int inline_functions()
+{
+    int total = 0;
+    for (int round = 0; round < inline_max_rounds; round++)
+    {
+        int changed = 0;
+        int function_count = 0;
+        FunctionInfo *functions = collect_functions(&function_count);
+        mark_recursive_functions(functions, function_count);
+
+        for (int caller = 0; caller < function_count; caller++)
+        {
+            for (int i = functions[caller].start + 1; i < functions[caller].end; i++)
+            {
+                IRInstruction *call = &ir_code[i];
+                if (!ir_is(call, "call_function"))
+                    continue;
+
+                int f = find_function_info(functions, function_count, call->arg1);
+                if (f < 0 || f == caller || functions[f].recursive || functions[f].size > inline_max_size ||
+                    functions[f].param_count != atoi(call->arg2))
+                    continue;
+
+                // 实参必须紧挨在调用之前
+                int argc = functions[f].param_count;
+                int ok = i - argc > functions[caller].start;
+                for (int k = 1; k <= argc && ok; k++)
+                    ok = ir_is(&ir_code[i - k], "arg");
+                if (!ok)
+                    continue;
+
+                int before = ir_count;
+                inline_call(&functions[f], i);
+                int growth = ir_count - before;
+                total++;
+                changed = 1;
+
+                // 调整后续函数的位置
+                functions[caller].end += growth;
+                for (int g = 0; g < function_count; g++)
+                {
+                    if (functions[g].start > i)
+                    {
+                        functions[g].start += growth;
+                        functions[g].end += growth;
+                    }
+                }
+                i += growth;
+            }
+        }
+
+        for (int f = 0; f < function_count; f++)
+            free(functions[f].params);
+        free(functions);
+        ir_remove_nops();
+        if (!changed)
+            break;
+    }
+    return total;
+}
+
+// ---------------- 常量折叠与死代码删除 ----------------
+
+// 计算常量运算, 不能折叠时返回 0
+int fold_binary(const char *op, const char *a, const char *b, char *out)
+{
+    int is_float = strchr(a, '.') != NULL || strchr(b, '.') != NULL;
+    if (!is_float)
+    {
+        long long x = atoll(a);
+        long long y = atoll(b);
+        long long r;
+        // 与运行时一致, 整数运算按 64 位补码回绕
+        if (strcmp(op, "add") == 0)
+            r = (long long)((unsigned long long)x + (unsigned long long)y);
+        else if (strcmp(op, "sub") == 0)
+            r = (long long)((unsigned long long)x - (unsigned long long)y);
+        else if (strcmp(op, "mul") == 0)
+            r = (long long)((unsigned long long)x * (unsigned long long)y);
+        else if (strcmp(op, "div") == 0)
+        {
+            if (y == 0)
+                return 0;
+            r = y == -1 ? (long long)(0ULL - (unsigned long long)x) : x / y;
+        }
+        else if (strcmp(op, "gt") == 0)
+            r = x > y;
+        else if (strcmp(op, "lt") == 0)
+            r = x < y;
+        else if (strcmp(op, "ge") == 0)
+            r = x >= y;
+        else if (strcmp(op, "le") == 0)
+            r = x <= y;
+        else if (strcmp(op, "eq") == 0)
+            r = x == y;
+        else
+            return 0;
+        sprintf(out, "%lld", r);
+        return 1;
+    }
+
+    double x = atof(a);
+    double y = atof(b);
+    double r;
+    int compare = 0;
+    if (strcmp(op, "add") == 0)
+        r = x + y;
+    else if (strcmp(op, "sub") == 0)
+        r = x - y;
+    else if (strcmp(op, "mul") == 0)
+        r = x * y;
+    else if (strcmp(op, "div") == 0)
+    {
+        if (y == 0)
+            return 0;
+        r = x / y;
+    }
+    else
+    {
+        compare = 1;
+        if (strcmp(op, "gt") == 0)
+            r = x > y;
+        else if (strcmp(op, "lt") == 0)
+            r = x < y;
+        else if (strcmp(op, "ge") == 0)
+            r = x >= y;
+        else if (strcmp(op, "le") == 0)
+            r = x <= y;
+        else if (strcmp(op, "eq") == 0)
+            r = x == y;
+        else
+            return 0;
+    }
+
+    if (compare)
+    {
+        sprintf(out, "%d", (int)r);
+        return 1;
+    }
+    sprintf(out, "%.17g", r);
+    if (strchr(out, '.') == NULL && strchr(out, 'e') == NULL)
+        strcat(out, ".0");
+    return strchr(out, 'e') == NULL && strchr(out, 'n') == NULL && strchr(out, 'i') == NULL;
+}
+
+// 折叠常量运算和常量条件分支
+int constant_folding_range(int start, int end)
+{
+    int total = 0;
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        int *def_at = temp_definitions(start, end);
+        for (int i = start; i < end; i++)
+        {
+            IRInstruction *ins = &ir_code[i];
+            char value[128];
+            if (ir_is_binary(ins->op))
+            {
+                IRInstruction *a = defined_by(def_at, ins->arg1, "load_const");
+                IRInstruction *b = defined_by(def_at, ins->arg2, "load_const");
+                if (is_number_constant(a) && is_number_constant(b) && fold_binary(ins->op, a->arg1, b->arg1, value))
+                {
+                    ir_set(ins, "load_const", value, NULL, ins->result);
+                    changed = 1;
+                    total++;
+                }
+            }
+            else if (ir_is(ins, "if_false"))
+            {
+                IRInstruction *c = defined_by(def_at, ins->arg1, "load_const");
+                if (is_number_constant(c))
+                {
+                    if (atof(c->arg1) == 0)
+                        ir_set(ins, "goto", ins->arg2, NULL, NULL);
+                    else
+                        ir_make_nop(ins);
+                    changed = 1;
+                    total++;
+                }
+            }
+        }
+        free(def_at);
+    }
+    return total;
+}
+
+// 删除后没有副作用的指令
+int is_removable(IRInstruction *ins)
+{
+    if (ir_is(ins, "load_const") || ir_is(ins, "load") || ir_is(ins, "move") || ir_is(ins, "new_array") ||
+        ir_is(ins, "new_map") || ir_is(ins, "array_length") || ir_is(ins, "array_access_unchecked"))
+        return 1;
+    return ir_is_binary(ins->op) && !ir_is(ins, "div");
+}
+
+// 删除不可达代码, 无用的临时变量定义和不会被读取的局部变量存储
+int dead_code_range(int start, int end)
+{
+    int total = 0;
+
+    ControlFlowGraph *cfg = build_cfg(start, end);
+    for (int b = 1; b < cfg->block_count; b++)
+    {
+        if (cfg->blocks[b].idom != -1)
+            continue;
+        for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++)
+        {
+            if (!ir_is(&ir_code[i], "nop"))
+            {
+                ir_make_nop(&ir_code[i]);
+                total++;
+            }
+        }
+    }
+    free_cfg(cfg);
+
+    // goto 紧跟它的目标标签
+    for (int i = start; i < end; i++)
+    {
+        if (!ir_is(&ir_code[i], "goto"))
+            continue;
+        int next = i + 1;
+        while (next < end && ir_is(&ir_code[next], "nop"))
+            next++;
+        if (next < end && ir_is(&ir_code[next], "label") && strcmp(ir_code[next].arg1, ir_code[i].arg1) == 0)
+        {
+            ir_make_nop(&ir_code[i]);
+            total++;
+        }
+    }
+
+    // 没有分支跳转到的标签
+    StringMap targets;
+    string_map_init(&targets, 16);
+    for (int i = start; i < end; i++)
+    {
+        if (ir_is(&ir_code[i], "goto"))
+            string_map_put(&targets, ir_code[i].arg1, 1);
+        else if (ir_is(&ir_code[i], "if_false"))
+            string_map_put(&targets, ir_code[i].arg2, 1);
+    }
+    for (int i = start; i < end; i++)
+    {
+        if (ir_is(&ir_code[i], "label") && string_map_get(&targets, ir_code[i].arg1) < 0)
+        {
+            ir_make_nop(&ir_code[i]);
+            total++;
+        }
+    }
+    string_map_free(&targets);
+
+    int *uses = malloc(sizeof(int) * (temp_counter + 1));
+    StringMap loaded;
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        memset(uses, 0, sizeof(int) * (temp_counter + 1));
+        string_map_init(&loaded, 16);
+        for (int i = start; i < end; i++)
+        {
+            IRInstruction *ins = &ir_code[i];
+            int mask = ir_use_mask(ins->op);
+            if ((mask & 1) && is_temp(ins->arg1))
+                uses[temp_index(ins->arg1)]++;
+            if ((mask & 2) && is_temp(ins->arg2))
+                uses[temp_index(ins->arg2)]++;
+            if ((mask & 4) && is_temp(ins->result))
+                uses[temp_index(ins->result)]++;
+            if (ir_is(ins, "load"))
+                string_map_put(&loaded, ins->arg1, 1);
+        }
+
+        for (int i = start; i < end; i++)
+        {
+            IRInstruction *ins = &ir_code[i];
+            if (ir_has_def(ins->op) && is_temp(ins->result) && uses[temp_index(ins->result)] == 0 && is_removable(ins))
+            {
+                ir_make_nop(ins);
+                changed = 1;
+                total++;
+            }
+            else if (ir_is(ins, "store") && string_map_get(&loaded, ins->result) < 0 && !is_global_var(ins->result))
+            {
+                ir_make_nop(ins);
+                changed = 1;
+                total++;
+            }
+        }
+        string_map_free(&loaded);
+    }
+
+    free(uses);
+    return total;
+}
+
+int constant_folding()
+{
+    return for_each_function(constant_folding_range);
+}
+
+int dead_code_elimination()
+{
+    int removed = for_each_function(dead_code_range);
+    ir_remove_nops();
+    return removed;
+}
+
+int strength_reduction()
+{
+    return for_each_function(strength_reduction_range);
+}
+
+int loop_invariant_code_motion()
+{
+    int hoisted = for_each_function(licm_range);
+    ir_remove_nops();
+    return hoisted;
+}
+
+// ---------------- SSA 与稀疏条件常量传播 ----------------
+
+// SSA 形式中局部变量不再经过 load/store, 每个值都是只定义一次的临时变量;
+// 汇合点的 phi 指令写作 phi var %1@L1,%2@L2 result, 每个可达前驱一项, 前驱用它的标签表示, 函数入口块记作 entry
+int ssa_label_counter = 0;
+
+// 区间是否是函数体, 全局代码中的变量都是全局变量, 不参与 SSA
+int is_function_range(int start)
+{
+    return start > 0 && ir_is(&ir_code[start - 1], "function");
+}
+
+// 基本块在 phi 中的名字
+const char *ssa_block_name(ControlFlowGraph *cfg, int b)
+{
+    IRInstruction *first = &ir_code[cfg->blocks[b].start];
+    if (ir_is(first, "label"))
+        return first->arg1;
+    return b == 0 ? "entry" : NULL;
+}
+
+int ssa_block_of_name(ControlFlowGraph *cfg, const char *name)
+{
+    return strcmp(name, "entry") == 0 ? 0 : cfg_block_of_label(cfg, name);
+}
+
+// 给没有标签的基本块补上标签; 入口块有前驱时在它前面插入新的入口, 返回插入的指令数
+int ssa_label_blocks(int start, int end)
+{
+    ControlFlowGraph *cfg = build_cfg(start, end);
+    int *positions = malloc(sizeof(int) * (cfg->block_count + 1));
+    int count = 0;
+    if (cfg->blocks[0].pred_count > 0)
+        positions[count++] = start;
+    for (int b = 1; b < cfg->block_count; b++)
+    {
+        if (!ir_is(&ir_code[cfg->blocks[b].start], "label"))
+            positions[count++] = cfg->blocks[b].start;
+    }
+    free_cfg(cfg);
+
+    for (int k = count - 1; k >= 0; k--)
+    {
+        IRInstruction label;
+        char name[32];
+        sprintf(name, "bb_%d", ssa_label_counter++);
+        ir_set(&label, "label", name, NULL, NULL);
+        ir_insert(positions[k], &label, 1);
+    }
+    free(positions);
+    return count;
+}
+
+// 支配边界: 汇合块 b 属于从它的每个前驱沿支配树向上, 直到 idom(b) 之前经过的块的支配边界
+int **dominance_frontiers(ControlFlowGraph *cfg, int **frontier_count)
+{
+    int **frontier = calloc(cfg->block_count, sizeof(int *));
+    *frontier_count = calloc(cfg->block_count, sizeof(int));
+    for (int b = 0; b < cfg->block_count; b++)
+    {
+        BasicBlock *block = &cfg->blocks[b];
+        if (block->idom == -1 || block->pred_count < 2)
+            continue;
+        for (int p = 0; p < block->pred_count; p++)
+        {
+            int runner = block->preds[p];
+            if (cfg->blocks[runner].idom == -1)
+                continue;
+            while (runner != block->idom)
+            {
+                int seen = 0;
+                for (int k = 0; k < (*frontier_count)[runner]; k++)
+                    seen |= frontier[runner][k] == b;
+                if (!seen)
+                {
+                    frontier[runner] = realloc(frontier[runner], sizeof(int) * ((*frontier_count)[runner] + 1));
+                    frontier[runner][(*frontier_count)[runner]++] = b;
+                }
+                if (runner == 0)
+                    break;
+                runner = cfg->blocks[runner].idom;
+            }
+        }
+    }
+    return frontier;
+}
+
+// 重命名时的状态
+typedef struct
+{
+    ControlFlowGraph *cfg;
+    StringMap vars;      // 提升的局部变量 -> 编号
+    int var_count;
+    char ***stacks;      // 每个变量当前可见的值
+    int *depth;
+    char **replacement;  // 被删除的 load 结果 -> 变量当前的值
+    StringMap initial;   // 入口处读取变量初值的临时变量
+} SSAState;
+
+void ssa_push(SSAState *state, int var, char *value)
+{
+    state->stacks[var] = realloc(state->stacks[var], sizeof(char *) * (state->depth[var] + 1));
+    state->stacks[var][state->depth[var]++] = value;
+}
+
+// 沿支配树重命名: store 压入新值, load 改为使用当前值, 并填写后继块 phi 中来自本块的一项
+void ssa_rename_block(SSAState *state, int b)
+{
+    BasicBlock *block = &state->cfg->blocks[b];
+    int *saved = malloc(sizeof(int) * (state->var_count + 1));
+    memcpy(saved, state->depth, sizeof(int) * (state->var_count + 1));
+
+    for (int i = block->start; i < block->end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (ir_is(ins, "phi"))
+        {
+            ssa_push(state, string_map_get(&state->vars, ins->arg1), ins->result);
+            continue;
+        }
+        rewrite_uses(ins, state->replacement);
+
+        int var = -1;
+        if (ir_is(ins, "load"))
+            var = string_map_get(&state->vars, ins->arg1);
+        else if (ir_is(ins, "store"))
+            var = string_map_get(&state->vars, ins->result);
+        if (var < 0)
+            continue;
+
+        if (ir_is(ins, "store"))
+        {
+            ssa_push(state, var, ins->arg1);
+            ir_make_nop(ins);
+        }
+        else if (string_map_get(&state->initial, ins->result) >= 0)
+        {
+            ssa_push(state, var, ins->result);
+        }
+        else
+        {
+            state->replacement[temp_index(ins->result)] = state->stacks[var][state->depth[var] - 1];
+            ir_make_nop(ins);
+        }
+    }
+
+    const char *name = ssa_block_name(state->cfg, b);
+    for (int s = 0; s < block->succ_count; s++)
+    {
+        BasicBlock *succ = &state->cfg->blocks[block->succs[s]];
+        for (int i = succ->start; i < succ->end; i++)
+        {
+            IRInstruction *phi = &ir_code[i];
+            if (ir_is(phi, "label"))
+                continue;
+            if (!ir_is(phi, "phi"))
+                break;
+            int var = string_map_get(&state->vars, phi->arg1);
+            char *value = state->stacks[var][state->depth[var] - 1];
+            int length = (phi->arg2 ? strlen(phi->arg2) : 0) + strlen(value) + strlen(name) + 3;
+            char *args = malloc(length);
+            sprintf(args, "%s%s%s@%s", phi->arg2 ? phi->arg2 : "", phi->arg2 ? "," : "", value, name);
+            phi->arg2 = args;
+        }
+    }
+
+    for (int c = 0; c < block->dom_child_count; c++)
+    {
+        ssa_rename_block(state, block->dom_children[c]);
+    }
+
+    memcpy(state->depth, saved, sizeof(int) * (state->var_count + 1));
+    free(saved);
+}
+
+// 把函数中的局部变量转换为 SSA 形式, 返回插入的 phi 数
+int construct_ssa_range(int start, int end)
+{
+    if (!is_function_range(start))
+        return 0;
+    end += ssa_label_blocks(start, end);
+
+    SSAState state;
+    memset(&state, 0, sizeof(state));
+    string_map_init(&state.vars, 16);
+    char **names = NULL;
+    for (int i = start; i < end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        const char *name = ir_is(ins, "load") || ir_is(ins, "param") ? ins->arg1 : ir_is(ins, "store") ? ins->result : NULL;
+        if (name != NULL && string_map_get(&state.vars, name) < 0 && !is_global_var(name))
+        {
+            names = realloc(names, sizeof(char *) * (state.var_count + 1));
+            names[state.var_count] = (char *)name;
+            string_map_put(&state.vars, name, state.var_count++);
+        }
+    }
+    if (state.var_count == 0)
+    {
+        string_map_free(&state.vars);
+        return 0;
+    }
+
+    ControlFlowGraph *cfg = build_cfg(start, end);
+    int n = cfg->block_count;
+
+    // 定义块, 以及在块内先读后写的变量 (只有它们可能需要 phi)
+    char *defined = calloc((size_t)state.var_count * n, 1);
+    int *needs_phi = calloc(state.var_count, sizeof(int));
+    int *killed = calloc(state.var_count, sizeof(int));
+    for (int v = 0; v < state.var_count; v++)
+        defined[(size_t)v * n] = 1;
+    for (int b = 0; b < n; b++)
+    {
+        for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++)
+        {
+            IRInstruction *ins = &ir_code[i];
+            if (ir_is(ins, "load"))
+            {
+                int v = string_map_get(&state.vars, ins->arg1);
+                if (v >= 0 && killed[v] != b + 1)
+                    needs_phi[v] = 1;
+            }
+            else if (ir_is(ins, "store"))
+            {
+                int v = string_map_get(&state.vars, ins->result);
+                if (v >= 0)
+                {
+                    killed[v] = b + 1;
+                    defined[(size_t)v * n + b] = 1;
+                }
+            }
+        }
+    }
+
+    // 在迭代支配边界上放置 phi
+    int *frontier_count;
+    int **frontier = dominance_frontiers(cfg, &frontier_count);
+    int *has_phi = calloc(n, sizeof(int));
+    int *queued = calloc(n, sizeof(int));
+    int *worklist = malloc(sizeof(int) * n);
+    IRInstruction **phis = calloc(n, sizeof(IRInstruction *));
+    int *phi_count = calloc(n, sizeof(int));
+    int total = 0;
+    for (int v = 0; v < state.var_count; v++)
+    {
+        if (!needs_phi[v])
+            continue;
+        int count = 0;
+        for (int b = 0; b < n; b++)
+        {
+            if (defined[(size_t)v * n + b] && cfg->blocks[b].idom != -1)
+            {
+                queued[b] = v + 1;
+                worklist[count++] = b;
+            }
+        }
+        while (count > 0)
+        {
+            int x = worklist[--count];
+            for (int k = 0; k < frontier_count[x]; k++)
+            {
+                int d = frontier[x][k];
+                if (has_phi[d] == v + 1)
+                    continue;
+                has_phi[d] = v + 1;
+                ir_list_append(&phis[d], &phi_count[d], "phi", names[v], NULL, new_temp());
+                total++;
+                if (queued[d] != v + 1)
+                {
+                    queued[d] = v + 1;
+                    worklist[count++] = d;
+                }
+            }
+        }
+    }
+
+    // 入口处读取每个变量的初值 (参数或 nil)
+    IRInstruction *initial = NULL;
+    int initial_count = 0;
+    string_map_init(&state.initial, state.var_count);
+    for (int v = 0; v < state.var_count; v++)
+    {
+        char *temp = new_temp();
+        ir_list_append(&initial, &initial_count, "load", names[v], NULL, temp);
+        string_map_put(&state.initial, temp, v);
+    }
+    int initial_at = cfg->blocks[0].start;
+    if (ir_is(&ir_code[initial_at], "label"))
+        initial_at++;
+    while (initial_at < cfg->blocks[0].end && ir_is(&ir_code[initial_at], "param"))
+        initial_at++;
+
+    for (int b = n - 1; b > 0; b--)
+    {
+        ir_insert(cfg->blocks[b].start + 1, phis[b], phi_count[b]);
+        end += phi_count[b];
+        free(phis[b]);
+    }
+    ir_insert(initial_at, initial, initial_count);
+    end += initial_count;
+
+    for (int b = 0; b < n; b++)
+        free(frontier[b]);
+    free(frontier);
+    free(frontier_count);
+    free(has_phi);
+    free(queued);
+    free(worklist);
+    free(phis);
+    free(phi_count);
+    free(initial);
+    free(defined);
+    free(needs_phi);
+    free(killed);
+    free_cfg(cfg);
+
+    // 重命名
+    state.cfg = build_cfg(start, end);
+    state.stacks = calloc(state.var_count, sizeof(char **));
+    state.depth = calloc(state.var_count + 1, sizeof(int));
+    state.replacement = calloc(temp_counter + 1, sizeof(char *));
+    ssa_rename_block(&state, 0);
+    for (int i = start; i < end; i++)
+    {
+        rewrite_uses(&ir_code[i], state.replacement);
+    }
+
+    for (int v = 0; v < state.var_count; v++)
+        free(state.stacks[v]);
+    free(state.stacks);
+    free(state.depth);
+    free(state.replacement);
+    free(names);
+    free_cfg(state.cfg);
+    string_map_free(&state.vars);
+    string_map_free(&state.initial);
+    return total;
+}
+
+// 稀疏条件常量传播的格: 未定 < 常量 < 不确定
+enum
+{
+    LATTICE_TOP,
+    LATTICE_CONST,
+    LATTICE_BOTTOM
+};
+
+typedef struct
+{
+    int state;
+    char *value;
+} LatticeCell;
+
+typedef struct
+{
+    ControlFlowGraph *cfg;
+    int *block_of;
+    LatticeCell *cells;  // 按临时变量编号
+    int **edge_live;     // edge_live[b][p]: 从第 p 个前驱到 b 的边是否可执行
+    int *visited;        // 块是否已经可执行
+    int **users;         // 使用每个临时变量的指令
+    int *user_count;
+    int *flow;           // 待处理的块 (新增了可执行的入边)
+    int flow_count;
+    int *ssa;            // 待重新计算的指令
+    int ssa_count;
+    int ssa_capacity;
+} SCCPState;
+
+// phi 的参数表 %1@L1,%2@L2 拆分为值和来源块
+int phi_operands(ControlFlowGraph *cfg, IRInstruction *phi, char ***values, int **blocks)
+{
+    int count = 0;
+    *values = NULL;
+    *blocks = NULL;
+    if (phi->arg2 == NULL)
+        return 0;
+    char *list = strdup(phi->arg2);
+    for (char *item = strtok(list, ","); item != NULL; item = strtok(NULL, ","))
+    {
+        char *at = strchr(item, '@');
+        *at = '\0';
+        *values = realloc(*values, sizeof(char *) * (count + 1));
+        *blocks = realloc(*blocks, sizeof(int) * (count + 1));
+        (*values)[count] = strdup(item);
+        (*blocks)[count] = ssa_block_of_name(cfg, at + 1);
+        count++;
+    }
+    free(list);
+    return count;
+}
+
+void phi_operands_free(char **values, int *blocks, int count)
+{
+    for (int k = 0; k < count; k++)
+        free(values[k]);
+    free(values);
+    free(blocks);
+}
+
+LatticeCell sccp_cell(SCCPState *state, const char *temp)
+{
+    LatticeCell bottom = {LATTICE_BOTTOM, NULL};
+    return is_temp(temp) ? state->cells[temp_index(temp)] : bottom;
+}
+
+int sccp_edge_index(ControlFlowGraph *cfg, int from, int to)
+{
+    for (int p = 0; p < cfg->blocks[to].pred_count; p++)
+    {
+        if (cfg->blocks[to].preds[p] == from)
+            return p;
+    }
+    return -1;
+}
+
+void sccp_mark_edge(SCCPState *state, int from, int to)
+{
+    int p = sccp_edge_index(state->cfg, from, to);
+    if (p < 0 || state->edge_live[to][p])
+        return;
+    state->edge_live[to][p] = 1;
+    state->flow[state->flow_count++] = to;
+}
+
+// 格值只能下降, 下降时把使用者加入工作表
+void sccp_lower(SCCPState *state, const char *temp, int level, char *value)
+{
+    LatticeCell *cell = &state->cells[temp_index(temp)];
+    if (level <= cell->state)
+        return;
+    cell->state = level;
+    cell->value = value;
+    int t = temp_index(temp);
+    for (int k = 0; k < state->user_count[t]; k++)
+    {
+        if (state->ssa_count == state->ssa_capacity)
+        {
+            state->ssa_capacity = state->ssa_capacity == 0 ? 64 : state->ssa_capacity * 2;
+            state->ssa = realloc(state->ssa, sizeof(int) * state->ssa_capacity);
+        }
+        state->ssa[state->ssa_count++] = state->users[t][k];
+    }
+}
+
+int is_number_literal(const char *s)
+{
+    return s != NULL && (isdigit((unsigned char)s[0]) || (s[0] == '-' && isdigit((unsigned char)s[1])));
+}
+
+// 按块末尾的指令决定哪些出边可执行
+void sccp_block_edges(SCCPState *state, int b)
+{
+    BasicBlock *block = &state->cfg->blocks[b];
+    IRInstruction *last = &ir_code[block->end - 1];
+    if (ir_is(last, "if_false"))
+    {
+        LatticeCell c = sccp_cell(state, last->arg1);
+        if (c.state == LATTICE_TOP)
+            return;
+        int target = cfg_block_of_label(state->cfg, last->arg2);
+        int taken = c.state == LATTICE_BOTTOM || !is_number_literal(c.value) || atof(c.value) == 0;
+        int falls = c.state == LATTICE_BOTTOM || !is_number_literal(c.value) || atof(c.value) != 0;
+        if (taken && target >= 0)
+            sccp_mark_edge(state, b, target);
+        if (falls && b + 1 < state->cfg->block_count)
+            sccp_mark_edge(state, b, b + 1);
+        return;
+    }
+    for (int s = 0; s < block->succ_count; s++)
+    {
+        sccp_mark_edge(state, b, block->succs[s]);
+    }
+}
+
+void sccp_evaluate(SCCPState *state, int i)
+{
+    IRInstruction *ins = &ir_code[i];
+    if (ir_is(ins, "phi"))
+    {
+        char **values;
+        int *blocks;
+        int count = phi_operands(state->cfg, ins, &values, &blocks);
+        int b = state->block_of[i - state->cfg->start];
+        int level = LATTICE_TOP;
+        char *value = NULL;
+        for (int k = 0; k < count && level != LATTICE_BOTTOM; k++)
+        {
+            int p = blocks[k] >= 0 ? sccp_edge_index(state->cfg, blocks[k], b) : -1;
+            if (p < 0 || !state->edge_live[b][p])
+                continue;
+            LatticeCell c = sccp_cell(state, values[k]);
+            if (c.state == LATTICE_CONST && (level == LATTICE_TOP || strcmp(value, c.value) == 0))
+            {
+                level = LATTICE_CONST;
+                value = c.value;
+            }
+            else if (c.state != LATTICE_TOP)
+                level = LATTICE_BOTTOM;
+        }
+        phi_operands_free(values, blocks, count);
+        sccp_lower(state, ins->result, level, value);
+        return;
+    }
+
+    if (ir_is_branch(ins))
+    {
+        sccp_block_edges(state, state->block_of[i - state->cfg->start]);
+        return;
+    }
+    if (!ir_has_def(ins->op) || !is_temp(ins->result))
+        return;
+
+    if (ir_is(ins, "load_const"))
+    {
+        sccp_lower(state, ins->result, LATTICE_CONST, ins->arg1);
+    }
+    else if (ir_is_binary(ins->op))
+    {
+        LatticeCell a = sccp_cell(state, ins->arg1);
+        LatticeCell b = sccp_cell(state, ins->arg2);
+        char value[128];
+        if (a.state == LATTICE_BOTTOM || b.state == LATTICE_BOTTOM)
+            sccp_lower(state, ins->result, LATTICE_BOTTOM, NULL);
+        else if (a.state == LATTICE_CONST && b.state == LATTICE_CONST)
+        {
+            if (is_number_literal(a.value) && is_number_literal(b.value) && fold_binary(ins->op, a.value, b.value, value))
+                sccp_lower(state, ins->result, LATTICE_CONST, strdup(value));
+            else
+                sccp_lower(state, ins->result, LATTICE_BOTTOM, NULL);
+        }
+    }
+    else
+    {
+        sccp_lower(state, ins->result, LATTICE_BOTTOM, NULL);
+    }
+}
+
+// 在 SSA 形式上同时传播常量和可执行边 (Wegman-Zadeck), 返回改写的指令数
+int sccp_range(int start, int end)
+{
+    if (!is_function_range(start))
+        return 0;
+
+    SCCPState state;
+    memset(&state, 0, sizeof(state));
+    state.cfg = build_cfg(start, end);
+    ControlFlowGraph *cfg = state.cfg;
+    state.block_of = instruction_blocks(cfg);
+    state.cells = calloc(temp_counter + 1, sizeof(LatticeCell));
+    state.edge_live = malloc(sizeof(int *) * cfg->block_count);
+    for (int b = 0; b < cfg->block_count; b++)
+        state.edge_live[b] = calloc(cfg->blocks[b].pred_count + 1, sizeof(int));
+    state.visited = calloc(cfg->block_count, sizeof(int));
+    state.flow = malloc(sizeof(int) * (cfg->block_count * 2 + 1));
+
+    // 定义-使用链
+    state.users = calloc(temp_counter + 1, sizeof(int *));
+    state.user_count = calloc(temp_counter + 1, sizeof(int));
+    for (int i = start; i < end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        char *used[3] = {NULL, NULL, NULL};
+        char **values = NULL;
+        int *blocks = NULL;
+        int count = 0;
+        if (ir_is(ins, "phi"))
+            count = phi_operands(cfg, ins, &values, &blocks);
+        else
+        {
+            int mask = ir_use_mask(ins->op);
+            char *fields[3] = {ins->arg1, ins->arg2, ins->result};
+            for (int f = 0; f < 3; f++)
+            {
+                if (mask & (1 << f))
+                    used[count++] = fields[f];
+            }
+            values = used;
+        }
+        for (int k = 0; k < count; k++)
+        {
+            if (!is_temp(values[k]))
+                continue;
+            int t = temp_index(values[k]);
+            state.users[t] = realloc(state.users[t], sizeof(int) * (state.user_count[t] + 1));
+            state.users[t][state.user_count[t]++] = i;
+        }
+        if (ir_is(ins, "phi"))
+            phi_operands_free(values, blocks, count);
+    }
+
+    // 入口块无条件可执行
+    state.flow[state.flow_count++] = 0;
+    while (state.flow_count > 0 || state.ssa_count > 0)
+    {
+        if (state.flow_count > 0)
+        {
+            int b = state.flow[--state.flow_count];
+            BasicBlock *block = &cfg->blocks[b];
+            for (int i = block->start; i < block->end; i++)
+            {
+                if (ir_is(&ir_code[i], "phi"))
+                    sccp_evaluate(&state, i);
+            }
+            if (state.visited[b])
+                continue;
+            state.visited[b] = 1;
+            for (int i = block->start; i < block->end; i++)
+            {
+                if (!ir_is(&ir_code[i], "phi"))
+                    sccp_evaluate(&state, i);
+            }
+            if (!ir_is_branch(&ir_code[block->end - 1]))
+                sccp_block_edges(&state, b);
+        }
+        else
+        {
+            int i = state.ssa[--state.ssa_count];
+            if (state.visited[state.block_of[i - start]])
+                sccp_evaluate(&state, i);
+        }
+    }
+
+    // 改写: 常量值变成 load_const, 常量条件分支变成 goto, 不可执行的块和边删除
+    int total = 0;
+    for (int b = 0; b < cfg->block_count; b++)
+    {
+        BasicBlock *block = &cfg->blocks[b];
+        for (int i = block->start; i < block->end; i++)
+        {
+            IRInstruction *ins = &ir_code[i];
+            if (!state.visited[b])
+            {
+                if (!ir_is(ins, "nop"))
+                {
+                    ir_make_nop(ins);
+                    total++;
+                }
+                continue;
+            }
+
+            if (ir_has_def(ins->op) && is_temp(ins->result) && !ir_is(ins, "load_const"))
+            {
+                LatticeCell c = state.cells[temp_index(ins->result)];
+                if (c.state == LATTICE_CONST)
+                {
+                    ir_set(ins, "load_const", c.value, NULL, ins->result);
+                    total++;
+                    continue;
+                }
+            }
+
+            if (ir_is(ins, "if_false"))
+            {
+                LatticeCell c = sccp_cell(&state, ins->arg1);
+                if (c.state == LATTICE_CONST && is_number_literal(c.value))
+                {
+                    if (atof(c.value) == 0)
+                        ir_set(ins, "goto", ins->arg2, NULL, NULL);
+                    else
+                        ir_make_nop(ins);
+                    total++;
+                }
+            }
+            else if (ir_is(ins, "phi"))
+            {
+                // 只保留可执行入边的参数
+                char **values;
+                int *blocks;
+                int count = phi_operands(cfg, ins, &values, &blocks);
+                char *args = calloc(1, strlen(ins->arg2) + 1);
+                for (int k = 0; k < count; k++)
+                {
+                    int p = blocks[k] >= 0 ? sccp_edge_index(cfg, blocks[k], b) : -1;
+                    if (p < 0 || !state.edge_live[b][p])
+                        continue;
+                    sprintf(args + strlen(args), "%s%s@%s", args[0] ? "," : "", values[k], ssa_block_name(cfg, blocks[k]));
+                }
+                if (strcmp(args, ins->arg2) != 0)
+                    total++;
+                ins->arg2 = args;
+                phi_operands_free(values, blocks, count);
+            }
+        }
+    }
+
+    for (int t = 0; t <= temp_counter; t++)
+        free(state.users[t]);
+    free(state.users);
+    free(state.user_count);
+    for (int b = 0; b < cfg->block_count; b++)
+        free(state.edge_live[b]);
+    free(state.edge_live);
+    free(state.visited);
+    free(state.flow);
+    free(state.ssa);
+    free(state.cells);
+    free(state.block_of);
+    free_cfg(cfg);
+    return total;
+}
+
+// 离开 SSA: phi 的每个参数在对应前驱的末尾 (跳转之前) 存回原变量, phi 本身变为在汇合点读取该变量;
+// 同一变量的所有版本互不重叠, 同一前驱的各个后继需要的也是同一个值, 因此不需要拆分关键边
+int destruct_ssa_range(int start, int end)
+{
+    if (!is_function_range(start))
+        return 0;
+
+    ControlFlowGraph *cfg = build_cfg(start, end);
+
+    // 先删除没有使用者的 phi (包括只被其他死 phi 使用的)
+    int *uses = calloc(temp_counter + 1, sizeof(int));
+    for (int i = start; i < end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        char **values;
+        int *blocks;
+        if (ir_is(ins, "phi"))
+        {
+            int count = phi_operands(cfg, ins, &values, &blocks);
+            for (int k = 0; k < count; k++)
+                uses[temp_index(values[k])]++;
+            phi_operands_free(values, blocks, count);
+            continue;
+        }
+        int mask = ir_use_mask(ins->op);
+        char *fields[3] = {ins->arg1, ins->arg2, ins->result};
+        for (int f = 0; f < 3; f++)
+        {
+            if ((mask & (1 << f)) && is_temp(fields[f]))
+                uses[temp_index(fields[f])]++;
+        }
+    }
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        for (int i = start; i < end; i++)
+        {
+            IRInstruction *ins = &ir_code[i];
+            char **values;
+            int *blocks;
+            if (!ir_is(ins, "phi") || uses[temp_index(ins->result)] > 0)
+                continue;
+            int count = phi_operands(cfg, ins, &values, &blocks);
+            for (int k = 0; k < count; k++)
+                uses[temp_index(values[k])]--;
+            phi_operands_free(values, blocks, count);
+            ir_make_nop(ins);
+            changed = 1;
+        }
+    }
+    free(uses);
+
+    // 值本身就是从该变量读出的 (入口初值或另一个 phi), 变量中已经是这个值, 不必存回
+    StringMap read_from;
+    string_map_init(&read_from, 16);
+    for (int i = start; i < end; i++)
+    {
+        if ((ir_is(&ir_code[i], "load") || ir_is(&ir_code[i], "phi")) && is_temp(ir_code[i].result))
+            string_map_put(&read_from, ir_code[i].result, i);
+    }
+
+    int *insert_pos = NULL;
+    IRInstruction *insert_list = NULL;
+    int insert_count = 0;
+    int removed = 0;
+    for (int i = start; i < end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (!ir_is(ins, "phi"))
+            continue;
+        char **values;
+        int *blocks;
+        int count = phi_operands(cfg, ins, &values, &blocks);
+        for (int k = 0; k < count; k++)
+        {
+            int source = string_map_get(&read_from, values[k]);
+            if (source >= 0 && strcmp(ir_code[source].arg1, ins->arg1) == 0)
+                continue;
+            BasicBlock *pred = &cfg->blocks[blocks[k]];
+            int pos = ir_is_branch(&ir_code[pred->end - 1]) ? pred->end - 1 : pred->end;
+            int duplicate = 0;
+            for (int j = 0; j < insert_count; j++)
+                duplicate |= insert_pos[j] == pos && strcmp(insert_list[j].result, ins->arg1) == 0;
+            if (duplicate)
+                continue;
+            insert_pos = realloc(insert_pos, sizeof(int) * (insert_count + 1));
+            insert_pos[insert_count] = pos;
+            ir_list_append(&insert_list, &insert_count, "store", values[k], NULL, ins->arg1);
+        }
+        phi_operands_free(values, blocks, count);
+        ir_set(ins, "load", ins->arg1, NULL, ins->result);
+        removed++;
+    }
+    string_map_free(&read_from);
+    free_cfg(cfg);
+
+    // 从后往前插入, 位置相同的保持原顺序
+    for (int pos = end; pos >= start && insert_count > 0; pos--)
+    {
+        for (int j = insert_count - 1; j >= 0; j--)
+        {
+            if (insert_pos[j] == pos)
+                ir_insert(pos, &insert_list[j], 1);
+        }
+    }
+    free(insert_pos);
+    free(insert_list);
+    return removed;
+}
+
+int sparse_conditional_constant_propagation()
+{
+    for_each_function(construct_ssa_range);
+    int changed = for_each_function(sccp_range);
+    for_each_function(destruct_ssa_range);
+    ir_remove_nops();
+    return changed;
+}
+
+// ---------------- 类型推断 ----------------
+
+// 类型是值可能的运行时类型的集合, 每种类型一位; 0 表示还没有值到达, 只有一位时类型确定
+enum
+{
+    TYPE_NIL = 1,
+    TYPE_INT = 2,
+    TYPE_FLOAT = 4,
+    TYPE_STRING = 8,
+    TYPE_ARRAY = 16,
+    TYPE_MAP = 32,
+    TYPE_ANY = 63
+};
+
+typedef struct
+{
+    FunctionInfo *functions;
+    int function_count;
+    int **param_types; // 按函数: 每个形参在所有调用点的实参类型之并
+    int *return_types;
+    StringMap globals; // 全局变量可能在任何函数中被修改, 类型不跟踪
+    int *temp_types;   // 按临时变量编号, 所有定义的类型之并
+    int changed;
+} TypeInference;
+
+void type_join(TypeInference *ti, int *slot, int type)
+{
+    if ((*slot | type) != *slot)
+    {
+        *slot |= type;
+        ti->changed = 1;
+    }
+}
+
+// 常量的类型, 规则与 value_from_constant 相同
+int constant_type(const char *text)
+{
+    if (text[0] == '"')
+        return TYPE_STRING;
+    if (strcmp(text, "nil") == 0)
+        return TYPE_NIL;
+    return strchr(text, '.') != NULL ? TYPE_FLOAT : TYPE_INT;
+}
+
+// 二元运算的结果类型, 规则与 value.c 相同: 比较总是整数; 两个整数得整数, 其他数值组合得浮点数;
+// 加法有一边是字符串时拼接; 其余组合为 nil
+int binary_result_type(const char *op, int a, int b)
+{
+    if (strcmp(op, "lt") == 0 || strcmp(op, "gt") == 0 || strcmp(op, "le") == 0 || strcmp(op, "ge") == 0 ||
+        strcmp(op, "eq") == 0)
+        return a && b ? TYPE_INT : 0;
+    int result = 0;
+    for (int x = TYPE_NIL; x <= TYPE_MAP; x <<= 1)
+    {
+        for (int y = TYPE_NIL; y <= TYPE_MAP; y <<= 1)
+        {
+            if (!(a & x) || !(b & y))
+                continue;
+            if (x == TYPE_INT && y == TYPE_INT)
+                result |= TYPE_INT;
+            else if ((x | y) == TYPE_FLOAT || (x | y) == (TYPE_INT | TYPE_FLOAT))
+                result |= TYPE_FLOAT;
+            else if (strcmp(op, "add") == 0 && (x == TYPE_STRING || y == TYPE_STRING))
+                result |= TYPE_STRING;
+            else
+                result |= TYPE_NIL;
+        }
+    }
+    return result;
+}
+
+int type_of(TypeInference *ti, const char *temp)
+{
+    return is_temp(temp) ? ti->temp_types[temp_index(temp)] : constant_type(temp);
+}
+
+// 调用: 实参类型并入被调函数的形参, 返回被调函数的返回类型
+int type_call(TypeInference *ti, const char *name, int *args, int argc)
+{
+    if (strcmp(name, "print") == 0)
+        return TYPE_NIL;
+    if (strcmp(name, "read") == 0)
+        return TYPE_NIL | TYPE_INT | TYPE_FLOAT | TYPE_STRING;
+    int f = find_function_info(ti->functions, ti->function_count, name);
+    if (f < 0)
+        return TYPE_ANY;
+    for (int k = 0; k < ti->functions[f].param_count; k++)
+        type_join(ti, &ti->param_types[f][k], k < argc ? args[k] : TYPE_NIL);
+    return ti->return_types[f];
+}
+
+// 分析区间 [start, end), f 是所在函数的编号, 全局代码为 -1
+// 局部变量的类型沿控制流传播 (流敏感), 在汇合处取并; 临时变量取所有定义之并
+void type_range(TypeInference *ti, int f, int start, int end)
+{
+    if (start >= end)
+    {
+        if (f >= 0)
+            type_join(ti, &ti->return_types[f], TYPE_NIL);
+        return;
+    }
+    ControlFlowGraph *cfg = build_cfg(start, end);
+    StringMap vars;
+    string_map_init(&vars, 16);
+    int var_count = 0;
+    for (int i = start; i < end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        const char *name = ir_is(ins, "param") || ir_is(ins, "load") ? ins->arg1 : ir_is(ins, "store") ? ins->result : NULL;
+        if (name != NULL && string_map_get(&ti->globals, name) < 0 && string_map_get(&vars, name) < 0)
+            string_map_put(&vars, name, var_count++);
+    }
+
+    // 入口: 形参是调用点的实参类型, 其他局部变量是 nil
+    // 与全局变量同名的形参生成 IR 前已经改名 (rename_shadowing_params), 不是局部变量的形参跳过
+    int n = var_count > 0 ? var_count : 1;
+    int *entry = malloc(sizeof(int) * n);
+    for (int v = 0; v < var_count; v++)
+        entry[v] = TYPE_NIL;
+    int param = 0;
+    for (int i = start; i < end && f >= 0; i++)
+    {
+        if (!ir_is(&ir_code[i], "param"))
+            continue;
+        int v = string_map_get(&vars, ir_code[i].arg1);
+        if (v >= 0)
+            entry[v] = ti->param_types[f][param];
+        param++;
+    }
+
+    int *out = calloc(cfg->block_count * n, sizeof(int));
+    int *state = malloc(sizeof(int) * n);
+    int *args = NULL;
+    int arg_count = 0;
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        for (int k = 0; k < cfg->order_count; k++)
+        {
+            int b = cfg->order[k];
+            BasicBlock *block = &cfg->blocks[b];
+            for (int v = 0; v < var_count; v++)
+                state[v] = b == 0 ? entry[v] : 0;
+            for (int p = 0; p < block->pred_count; p++)
+            {
+                for (int v = 0; v < var_count; v++)
+                    state[v] |= out[block->preds[p] * n + v];
+            }
+
+            arg_count = 0;
+            for (int i = block->start; i < block->end; i++)
+            {
+                IRInstruction *ins = &ir_code[i];
+                const char *op = ins->op;
+                int *result = ir_has_def(op) && is_temp(ins->result) ? &ti->temp_types[temp_index(ins->result)] : NULL;
+                if (strcmp(op, "load") == 0)
+                {
+                    int v = string_map_get(&vars, ins->arg1);
+                    type_join(ti, result, v >= 0 ? state[v] : TYPE_ANY);
+                }
+                else if (strcmp(op, "store") == 0)
+                {
+                    int v = string_map_get(&vars, ins->result);
+                    if (v >= 0)
+                        state[v] = type_of(ti, ins->arg1);
+                }
+                else if (strcmp(op, "load_const") == 0)
+                    type_join(ti, result, constant_type(ins->arg1));
+                else if (ir_is_binary(op))
+                    type_join(ti, result, binary_result_type(op, type_of(ti, ins->arg1), type_of(ti, ins->arg2)));
+                else if (strcmp(op, "move") == 0 || strcmp(op, "string_builder") == 0)
+                    type_join(ti, result, type_of(ti, ins->arg1));
+                else if (strcmp(op, "string_append") == 0)
+                    type_join(ti, result, binary_result_type("add", type_of(ti, ins->arg1), type_of(ti, ins->arg2)));
+                else if (strcmp(op, "new_array") == 0)
+                    type_join(ti, result, TYPE_ARRAY);
+                else if (strcmp(op, "new_map") == 0)
+                    type_join(ti, result, TYPE_MAP);
+                else if (strcmp(op, "array_length") == 0)
+                    type_join(ti, result, TYPE_INT);
+                else if (strcmp(op, "arg") == 0)
+                {
+                    args = realloc(args, sizeof(int) * (arg_count + 1));
+                    args[arg_count++] = type_of(ti, ins->arg1);
+                }
+                else if (strcmp(op, "call_function") == 0 || strcmp(op, "tail_call") == 0 ||
+                         strcmp(op, "parallel_for") == 0 || strcmp(op, "spawn") == 0)
+                {
+                    // parallel_for 的前几个实参就是循环体函数的形参, 结果是循环体函数的返回值或 end (整数)
+                    // spawn 的实参同样是函数的形参, 结果是任务
+                    int argc = atoi(ins->arg2);
+                    if (argc > arg_count)
+                        argc = arg_count;
+                    arg_count -= argc;
+                    int type = type_call(ti, ins->arg1, args + arg_count, argc);
+                    if (strcmp(op, "spawn") == 0)
+                        type_join(ti, result, TYPE_ANY);
+                    else if (result != NULL)
+                        type_join(ti, result, type);
+                    else if (f >= 0)
+                        type_join(ti, &ti->return_types[f], type);
+                }
+                else if (strcmp(op, "parallel_apply") == 0)
+                {
+                    // 函数的实参是数组的元素和累积值, 类型未知
+                    int any[2] = {TYPE_ANY, TYPE_ANY};
+                    int argc = atoi(ins->arg2);
+                    arg_count -= argc < arg_count ? argc : arg_count;
+                    type_call(ti, ins->arg1, any, 2);
+                    type_join(ti, result, TYPE_ANY);
+                }
+                else if (strcmp(op, "return") == 0 && f >= 0)
+                    type_join(ti, &ti->return_types[f], ins->arg1 != NULL ? type_of(ti, ins->arg1) : TYPE_NIL);
+                else if (result != NULL)
+                    type_join(ti, result, TYPE_ANY);
+            }
+
+            for (int v = 0; v < var_count; v++)
+            {
+                if (out[b * n + v] != state[v])
+                {
+                    out[b * n + v] = state[v];
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    // 执行到区间末尾时返回 nil
+    IRInstruction *last = &ir_code[end - 1];
+    if (f >= 0 && !ir_is_exit(last) && !ir_is(last, "goto"))
+        type_join(ti, &ti->return_types[f], TYPE_NIL);
+
+    free(args);
+    free(state);
+    free(out);
+    free(entry);
+    string_map_free(&vars);
+    free_cfg(cfg);
+}
+
+// 类型确定的运算改写为专用指令: 两个整数 -> *_i64, 两个浮点数 -> *_f64, 有一边是字符串的加法 -> concat
+// 专用指令不再检查类型标签; 类型不确定的运算保持原样, 由带类型检查的通用指令处理
+const char *typed_binary(const char *op, int a, int b)
+{
+    static const char *int_ops[][2] = {{"add", "add_i64"}, {"sub", "sub_i64"}, {"mul", "mul_i64"}, {"lt", "lt_i64"},
+                                       {"gt", "gt_i64"},   {"le", "le_i64"},   {"ge", "ge_i64"},   {"eq", "eq_i64"}};
+    static const char *float_ops[][2] = {{"add", "add_f64"}, {"sub", "sub_f64"}, {"mul", "mul_f64"}, {"div", "div_f64"}};
+    if (a == TYPE_INT && b == TYPE_INT)
+    {
+        for (int k = 0; k < 8; k++)
+        {
+            if (strcmp(op, int_ops[k][0]) == 0)
+                return int_ops[k][1];
+        }
+    }
+    if (a == TYPE_FLOAT && b == TYPE_FLOAT)
+    {
+        for (int k = 0; k < 4; k++)
+        {
+            if (strcmp(op, float_ops[k][0]) == 0)
+                return float_ops[k][1];
+        }
+    }
+    if (strcmp(op, "add") == 0 && (a == TYPE_STRING || b == TYPE_STRING))
+        return "concat";
+    return NULL;
+}
+
+// 全程序类型推断: 形参类型来自所有调用点, 返回类型来自所有 return, 反复分析直到不再变化
+void type_analyze(TypeInference *ti)
+{
+    memset(ti, 0, sizeof(*ti));
+    ti->functions = collect_functions(&ti->function_count);
+    ti->param_types = calloc(ti->function_count + 1, sizeof(int *));
+    ti->return_types = calloc(ti->function_count + 1, sizeof(int));
+    for (int f = 0; f < ti->function_count; f++)
+    {
+        ti->param_types[f] = calloc(ti->functions[f].param_count + 1, sizeof(int));
+        // main 由运行时不带实参调用
+        if (strcmp(ti->functions[f].name, "main") == 0)
+        {
+            for (int k = 0; k < ti->functions[f].param_count; k++)
+                ti->param_types[f][k] = TYPE_NIL;
+        }
+    }
+    ti->temp_types = calloc(temp_counter + 1, sizeof(int));
+    string_map_init(&ti->globals, 16);
+    for (int i = 0; i < ir_count; i++)
+    {
+        if (ir_is(&ir_code[i], "function"))
+            i = find_function_end(i);
+        else if (ir_is(&ir_code[i], "alloc"))
+            string_map_put(&ti->globals, ir_code[i].arg1, 1);
+    }
+
+    do
+    {
+        ti->changed = 0;
+        int i = 0;
+        while (i < ir_count)
+        {
+            if (ir_is(&ir_code[i], "function"))
+            {
+                int end = find_function_end(i);
+                type_range(ti, find_function_info(ti->functions, ti->function_count, ir_code[i].arg1), i + 1, end);
+                i = end + 1;
+            }
+            else
+            {
+                int end = i;
+                while (end < ir_count && !ir_is(&ir_code[end], "function"))
+                    end++;
+                type_range(ti, -1, i, end);
+                i = end;
+            }
+        }
+    } while (ti->changed);
+}
+
+void type_free(TypeInference *ti)
+{
+    for (int f = 0; f < ti->function_count; f++)
+    {
+        free(ti->param_types[f]);
+        free(ti->functions[f].params);
+    }
+    free(ti->param_types);
+    free(ti->return_types);
+    free(ti->functions);
+    free(ti->temp_types);
+    string_map_free(&ti->globals);
+}
+
+int type_inference()
+{
+    TypeInference ti;
+    type_analyze(&ti);
+
+    int changed = 0;
+    for (int i = 0; i < ir_count; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (!ir_is_binary(ins->op) || !is_temp(ins->arg1) || !is_temp(ins->arg2))
+            continue;
+        const char *typed = typed_binary(ins->op, type_of(&ti, ins->arg1), type_of(&ti, ins->arg2));
+        if (typed != NULL)
+        {
+            ir_set(ins, typed, ins->arg1, ins->arg2, ins->result);
+            changed++;
+        }
+    }
+
+    type_free(&ti);
+    return changed;
+}
+
+// 字符串构建器 (见 pseudo.c) 按语句的形式生成, 不知道类型; 操作数不可能是字符串时 (如 sum = sum + i)
+// string_append 改回 add, string_builder 改为 move, 之后的优化和类型推断照常处理
+int lower_string_builders()
+{
+    int found = 0;
+    for (int i = 0; i < ir_count && !found; i++)
+        found = ir_is(&ir_code[i], "string_builder");
+    if (!found)
+        return 0;
+
+    TypeInference ti;
+    type_analyze(&ti);
+    int changed = 0;
+    for (int i = 0; i < ir_count; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (ir_is(ins, "string_append") && !((type_of(&ti, ins->arg1) | type_of(&ti, ins->arg2)) & TYPE_STRING))
+        {
+            ir_set(ins, "add", ins->arg1, ins->arg2, ins->result);
+            changed++;
+        }
+        else if (ir_is(ins, "string_builder") && !(type_of(&ti, ins->arg1) & TYPE_STRING))
+        {
+            ir_set(ins, "move", ins->arg1, NULL, ins->result);
+            changed++;
+        }
+    }
+    type_free(&ti);
+    return changed;
+}
+
+// ---------------- 循环向量化 ----------------
+
+// 形如 for (i: s, n) { a[i] = b[i] + c[i]; } 的循环经过越界检查消除后, 无检查的副本中
+// 只剩以循环变量为下标的数组读写和逐元素运算, 不同迭代之间没有依赖;
+// 这样的循环体整体改写为一次内置函数 $vector 的调用, 由运行时按段用 SIMD 执行 (见 value.c 的 vector_loop)
+// 循环头的判断保留, 调用返回时循环变量已经是终值, 回到循环头后判断失败而退出;
+// 检查没通过时仍执行原来带检查的标量循环
+int vectorize_max_steps = 32;
+
+// 逐元素运算在程序文本中的名字, 类型推断改写出的专用指令按通用运算处理
+const char *vector_op_name(const char *op)
+{
+    static const char *ops[] = {"add", "sub", "mul", "div", "lt", "gt", "le", "ge", "eq"};
+    for (int k = 0; k < (int)(sizeof(ops) / sizeof(ops[0])); k++)
+    {
+        size_t length = strlen(ops[k]);
+        if (strncmp(op, ops[k], length) == 0 &&
+            (op[length] == '\0' || strcmp(op + length, "_i64") == 0 || strcmp(op + length, "_f64") == 0))
+            return ops[k];
+    }
+    return NULL;
+}
+
+typedef struct
+{
+    char program[1024];
+    int length;
+    int step_count;
+    StringMap registers; // 循环体中定义的临时变量 -> 寄存器编号
+    char **operands;     // 循环外定义的临时变量, 按实参顺序
+    int operand_count;
+    int index_register;
+} VectorBuilder;
+
+void vector_append(VectorBuilder *v, const char *format, int a, int b)
+{
+    if (v->length > 0 && v->length < (int)sizeof(v->program))
+        v->length += snprintf(v->program + v->length, sizeof(v->program) - v->length, "; ");
+    if (v->length < (int)sizeof(v->program))
+        v->length += snprintf(v->program + v->length, sizeof(v->program) - v->length, format, a, b);
+    v->step_count++;
+}
+
+int vector_operand(VectorBuilder *v, const char *temp)
+{
+    for (int k = 0; k < v->operand_count; k++)
+    {
+        if (strcmp(v->operands[k], temp) == 0)
+            return k;
+    }
+    v->operands = realloc(v->operands, sizeof(char *) * (v->operand_count + 1));
+    v->operands[v->operand_count] = (char *)temp;
+    return v->operand_count++;
+}
+
+// 临时变量是否在 [from, to) 中定义
+int temp_defined_in(const char *temp, int from, int to)
+{
+    for (int i = from; i < to; i++)
+    {
+        if (ir_has_def(ir_code[i].op) && ir_code[i].result && strcmp(ir_code[i].result, temp) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// 运算数所在的寄存器: 循环变量, 循环体中已计算的值, 或循环 [from, to) 外的不变量; 循环中其他位置定义的值返回 -1
+int vector_register(VectorBuilder *v, const char *temp, const char *index, int from, int to)
+{
+    if (!is_temp(temp))
+        return -1;
+    if (strcmp(temp, index) == 0)
+    {
+        if (v->index_register < 0)
+        {
+            v->index_register = v->step_count;
+            vector_append(v, "index", 0, 0);
+        }
+        return v->index_register;
+    }
+    int reg = string_map_get(&v->registers, temp);
+    if (reg >= 0 || temp_defined_in(temp, from, to))
+        return reg;
+    reg = v->step_count;
+    vector_append(v, "const %d", vector_operand(v, temp), 0);
+    string_map_put(&v->registers, temp, reg);
+    return reg;
+}
+
+// 循环读写的数组: 循环外定义的临时变量
+int vector_array(const char *temp, const char *index, int from, int to)
+{
+    return is_temp(temp) && strcmp(temp, index) != 0 && !temp_defined_in(temp, from, to);
+}
+
+// 临时变量在 [start, end) 中除 [from, to) 以外的位置是否被使用
+int temp_used_outside(const char *temp, int start, int end, int from, int to)
+{
+    for (int i = start; i < end; i++)
+    {
+        if (i >= from && i < to)
+            continue;
+        IRInstruction *ins = &ir_code[i];
+        int mask = ir_use_mask(ins->op);
+        if (((mask & 1) && ins->arg1 && strcmp(ins->arg1, temp) == 0) ||
+            ((mask & 2) && ins->arg2 && strcmp(ins->arg2, temp) == 0) ||
+            ((mask & 4) && ins->result && strcmp(ins->result, temp) == 0))
+            return 1;
+    }
+    return 0;
+}
+
+// 从 header 处的标签开始匹配循环:
+//   label L; load i tI; lt tI tN tC; if_false tC exit; 循环体; add tI t1 tJ; store tJ i; goto L
+// 改写成功时返回插入的指令数 (原循环体变为 nop), 否则返回 0
+int vectorize_loop(int start, int end, int header)
+{
+    if (header + 4 >= end)
+        return 0;
+    IRInstruction *load = &ir_code[header + 1];
+    IRInstruction *test = &ir_code[header + 2];
+    IRInstruction *branch = &ir_code[header + 3];
+    if (!ir_is(load, "load") || !is_temp(load->result) || (!ir_is(test, "lt") && !ir_is(test, "lt_i64")) ||
+        strcmp(test->arg1, load->result) != 0 || !ir_is(branch, "if_false") || strcmp(branch->arg1, test->result) != 0)
+        return 0;
+
+    int latch = header + 4;
+    while (latch < end && !ir_is(&ir_code[latch], "goto") && !ir_is(&ir_code[latch], "label") &&
+           !ir_is(&ir_code[latch], "if_false"))
+        latch++;
+    if (latch >= end || !ir_is(&ir_code[latch], "goto") || strcmp(ir_code[latch].arg1, ir_code[header].arg1) != 0 ||
+        latch - (header + 4) < 3)
+        return 0;
+
+    // 循环变量每次加 1, 1 在循环外只由常量定义
+    const char *var = load->arg1;
+    const char *index = load->result;
+    const char *bound = test->arg2;
+    IRInstruction *step = &ir_code[latch - 2];
+    IRInstruction *advance = &ir_code[latch - 1];
+    if ((!ir_is(step, "add") && !ir_is(step, "add_i64")) || strcmp(step->arg1, index) != 0 ||
+        !ir_is(advance, "store") || strcmp(advance->arg1, step->result) != 0 || strcmp(advance->result, var) != 0)
+        return 0;
+    if (temp_defined_in(bound, header, latch + 1))
+        return 0;
+    for (int i = start; i < end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (ir_has_def(ins->op) && ins->result && strcmp(ins->result, step->arg2) == 0 &&
+            (!ir_is(ins, "load_const") || strcmp(ins->arg1, "1") != 0))
+            return 0;
+    }
+
+    VectorBuilder v;
+    memset(&v, 0, sizeof(v));
+    string_map_init(&v.registers, 16);
+    v.index_register = -1;
+    IRInstruction *hoisted = NULL;
+    int hoisted_count = 0;
+    int stores = 0;
+    int ok = 1;
+    int body = header + 4;
+    for (int i = body; i < latch - 2 && ok; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        const char *op = vector_op_name(ins->op);
+        if (ir_has_def(ins->op) && (string_map_get(&v.registers, ins->result) >= 0 ||
+                                    temp_used_outside(ins->result, start, end, body, latch + 1)))
+        {
+            // 循环体的值在循环外不能再被使用
+            ok = 0;
+        }
+        else if (ir_is(ins, "load_const"))
+        {
+            // 循环体中的常量移到调用之前, 作为不变量
+            ir_list_append(&hoisted, &hoisted_count, ins->op, ins->arg1, NULL, ins->result);
+            vector_register(&v, ins->result, index, latch + 1, latch + 1);
+        }
+        else if (ir_is(ins, "array_access_unchecked") && strcmp(ins->arg2, index) == 0 &&
+                 vector_array(ins->arg1, index, header, latch + 1))
+        {
+            string_map_put(&v.registers, ins->result, v.step_count);
+            vector_append(&v, "load %d", vector_operand(&v, ins->arg1), 0);
+        }
+        else if (ir_is(ins, "array_store_unchecked") && strcmp(ins->arg1, index) == 0 &&
+                 vector_array(ins->result, index, header, latch + 1))
+        {
+            int value = vector_register(&v, ins->arg2, index, header, latch + 1);
+            if (value < 0)
+                ok = 0;
+            else
+                vector_append(&v, "store %d %d", vector_operand(&v, ins->result), value);
+            stores++;
+        }
+        else if (op != NULL)
+        {
+            int a = vector_register(&v, ins->arg1, index, header, latch + 1);
+            int b = vector_register(&v, ins->arg2, index, header, latch + 1);
+            if (a < 0 || b < 0)
+                ok = 0;
+            else
+            {
+                char format[32];
+                snprintf(format, sizeof(format), "%s %%d %%d", op);
+                string_map_put(&v.registers, ins->result, v.step_count);
+                vector_append(&v, format, a, b);
+            }
+        }
+        else
+        {
+            ok = 0;
+        }
+    }
+    ok = ok && stores > 0 && v.step_count <= vectorize_max_steps && v.length < (int)sizeof(v.program) - 1 &&
+         !temp_used_outside(step->result, start, end, body, latch + 1);
+
+    int inserted = 0;
+    if (ok)
+    {
+        // 常量; 实参: 数组与不变量, 初值, 终值, 程序; 调用; 写回循环变量; 回到循环头
+        IRInstruction *code = hoisted;
+        int count = hoisted_count;
+        char text[sizeof(v.program) + 2];
+        char argc[32];
+        char *program = new_temp();
+        char *result = new_temp();
+        snprintf(text, sizeof(text), "\"%s\"", v.program);
+        snprintf(argc, sizeof(argc), "%d", v.operand_count + 3);
+        ir_list_append(&code, &count, "load_const", text, NULL, program);
+        for (int k = 0; k < v.operand_count; k++)
+            ir_list_append(&code, &count, "arg", v.operands[k], NULL, NULL);
+        ir_list_append(&code, &count, "arg", index, NULL, NULL);
+        ir_list_append(&code, &count, "arg", bound, NULL, NULL);
+        ir_list_append(&code, &count, "arg", program, NULL, NULL);
+        ir_list_append(&code, &count, "call_function", "$vector", argc, result);
+        ir_list_append(&code, &count, "store", result, NULL, var);
+
+        for (int i = body; i < latch; i++)
+            ir_make_nop(&ir_code[i]);
+        ir_insert(body, code, count);
+        inserted = count;
+        free(code);
+    }
+    else
+    {
+        free(hoisted);
+    }
+    string_map_free(&v.registers);
+    free(v.operands);
+    return inserted;
+}
+
+int vectorize_range(int start, int end)
+{
+    int total = 0;
+    for (int i = start; i < end; i++)
+    {
+        if (!ir_is(&ir_code[i], "label"))
+            continue;
+        int inserted = vectorize_loop(start, end, i);
+        if (inserted > 0)
+        {
+            end += inserted;
+            total++;
+        }
+    }
+    return total;
+}
+
+int vectorize_loops()
+{
+    int total = for_each_function(vectorize_range);
+    ir_remove_nops();
+    return total;
+}
+
+// 优化流程: 内联后先折叠一次; 强度削弱在值编号之前进行, 此时每次使用循环变量都有独立的 load;
+// 强度削弱之后转为 SSA 做稀疏条件常量传播, 局部变量大多变成临时变量;
+// 越界检查消除在外提之后进行, 此时数组已经是循环外的临时变量;
+// 类型推断在向量化之前进行, 改写出的专用指令不再经过其他优化; 向量化只改写越界检查消除得到的无检查循环
+void optimize_ir()
+{
+    lower_string_builders();
+    inline_functions();
+    constant_folding();
+    dead_code_elimination();
+    strength_reduction();
+    sparse_conditional_constant_propagation();
+    for (int round = 0; round < 4; round++)
+    {
+        int changed = global_value_numbering();
+        changed += constant_folding();
+        changed += dead_code_elimination();
+        if (changed == 0)
+            break;
+    }
+    loop_invariant_code_motion();
+    // 外提到同一个前置块的常量和表达式可能重复, 再做一次值编号合并
+    global_value_numbering();
+    dead_code_elimination();
+    bounds_check_elimination();
+    type_inference();
+    vectorize_loops();
+}
+
+// // 测试输入
+// int main()
+// {
+//     freopen("input.txt", "r", stdin);
+//     int fsize = 1000;
+
+//     char source[1000] = {0};
+//     fread(source, 1, fsize, stdin);
+
+//     int token_count = 0;
+//     Token *tokens = lexer(source, &token_count);
+//     ASTNode *root = parse_program(&tokens, token_count);
+//     generateIR(root);
+//     optimize_ir();
+
+//     freopen("output_optimizer.txt", "w", stdout);
+//     print_ir(stdout);
+
+//     return 0;
+// }
\ No newline at end of file
@@ -0,0 +1,462 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "io.c"
+
+// ---------------- 并行循环的运行时 ----------------
+
+// 编译器 (pseudo.c) 把迭代之间没有依赖的 for 循环体提取为函数 f($lo, $hi, 捕获的变量...),
+// 执行时把 [start, end) 分给线程池中的线程, 每个线程对分到的区间调用 f
+// 每个线程有自己的区间, 从前端取块执行, 块的大小随剩余的迭代数减小; 自己的区间取完后
+// 从其他线程的区间后端偷走一半, 各次迭代的耗时不均匀时也能让所有线程忙到最后
+// 迭代之间互不依赖, 任何划分得到的结果都与顺序执行相同
+
+#define PARALLEL_MAX_THREADS 256
+// 一个并行循环最多写入的数组个数, 与 pseudo.c 的 parallel_max_arrays 相同
+#define PARALLEL_MAX_ARRAYS 8
+
+// 线程数 (包括调用者): 0 时取环境变量 X_THREADS, 没有设置时取 CPU 核数; 1 时总是顺序执行
+int parallel_thread_count = 0;
+// 迭代数少于这个值的循环顺序执行, 唤醒线程的开销比收益大
+long long parallel_min_iterations = 1024;
+// 从区间取块时的最小迭代数
+long long parallel_min_chunk = 16;
+
+// 线程池中的线程和正在执行并行循环的调用者不再发起并行循环
+__thread int parallel_depth = 0;
+
+// 每次在 [lo, hi) 上执行循环体, worker 是执行它的线程的编号 (调用者为 0)
+typedef void (*ParallelTask)(void *context, int worker, long long lo, long long hi);
+
+// 线程的区间 [next, end), 各占一个缓存行
+typedef struct
+{
+    pthread_mutex_t lock;
+    long long next;
+    long long end;
+    char padding[64];
+} ParallelRange;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // 发布了新的循环
+    pthread_cond_t done; // 参与的线程都已完成
+    int thread_count;    // 已经创建的线程, 编号 1 .. thread_count
+    int generation;      // 每发布一个循环加一, 线程据此发现新的循环
+    int worker_count;    // 本次参与的线程数 (包括调用者)
+    int pending;         // 本次还没有完成的线程 (不包括调用者)
+    ParallelTask task;
+    void *context;
+    ParallelRange ranges[PARALLEL_MAX_THREADS];
+} ParallelPool;
+
+ParallelPool parallel_pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+// 实际使用的线程数
+int parallel_threads()
+{
+    int n = parallel_thread_count;
+    if (n <= 0 && getenv("X_THREADS") != NULL)
+        n = atoi(getenv("X_THREADS"));
+    if (n <= 0)
+        n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+        n = 1;
+    return n > PARALLEL_MAX_THREADS ? PARALLEL_MAX_THREADS : n;
+}
+
+// 从自己的区间前端取一块: 剩余迭代数的 1/4, 至少 parallel_min_chunk
+int parallel_take(ParallelRange *range, long long *lo, long long *hi)
+{
+    pthread_mutex_lock(&range->lock);
+    long long n = range->end - range->next;
+    long long size = n / 4 > parallel_min_chunk ? n / 4 : parallel_min_chunk;
+    if (size > n)
+        size = n;
+    *lo = range->next;
+    *hi = range->next + size;
+    range->next += size;
+    pthread_mutex_unlock(&range->lock);
+    return size > 0;
+}
+
+// 自己的区间取完后, 从其他线程的区间后端偷走一半放入自己的区间; 都取完时返回 0
+int parallel_steal(ParallelPool *pool, int worker)
+{
+    for (int k = 1; k < pool->worker_count; k++)
+    {
+        ParallelRange *victim = &pool->ranges[(worker + k) % pool->worker_count];
+        pthread_mutex_lock(&victim->lock);
+        long long n = victim->end - victim->next;
+        long long lo = victim->end - (n + 1) / 2;
+        long long hi = victim->end;
+        if (n > 0)
+            victim->end = lo;
+        pthread_mutex_unlock(&victim->lock);
+        if (n > 0)
+        {
+            ParallelRange *own = &pool->ranges[worker];
+            pthread_mutex_lock(&own->lock);
+            own->next = lo;
+            own->end = hi;
+            pthread_mutex_unlock(&own->lock);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void parallel_work(ParallelPool *pool, int worker)
+{
+    long long lo, hi;
+    do
+    {
+        while (parallel_take(&pool->ranges[worker], &lo, &hi))
+            pool->task(pool->context, worker, lo, hi);
+    } while (parallel_steal(pool, worker));
+}
+
+// 线程常驻, 等待下一个循环
+void *parallel_thread(void *arg)
+{
+    ParallelPool *pool = &parallel_pool;
+    int worker = (int)(size_t)arg;
+    int seen = 0;
+    parallel_depth = 1;
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        while (pool->generation == seen)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        seen = pool->generation;
+        if (worker >= pool->worker_count)
+            continue;
+        pthread_mutex_unlock(&pool->lock);
+        parallel_work(pool, worker);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    return NULL;
+}
+
+// 在 [start, end) 上执行 task, 至多使用 workers 个线程 (包括调用者), 所有迭代完成后返回
+// 线程不够时 (创建失败) 用已有的线程, 只剩调用者时顺序执行
+void parallel_run(ParallelTask task, void *context, long long start, long long end, int workers)
+{
+    ParallelPool *pool = &parallel_pool;
+    if (workers > PARALLEL_MAX_THREADS)
+        workers = PARALLEL_MAX_THREADS;
+    if (pool->thread_count == 0)
+        pthread_mutex_init(&pool->ranges[0].lock, NULL);
+    while (parallel_depth == 0 && pool->thread_count < workers - 1)
+    {
+        pthread_t thread;
+        int worker = pool->thread_count + 1;
+        pthread_mutex_init(&pool->ranges[worker].lock, NULL);
+        if (pthread_create(&thread, NULL, parallel_thread, (void *)(size_t)worker) != 0)
+            break;
+        pthread_detach(thread);
+        pool->thread_count = worker;
+    }
+    if (workers > pool->thread_count + 1)
+        workers = pool->thread_count + 1;
+    // 线程的虚拟机不是回收器的根, 执行期间不回收 (见 value.c)
+    __atomic_add_fetch(&gc_inhibit, 1, __ATOMIC_RELAXED);
+    if (workers <= 1 || parallel_depth > 0 || end - start < 2)
+    {
+        task(context, 0, start, end);
+        __atomic_sub_fetch(&gc_inhibit, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // 先均分, 快的线程再去偷慢的线程剩下的迭代
+    long long n = end - start;
+    for (int w = 0; w < workers; w++)
+    {
+        pool->ranges[w].next = start + n / workers * w + (w < n % workers ? w : n % workers);
+        pool->ranges[w].end = start + n / workers * (w + 1) + (w + 1 < n % workers ? w + 1 : n % workers);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->context = context;
+    pool->worker_count = workers;
+    pool->pending = workers - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    parallel_depth++;
+    parallel_work(pool, 0);
+    parallel_depth--;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+    __atomic_sub_fetch(&gc_inhibit, 1, __ATOMIC_RELAXED);
+}
+
+// 一次并行循环的参数
+typedef struct
+{
+    long long start;
+    long long end;
+    int workers; // 使用的线程数, 1 表示顺序执行
+    int argc;    // 循环体函数的实参: start, end 和捕获的变量
+    int array_count;
+    Array *arrays[PARALLEL_MAX_ARRAYS]; // 写入的数组
+    int kinds[PARALLEL_MAX_ARRAYS];     // 写入的数组原来的表示
+} ParallelLoop;
+
+// parallel_for 的实参依次是 start, end, 捕获的变量..., 写入的数组..., 读取的容器..., 写入的数组个数, 读取的容器个数
+// 返回使用的线程数; 边界不是非负整数, 迭代太少, 写入的不是数组或长度不够 (写入会扩展数组),
+// 或者读取的数组就是写入的数组时返回 1, 调用者按普通调用顺序执行整个循环
+// 可以并行时把写入的数组装箱: 紧凑数组写入其他类型的元素时要重新分配, 不能与其他线程的写入同时发生
+int parallel_prepare(ParallelLoop *loop, Value *args, int argc)
+{
+    loop->workers = 1;
+    loop->array_count = 0;
+    if (argc < 4 || args[argc - 2].type != VAL_INT || args[argc - 1].type != VAL_INT)
+        return 1;
+    long long written = args[argc - 2].as.i;
+    long long read = args[argc - 1].as.i;
+    if (written < 1 || written > PARALLEL_MAX_ARRAYS || read < 0 || 4 + written + read > argc)
+        return 1;
+    Value start = args[0];
+    Value end = args[1];
+    if (start.type != VAL_INT || end.type != VAL_INT || start.as.i < 0 || end.as.i <= start.as.i ||
+        end.as.i - start.as.i < parallel_min_iterations || parallel_depth > 0)
+        return 1;
+    int workers = parallel_threads();
+    if (workers <= 1)
+        return 1;
+
+    loop->argc = argc - 2 - (int)written - (int)read;
+    Value *arrays = &args[loop->argc];
+    for (int k = 0; k < written; k++)
+    {
+        if (arrays[k].type != VAL_ARRAY || arrays[k].as.array->length < end.as.i)
+            return 1;
+    }
+    for (int r = 0; r < read; r++)
+    {
+        Value v = arrays[written + r];
+        for (int k = 0; k < written && v.type == VAL_ARRAY; k++)
+        {
+            if (v.as.array == arrays[k].as.array)
+                return 1;
+        }
+    }
+
+    for (int k = 0; k < written; k++)
+    {
+        Array *array = arrays[k].as.array;
+        loop->arrays[k] = array;
+        loop->kinds[k] = array->kind;
+        array_box(array);
+    }
+    loop->array_count = (int)written;
+    loop->start = start.as.i;
+    loop->end = end.as.i;
+    loop->workers = workers;
+    return workers;
+}
+
+// 并行执行后恢复写入的数组的表示: 写入的元素类型没有变时转回紧凑数组, 与顺序执行的结果相同
+void parallel_finish(ParallelLoop *loop)
+{
+    for (int k = 0; k < loop->array_count; k++)
+        array_pack(loop->arrays[k], loop->kinds[k]);
+}
+
+// ---------------- pmap / pfilter / preduce ----------------
+
+// 对数组的每个元素调用用户函数 (见 pseudo.c 的 parallel_apply); 函数是纯函数时分块交给线程池
+//   - pmap 的每个线程把结果写入结果数组中自己的下标, pfilter 先记下每个元素是否保留, 再按顺序收集
+//   - preduce 按固定大小的块分别从块的第一个元素开始合并, 再从 init 开始依次合并各块的结果
+//     块的划分只取决于数组长度, 与线程数和偷取无关, 结果是确定的; f 满足结合律时与顺序合并相同
+// 函数不是纯函数或者元素太少时在调用者中按顺序执行, preduce 这时从 init 开始依次合并每个元素
+
+// 与 pseudo.c 的 parallel_builtin_names 的顺序相同
+enum
+{
+    PARALLEL_MAP,
+    PARALLEL_FILTER,
+    PARALLEL_REDUCE
+};
+
+const char *parallel_apply_names[] = {"pmap", "pfilter", "preduce"};
+
+// 元素少于这个值时顺序执行
+long long parallel_min_elements = 256;
+// preduce 的块大小
+long long parallel_reduce_block = 256;
+
+// 调用用户函数: worker 为 -1 时用调用者自己的状态, 否则用线程池中线程 worker 的状态
+typedef Value (*ParallelCall)(void *context, int worker, Value *args, int argc);
+
+typedef struct
+{
+    int kind;
+    int pure;
+    Array *array;
+    Value init;
+    long long length;
+    ParallelCall call;
+    void *context;
+    Value *results; // pmap 的结果, pfilter 传给函数的元素, preduce 各块的结果
+    char *keep;     // pfilter 的各个元素是否保留
+} ParallelApply;
+
+// 实参依次是数组, 初值, 种类, 是否是纯函数; 返回使用的线程数, 1 表示在调用者中执行
+int parallel_apply_prepare(ParallelApply *apply, Value *args, int argc)
+{
+    if (argc != 4 || args[2].type != VAL_INT || args[2].as.i < PARALLEL_MAP || args[2].as.i > PARALLEL_REDUCE)
+        runtime_error("invalid parallel builtin", NULL);
+    apply->kind = (int)args[2].as.i;
+    if (args[0].type != VAL_ARRAY)
+        runtime_error("expected an array in", parallel_apply_names[apply->kind]);
+    apply->pure = args[3].type == VAL_INT && args[3].as.i != 0;
+    apply->array = args[0].as.array;
+    apply->init = args[1];
+    apply->length = apply->array->length;
+    if (!apply->pure || apply->length < parallel_min_elements || parallel_depth > 0)
+        return 1;
+    return parallel_threads();
+}
+
+void parallel_apply_task(void *context, int worker, long long lo, long long hi)
+{
+    ParallelApply *apply = context;
+    Value args[2];
+    for (long long i = lo; i < hi; i++)
+    {
+        if (apply->kind == PARALLEL_REDUCE)
+        {
+            long long start = i * parallel_reduce_block;
+            long long end = start + parallel_reduce_block < apply->length ? start + parallel_reduce_block : apply->length;
+            args[0] = array_get(apply->array, start);
+            for (long long k = start + 1; k < end; k++)
+            {
+                args[1] = array_get(apply->array, k);
+                args[0] = apply->call(apply->context, worker, args, 2);
+            }
+            apply->results[i] = args[0];
+            continue;
+        }
+        args[0] = array_get(apply->array, i);
+        Value value = apply->call(apply->context, worker, args, 1);
+        if (apply->kind == PARALLEL_MAP)
+            apply->results[i] = value;
+        else
+        {
+            apply->results[i] = args[0];
+            apply->keep[i] = value_truthy(value);
+        }
+    }
+}
+
+Value parallel_apply_run(ParallelApply *apply, int workers, ParallelCall call, void *context)
+{
+    long long n = apply->length;
+    apply->call = call;
+    apply->context = context;
+    Value result;
+    Value args[2];
+    if (apply->kind == PARALLEL_REDUCE)
+    {
+        result = apply->init;
+        if (!apply->pure || n < parallel_min_elements)
+        {
+            for (long long i = 0; i < n; i++)
+            {
+                args[0] = result;
+                args[1] = array_get(apply->array, i);
+                result = call(context, -1, args, 2);
+            }
+            return result;
+        }
+        long long blocks = (n + parallel_reduce_block - 1) / parallel_reduce_block;
+        apply->results = malloc(sizeof(Value) * blocks);
+        if (workers > 1)
+            parallel_run(parallel_apply_task, apply, 0, blocks, workers);
+        else
+            parallel_apply_task(apply, -1, 0, blocks);
+        for (long long b = 0; b < blocks; b++)
+        {
+            args[0] = result;
+            args[1] = apply->results[b];
+            result = call(context, -1, args, 2);
+        }
+        free(apply->results);
+        return result;
+    }
+
+    if (apply->kind == PARALLEL_MAP)
+    {
+        // 结果数组先装箱, 各线程写入不同的元素; 结束后元素类型相同时转回紧凑数组
+        result = value_new_array((int)n);
+        array_box(result.as.array);
+        apply->results = result.as.array->data;
+    }
+    else
+    {
+        apply->results = malloc(sizeof(Value) * (n + 1));
+        apply->keep = malloc(n + 1);
+    }
+
+    if (workers > 1)
+        parallel_run(parallel_apply_task, apply, 0, n, workers);
+    else
+        parallel_apply_task(apply, -1, 0, n);
+
+    if (apply->kind == PARALLEL_MAP)
+    {
+        gc_barrier_all(result.as.array);
+        result.as.array->length = (int)n;
+        if (n > 0)
+            array_pack(result.as.array, apply->results[0].type);
+        return result;
+    }
+    result = value_new_array(0);
+    for (long long i = 0; i < n; i++)
+    {
+        if (apply->keep[i])
+            array_set(result.as.array, result.as.array->length, apply->results[i]);
+    }
+    free(apply->results);
+    free(apply->keep);
+    return result;
+}
+
+// 执行 pmap / pfilter / preduce, workers 是 parallel_apply_prepare 的返回值
+// 数组, 初值和中间结果保存在这里的局部变量中, 不是回收器的根, 执行期间不回收 (顺序执行时也是)
+Value parallel_apply(ParallelApply *apply, int workers, ParallelCall call, void *context)
+{
+    __atomic_add_fetch(&gc_inhibit, 1, __ATOMIC_RELAXED);
+    Value result = parallel_apply_run(apply, workers, call, context);
+    __atomic_sub_fetch(&gc_inhibit, 1, __ATOMIC_RELAXED);
+    return result;
+}
+
+// // 测试输入
+// void square(void *context, int worker, long long lo, long long hi)
+// {
+//     long long *out = context;
+//     for (long long i = lo; i < hi; i++)
+//         out[i] = i * i;
+// }
+
+// int main()
+// {
+//     static long long out[1000000];
+//     parallel_run(square, out, 0, 1000000, parallel_threads());
+//     printf("%lld\n", out[999999]);
+//     return 0;
+// }
\ No newline at end of file
@@ -28,6 +28,8 @@ typedef enum
     NODE_KEY_VALUE_PAIR,  // 键值对节点
     NODE_EXPRESSION,      // 表达式节点
     NODE_ARRAY_ACCESS,    // 数组下标节点
+    NODE_SPAWN,           // spawn 节点, 子节点是函数调用
+    NODE_AWAIT,           // await 节点, 子节点是等待的任务
 
     NODE_LITERAL,    // 字面量节点
     NODE_OPERATOR,   // 操作符节点
@@ -213,6 +215,8 @@ ASTNode *parse_statement(Token **tokens, int token_count, int *current_token_ind
 ASTNode *parse_assignment_or_function_call(Token **tokens, int token_count, int *current_token_index);
 ASTNode *parse_if_statement(Token **tokens, int token_count, int *current_token_index);
 ASTNode *parse_return_statement(Token **tokens, int token_count, int *current_token_index);
+ASTNode *parse_task_expression(Token **tokens, int token_count, int *current_token_index);
+ASTNode *parse_primary(Token **tokens, int token_count, int *current_token_index);
 ASTNode *parse_for_loop(Token **tokens, int token_count, int *current_token_index);
 ASTNode *parse_assignment(Token **tokens, int token_count, int *current_token_index);
 ASTNode *parse_function_call(Token **tokens, int token_count, int *current_token_index);
@@ -227,6 +231,9 @@ ASTNode *parse_arg_list(Token **tokens, int token_count, int *current_token_inde
 ASTNode *parse_literal(Token **tokens, int token_count, int *current_token_index);
 ASTNode *parse_operator(Token **tokens, int token_count, int *current_token_index);
 ASTNode *parse_identifier(Token **tokens, int token_count, int *current_token_index);
+ASTNode *parse_int(Token **tokens, int token_count, int *current_token_index);
+ASTNode *parse_float(Token **tokens, int token_count, int *current_token_index);
+ASTNode *parse_string(Token **tokens, int token_count, int *current_token_index);
 
 ASTNode *create_node(NodeType type)
 {
@@ -236,6 +243,7 @@ ASTNode *create_node(NodeType type)
         return NULL;
     }
     node->type = type;
+    memset(&node->data, 0, sizeof(ASTNodeData));
     node->children = NULL;
     node->children_count = 0;
     return node;
@@ -467,6 +475,15 @@ ASTNode *parse_statement(Token **tokens, int token_count, int *current_token_ind
         // 解析复合语句
         return parse_compound_statement(tokens, token_count, current_token_index);
 
+    case TOKEN_SPAWN:
+    case TOKEN_AWAIT:
+    {
+        // 解析 spawn f(...); 和 await t; 不使用结果
+        ASTNode *node = parse_task_expression(tokens, token_count, current_token_index);
+        consume(tokens, token_count, current_token_index, TOKEN_SEMICOLON);
+        return node;
+    }
+
     default:
         printf("Syntax error: Unexpected token in statement.\n");
         exit(1);
@@ -931,8 +948,52 @@ ASTNode *parse_arg_list(Token **tokens, int token_count, int *current_token_inde
     return args_node;
 }
 
+// 解析 spawn f(...) 和 await 操作数, 操作数是没有运算符的表达式 (await t + 1 等于 (await t) + 1)
+ASTNode *parse_task_expression(Token **tokens, int token_count, int *current_token_index)
+{
+    TokenType type = (*tokens)[*current_token_index].type;
+    ASTNode *node = create_node(type == TOKEN_SPAWN ? NODE_SPAWN : NODE_AWAIT);
+    advance(tokens, current_token_index);
+
+    if (type == TOKEN_SPAWN)
+    {
+        if ((*tokens)[*current_token_index].type != TOKEN_IDENTIFIER || *current_token_index + 1 >= token_count ||
+            (*tokens)[*current_token_index + 1].type != TOKEN_LEFT_PAREN)
+        {
+            printf("Syntax error: Expected function call after spawn\n");
+            free_ast(node);
+            exit(1);
+            return NULL;
+        }
+        add_child(node, parse_function_call(tokens, token_count, current_token_index));
+    }
+    else
+    {
+        add_child(node, parse_primary(tokens, token_count, current_token_index));
+    }
+
+    return node;
+}
+
 // 解析 expression
 ASTNode *parse_expression(Token **tokens, int token_count, int *current_token_index)
+{
+    ASTNode *node = parse_primary(tokens, token_count, current_token_index);
+    while ((*current_token_index < token_count) &&
+           ((*tokens)[*current_token_index].type >= TOKEN_PLUS && (*tokens)[*current_token_index].type <= TOKEN_EQUAL))
+    {
+        ASTNode *opNode = create_node(NODE_EXPRESSION);
+        add_child(opNode, node);
+        add_child(opNode, parse_operator(tokens, token_count, current_token_index));
+        add_child(opNode, parse_expression(tokens, token_count, current_token_index));
+        node = opNode;
+    }
+
+    return node;
+}
+
+// 解析运算符之前的部分: 括号中的子表达式, 函数调用, 标识符, 数组下标, 字面值, spawn / await
+ASTNode *parse_primary(Token **tokens, int token_count, int *current_token_index)
 {
 
     // 包括解析子表达式的情形
@@ -981,45 +1042,35 @@ ASTNode *parse_expression(Token **tokens, int token_count, int *current_token_in
             }
         }
     }
-    else
+    else if ((*tokens)[*current_token_index].type == TOKEN_SPAWN || (*tokens)[*current_token_index].type == TOKEN_AWAIT)
     {
-        node = parse_literal(tokens, token_count, current_token_index);
+        node = parse_task_expression(tokens, token_count, current_token_index);
     }
-    while ((*current_token_index < token_count) &&
-           ((*tokens)[*current_token_index].type >= TOKEN_PLUS && (*tokens)[*current_token_index].type <= TOKEN_EQUAL))
+    else
     {
-        ASTNode *opNode = create_node(NODE_EXPRESSION);
-        add_child(opNode, node);
-        add_child(opNode, parse_operator(tokens, token_count, current_token_index));
-        add_child(opNode, parse_expression(tokens, token_count, current_token_index));
-        node = opNode;
+        node = parse_literal(tokens, token_count, current_token_index);
     }
 
     return node;
 }
 
-// 解析字面值
+// 解析字面值, 按 Token 类型生成 int / float / string 节点
 ASTNode *parse_literal(Token **tokens, int token_count, int *current_token_index)
 {
-    ASTNode *node = create_node(NODE_LITERAL);
-    if (node == NULL)
-        return NULL;
-
     Token *currentToken = &((*tokens)[*current_token_index]);
-    if (currentToken->type == TOKEN_INT || currentToken->type == TOKEN_FLOAT || currentToken->type == TOKEN_STRING)
-    {
-        node->data.literal.value = strdup(currentToken->value);
-        advance(tokens, current_token_index);
-    }
-    else
+    switch (currentToken->type)
     {
+    case TOKEN_INT:
+        return parse_int(tokens, token_count, current_token_index);
+    case TOKEN_FLOAT:
+        return parse_float(tokens, token_count, current_token_index);
+    case TOKEN_STRING:
+        return parse_string(tokens, token_count, current_token_index);
+    default:
         printf("Syntax error: Expected literal\n");
-        free_ast(node);
         exit(1);
         return NULL;
     }
-
-    return node;
 }
 
 // 解析操作符
@@ -1242,6 +1293,12 @@ void print_ast_to_file(ASTNode *node, int depth, FILE *outfile)
     case NODE_ARRAY_ACCESS:
         fprintf(outfile, "<array_access>\n");
         break;
+    case NODE_SPAWN:
+        fprintf(outfile, "<spawn>\n");
+        break;
+    case NODE_AWAIT:
+        fprintf(outfile, "<await>\n");
+        break;
     case NODE_FOR_LOOP:
         fprintf(outfile, "<for_loop>: %s\n", node->data.for_loop.var_name);
         break;
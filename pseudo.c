@@ -11,222 +11,1711 @@ typedef struct
     char *result;
 } IRInstruction;
 
+// 生成的三地址码序列
+IRInstruction *ir_code = NULL;
+int ir_count = 0;
+int ir_capacity = 0;
+
+// 临时变量与标签计数器
+int temp_counter = 0;
+int label_counter = 0;
+
+// 正在生成的函数, 用于识别自递归的尾调用
+ASTNode *current_function = NULL;
+
+// 常量次数 for 循环的展开因子, 以及允许展开的循环体大小 (AST 节点数)
+int unroll_factor = 4;
+int unroll_max_body = 48;
+
+// 迭代互不依赖的 for 循环提取为函数, 运行时由线程池并行执行 (见 parallel.c); 0 时照常生成循环
+int parallel_loops = 1;
+// 一个并行循环最多写入的数组个数, 与 parallel.c 的 PARALLEL_MAX_ARRAYS 相同
+int parallel_max_arrays = 8;
+
+// 整个程序, 提取出的函数按它取不重名的名字
+ASTNode *current_program = NULL;
+// 提取出的循环体函数, 在所在函数之后生成; 生成它们时不再提取嵌套的循环
+ASTNode **parallel_bodies = NULL;
+int parallel_body_count = 0;
+int parallel_body_counter = 0;
+int generating_parallel_body = 0;
+
 void generateIR(ASTNode *node);
+char *generateExpr(ASTNode *node);
+char *generateParallelApply(ASTNode *call, int kind);
+int parallel_builtin_kind(ASTNode *program, ASTNode *call);
+void generateLoopBody(ASTNode *node);
 void emit(char *op, char *arg1, char *arg2, char *result);
 
 void emit(char *op, char *arg1, char *arg2, char *result)
 {
-    printf("%s %s %s %s\n", op, arg1 ? arg1 : "", arg2 ? arg2 : "", result ? result : "");
+    if (ir_count >= ir_capacity)
+    {
+        ir_capacity = ir_capacity == 0 ? 64 : ir_capacity * 2;
+        ir_code = realloc(ir_code, sizeof(IRInstruction) * ir_capacity);
+    }
+
+    ir_code[ir_count].op = strdup(op);
+    ir_code[ir_count].arg1 = arg1 ? strdup(arg1) : NULL;
+    ir_code[ir_count].arg2 = arg2 ? strdup(arg2) : NULL;
+    ir_code[ir_count].result = result ? strdup(result) : NULL;
+    ir_count++;
+}
+
+// 生成新的临时变量 %1, %2, ...; % 不能出现在标识符中, 临时变量不会与用户的变量同名
+char *new_temp()
+{
+    char buffer[32];
+    sprintf(buffer, "%%%d", ++temp_counter);
+    return strdup(buffer);
+}
+
+// 生成新的标签, 同一个语句的标签共用编号
+char *new_label(const char *prefix, int id)
+{
+    char buffer[64];
+    sprintf(buffer, "%s_%d", prefix, id);
+    return strdup(buffer);
+}
+
+// 判断是否是临时变量
+int is_temp(const char *name)
+{
+    return name != NULL && name[0] == '%' && is_digit(name[1]);
+}
+
+// 全局变量: 出现在函数之外的 alloc
+int is_global_var(const char *name)
+{
+    int depth = 0;
+    for (int i = 0; i < ir_count; i++)
+    {
+        if (strcmp(ir_code[i].op, "function") == 0)
+            depth++;
+        else if (strcmp(ir_code[i].op, "end_function") == 0)
+            depth--;
+        else if (depth == 0 && strcmp(ir_code[i].op, "alloc") == 0 && strcmp(ir_code[i].arg1, name) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// 操作符到 IR 操作码的映射
+const char *operator_opcode(const char *op)
+{
+    if (strcmp(op, "+") == 0)
+        return "add";
+    if (strcmp(op, "-") == 0)
+        return "sub";
+    if (strcmp(op, "*") == 0)
+        return "mul";
+    if (strcmp(op, "/") == 0)
+        return "div";
+    if (strcmp(op, ">") == 0)
+        return "gt";
+    if (strcmp(op, "<") == 0)
+        return "lt";
+    if (strcmp(op, ">=") == 0)
+        return "ge";
+    if (strcmp(op, "<=") == 0)
+        return "le";
+    if (strcmp(op, "==") == 0)
+        return "eq";
+    return op;
+}
+
+// 打印 IR
+void print_ir(FILE *outfile)
+{
+    for (int i = 0; i < ir_count; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (strcmp(ins->op, "nop") == 0)
+        {
+            continue;
+        }
+        fprintf(outfile, "%s %s %s %s\n", ins->op, ins->arg1 ? ins->arg1 : "", ins->arg2 ? ins->arg2 : "", ins->result ? ins->result : "");
+    }
+}
+
+// 生成数组字面量
+char *generateArrayLiteral(ASTNode *expr_list)
+{
+    char *array = new_temp();
+    char count[32];
+    int n = expr_list != NULL ? expr_list->children_count : 0;
+
+    sprintf(count, "%d", n);
+    emit("new_array", count, NULL, array);
+
+    for (int i = 0; i < n; i++)
+    {
+        char index_value[32];
+        char *index = new_temp();
+        sprintf(index_value, "%d", i);
+        emit("load_const", index_value, NULL, index);
+
+        char *value = generateExpr(expr_list->children[i]);
+        emit("array_store", index, value, array);
+    }
+
+    return array;
+}
+
+// 生成键值对字面量, pairs 从 first 开始
+char *generateMapLiteral(ASTNode *node, int first)
+{
+    char *map = new_temp();
+    char count[32];
+
+    sprintf(count, "%d", node->children_count - first);
+    emit("new_map", count, NULL, map);
+
+    for (int i = first; i < node->children_count; i++)
+    {
+        ASTNode *pair = node->children[i];
+        if (pair->children_count < 2)
+        {
+            printf("Error: Key-value pair node does not have two children.\n");
+            continue;
+        }
+
+        char *key = generateExpr(pair->children[0]);
+        char *value = generateExpr(pair->children[1]);
+        emit("key_value_pair", key, value, map);
+    }
+
+    return map;
+}
+
+// 生成表达式, 返回保存结果的临时变量
+char *generateExpr(ASTNode *node)
+{
+    char *result = NULL;
+    char buffer[1024];
+
+    if (node == NULL)
+    {
+        return NULL;
+    }
+
+    switch (node->type)
+    {
+    case NODE_INT:
+    case NODE_FLOAT:
+    case NODE_LITERAL:
+        result = new_temp();
+        emit("load_const", node->data.literal.value, NULL, result);
+        break;
+
+    case NODE_STRING:
+        // 字符串常量保留引号, 与数字常量区分
+        result = new_temp();
+        snprintf(buffer, sizeof(buffer), "\"%s\"", node->data.string_node.value);
+        emit("load_const", buffer, NULL, result);
+        break;
+
+    case NODE_IDENTIFIER:
+        result = new_temp();
+        emit("load", node->data.identifier.name, NULL, result);
+        break;
+
+    case NODE_EXPRESSION:
+        if (node->children_count >= 3)
+        {
+            char *left = generateExpr(node->children[0]);
+            char *right = generateExpr(node->children[2]);
+            result = new_temp();
+            emit((char *)operator_opcode(node->children[1]->data.operator_node.op), left, right, result);
+        }
+        else if (node->children_count == 1)
+        {
+            result = generateExpr(node->children[0]);
+        }
+        else
+        {
+            printf("Error: Incomplete expression structure.\n");
+        }
+        break;
+
+    case NODE_ARRAY_ACCESS:
+    {
+        char *array = generateExpr(node->children[0]);
+        char *index = generateExpr(node->children[1]);
+        result = new_temp();
+        emit("array_access", array, index, result);
+        break;
+    }
+
+    case NODE_FUNCTION_CALL:
+    case NODE_SPAWN:
+    {
+        // spawn f(...) 与调用相同地压入实参, 再创建执行 f 的任务
+        ASTNode *call = node->type == NODE_SPAWN ? node->children[0] : node;
+        if (call->children_count < 1)
+        {
+            printf("Error: Incomplete function call structure.\n");
+            break;
+        }
+        if (node->type == NODE_FUNCTION_CALL && parallel_builtin_kind(current_program, call) >= 0)
+        {
+            result = generateParallelApply(call, parallel_builtin_kind(current_program, call));
+            break;
+        }
+
+        // 先计算全部实参, 再依次压入, 避免嵌套调用打乱参数顺序
+        ASTNode *args = call->children_count == 2 ? call->children[1] : NULL;
+        int argc = args != NULL ? args->children_count : 0;
+        char **params = malloc(sizeof(char *) * (argc + 1));
+
+        for (int i = 0; i < argc; i++)
+        {
+            params[i] = generateExpr(args->children[i]);
+        }
+        for (int i = 0; i < argc; i++)
+        {
+            emit("arg", params[i], NULL, NULL);
+        }
+        free(params);
+
+        sprintf(buffer, "%d", argc);
+        result = new_temp();
+        emit(node->type == NODE_SPAWN ? "spawn" : "call_function", call->children[0]->data.identifier.name, buffer, result);
+        break;
+    }
+
+    case NODE_AWAIT:
+    {
+        char *task = generateExpr(node->children[0]);
+        result = new_temp();
+        emit("await", task, NULL, result);
+        break;
+    }
+
+    case NODE_ARRAY_DECL:
+        // 嵌套的数组字面量
+        result = generateArrayLiteral(node->children_count > 0 ? node->children[node->children_count - 1] : NULL);
+        break;
+
+    case NODE_KEY_VALUE_DECL:
+        // 嵌套的键值对字面量
+        result = generateMapLiteral(node, 0);
+        break;
+
+    default:
+        printf("Error: Unsupported expression node %d.\n", node->type);
+        break;
+    }
+
+    return result;
+}
+
+// 自递归尾调用跳回的函数入口标签
+char *function_entry_label(const char *name)
+{
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "entry_%s", name);
+    return strdup(buffer);
+}
+
+// return 的表达式是否可以作为尾调用: 调用用户函数 (内置函数照常调用)
+int is_tail_call(ASTNode *node)
+{
+    if (node == NULL || node->type != NODE_FUNCTION_CALL || node->children_count < 1)
+    {
+        return 0;
+    }
+    const char *name = node->children[0]->data.identifier.name;
+    return strcmp(name, "print") != 0 && strcmp(name, "read") != 0 && parallel_builtin_kind(current_program, node) < 0;
+}
+
+// 是否是对 function 自身的尾调用, 且实参个数与形参相同
+int is_self_tail_call(ASTNode *call, ASTNode *function)
+{
+    if (function == NULL || function->type != NODE_FUNCTION || !is_tail_call(call))
+    {
+        return 0;
+    }
+    int argc = call->children_count == 2 ? call->children[1]->children_count : 0;
+    int param_count = function->data.function.param_list != NULL ? function->data.function.param_list->children_count : 0;
+    return strcmp(call->children[0]->data.identifier.name, function->data.function.name) == 0 && argc == param_count;
+}
+
+// 子树中是否有自递归的尾调用
+int has_self_tail_call(ASTNode *node, ASTNode *function)
+{
+    if (node == NULL)
+    {
+        return 0;
+    }
+    if (node->type == NODE_RETURN_STATEMENT && is_self_tail_call(node->data.return_statement.expression, function))
+    {
+        return 1;
+    }
+    for (int i = 0; i < node->children_count; i++)
+    {
+        if (has_self_tail_call(node->children[i], function))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// return f(...): 自递归时重新绑定形参并跳回入口, 否则生成 tail_call 复用当前栈帧
+void generateTailCall(ASTNode *call)
+{
+    ASTNode *args = call->children_count == 2 ? call->children[1] : NULL;
+    int argc = args != NULL ? args->children_count : 0;
+    char **values = malloc(sizeof(char *) * (argc + 1));
+
+    // 先计算全部实参, 再绑定, 实参中可以读取旧的形参
+    for (int i = 0; i < argc; i++)
+    {
+        values[i] = generateExpr(args->children[i]);
+    }
+
+    if (is_self_tail_call(call, current_function))
+    {
+        ASTNode *params = current_function->data.function.param_list;
+        for (int i = 0; i < argc; i++)
+        {
+            emit("store", values[i], NULL, params->children[i]->data.identifier.name);
+        }
+        emit("goto", function_entry_label(current_function->data.function.name), NULL, NULL);
+    }
+    else
+    {
+        char count[32];
+        for (int i = 0; i < argc; i++)
+        {
+            emit("arg", values[i], NULL, NULL);
+        }
+        sprintf(count, "%d", argc);
+        emit("tail_call", call->children[0]->data.identifier.name, count, NULL);
+    }
+    free(values);
+}
+
+// AST 节点数, 用于估计循环体大小
+int ast_size(ASTNode *node)
+{
+    if (node == NULL)
+    {
+        return 0;
+    }
+
+    int size = 1;
+    if (node->type == NODE_FOR_LOOP)
+    {
+        size += ast_size(node->data.for_loop.start_expr) + ast_size(node->data.for_loop.end_expr);
+    }
+    else if (node->type == NODE_RETURN_STATEMENT)
+    {
+        size += ast_size(node->data.return_statement.expression);
+    }
+    for (int i = 0; i < node->children_count; i++)
+    {
+        size += ast_size(node->children[i]);
+    }
+    return size;
+}
+
+// 子树中是否给变量 name 赋值
+int ast_assigns(ASTNode *node, const char *name)
+{
+    if (node == NULL)
+    {
+        return 0;
+    }
+
+    if (node->type == NODE_ASSIGNMENT && node->children[0]->children_count == 0 &&
+        strcmp(node->children[0]->data.identifier.name, name) == 0)
+    {
+        return 1;
+    }
+    if (node->type == NODE_FOR_LOOP && strcmp(node->data.for_loop.var_name, name) == 0)
+    {
+        return 1;
+    }
+    for (int i = 0; i < node->children_count; i++)
+    {
+        if (ast_assigns(node->children[i], name))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 子树中是否有用户函数调用 (print / read 除外); await 期间其他任务可能执行, 也算作调用
+int ast_has_call(ASTNode *node)
+{
+    if (node == NULL)
+    {
+        return 0;
+    }
+
+    if (node->type == NODE_AWAIT)
+    {
+        return 1;
+    }
+    if (node->type == NODE_FUNCTION_CALL)
+    {
+        const char *name = node->children[0]->data.identifier.name;
+        if (strcmp(name, "print") != 0 && strcmp(name, "read") != 0)
+        {
+            return 1;
+        }
+    }
+    if (node->type == NODE_FOR_LOOP &&
+        (ast_has_call(node->data.for_loop.start_expr) || ast_has_call(node->data.for_loop.end_expr)))
+    {
+        return 1;
+    }
+    if (node->type == NODE_RETURN_STATEMENT && ast_has_call(node->data.return_statement.expression))
+    {
+        return 1;
+    }
+    for (int i = 0; i < node->children_count; i++)
+    {
+        if (ast_has_call(node->children[i]))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 边界都是整数常量, 且循环体不会修改循环变量时, 循环次数在编译期已知
+int constant_trip_count(ASTNode *node, int *trips)
+{
+    ASTNode *start = node->data.for_loop.start_expr;
+    ASTNode *end = node->data.for_loop.end_expr;
+    char *var_name = node->data.for_loop.var_name;
+
+    if (start == NULL || end == NULL || start->type != NODE_INT || end->type != NODE_INT)
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < node->children_count; i++)
+    {
+        if (ast_assigns(node->children[i], var_name))
+        {
+            return 0;
+        }
+        // 全局循环变量可能被调用的函数修改
+        if (ast_has_call(node->children[i]) && is_global_var(var_name))
+        {
+            return 0;
+        }
+    }
+
+    int count = atoi(end->data.int_node.value) - atoi(start->data.int_node.value);
+    *trips = count > 0 ? count : 0;
+    return 1;
+}
+
+// 表达式只由常量, 变量, 以 var 为下标的数组元素和二元运算组成
+int ast_elementwise_expr(ASTNode *node, const char *var)
+{
+    if (node == NULL)
+    {
+        return 0;
+    }
+
+    switch (node->type)
+    {
+    case NODE_INT:
+    case NODE_FLOAT:
+    case NODE_LITERAL:
+    case NODE_IDENTIFIER:
+        return 1;
+    case NODE_EXPRESSION:
+        if (node->children_count == 1)
+        {
+            return ast_elementwise_expr(node->children[0], var);
+        }
+        return node->children_count >= 3 && ast_elementwise_expr(node->children[0], var) &&
+               ast_elementwise_expr(node->children[2], var);
+    case NODE_ARRAY_ACCESS:
+        return node->children[0]->type == NODE_IDENTIFIER && node->children[1]->type == NODE_IDENTIFIER &&
+               strcmp(node->children[1]->data.identifier.name, var) == 0;
+    default:
+        return 0;
+    }
+}
+
+// 循环体只有 a[i] = 逐元素表达式 形式的赋值, 优化器可以把它向量化 (见 optimizer.c 的循环向量化)
+int ast_elementwise_loop(ASTNode *node)
+{
+    const char *var = node->data.for_loop.var_name;
+    for (int i = 0; i < node->children_count; i++)
+    {
+        ASTNode *child = node->children[i];
+        if (child->type == NODE_STATEMENT && child->children_count == 1)
+        {
+            child = child->children[0];
+        }
+        if (child->type != NODE_ASSIGNMENT || child->children[0]->children_count == 0)
+        {
+            return 0;
+        }
+        ASTNode *index = child->children[0]->children[0];
+        if (index->type != NODE_IDENTIFIER || strcmp(index->data.identifier.name, var) != 0 ||
+            !ast_elementwise_expr(child->children[1], var))
+        {
+            return 0;
+        }
+    }
+    return node->children_count > 0;
+}
+
+// 可以向量化的循环不展开, 保持原样交给优化器
+int can_unroll_loop(ASTNode *node, int *trips)
+{
+    if (unroll_factor <= 1 || !constant_trip_count(node, trips) || ast_elementwise_loop(node))
+    {
+        return 0;
+    }
+
+    int body_size = 0;
+    for (int i = 0; i < node->children_count; i++)
+    {
+        body_size += ast_size(node->children[i]);
+    }
+    return body_size <= unroll_max_body;
+}
+
+// i = i + 1
+void generateLoopIncrement(char *var_name)
+{
+    char *counter = new_temp();
+    char *one = new_temp();
+    char *next = new_temp();
+    emit("load", var_name, NULL, counter);
+    emit("load_const", "1", NULL, one);
+    emit("add", counter, one, next);
+    emit("store", next, NULL, var_name);
+}
+
+// 生成一次迭代: 循环体与循环变量自增
+void generateLoopBody(ASTNode *node)
+{
+    for (int i = 0; i < node->children_count; i++)
+    {
+        generateIR(node->children[i]);
+    }
+    generateLoopIncrement(node->data.for_loop.var_name);
+}
+
+// 部分展开常量次数的循环: 主循环每次执行 unroll_factor 次迭代, 余下的迭代直接展开
+void generateUnrolledLoop(ASTNode *node, int trips)
+{
+    char *var_name = node->data.for_loop.var_name;
+    int remainder = trips % unroll_factor;
+    int main_trips = trips - remainder;
+
+    if (main_trips > unroll_factor)
+    {
+        int id = ++label_counter;
+        char *loop_start = new_label("loop_start", id);
+        char *loop_end = new_label("loop_end", id);
+        char bound_value[32];
+        char *bound = new_temp();
+
+        sprintf(bound_value, "%d", atoi(node->data.for_loop.start_expr->data.int_node.value) + main_trips);
+        emit("load_const", bound_value, NULL, bound);
+
+        emit("label", loop_start, NULL, NULL);
+
+        char *current = new_temp();
+        emit("load", var_name, NULL, current);
+        char *condition = new_temp();
+        emit("lt", current, bound, condition);
+        emit("if_false", condition, loop_end, NULL);
+
+        for (int u = 0; u < unroll_factor; u++)
+        {
+            generateLoopBody(node);
+        }
+
+        emit("goto", loop_start, NULL, NULL);
+        emit("label", loop_end, NULL, NULL);
+    }
+    else
+    {
+        // 主循环只有一轮时完全展开
+        remainder = trips;
+    }
+
+    for (int r = 0; r < remainder; r++)
+    {
+        generateLoopBody(node);
+    }
+}
+
+// ---------------- 并行循环 ----------------
+
+// for (i: start, end) 的迭代互不依赖时, 循环体提取为函数 f($lo, $hi, 捕获的变量...):
+//     for (i: $lo, $hi) { 循环体 } return i;
+// 原处生成 parallel_for f, 实参依次是 start, end, 捕获的变量, 写入的数组, 读取的容器, 写入的数组个数和读取的容器个数,
+// 运行时由 parallel.c 检查实参, 把 [start, end) 分给多个线程, 不能并行时顺序调用一次 f 执行整个循环
+//
+// 迭代互不依赖的条件 (保守):
+//   - 循环体只有赋值, 变量声明, if 和内层 for, 没有调用 (包括 print / read) 和 return
+//   - 数组只以 a[i] 的形式写入 (i 是循环变量), 写入的数组在循环体中也只读取 a[i]
+//   - 其他下标读取的容器不写入, 下标中没有字符串常量 (字段访问的内联缓存不是线程安全的)
+//   - 赋值的标量是每次迭代私有的: 不是全局变量和形参, 函数中循环之外没有用到,
+//     循环体中第一条用到它的顶层语句就是不读取它的赋值 (或以它为循环变量的内层 for)
+//   - 循环变量是局部变量, 循环体不修改它
+// 写入的数组是否互不相同, 是否与读取的数组重叠由运行时检查
+// 逐元素的循环交给循环向量化 (见 optimizer.c), 不提取
+
+typedef struct
+{
+    char **names;
+    int count;
+} NameList;
+
+int name_list_has(NameList *list, const char *name)
+{
+    for (int i = 0; i < list->count; i++)
+    {
+        if (strcmp(list->names[i], name) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void name_list_add(NameList *list, char *name)
+{
+    if (name_list_has(list, name))
+    {
+        return;
+    }
+    list->names = realloc(list->names, sizeof(char *) * (list->count + 1));
+    list->names[list->count++] = name;
+}
+
+// 循环的依赖分析结果
+typedef struct
+{
+    char *var;         // 循环变量
+    NameList scalars;  // 循环体中赋值的标量 (每次迭代私有)
+    NameList written;  // 以 a[i] 的形式写入的数组
+    NameList read;     // 下标读取的其他容器
+    NameList captured; // 循环体读取的外层局部变量, 作为提取出的函数的形参
+} LoopDependence;
+
+void loop_dependence_free(LoopDependence *d)
+{
+    free(d->scalars.names);
+    free(d->written.names);
+    free(d->read.names);
+    free(d->captured.names);
+}
+
+// 子树中出现 name 的次数 (读取, 赋值, 声明, 循环变量)
+int ast_mentions(ASTNode *node, const char *name)
+{
+    if (node == NULL)
+    {
+        return 0;
+    }
+
+    int count = 0;
+    if (node->type == NODE_IDENTIFIER && strcmp(node->data.identifier.name, name) == 0)
+    {
+        count++;
+    }
+    else if (node->type == NODE_VAR_DECL && strcmp(node->data.var_decl.name, name) == 0)
+    {
+        count++;
+    }
+    else if (node->type == NODE_FOR_LOOP)
+    {
+        count += strcmp(node->data.for_loop.var_name, name) == 0;
+        count += ast_mentions(node->data.for_loop.start_expr, name) + ast_mentions(node->data.for_loop.end_expr, name);
+    }
+    else if (node->type == NODE_RETURN_STATEMENT)
+    {
+        count += ast_mentions(node->data.return_statement.expression, name);
+    }
+    for (int i = 0; i < node->children_count; i++)
+    {
+        count += ast_mentions(node->children[i], name);
+    }
+    return count;
+}
+
+// 收集循环体中赋值的标量和写入的数组
+void loop_collect_assigned(LoopDependence *d, ASTNode *node)
+{
+    if (node == NULL)
+    {
+        return;
+    }
+
+    if (node->type == NODE_ASSIGNMENT)
+    {
+        ASTNode *target = node->children[0];
+        name_list_add(target->children_count == 0 ? &d->scalars : &d->written, target->data.identifier.name);
+    }
+    else if (node->type == NODE_VAR_DECL)
+    {
+        name_list_add(&d->scalars, node->data.var_decl.name);
+    }
+    else if (node->type == NODE_FOR_LOOP)
+    {
+        name_list_add(&d->scalars, node->data.for_loop.var_name);
+    }
+    for (int i = 0; i < node->children_count; i++)
+    {
+        loop_collect_assigned(d, node->children[i]);
+    }
+}
+
+// 顶层语句是否给 name 赋值且不读取它
+int defines_before_use(ASTNode *node, const char *name)
+{
+    if (node->type == NODE_ASSIGNMENT && node->children[0]->children_count == 0 &&
+        strcmp(node->children[0]->data.identifier.name, name) == 0)
+    {
+        return ast_mentions(node->children[1], name) == 0;
+    }
+    if (node->type == NODE_VAR_DECL && strcmp(node->data.var_decl.name, name) == 0)
+    {
+        return ast_mentions(node->data.var_decl.value, name) == 0;
+    }
+    if (node->type == NODE_FOR_LOOP && strcmp(node->data.for_loop.var_name, name) == 0)
+    {
+        return ast_mentions(node->data.for_loop.start_expr, name) == 0 &&
+               ast_mentions(node->data.for_loop.end_expr, name) == 0;
+    }
+    return 0;
+}
+
+// 语句序列中第一条用到 name 的语句是否给它赋值且不读取它
+// 第一条是内层 for 且之后的语句不再用到 name 时, 看内层循环体 (内层循环不执行时也不会读取 name)
+int defines_first(ASTNode **statements, int count, const char *name)
+{
+    for (int i = 0; i < count; i++)
+    {
+        ASTNode *node = statements[i];
+        if (ast_mentions(node, name) == 0)
+        {
+            continue;
+        }
+        if (defines_before_use(node, name))
+        {
+            return 1;
+        }
+        if (node->type != NODE_FOR_LOOP || ast_mentions(node->data.for_loop.start_expr, name) > 0 ||
+            ast_mentions(node->data.for_loop.end_expr, name) > 0)
+        {
+            return 0;
+        }
+        for (int k = i + 1; k < count; k++)
+        {
+            if (ast_mentions(statements[k], name) > 0)
+            {
+                return 0;
+            }
+        }
+        return defines_first(node->children, node->children_count, name);
+    }
+    return 0;
+}
+
+// 循环体中赋值的标量 name 是否是每次迭代私有的
+int loop_private_ok(ASTNode *loop, const char *name)
+{
+    if (is_global_var(name))
+    {
+        return 0;
+    }
+    ASTNode *params = current_function->type == NODE_FUNCTION ? current_function->data.function.param_list : NULL;
+    for (int i = 0; params != NULL && i < params->children_count; i++)
+    {
+        if (strcmp(params->children[i]->data.identifier.name, name) == 0)
+        {
+            return 0;
+        }
+    }
+    if (ast_mentions(current_function, name) != ast_mentions(loop, name))
+    {
+        return 0;
+    }
+    return defines_first(loop->children, loop->children_count, name);
+}
+
+// 读取变量 name: 外层的局部变量作为提取出的函数的形参
+void loop_read(LoopDependence *d, char *name)
+{
+    if (strcmp(name, d->var) != 0 && !name_list_has(&d->scalars, name) && !is_global_var(name))
+    {
+        name_list_add(&d->captured, name);
+    }
+}
+
+int loop_expr_ok(LoopDependence *d, ASTNode *node, int in_index)
+{
+    if (node == NULL)
+    {
+        return 0;
+    }
+
+    switch (node->type)
+    {
+    case NODE_INT:
+    case NODE_FLOAT:
+    case NODE_LITERAL:
+        return 1;
+    case NODE_STRING:
+        return !in_index;
+    case NODE_IDENTIFIER:
+        loop_read(d, node->data.identifier.name);
+        return 1;
+    case NODE_EXPRESSION:
+        if (node->children_count == 1)
+        {
+            return loop_expr_ok(d, node->children[0], in_index);
+        }
+        return node->children_count >= 3 && loop_expr_ok(d, node->children[0], in_index) &&
+               loop_expr_ok(d, node->children[2], in_index);
+    case NODE_ARRAY_ACCESS:
+    {
+        ASTNode *base = node->children[0];
+        ASTNode *index = node->children[1];
+        if (base->type != NODE_IDENTIFIER)
+        {
+            return 0;
+        }
+        char *name = base->data.identifier.name;
+        if (strcmp(name, d->var) == 0 || name_list_has(&d->scalars, name))
+        {
+            return 0;
+        }
+        if (name_list_has(&d->written, name))
+        {
+            if (index->type != NODE_IDENTIFIER || strcmp(index->data.identifier.name, d->var) != 0)
+            {
+                return 0;
+            }
+        }
+        else
+        {
+            name_list_add(&d->read, name);
+        }
+        loop_read(d, name);
+        return loop_expr_ok(d, index, 1);
+    }
+    default:
+        return 0;
+    }
+}
+
+int loop_stmt_ok(LoopDependence *d, ASTNode *node)
+{
+    if (node == NULL)
+    {
+        return 0;
+    }
+
+    switch (node->type)
+    {
+    case NODE_STATEMENT:
+        for (int i = 0; i < node->children_count; i++)
+        {
+            if (!loop_stmt_ok(d, node->children[i]))
+            {
+                return 0;
+            }
+        }
+        return 1;
+    case NODE_ASSIGNMENT:
+    {
+        ASTNode *target = node->children[0];
+        if (target->children_count > 0)
+        {
+            ASTNode *index = target->children[0];
+            if (index->type != NODE_IDENTIFIER || strcmp(index->data.identifier.name, d->var) != 0)
+            {
+                return 0;
+            }
+            loop_read(d, target->data.identifier.name);
+        }
+        return loop_expr_ok(d, node->children[1], 0);
+    }
+    case NODE_VAR_DECL:
+        return loop_expr_ok(d, node->data.var_decl.value, 0);
+    case NODE_IF_STATEMENT:
+        if (node->children_count < 2 || !loop_expr_ok(d, node->children[0], 0) || !loop_stmt_ok(d, node->children[1]))
+        {
+            return 0;
+        }
+        return node->children_count == 2 ||
+               (node->children[2]->type == NODE_ELSE_STATEMENT && loop_stmt_ok(d, node->children[2]->children[0]));
+    case NODE_FOR_LOOP:
+        if (!loop_expr_ok(d, node->data.for_loop.start_expr, 0) || !loop_expr_ok(d, node->data.for_loop.end_expr, 0))
+        {
+            return 0;
+        }
+        for (int i = 0; i < node->children_count; i++)
+        {
+            if (!loop_stmt_ok(d, node->children[i]))
+            {
+                return 0;
+            }
+        }
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// 循环能否提取为并行执行的函数
+int analyze_parallel_loop(ASTNode *node, LoopDependence *d)
+{
+    memset(d, 0, sizeof(LoopDependence));
+    d->var = node->data.for_loop.var_name;
+    if (!parallel_loops || generating_parallel_body || current_function == NULL || current_program == NULL ||
+        is_global_var(d->var) || ast_elementwise_loop(node))
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < node->children_count; i++)
+    {
+        loop_collect_assigned(d, node->children[i]);
+    }
+    if (d->written.count == 0 || d->written.count > parallel_max_arrays || name_list_has(&d->scalars, d->var) ||
+        name_list_has(&d->written, d->var))
+    {
+        return 0;
+    }
+    for (int i = 0; i < d->scalars.count; i++)
+    {
+        if (name_list_has(&d->written, d->scalars.names[i]) || !loop_private_ok(node, d->scalars.names[i]))
+        {
+            return 0;
+        }
+    }
+    for (int i = 0; i < node->children_count; i++)
+    {
+        if (!loop_stmt_ok(d, node->children[i]))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+ASTNode *identifier_node(const char *name)
+{
+    ASTNode *node = create_node(NODE_IDENTIFIER);
+    node->data.identifier.name = strdup(name);
+    return node;
+}
+
+// 提取出的函数名: 所在函数名_loopN, 不与程序中的函数重名
+char *parallel_body_name()
+{
+    const char *base = current_function->type == NODE_FUNCTION ? current_function->data.function.name : "main";
+    char buffer[256];
+    int taken = 1;
+    while (taken)
+    {
+        snprintf(buffer, sizeof(buffer), "%s_loop%d", base, ++parallel_body_counter);
+        taken = 0;
+        for (int i = 0; i < current_program->children_count; i++)
+        {
+            ASTNode *child = current_program->children[i];
+            if (child->type == NODE_FUNCTION && strcmp(child->data.function.name, buffer) == 0)
+            {
+                taken = 1;
+            }
+        }
+    }
+    return strdup(buffer);
+}
+
+// 提取循环体, 原处生成 parallel_for; 返回后循环变量是终值
+void generateParallelLoop(ASTNode *node, LoopDependence *d)
+{
+    char *name = parallel_body_name();
+
+    ASTNode *function = create_node(NODE_FUNCTION);
+    function->data.function.name = name;
+    ASTNode *params = create_node(NODE_PARAM_LIST);
+    add_child(params, identifier_node("$lo"));
+    add_child(params, identifier_node("$hi"));
+    for (int i = 0; i < d->captured.count; i++)
+    {
+        add_child(params, identifier_node(d->captured.names[i]));
+    }
+    function->data.function.param_list = params;
+
+    ASTNode *loop = create_node(NODE_FOR_LOOP);
+    loop->data.for_loop.var_name = d->var;
+    loop->data.for_loop.start_expr = identifier_node("$lo");
+    loop->data.for_loop.end_expr = identifier_node("$hi");
+    loop->children = node->children;
+    loop->children_count = node->children_count;
+    add_child(function, loop);
+    ASTNode *result = create_node(NODE_RETURN_STATEMENT);
+    result->data.return_statement.expression = identifier_node(d->var);
+    add_child(function, result);
+
+    parallel_bodies = realloc(parallel_bodies, sizeof(ASTNode *) * (parallel_body_count + 1));
+    parallel_bodies[parallel_body_count++] = function;
+
+    // 与普通循环相同: 先存入 start, 边界只计算一次
+    char *start = generateExpr(node->data.for_loop.start_expr);
+    emit("store", start, NULL, d->var);
+    char *end = generateExpr(node->data.for_loop.end_expr);
+
+    int argc = 4 + d->captured.count + d->written.count + d->read.count;
+    char **values = malloc(sizeof(char *) * argc);
+    char count[32];
+    int n = 0;
+    values[n++] = start;
+    values[n++] = end;
+    for (int i = 0; i < d->captured.count; i++)
+    {
+        values[n] = new_temp();
+        emit("load", d->captured.names[i], NULL, values[n++]);
+    }
+    for (int i = 0; i < d->written.count; i++)
+    {
+        values[n] = new_temp();
+        emit("load", d->written.names[i], NULL, values[n++]);
+    }
+    for (int i = 0; i < d->read.count; i++)
+    {
+        values[n] = new_temp();
+        emit("load", d->read.names[i], NULL, values[n++]);
+    }
+    values[n] = new_temp();
+    sprintf(count, "%d", d->written.count);
+    emit("load_const", count, NULL, values[n++]);
+    values[n] = new_temp();
+    sprintf(count, "%d", d->read.count);
+    emit("load_const", count, NULL, values[n++]);
+
+    for (int i = 0; i < argc; i++)
+    {
+        emit("arg", values[i], NULL, NULL);
+    }
+    free(values);
+
+    char *final = new_temp();
+    sprintf(count, "%d", argc);
+    emit("parallel_for", name, count, final);
+    emit("store", final, NULL, d->var);
+}
+
+// ---------------- 并行的 pmap / pfilter / preduce ----------------
+
+// pmap(a, f), pfilter(a, f) 和 preduce(a, f, init) 对数组 a 的每个元素调用用户函数 f (这里 f 只能是函数名):
+// pmap 得到 f(a[i]) 组成的数组, pfilter 得到 f(a[i]) 为真的元素组成的数组, preduce 把元素依次与累积值合并
+// 生成 parallel_apply f, 实参依次是数组, 初值 (pmap / pfilter 为 nil), 种类和 f 是否是纯函数,
+// 运行时由 parallel.c 分块交给线程池, 各块的结果按元素的顺序合并; f 不是纯函数时按顺序逐个调用
+// 程序中定义了同名的函数, 或者形式不符时是普通的函数调用
+
+// 种类的编号与 parallel.c 的 PARALLEL_MAP, PARALLEL_FILTER, PARALLEL_REDUCE 相同
+const char *parallel_builtin_names[] = {"pmap", "pfilter", "preduce"};
+
+ASTNode *ast_find_function(ASTNode *program, const char *name)
+{
+    for (int i = 0; program != NULL && i < program->children_count; i++)
+    {
+        ASTNode *child = program->children[i];
+        if (child->type == NODE_FUNCTION && strcmp(child->data.function.name, name) == 0)
+        {
+            return child;
+        }
+    }
+    return NULL;
+}
+
+// 顶层声明的变量 (全局变量)
+int ast_is_global(ASTNode *program, const char *name)
+{
+    for (int i = 0; program != NULL && i < program->children_count; i++)
+    {
+        ASTNode *child = program->children[i];
+        if (child->type == NODE_VAR_DECL && strcmp(child->data.var_decl.name, name) == 0)
+        {
+            return 1;
+        }
+        if ((child->type == NODE_ARRAY_DECL || child->type == NODE_KEY_VALUE_DECL) &&
+            strcmp(child->children[0]->data.identifier.name, name) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
 }
 
-void generateIR(ASTNode *node)
+// 把子树中的 name 改为 renamed (读取, 赋值, 循环变量), 被调函数的名字不变
+void ast_rename(ASTNode *node, const char *name, const char *renamed)
 {
     if (node == NULL)
     {
         return;
     }
-
-    switch (node->type)
+    if (node->type == NODE_IDENTIFIER && strcmp(node->data.identifier.name, name) == 0)
     {
-    case NODE_FUNCTION:
-        printf("Function: %s\n", node->data.function.name);
-
-        if (node->children_count > 0)
+        node->data.identifier.name = strdup(renamed);
+    }
+    else if (node->type == NODE_FOR_LOOP)
+    {
+        if (strcmp(node->data.for_loop.var_name, name) == 0)
         {
-            generateIR(node->children[0]);
+            node->data.for_loop.var_name = strdup(renamed);
+        }
+        ast_rename(node->data.for_loop.start_expr, name, renamed);
+        ast_rename(node->data.for_loop.end_expr, name, renamed);
+    }
+    else if (node->type == NODE_RETURN_STATEMENT)
+    {
+        ast_rename(node->data.return_statement.expression, name, renamed);
+    }
+    for (int i = node->type == NODE_FUNCTION_CALL ? 1 : 0; i < node->children_count; i++)
+    {
+        ast_rename(node->children[i], name, renamed);
+    }
+}
 
-            for (int i = 1; i < node->children_count; i++)
+// 形参遮蔽同名的全局变量: 名字解析时全局变量优先, 所以把这样的形参和函数中对它的读写改为 name.param,
+// 这个名字不是合法的标识符, 不会与其他变量冲突; 生成 IR 和解释执行之前调用, 所有执行引擎的结果一致
+void rename_shadowing_params(ASTNode *program)
+{
+    for (int i = 0; program != NULL && i < program->children_count; i++)
+    {
+        ASTNode *function = program->children[i];
+        if (function->type != NODE_FUNCTION || function->data.function.param_list == NULL)
+        {
+            continue;
+        }
+        ASTNode *params = function->data.function.param_list;
+        for (int k = 0; k < params->children_count; k++)
+        {
+            char *name = params->children[k]->data.identifier.name;
+            if (!ast_is_global(program, name))
             {
-                generateIR(node->children[i]);
+                continue;
             }
+            char renamed[256];
+            snprintf(renamed, sizeof(renamed), "%s.param", name);
+            for (int c = 0; c < function->children_count; c++)
+            {
+                ast_rename(function->children[c], name, renamed);
+            }
+            params->children[k]->data.identifier.name = strdup(renamed);
         }
-        break;
+    }
+}
 
-    case NODE_VAR_DECL:
-        emit("alloc", node->data.var_decl.name, NULL, NULL);
-        if (node->data.var_decl.value != NULL)
+// 调用是否是并行的内置函数, 返回种类, 不是时返回 -1
+int parallel_builtin_kind(ASTNode *program, ASTNode *call)
+{
+    const char *name = call->children[0]->data.identifier.name;
+    ASTNode *args = call->children_count == 2 ? call->children[1] : NULL;
+    for (int kind = 0; kind < 3; kind++)
+    {
+        if (strcmp(name, parallel_builtin_names[kind]) != 0)
         {
-            generateIR(node->data.var_decl.value);
-            emit("store", "temp_var", NULL, node->data.var_decl.name);
+            continue;
         }
-        break;
+        if (args == NULL || args->children_count != (kind == 2 ? 3 : 2) ||
+            args->children[1]->type != NODE_IDENTIFIER || ast_find_function(program, name) != NULL)
+        {
+            return -1;
+        }
+        return kind;
+    }
+    return -1;
+}
 
-    case NODE_MAIN:
-        printf("Function: main\n");
+// 纯函数的检查: 从 f 出发能调用到的函数都没有副作用时, 多个线程可以同时执行 f
+//   - 不写全局变量和任何数组 / 键值对 (数组只能是全局的或者由实参传入, 都可能被其他调用读取)
+//   - 不调用 print / read, 没有 spawn / await, 调用的函数也都是纯函数
+//   - 字符串常量和下标访问不同时出现: 常量键的访问带内联缓存 (内联后可能跨越函数), 缓存不是线程安全的
+typedef struct
+{
+    ASTNode *program;
+    NameList visited;
+    int strings;
+    int indexes;
+} PurityCheck;
 
-        for (int i = 0; i < node->children_count; i++)
+int ast_pure(PurityCheck *check, ASTNode *node);
+
+int function_pure(PurityCheck *check, const char *name)
+{
+    ASTNode *function = ast_find_function(check->program, name);
+    if (function == NULL)
+    {
+        return 0;
+    }
+    // 递归调用: 正在检查的函数先当作纯函数
+    if (name_list_has(&check->visited, name))
+    {
+        return 1;
+    }
+    name_list_add(&check->visited, function->data.function.name);
+    for (int i = 0; i < function->children_count; i++)
+    {
+        if (!ast_pure(check, function->children[i]))
         {
-            generateIR(node->children[i]);
+            return 0;
         }
+    }
+    return 1;
+}
 
-        emit("end_main", NULL, NULL, NULL);
+int ast_pure(PurityCheck *check, ASTNode *node)
+{
+    if (node == NULL)
+    {
+        return 1;
+    }
 
+    switch (node->type)
+    {
+    case NODE_SPAWN:
+    case NODE_AWAIT:
+        return 0;
+    case NODE_STRING:
+        check->strings = 1;
         break;
-
+    case NODE_ARRAY_ACCESS:
+        check->indexes = 1;
+        break;
+    case NODE_ASSIGNMENT:
+        if (node->children[0]->children_count > 0 || ast_is_global(check->program, node->children[0]->data.identifier.name))
+        {
+            return 0;
+        }
+        break;
+    case NODE_VAR_DECL:
+        if (ast_is_global(check->program, node->data.var_decl.name))
+        {
+            return 0;
+        }
+        return ast_pure(check, node->data.var_decl.value);
+    case NODE_FOR_LOOP:
+        if (ast_is_global(check->program, node->data.for_loop.var_name) ||
+            !ast_pure(check, node->data.for_loop.start_expr) || !ast_pure(check, node->data.for_loop.end_expr))
+        {
+            return 0;
+        }
+        break;
+    case NODE_RETURN_STATEMENT:
+        return ast_pure(check, node->data.return_statement.expression);
     case NODE_FUNCTION_CALL:
-        if (node->children_count >= 1)
+    {
+        const char *name = node->children[0]->data.identifier.name;
+        int kind = parallel_builtin_kind(check->program, node);
+        if (kind >= 0)
         {
-            generateIR(node->children[0]);
-
-            char param_list[1024] = "";
-
-            if (node->children_count == 2)
-            {
-                for (int i = 0; i < node->children[1]->children_count; i++)
-                {
-                    generateIR(node->children[1]->children[i]);
-
-                    strcat(param_list, "temp_param");
-                    if (i < node->children[1]->children_count - 1)
-                    {
-                        strcat(param_list, ", ");
-                    }
-                }
-            }
-
-            emit("call_function", "temp_func_name", param_list, "temp_result");
+            name = node->children[1]->children[1]->data.identifier.name;
         }
-        else
+        if (!function_pure(check, name))
         {
-            printf("Error: Incomplete function call structure.\n");
+            return 0;
         }
         break;
+    }
+    default:
+        break;
+    }
+    for (int i = 0; i < node->children_count; i++)
+    {
+        if (!ast_pure(check, node->children[i]))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
 
-    case NODE_IF_STATEMENT:
-        if (node->children_count >= 2)
+int ast_function_pure(ASTNode *program, const char *name)
+{
+    PurityCheck check;
+    memset(&check, 0, sizeof(check));
+    check.program = program;
+    int pure = function_pure(&check, name) && !(check.strings && check.indexes);
+    free(check.visited.names);
+    return pure;
+}
+
+char *generateParallelApply(ASTNode *call, int kind)
+{
+    ASTNode *args = call->children[1];
+    const char *function = args->children[1]->data.identifier.name;
+    char *values[4];
+    values[0] = generateExpr(args->children[0]);
+    if (kind == 2)
+    {
+        values[1] = generateExpr(args->children[2]);
+    }
+    else
+    {
+        values[1] = new_temp();
+        emit("load_const", "nil", NULL, values[1]);
+    }
+    char buffer[32];
+    values[2] = new_temp();
+    sprintf(buffer, "%d", kind);
+    emit("load_const", buffer, NULL, values[2]);
+    values[3] = new_temp();
+    sprintf(buffer, "%d", ast_function_pure(current_program, function));
+    emit("load_const", buffer, NULL, values[3]);
+
+    for (int i = 0; i < 4; i++)
+    {
+        emit("arg", values[i], NULL, NULL);
+    }
+    char *result = new_temp();
+    emit("parallel_apply", (char *)function, "4", result);
+    return result;
+}
+
+// ---------------- 字符串构建器 ----------------
+
+// 循环中反复执行的 s = s + x 每次复制整个字符串, 总代价是 O(n^2); s 满足下面的条件时改为原地追加 (见 value.c):
+//   - s 是局部变量, 循环 (包括边界表达式) 中出现 s 的地方都是 s = s + x 形式的语句, x 中没有 s
+// 这时循环中 s 的值除了下一次追加之外没有人读取, 进入循环时 string_builder 把它复制为构建器,
+// 循环中的追加生成 string_append, 构建器只被 s 引用, 可以直接修改; 内层循环沿用外层循环的构建器
+
+// 正在生成的循环中以构建器方式追加的变量
+NameList string_builders;
+
+// node 是否是 s = s + x, x 中没有 s
+int is_self_append(ASTNode *node, const char *name)
+{
+    if (node->type != NODE_ASSIGNMENT || node->children[0]->children_count > 0 ||
+        strcmp(node->children[0]->data.identifier.name, name) != 0)
+    {
+        return 0;
+    }
+    ASTNode *value = node->children[1];
+    return value->type == NODE_EXPRESSION && value->children_count == 3 &&
+           strcmp(value->children[1]->data.operator_node.op, "+") == 0 && value->children[0]->type == NODE_IDENTIFIER &&
+           strcmp(value->children[0]->data.identifier.name, name) == 0 && ast_mentions(value->children[2], name) == 0;
+}
+
+int count_self_appends(ASTNode *node, const char *name)
+{
+    if (node == NULL)
+    {
+        return 0;
+    }
+    if (is_self_append(node, name))
+    {
+        return 1;
+    }
+    int count = 0;
+    for (int i = 0; i < node->children_count; i++)
+    {
+        count += count_self_appends(node->children[i], name);
+    }
+    return count;
+}
+
+// 收集循环 loop 中可以用构建器追加的变量, 加入 string_builders
+void string_builder_names(ASTNode *loop, ASTNode *node)
+{
+    if (node == NULL)
+    {
+        return;
+    }
+    if (node->type == NODE_ASSIGNMENT && node->children[0]->children_count == 0)
+    {
+        char *name = node->children[0]->data.identifier.name;
+        if (is_self_append(node, name) && !name_list_has(&string_builders, name) &&
+            !ast_is_global(current_program, name) && ast_mentions(loop, name) == 2 * count_self_appends(loop, name))
         {
-            generateIR(node->children[0]);
-            emit("if_false", "temp_condition", "label_else", NULL);
+            name_list_add(&string_builders, name);
+        }
+    }
+    for (int i = 0; i < node->children_count; i++)
+    {
+        string_builder_names(loop, node->children[i]);
+    }
+}
 
-            generateIR(node->children[1]);
+// 进入循环之前把新加入的变量复制为构建器
+void generateStringBuilders(int from)
+{
+    for (int i = from; i < string_builders.count; i++)
+    {
+        char *value = new_temp();
+        emit("load", string_builders.names[i], NULL, value);
+        char *builder = new_temp();
+        emit("string_builder", value, NULL, builder);
+        emit("store", builder, NULL, string_builders.names[i]);
+    }
+}
 
-            if (node->children_count > 2 && node->children[2]->type == NODE_ELSE_STATEMENT)
-            {
-                emit("goto", "label_end_if", NULL, NULL);
-                emit("label", "label_else", NULL, NULL);
-                generateIR(node->children[2]->children[0]);
-            }
-            else
+void generateIR(ASTNode *node)
+{
+    if (node == NULL)
+    {
+        return;
+    }
+
+    switch (node->type)
+    {
+    case NODE_PROGRAM:
+        current_program = node;
+        rename_shadowing_params(node);
+        // 先生成全局声明, 再生成函数
+        for (int i = 0; i < node->children_count; i++)
+        {
+            NodeType type = node->children[i]->type;
+            if (type != NODE_FUNCTION && type != NODE_MAIN)
             {
-                emit("label", "label_else", NULL, NULL);
+                generateIR(node->children[i]);
             }
-
-            emit("label", "label_end_if", NULL, NULL);
         }
-        else
+        for (int i = 0; i < node->children_count; i++)
         {
-            printf("Error: Incomplete if statement structure.\n");
+            NodeType type = node->children[i]->type;
+            if (type == NODE_FUNCTION || type == NODE_MAIN)
+            {
+                generateIR(node->children[i]);
+            }
+            // 函数中提取出的并行循环体紧跟在函数之后
+            generating_parallel_body = 1;
+            for (int k = 0; k < parallel_body_count; k++)
+            {
+                generateIR(parallel_bodies[k]);
+            }
+            generating_parallel_body = 0;
+            parallel_body_count = 0;
         }
         break;
 
-    case NODE_FOR_LOOP:
-        generateIR(node->data.for_loop.start_expr);
-
-        emit("label", "loop_start", NULL, NULL);
-
-        generateIR(node->data.for_loop.end_expr);
-        emit("if_false", "temp_condition", "loop_end", NULL);
+    case NODE_FUNCTION:
+        current_function = node;
+        emit("function", node->data.function.name, NULL, NULL);
 
-        if (node->children_count > 0)
+        if (node->data.function.param_list != NULL)
         {
-            for (int i = 0; i < node->children_count; i++)
+            for (int i = 0; i < node->data.function.param_list->children_count; i++)
             {
-                generateIR(node->children[i]);
+                emit("param", node->data.function.param_list->children[i]->data.identifier.name, NULL, NULL);
             }
         }
 
-        emit("add", node->data.for_loop.var_name, NULL, NULL);
-        emit("goto", "loop_start", NULL, NULL);
-
-        emit("label", "loop_end", NULL, NULL);
-        break;
+        if (has_self_tail_call(node, node))
+        {
+            emit("label", function_entry_label(node->data.function.name), NULL, NULL);
+        }
 
-    case NODE_RETURN_STATEMENT:
+        for (int i = 0; i < node->children_count; i++)
+        {
+            generateIR(node->children[i]);
+        }
 
-        generateIR(node->data.return_statement.expression);
-        emit("return", NULL, NULL, NULL);
+        emit("end_function", node->data.function.name, NULL, NULL);
+        current_function = NULL;
         break;
 
-    case NODE_LITERAL:
-
-        emit("load_const", node->data.literal.value, NULL, "temp_literal");
-        break;
+    case NODE_MAIN:
+        current_function = node;
+        emit("function", "main", NULL, NULL);
 
-    case NODE_IDENTIFIER:
+        for (int i = 0; i < node->children_count; i++)
+        {
+            generateIR(node->children[i]);
+        }
 
-        emit("load", node->data.identifier.name, NULL, "temp_var");
+        emit("end_function", "main", NULL, NULL);
         break;
 
-    case NODE_EXPRESSION_LIST:
-
-        for (int i = 0; i < node->data.expression_list.count; i++)
+    case NODE_VAR_DECL:
+        emit("alloc", node->data.var_decl.name, NULL, NULL);
+        if (node->data.var_decl.value != NULL)
         {
-            generateIR(node->data.expression_list.items[i]);
+            char *value = generateExpr(node->data.var_decl.value);
+            emit("store", value, NULL, node->data.var_decl.name);
         }
         break;
 
-    case NODE_ARGUMENT_LIST:
+    case NODE_ARRAY_DECL:
+    {
+        char *name = node->children[0]->data.identifier.name;
+        emit("alloc", name, NULL, NULL);
+        char *array = generateArrayLiteral(node->children_count > 1 ? node->children[1] : NULL);
+        emit("store", array, NULL, name);
+        break;
+    }
+
+    case NODE_KEY_VALUE_DECL:
+    {
+        char *name = node->children[0]->data.identifier.name;
+        emit("alloc", name, NULL, NULL);
+        char *map = generateMapLiteral(node, 1);
+        emit("store", map, NULL, name);
+        break;
+    }
 
+    case NODE_STATEMENT:
         for (int i = 0; i < node->children_count; i++)
         {
             generateIR(node->children[i]);
+        }
+        break;
+
+    case NODE_ASSIGNMENT:
+    {
+        ASTNode *target = node->children[0];
+        char *name = target->data.identifier.name;
 
-            emit("arg", "temp_param", NULL, NULL);
+        if (target->children_count > 0)
+        {
+            // array[index] = value
+            char *array = new_temp();
+            emit("load", name, NULL, array);
+            char *index = generateExpr(target->children[0]);
+            char *value = generateExpr(node->children[1]);
+            emit("array_store", index, value, array);
+        }
+        else if (name_list_has(&string_builders, name) && is_self_append(node, name))
+        {
+            // s = s + x 追加到构建器
+            char *current = new_temp();
+            emit("load", name, NULL, current);
+            char *value = generateExpr(node->children[1]->children[2]);
+            char *result = new_temp();
+            emit("string_append", current, value, result);
+            emit("store", result, NULL, name);
+        }
+        else
+        {
+            char *value = generateExpr(node->children[1]);
+            emit("store", value, NULL, name);
         }
         break;
+    }
 
-    case NODE_KEY_VALUE_PAIR:
+    case NODE_FUNCTION_CALL:
+    case NODE_SPAWN:
+    case NODE_AWAIT:
+        generateExpr(node);
+        break;
 
+    case NODE_IF_STATEMENT:
         if (node->children_count >= 2)
         {
-            generateIR(node->children[0]);
+            int id = ++label_counter;
+            char *label_else = new_label("label_else", id);
+            char *label_end = new_label("label_end_if", id);
+
+            char *condition = generateExpr(node->children[0]);
+            emit("if_false", condition, label_else, NULL);
+
             generateIR(node->children[1]);
 
-            emit("key_value_pair", "temp_key", "temp_value", "temp_pair");
+            if (node->children_count > 2 && node->children[2]->type == NODE_ELSE_STATEMENT)
+            {
+                emit("goto", label_end, NULL, NULL);
+                emit("label", label_else, NULL, NULL);
+                generateIR(node->children[2]->children[0]);
+                emit("label", label_end, NULL, NULL);
+            }
+            else
+            {
+                emit("label", label_else, NULL, NULL);
+            }
         }
         else
         {
-            printf("Error: Key-value pair node does not have two children.\n");
+            printf("Error: Incomplete if statement structure.\n");
         }
         break;
 
-    case NODE_ARRAY_ACCESS:
-        generateIR(node->data.array_access.array);
-        generateIR(node->data.array_access.index);
-        emit("array_access", "temp_array", "temp_index", "temp_element");
-        break;
+    case NODE_FOR_LOOP:
+    {
+        char *var_name = node->data.for_loop.var_name;
 
-    case NODE_OPERATOR:
-        emit("operator", node->data.operator_node.op, NULL, NULL);
-        break;
+        LoopDependence dependence;
+        if (analyze_parallel_loop(node, &dependence))
+        {
+            generateParallelLoop(node, &dependence);
+            loop_dependence_free(&dependence);
+            break;
+        }
+        loop_dependence_free(&dependence);
 
-    case NODE_INT:
+        int builders = string_builders.count;
+        string_builder_names(node, node);
+        generateStringBuilders(builders);
 
-        emit("load_const", node->data.int_node.value, NULL, "temp_int");
-        break;
+        // i = start
+        char *start = generateExpr(node->data.for_loop.start_expr);
+        emit("store", start, NULL, var_name);
 
-    case NODE_FLOAT:
+        int trips = 0;
+        if (can_unroll_loop(node, &trips))
+        {
+            generateUnrolledLoop(node, trips);
+            string_builders.count = builders;
+            break;
+        }
 
-        emit("load_const", node->data.float_node.value, NULL, "temp_float");
-        break;
+        int id = ++label_counter;
+        char *loop_start = new_label("loop_start", id);
+        char *loop_end = new_label("loop_end", id);
 
-    case NODE_STRING:
+        // 循环边界只在进入循环前计算一次
+        char *end = generateExpr(node->data.for_loop.end_expr);
 
-        emit("load_const", node->data.string_node.value, NULL, "temp_string");
-        break;
+        emit("label", loop_start, NULL, NULL);
 
-    case NODE_CHAR:
+        // i < end
+        char *current = new_temp();
+        emit("load", var_name, NULL, current);
+        char *condition = new_temp();
+        emit("lt", current, end, condition);
+        emit("if_false", condition, loop_end, NULL);
 
-        emit("load_const", node->data.char_node.text, NULL, "temp_char");
-        break;
-    default:
+        generateLoopBody(node);
 
+        emit("goto", loop_start, NULL, NULL);
+        emit("label", loop_end, NULL, NULL);
+        string_builders.count = builders;
         break;
     }
 
-    for (int i = 0; i < node->children_count; i++)
-    {
-        generateIR(node->children[i]);
+    case NODE_RETURN_STATEMENT:
+        if (is_tail_call(node->data.return_statement.expression))
+        {
+            generateTailCall(node->data.return_statement.expression);
+        }
+        else if (node->data.return_statement.expression != NULL)
+        {
+            char *value = generateExpr(node->data.return_statement.expression);
+            emit("return", value, NULL, NULL);
+        }
+        else
+        {
+            emit("return", NULL, NULL, NULL);
+        }
+        break;
+
+    default:
+        generateExpr(node);
+        break;
     }
 }
 
@@ -257,4 +1746,5 @@ void generateIR(ASTNode *node)
 //     ASTNode *root = parse_program(&tokens, token_count);
 //     freopen("output_pseudo.txt", "w", stdout);
 //     generateIR(root);
-// }
+//     print_ir(stdout);
+// }
\ No newline at end of file
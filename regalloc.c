@@ -0,0 +1,513 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "optimizer.c"
+
+// 寄存器分配参数, 寄存器虚拟机和本地代码后端各自指定寄存器数
+typedef struct
+{
+    int register_count; // 可分配的物理寄存器数, 至少 4: 一条指令最多读 3 个临时变量并写 1 个
+} RegAllocConfig;
+
+// 每个函数的分配结果
+typedef struct
+{
+    char *name;
+    int registers;    // 用到的物理寄存器数
+    int spilled;      // 溢出的临时变量数
+    int slots;        // 溢出槽数
+    int spill_stores; // 插入的 spill 指令数
+    int reloads;      // 插入的 reload 指令数
+} RegAllocStats;
+
+// 活跃区间: 位置 2i 是指令 i 读取操作数, 2i+1 是写入结果
+typedef struct
+{
+    int temp;
+    int start;
+    int end;
+    int reg;
+    int fixed; // spill/reload 产生的短区间, 不再溢出
+} LiveInterval;
+
+RegAllocConfig regalloc_config = {8};
+
+int *temp_register = NULL; // 临时变量 -> 物理寄存器, 未分配为 -1
+int temp_register_capacity = 0;
+char *regalloc_fixed = NULL; // 按临时变量编号, 是否是不可溢出的短区间
+int regalloc_fixed_capacity = 0;
+
+RegAllocStats *regalloc_stats = NULL;
+int regalloc_function_count = 0;
+
+// 按当前的临时变量数扩展以临时变量编号为下标的数组, 新元素填 fill
+void regalloc_grow(int **array, int *capacity, int fill)
+{
+    if (*capacity > temp_counter)
+        return;
+    int old = *capacity;
+    *capacity = temp_counter + 1;
+    *array = realloc(*array, sizeof(int) * *capacity);
+    for (int i = old; i < *capacity; i++)
+        (*array)[i] = fill;
+}
+
+void regalloc_mark_fixed(const char *temp)
+{
+    if (regalloc_fixed_capacity <= temp_counter)
+    {
+        int old = regalloc_fixed_capacity;
+        regalloc_fixed_capacity = temp_counter + 1;
+        regalloc_fixed = realloc(regalloc_fixed, regalloc_fixed_capacity);
+        memset(regalloc_fixed + old, 0, regalloc_fixed_capacity - old);
+    }
+    regalloc_fixed[temp_index(temp)] = 1;
+}
+
+int regalloc_is_fixed(int temp)
+{
+    return temp < regalloc_fixed_capacity && regalloc_fixed[temp];
+}
+
+// 指令使用的临时变量, 返回个数
+int instruction_uses(IRInstruction *ins, char ***fields)
+{
+    int mask = ir_use_mask(ins->op);
+    char **all[3] = {&ins->arg1, &ins->arg2, &ins->result};
+    int count = 0;
+    for (int f = 0; f < 3; f++)
+    {
+        if ((mask & (1 << f)) && is_temp(*all[f]))
+            fields[count++] = all[f];
+    }
+    return count;
+}
+
+int compare_interval_start(const void *a, const void *b)
+{
+    const LiveInterval *x = a;
+    const LiveInterval *y = b;
+    return x->start != y->start ? x->start - y->start : x->temp - y->temp;
+}
+
+// 计算 [start, end) 中临时变量的活跃区间 (按基本块做活跃变量分析)
+LiveInterval *compute_intervals(int start, int end, int *interval_count)
+{
+    ControlFlowGraph *cfg = build_cfg(start, end);
+    int n = cfg->block_count;
+
+    // 区间内的临时变量编为连续的编号
+    int *dense = malloc(sizeof(int) * (temp_counter + 1));
+    for (int t = 0; t <= temp_counter; t++)
+        dense[t] = -1;
+    int *temps = NULL;
+    int count = 0;
+    for (int i = start; i < end; i++)
+    {
+        char **fields[3];
+        int uses = instruction_uses(&ir_code[i], fields);
+        char *names[4];
+        int k;
+        for (k = 0; k < uses; k++)
+            names[k] = *fields[k];
+        if (ir_has_def(ir_code[i].op) && is_temp(ir_code[i].result))
+            names[k++] = ir_code[i].result;
+        for (int j = 0; j < k; j++)
+        {
+            int t = temp_index(names[j]);
+            if (dense[t] < 0)
+            {
+                temps = realloc(temps, sizeof(int) * (count + 1));
+                temps[count] = t;
+                dense[t] = count++;
+            }
+        }
+    }
+
+    // 活跃变量分析, 集合用位图表示
+    int words = (count + 63) / 64;
+    if (words == 0)
+        words = 1;
+    unsigned long long *use = calloc((size_t)n * words, sizeof(unsigned long long));
+    unsigned long long *def = calloc((size_t)n * words, sizeof(unsigned long long));
+    unsigned long long *live_in = calloc((size_t)n * words, sizeof(unsigned long long));
+    unsigned long long *live_out = calloc((size_t)n * words, sizeof(unsigned long long));
+    for (int b = 0; b < n; b++)
+    {
+        for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++)
+        {
+            char **fields[3];
+            int uses = instruction_uses(&ir_code[i], fields);
+            for (int k = 0; k < uses; k++)
+            {
+                int d = dense[temp_index(*fields[k])];
+                if (!(def[(size_t)b * words + d / 64] & (1ULL << (d % 64))))
+                    use[(size_t)b * words + d / 64] |= 1ULL << (d % 64);
+            }
+            if (ir_has_def(ir_code[i].op) && is_temp(ir_code[i].result))
+            {
+                int d = dense[temp_index(ir_code[i].result)];
+                def[(size_t)b * words + d / 64] |= 1ULL << (d % 64);
+            }
+        }
+    }
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        for (int b = n - 1; b >= 0; b--)
+        {
+            unsigned long long *out = &live_out[(size_t)b * words];
+            unsigned long long *in = &live_in[(size_t)b * words];
+            for (int s = 0; s < cfg->blocks[b].succ_count; s++)
+            {
+                unsigned long long *succ_in = &live_in[(size_t)cfg->blocks[b].succs[s] * words];
+                for (int w = 0; w < words; w++)
+                    out[w] |= succ_in[w];
+            }
+            for (int w = 0; w < words; w++)
+            {
+                unsigned long long value = use[(size_t)b * words + w] | (out[w] & ~def[(size_t)b * words + w]);
+                if (value != in[w])
+                {
+                    in[w] = value;
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    // 区间覆盖所有出现位置, 以及活跃进入/离开的整个块
+    LiveInterval *intervals = malloc(sizeof(LiveInterval) * (count + 1));
+    for (int d = 0; d < count; d++)
+    {
+        intervals[d].temp = temps[d];
+        intervals[d].start = 2 * end;
+        intervals[d].end = -1;
+        intervals[d].reg = -1;
+        intervals[d].fixed = regalloc_is_fixed(temps[d]);
+    }
+    for (int b = 0; b < n; b++)
+    {
+        int first = 2 * cfg->blocks[b].start;
+        int last = 2 * cfg->blocks[b].end - 1;
+        for (int d = 0; d < count; d++)
+        {
+            LiveInterval *it = &intervals[d];
+            if (live_in[(size_t)b * words + d / 64] & (1ULL << (d % 64)))
+            {
+                if (first < it->start)
+                    it->start = first;
+                if (first > it->end)
+                    it->end = first;
+            }
+            if (live_out[(size_t)b * words + d / 64] & (1ULL << (d % 64)))
+            {
+                if (last > it->end)
+                    it->end = last;
+                if (last < it->start)
+                    it->start = last;
+            }
+        }
+        for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++)
+        {
+            char **fields[3];
+            int uses = instruction_uses(&ir_code[i], fields);
+            for (int k = 0; k < uses; k++)
+            {
+                LiveInterval *it = &intervals[dense[temp_index(*fields[k])]];
+                if (2 * i < it->start)
+                    it->start = 2 * i;
+                if (2 * i > it->end)
+                    it->end = 2 * i;
+            }
+            if (ir_has_def(ir_code[i].op) && is_temp(ir_code[i].result))
+            {
+                LiveInterval *it = &intervals[dense[temp_index(ir_code[i].result)]];
+                if (2 * i + 1 < it->start)
+                    it->start = 2 * i + 1;
+                if (2 * i + 1 > it->end)
+                    it->end = 2 * i + 1;
+            }
+        }
+    }
+    qsort(intervals, count, sizeof(LiveInterval), compare_interval_start);
+
+    free(use);
+    free(def);
+    free(live_in);
+    free(live_out);
+    free(dense);
+    free(temps);
+    free_cfg(cfg);
+    *interval_count = count;
+    return intervals;
+}
+
+// 线性扫描 (Poletto-Sarkar): 寄存器不够时溢出结束最晚的区间, 返回溢出的区间数
+int linear_scan(LiveInterval *intervals, int count, int register_count, int *spilled, int *registers_used)
+{
+    LiveInterval **active = malloc(sizeof(LiveInterval *) * (register_count + 1));
+    int active_count = 0;
+    int *free_regs = malloc(sizeof(int) * register_count);
+    int free_count = 0;
+    for (int r = register_count - 1; r >= 0; r--)
+        free_regs[free_count++] = r;
+
+    int spill_count = 0;
+    *registers_used = 0;
+    for (int i = 0; i < count; i++)
+    {
+        LiveInterval *current = &intervals[i];
+
+        // 释放已经结束的区间, active 按结束位置升序
+        int kept = 0;
+        for (int a = 0; a < active_count; a++)
+        {
+            if (active[a]->end < current->start)
+                free_regs[free_count++] = active[a]->reg;
+            else
+                active[kept++] = active[a];
+        }
+        active_count = kept;
+
+        LiveInterval *victim = current;
+        if (free_count == 0)
+        {
+            for (int a = active_count - 1; a >= 0; a--)
+            {
+                if (!active[a]->fixed && (current->fixed || active[a]->end > current->end))
+                {
+                    victim = active[a];
+                    break;
+                }
+            }
+            if (victim != current)
+            {
+                current->reg = victim->reg;
+                victim->reg = -1;
+                for (int a = 0; a < active_count; a++)
+                {
+                    if (active[a] == victim)
+                    {
+                        memmove(&active[a], &active[a + 1], sizeof(LiveInterval *) * (active_count - a - 1));
+                        active_count--;
+                        break;
+                    }
+                }
+            }
+            spilled[spill_count++] = victim->temp;
+            if (victim == current)
+                continue;
+        }
+        else
+        {
+            current->reg = free_regs[--free_count];
+        }
+
+        if (current->reg + 1 > *registers_used)
+            *registers_used = current->reg + 1;
+        int pos = active_count;
+        while (pos > 0 && active[pos - 1]->end > current->end)
+        {
+            active[pos] = active[pos - 1];
+            pos--;
+        }
+        active[pos] = current;
+        active_count++;
+    }
+
+    free(active);
+    free(free_regs);
+    return spill_count;
+}
+
+// 为溢出的临时变量插入代码: 定义之后 spill 到槽, 每次使用之前 reload 到新的临时变量; 返回区间长度的变化
+int insert_spill_code(int start, int end, int *spilled, int spill_count, RegAllocStats *stats)
+{
+    int limit = temp_counter;
+    int *slot_of = malloc(sizeof(int) * (limit + 1));
+    for (int t = 0; t <= limit; t++)
+        slot_of[t] = -1;
+    for (int k = 0; k < spill_count; k++)
+    {
+        slot_of[spilled[k]] = stats->slots++;
+        stats->spilled++;
+    }
+
+    IRInstruction *list = NULL;
+    int list_count = 0;
+    char slot[32];
+    for (int i = start; i < end; i++)
+    {
+        IRInstruction ins = ir_code[i];
+        char **fields[3];
+        int uses = instruction_uses(&ins, fields);
+        char *reloaded_from[3];
+        char *reloaded_to[3];
+        int reloaded = 0;
+        for (int k = 0; k < uses; k++)
+        {
+            int t = temp_index(*fields[k]);
+            if (t > limit || slot_of[t] < 0)
+                continue;
+            char *temp = NULL;
+            for (int j = 0; j < reloaded; j++)
+            {
+                if (strcmp(reloaded_from[j], *fields[k]) == 0)
+                    temp = reloaded_to[j];
+            }
+            if (temp == NULL)
+            {
+                temp = new_temp();
+                regalloc_mark_fixed(temp);
+                sprintf(slot, "s%d", slot_of[t]);
+                ir_list_append(&list, &list_count, "reload", slot, NULL, temp);
+                stats->reloads++;
+                reloaded_from[reloaded] = *fields[k];
+                reloaded_to[reloaded++] = temp;
+            }
+            *fields[k] = temp;
+        }
+
+        list = realloc(list, sizeof(IRInstruction) * (list_count + 1));
+        list[list_count++] = ins;
+
+        if (ir_has_def(ins.op) && is_temp(ins.result) && temp_index(ins.result) <= limit &&
+            slot_of[temp_index(ins.result)] >= 0)
+        {
+            regalloc_mark_fixed(ins.result);
+            sprintf(slot, "s%d", slot_of[temp_index(ins.result)]);
+            ir_list_append(&list, &list_count, "spill", ins.result, NULL, slot);
+            stats->spill_stores++;
+        }
+    }
+
+    // 用新列表替换原区间
+    int delta = list_count - (end - start);
+    while (ir_count + delta > ir_capacity)
+    {
+        ir_capacity = ir_capacity == 0 ? 64 : ir_capacity * 2;
+        ir_code = realloc(ir_code, sizeof(IRInstruction) * ir_capacity);
+    }
+    memmove(&ir_code[end + delta], &ir_code[end], sizeof(IRInstruction) * (ir_count - end));
+    memcpy(&ir_code[start], list, sizeof(IRInstruction) * list_count);
+    ir_count += delta;
+
+    free(list);
+    free(slot_of);
+    return delta;
+}
+
+// 分配一个函数 (或全局代码) 的寄存器, 溢出后重新计算区间, 直到所有区间都分到寄存器
+int regalloc_range(int start, int end)
+{
+    regalloc_stats = realloc(regalloc_stats, sizeof(RegAllocStats) * (regalloc_function_count + 1));
+    RegAllocStats *stats = &regalloc_stats[regalloc_function_count++];
+    memset(stats, 0, sizeof(RegAllocStats));
+    stats->name = is_function_range(start) ? ir_code[start - 1].arg1 : "global";
+
+    int register_count = regalloc_config.register_count < 4 ? 4 : regalloc_config.register_count;
+    for (;;)
+    {
+        int count;
+        LiveInterval *intervals = compute_intervals(start, end, &count);
+        int *spilled = malloc(sizeof(int) * (count + 1));
+        int registers_used;
+        int spill_count = linear_scan(intervals, count, register_count, spilled, &registers_used);
+
+        if (spill_count == 0)
+        {
+            regalloc_grow(&temp_register, &temp_register_capacity, -1);
+            for (int k = 0; k < count; k++)
+                temp_register[intervals[k].temp] = intervals[k].reg;
+            stats->registers = registers_used;
+            free(spilled);
+            free(intervals);
+            return stats->spilled;
+        }
+
+        end += insert_spill_code(start, end, spilled, spill_count, stats);
+        free(spilled);
+        free(intervals);
+    }
+}
+
+// 为所有函数分配寄存器, 返回溢出的临时变量总数
+int allocate_registers(RegAllocConfig config)
+{
+    regalloc_config = config;
+    free(regalloc_stats);
+    regalloc_stats = NULL;
+    regalloc_function_count = 0;
+    return for_each_function(regalloc_range);
+}
+
+RegAllocStats *find_regalloc_stats(const char *name)
+{
+    for (int i = 0; i < regalloc_function_count; i++)
+    {
+        if (strcmp(regalloc_stats[i].name, name) == 0)
+            return &regalloc_stats[i];
+    }
+    return NULL;
+}
+
+// 临时变量分配到的寄存器名, 其他操作数原样返回
+const char *register_name(const char *operand, char *buffer)
+{
+    if (!is_temp(operand) || temp_index(operand) >= temp_register_capacity || temp_register[temp_index(operand)] < 0)
+        return operand;
+    sprintf(buffer, "r%d", temp_register[temp_index(operand)]);
+    return buffer;
+}
+
+// 打印分配后的 IR (临时变量替换为寄存器) 和每个函数的溢出统计
+void print_register_allocation(FILE *out)
+{
+    for (int i = 0; i < ir_count; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (ir_is(ins, "nop"))
+            continue;
+        char a[32], b[32], r[32];
+        int mask = ir_use_mask(ins->op) | (ir_has_def(ins->op) ? 4 : 0);
+        fprintf(out, "%s %s %s %s\n", ins->op,
+                ins->arg1 ? ((mask & 1) ? register_name(ins->arg1, a) : ins->arg1) : "",
+                ins->arg2 ? ((mask & 2) ? register_name(ins->arg2, b) : ins->arg2) : "",
+                ins->result ? ((mask & 4) ? register_name(ins->result, r) : ins->result) : "");
+    }
+
+    fprintf(out, "\n");
+    for (int i = 0; i < regalloc_function_count; i++)
+    {
+        RegAllocStats *s = &regalloc_stats[i];
+        fprintf(out, "%s: registers %d, spilled %d, slots %d, spill %d, reload %d\n",
+                s->name, s->registers, s->spilled, s->slots, s->spill_stores, s->reloads);
+    }
+}
+
+// // 测试输入
+// int main()
+// {
+//     freopen("input.txt", "r", stdin);
+//     int fsize = 1000;
+
+//     char source[1000] = {0};
+//     fread(source, 1, fsize, stdin);
+
+//     int token_count = 0;
+//     Token *tokens = lexer(source, &token_count);
+//     ASTNode *root = parse_program(&tokens, token_count);
+//     generateIR(root);
+//     optimize_ir();
+
+//     RegAllocConfig config = {4};
+//     allocate_registers(config);
+
+//     freopen("output_regalloc.txt", "w", stdout);
+//     print_register_allocation(stdout);
+
+//     return 0;
+// }
\ No newline at end of file
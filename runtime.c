@@ -0,0 +1,41 @@
+// 汇编程序可能用到并行和任务, 运行时对象总是包含它们
+#define X_TASKS
+#include "runtime.h"
+
+// ---------------- 汇编后端的运行时对象 ----------------
+
+// asmgen.c 生成的汇编程序与这个文件编译出的 runtime.o 链接
+// 值的运算直接调用 value.c 的函数, 内置函数是 runtime.h 中的 x_print / x_read / x_vector
+// 和 runtime_task.h 中的 x_parallel_for / x_parallel_apply, spawn / await 是 x_spawn / x_await,
+// 这里只补充汇编代码不方便内联的函数, 参数和返回值都按 System V 约定传递 (Value 占两个整数寄存器)
+
+// 压入实参
+void x_asm_push(Value v)
+{
+    x_push(v);
+}
+
+// 进入函数: 检查调用深度, 把实参复制到栈帧的局部变量区, 其余局部变量置为 nil
+void x_asm_enter(Value *locals, int local_count, int param_count, int argc, const char *name)
+{
+    Value *args = x_enter(name, argc);
+    for (int i = 0; i < local_count; i++)
+        locals[i] = i < param_count ? x_param(args, argc, i) : value_nil();
+    x_arg_count -= argc;
+}
+
+// 汇编代码在自己的栈上运行: 每层调用的栈帧比 C 编译器生成的大, 调用深度达到上限 X_MAX_DEPTH 时
+// 会超过系统默认的栈大小; 返回栈顶, 未使用的部分不会占用物理内存
+#define X_ASM_STACK_SIZE (256 << 20)
+
+void *x_asm_stack()
+{
+    char *stack = malloc(X_ASM_STACK_SIZE);
+    if (stack == NULL)
+        runtime_error("cannot allocate stack", NULL);
+    task_stack_size = X_ASM_STACK_SIZE;
+    return stack + X_ASM_STACK_SIZE;
+}
+
+// // 测试输入
+// // cc -O2 -std=c99 -pthread -c runtime.c -o runtime.o
\ No newline at end of file
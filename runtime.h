@@ -0,0 +1,145 @@
+// ---------------- C 后端的运行时 ----------------
+
+// cgen.c 生成的 C 程序包含这个头文件, 与生成的代码一起编译为一个翻译单元
+// 值的表示和各种运算直接复用 value.c, 因此结果与解释器, 虚拟机完全一致
+// 调用约定与虚拟机相同: 调用者把实参压入实参区, 被调函数取走最后 argc 个
+// 只包含值, 数组, 键值对和输入输出 (io.c); 程序用到并行循环, pmap / pfilter / preduce 或 spawn / await 时
+// 生成的代码先定义 X_TASKS, 再包含线程池和任务调度器 (task.c) 以及 runtime_task.h 中的内置函数,
+// 这时实参区和调用深度是线程局部的, 每个线程各有一份
+
+// value.c 用到 strdup, io.c 用到 writev 和 mmap, 在 -std=c99 下需要声明 POSIX 接口
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef X_TASKS
+#include "task.c"
+#define X_THREAD_LOCAL __thread
+#else
+#include "io.c"
+#define X_THREAD_LOCAL
+#endif
+
+// 与虚拟机相同的限制
+#define X_MAX_ARGS 4096
+#define X_MAX_DEPTH 100000
+
+X_THREAD_LOCAL Value x_args[X_MAX_ARGS];
+X_THREAD_LOCAL int x_arg_count = 0;
+X_THREAD_LOCAL int x_depth = 0;
+
+static inline void x_push(Value v)
+{
+    if (x_arg_count == X_MAX_ARGS)
+        runtime_error("too many arguments", NULL);
+    x_args[x_arg_count++] = v;
+}
+
+// 进入函数: 检查调用深度, 返回实参在实参区中的起始位置
+static inline Value *x_enter(const char *name, int argc)
+{
+    if (x_depth == X_MAX_DEPTH)
+        runtime_error("stack overflow in", name);
+    if (argc > x_arg_count)
+        runtime_error("missing arguments for", name);
+    x_depth++;
+    return &x_args[x_arg_count - argc];
+}
+
+static inline Value x_param(Value *args, int argc, int i)
+{
+    return i < argc ? args[i] : value_nil();
+}
+
+// 整数的快速路径与虚拟机相同, 其余交给 value.c
+static inline Value x_add(Value a, Value b)
+{
+    if (a.type == VAL_INT && b.type == VAL_INT)
+        return value_int((long long)((unsigned long long)a.as.i + (unsigned long long)b.as.i));
+    return value_add(a, b);
+}
+
+static inline Value x_sub(Value a, Value b)
+{
+    if (a.type == VAL_INT && b.type == VAL_INT)
+        return value_int((long long)((unsigned long long)a.as.i - (unsigned long long)b.as.i));
+    return value_sub(a, b);
+}
+
+static inline Value x_lt(Value a, Value b)
+{
+    if (a.type == VAL_INT && b.type == VAL_INT)
+        return value_int(a.as.i < b.as.i);
+    return value_lt(a, b);
+}
+
+static inline Value x_gt(Value a, Value b)
+{
+    if (a.type == VAL_INT && b.type == VAL_INT)
+        return value_int(a.as.i > b.as.i);
+    return value_gt(a, b);
+}
+
+static inline Value x_eq(Value a, Value b)
+{
+    if (a.type == VAL_INT && b.type == VAL_INT)
+        return value_int(a.as.i == b.as.i);
+    return value_eq(a, b);
+}
+
+static inline int x_truthy(Value v)
+{
+    if (v.type == VAL_INT)
+        return v.as.i != 0;
+    return value_truthy(v);
+}
+
+// 下标已证明不越界的数组读写
+static inline Value x_get_unchecked(Value a, Value i)
+{
+    if (a.type == VAL_ARRAY && i.type == VAL_INT)
+        return array_get(a.as.array, i.as.i);
+    return value_get_index(a, i);
+}
+
+static inline void x_set_unchecked(Value a, Value i, Value v)
+{
+    if (a.type == VAL_ARRAY && i.type == VAL_INT)
+        array_put(a.as.array, i.as.i, v);
+    else
+        value_set_index(a, i, v);
+}
+
+// 内置函数
+Value x_print(int argc)
+{
+    if (argc > x_arg_count)
+        runtime_error("missing arguments for builtin", NULL);
+    x_arg_count -= argc;
+    io_print(stdout, &x_args[x_arg_count], argc);
+    return value_nil();
+}
+
+Value x_vector(int argc)
+{
+    if (argc > x_arg_count)
+        runtime_error("missing arguments for builtin", NULL);
+    x_arg_count -= argc;
+    return vector_loop(&x_args[x_arg_count], argc);
+}
+
+Value x_read(int argc)
+{
+    if (argc > x_arg_count)
+        runtime_error("missing arguments for builtin", NULL);
+    x_arg_count -= argc;
+    return io_read();
+}
+
+#ifdef X_TASKS
+#include "runtime_task.h"
+#endif
\ No newline at end of file
@@ -0,0 +1,100 @@
+// ---------------- C 后端的并行和任务内置函数 ----------------
+
+// 由 runtime.h 在定义了 X_TASKS 时包含, 此时 task.c (以及 parallel.c) 已经包含
+// 循环体, pmap 的函数和任务都是编译出的 C 函数, 在各自线程的实参区中传递实参
+
+// 并行循环: 循环体是编译出的函数 body, 实参的含义见 parallel.c
+typedef struct
+{
+    Value (*body)(int argc);
+    Value *args; // start, end 和捕获的变量
+    int argc;
+} XParallelLoop;
+
+void x_parallel_task(void *context, int worker, long long lo, long long hi)
+{
+    XParallelLoop *loop = context;
+    x_push(value_int(lo));
+    x_push(value_int(hi));
+    for (int i = 2; i < loop->argc; i++)
+        x_push(loop->args[i]);
+    loop->body(loop->argc);
+}
+
+// pmap / pfilter / preduce: 每个线程在自己的实参区压入实参, 调用编译出的函数 body
+Value x_apply_call(void *context, int worker, Value *args, int argc)
+{
+    Value (*body)(int argc) = *(Value (**)(int argc))context;
+    for (int i = 0; i < argc; i++)
+        x_push(args[i]);
+    return body(argc);
+}
+
+Value x_parallel_apply(Value (*body)(int argc), int argc)
+{
+    if (argc > x_arg_count)
+        runtime_error("missing arguments for builtin", NULL);
+    ParallelApply apply;
+    int workers = parallel_apply_prepare(&apply, &x_args[x_arg_count - argc], argc);
+    x_arg_count -= argc;
+    return parallel_apply(&apply, workers, x_apply_call, &body);
+}
+
+// 任务: 在任务的栈上压入实参, 调用编译出的函数 body
+typedef struct
+{
+    Value (*body)(int argc);
+    int argc;
+    Value args[];
+} XTask;
+
+Value x_task_body(void *data)
+{
+    XTask *task = data;
+    // 调用深度从任务自己的栈底算起
+    x_depth = 0;
+    for (int i = 0; i < task->argc; i++)
+        x_push(task->args[i]);
+    Value result = task->body(task->argc);
+    free(task);
+    return result;
+}
+
+Value x_spawn(Value (*body)(int argc), int argc)
+{
+    if (argc > x_arg_count)
+        runtime_error("missing arguments for builtin", NULL);
+    XTask *task = malloc(sizeof(XTask) + sizeof(Value) * (argc + 1));
+    task->body = body;
+    task->argc = argc;
+    x_arg_count -= argc;
+    memcpy(task->args, &x_args[x_arg_count], sizeof(Value) * argc);
+    return value_task(task_spawn(x_task_body, task));
+}
+
+// 挂起期间同一线程上的其他任务会改变调用深度和实参区, 恢复时换回自己的
+Value x_await(Value v)
+{
+    int depth = x_depth;
+    int arg_count = x_arg_count;
+    Value result = task_await(v);
+    x_depth = depth;
+    x_arg_count = arg_count;
+    return result;
+}
+
+// 返回循环变量的终值: 并行时是 end, 顺序执行时是循环体函数的返回值
+Value x_parallel_for(Value (*body)(int argc), int argc)
+{
+    if (argc > x_arg_count)
+        runtime_error("missing arguments for builtin", NULL);
+    ParallelLoop loop;
+    Value *args = &x_args[x_arg_count - argc];
+    if (parallel_prepare(&loop, args, argc) <= 1)
+        return body(argc);
+    XParallelLoop context = {body, args, loop.argc};
+    parallel_run(x_parallel_task, &context, loop.start, loop.end, loop.workers);
+    x_arg_count -= argc;
+    parallel_finish(&loop);
+    return value_int(loop.end);
+}
\ No newline at end of file
@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <ucontext.h>
+
+#include "parallel.c"
+
+// ---------------- 协程任务和 M:N 调度器 ----------------
+
+// spawn f(...) 创建一个任务, 在自己的栈上执行 f (有栈协程); await t 等待任务 t 结束, 得到 f 的返回值
+// 任务由固定数量的工作线程执行, 任意多个任务复用这些线程:
+//   - 每个工作线程有自己的任务队列, 任务中创建的任务放在队尾, 工作线程从队尾取任务 (后进先出, 局部性好)
+//   - 自己的队列空了时取主线程创建的任务 (全局队列, 先进先出), 再从其他线程的队头偷还没有开始执行的任务
+//   - 已经开始执行的任务只在原来的线程上恢复: C 后端的实参区和调用深度是线程局部的, 协程不能换线程
+// 任务在 await 时挂起, 等待的任务结束后回到原来线程的队列
+//
+// 解释器, 虚拟机和运行时的数据结构 (全局变量, 内联缓存, JIT 编译, 数组的表示) 不是线程安全的,
+// X 代码总是在持有调度器的锁时执行, 同一时刻只有一个线程执行 X 代码;
+// 在 await 中等待, 任务结束, 以及在 read() 中阻塞时释放, 其他任务在这期间继续执行;
+// 释放之前写出本线程缓冲的输出 (见 io.c), 之后其他线程的输出排在它后面
+// 没有创建过任务时不加锁, 与没有任务的程序完全相同
+
+// 任务的栈默认与主线程默认的栈一样大, 只有用到的页占用内存; 汇编后端的运行时改为与它的主栈一样大
+size_t task_stack_size = 8 << 20;
+
+// 工作线程数: 0 时与并行循环的线程数相同 (见 parallel_threads)
+int task_worker_count = 0;
+
+typedef enum
+{
+    TASK_READY,   // 在队列中等待执行
+    TASK_RUNNING, // 正在执行
+    TASK_WAITING, // 在 await 中等待其他任务
+    TASK_DONE     // 已经结束, result 是返回值
+} TaskState;
+
+// 任务体: 在任务的栈上执行, 返回任务的结果; data 是执行引擎的状态 (函数, 实参)
+typedef Value (*TaskBody)(void *data);
+
+struct Task
+{
+    TaskBody body;
+    void *data;
+    Value result;
+    TaskState state;
+    int worker;         // 执行它的工作线程, 开始执行之前为 -1
+    char *stack;        // 开始执行时分配, 结束后回收
+    ucontext_t context; // 挂起时保存的上下文
+    Task *waiters;      // 在 await 中等待它的任务, 通过 next_waiter 串起来
+    Task *next_waiter;
+    Task *awaiting;     // 正在等待的任务, 用于发现互相等待
+    Task *prev;         // 所在的队列
+    Task *next;
+    int gc_epoch;       // 最近一次完全回收中访问它的轮次 (见 task_gc_result)
+};
+
+typedef struct
+{
+    Task *head;
+    Task *tail;
+} TaskQueue;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t ready; // 有任务可以执行
+    pthread_cond_t done;  // 有任务结束, 主线程在 await 和 task_wait_all 中等待
+    int started;          // 已经创建了工作线程, 主线程执行 X 代码时持有 lock
+    int worker_count;
+    int live; // 还没有结束的任务
+    TaskQueue global;
+    TaskQueue queues[PARALLEL_MAX_THREADS];
+    char **free_stacks;
+    int free_stack_count;
+} TaskScheduler;
+
+TaskScheduler task_scheduler = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+// 当前线程正在执行的任务 (主线程和没有执行任务的工作线程为 NULL), 工作线程的编号 (主线程为 -1)
+__thread Task *task_current = NULL;
+__thread int task_worker = -1;
+// 工作线程的调度循环的上下文, 任务挂起或结束时切换回去
+__thread ucontext_t *task_scheduler_context = NULL;
+
+Value value_task(Task *task)
+{
+    Value v;
+    v.type = VAL_TASK;
+    v.as.task = task;
+    return v;
+}
+
+void task_queue_push(TaskQueue *queue, Task *task)
+{
+    task->prev = queue->tail;
+    task->next = NULL;
+    if (queue->tail != NULL)
+        queue->tail->next = task;
+    else
+        queue->head = task;
+    queue->tail = task;
+}
+
+void task_queue_remove(TaskQueue *queue, Task *task)
+{
+    if (task->prev != NULL)
+        task->prev->next = task->next;
+    else
+        queue->head = task->next;
+    if (task->next != NULL)
+        task->next->prev = task->prev;
+    else
+        queue->tail = task->prev;
+    task->prev = task->next = NULL;
+}
+
+// 工作线程 worker 下一个要执行的任务, 没有时返回 NULL
+Task *task_take(TaskScheduler *s, int worker)
+{
+    Task *task = s->queues[worker].tail;
+    if (task != NULL)
+    {
+        task_queue_remove(&s->queues[worker], task);
+        return task;
+    }
+    task = s->global.head;
+    if (task != NULL)
+    {
+        task_queue_remove(&s->global, task);
+        return task;
+    }
+    // 偷其他线程最早创建的, 还没有开始执行的任务
+    for (int k = 1; k < s->worker_count; k++)
+    {
+        TaskQueue *victim = &s->queues[(worker + k) % s->worker_count];
+        for (task = victim->head; task != NULL; task = task->next)
+        {
+            if (task->worker < 0)
+            {
+                task_queue_remove(victim, task);
+                return task;
+            }
+        }
+    }
+    return NULL;
+}
+
+char *task_stack(TaskScheduler *s)
+{
+    if (s->free_stack_count > 0)
+        return s->free_stacks[--s->free_stack_count];
+    char *stack = malloc(task_stack_size);
+    if (stack == NULL)
+        runtime_error("out of memory for task stack", NULL);
+    return stack;
+}
+
+// 任务的入口, 在任务的栈上执行; 返回后切换到 uc_link 即调度循环
+void task_entry()
+{
+    Task *task = task_current;
+    TaskScheduler *s = &task_scheduler;
+    Value result = task->body(task->data);
+
+    task->result = result;
+    gc_remember_slot(&task->result);
+    task->state = TASK_DONE;
+    for (Task *waiter = task->waiters; waiter != NULL; waiter = waiter->next_waiter)
+    {
+        waiter->state = TASK_READY;
+        task_queue_push(&s->queues[waiter->worker], waiter);
+    }
+    task->waiters = NULL;
+    s->live--;
+    pthread_cond_broadcast(&s->ready);
+    pthread_cond_broadcast(&s->done);
+}
+
+// 工作线程的调度循环, 持有 lock 执行任务, 没有任务时在 ready 上等待
+void *task_thread(void *arg)
+{
+    TaskScheduler *s = &task_scheduler;
+    ucontext_t scheduler;
+    task_worker = (int)(size_t)arg;
+    task_scheduler_context = &scheduler;
+    pthread_mutex_lock(&s->lock);
+    for (;;)
+    {
+        Task *task = task_take(s, task_worker);
+        if (task == NULL)
+        {
+            io_flush();
+            pthread_cond_wait(&s->ready, &s->lock);
+            continue;
+        }
+        if (task->worker < 0)
+        {
+            task->worker = task_worker;
+            task->stack = task_stack(s);
+            getcontext(&task->context);
+            task->context.uc_stack.ss_sp = task->stack;
+            task->context.uc_stack.ss_size = task_stack_size;
+            task->context.uc_link = &scheduler;
+            makecontext(&task->context, task_entry, 0);
+        }
+        task->state = TASK_RUNNING;
+        task_current = task;
+        swapcontext(&scheduler, &task->context);
+        task_current = NULL;
+        if (task->state == TASK_DONE)
+        {
+            s->free_stacks = realloc(s->free_stacks, sizeof(char *) * (s->free_stack_count + 1));
+            s->free_stacks[s->free_stack_count++] = task->stack;
+            task->stack = NULL;
+        }
+    }
+    return NULL;
+}
+
+// 阻塞的操作 (read) 前后调用: 期间其他线程可以执行 X 代码; task_start 把它们设为 io.c 的钩子
+void task_block_begin()
+{
+    if (task_scheduler.started)
+    {
+        io_flush();
+        pthread_mutex_unlock(&task_scheduler.lock);
+    }
+}
+
+void task_block_end()
+{
+    if (task_scheduler.started)
+        pthread_mutex_lock(&task_scheduler.lock);
+}
+
+// 第一次创建任务时启动工作线程, 此后主线程执行 X 代码时持有 lock
+void task_start(TaskScheduler *s)
+{
+    int n = task_worker_count > 0 ? task_worker_count : parallel_threads();
+    if (n > PARALLEL_MAX_THREADS)
+        n = PARALLEL_MAX_THREADS;
+    pthread_mutex_lock(&s->lock);
+    s->started = 1;
+    io_block_begin = task_block_begin;
+    io_block_end = task_block_end;
+    for (int w = 0; w < n; w++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, task_thread, (void *)(size_t)w) != 0)
+            break;
+        pthread_detach(thread);
+        s->worker_count = w + 1;
+    }
+    if (s->worker_count == 0)
+        runtime_error("cannot create task worker threads", NULL);
+}
+
+// 创建任务, 调用者继续执行; 任务在调用者让出 (await, read() 或结束) 之后才可能开始执行
+Task *task_spawn(TaskBody body, void *data)
+{
+    TaskScheduler *s = &task_scheduler;
+    if (!s->started)
+        task_start(s);
+    Task *task = calloc(1, sizeof(Task));
+    task->body = body;
+    task->data = data;
+    task->result = value_nil();
+    task->state = TASK_READY;
+    task->worker = -1;
+    s->live++;
+    task_queue_push(task_worker >= 0 ? &s->queues[task_worker] : &s->global, task);
+    pthread_cond_broadcast(&s->ready);
+    return task;
+}
+
+// 等待任务结束, 返回它的结果; 在任务中挂起当前任务, 在主线程中阻塞等待
+Value task_await(Value v)
+{
+    if (v.type != VAL_TASK)
+        runtime_error("await of a value that is not a task", NULL);
+    Task *task = v.as.task;
+    TaskScheduler *s = &task_scheduler;
+    Task *self = task_current;
+    // 沿等待关系找回自己时, 这些任务永远不会结束
+    for (Task *t = task; self != NULL && t != NULL && t->state != TASK_DONE; t = t->awaiting)
+    {
+        if (t == self)
+            runtime_error("deadlock: tasks await each other", NULL);
+    }
+    while (task->state != TASK_DONE)
+    {
+        if (self != NULL)
+        {
+            self->state = TASK_WAITING;
+            self->awaiting = task;
+            self->next_waiter = task->waiters;
+            task->waiters = self;
+            swapcontext(&self->context, task_scheduler_context);
+            self->awaiting = NULL;
+        }
+        else
+        {
+            io_flush();
+            pthread_cond_wait(&s->done, &s->lock);
+        }
+    }
+    return task->result;
+}
+
+// 任务不由回收器管理, 完全回收时结果随引用任务的值一起标记, 每轮只访问一次
+Value *task_gc_result(Task *task)
+{
+    if (task->gc_epoch == gc_epoch)
+        return NULL;
+    task->gc_epoch = gc_epoch;
+    return &task->result;
+}
+
+// 程序结束前等待所有任务结束
+void task_wait_all()
+{
+    TaskScheduler *s = &task_scheduler;
+    while (s->started && s->live > 0)
+    {
+        io_flush();
+        pthread_cond_wait(&s->done, &s->lock);
+    }
+}
+
+// // 测试输入
+// Value square(void *data)
+// {
+//     long long x = (long long)(size_t)data;
+//     return value_int(x * x);
+// }
+
+// int main()
+// {
+//     Value tasks[100];
+//     for (int i = 0; i < 100; i++)
+//         tasks[i] = value_task(task_spawn(square, (void *)(size_t)i));
+//     long long sum = 0;
+//     for (int i = 0; i < 100; i++)
+//         sum += task_await(tasks[i]).as.i;
+//     printf("%lld\n", sum);
+//     return 0;
+// }
\ No newline at end of file
@@ -0,0 +1,31 @@
+# 循环的终值是浮点数时, 去掉边界检查的循环版本必须由保护条件正确排除; 期望的输出在 bounds.out 中
+br = [0.5, 1, 2];
+ar = [1, 2, 3, 4];
+
+function grow()
+{
+    for (i: 1, 1.5)
+    {
+        br[i + 2] = 7;
+    }
+}
+
+function fill(e)
+{
+    for (i: 1, e)
+    {
+        ar[i + 1] = i;
+    }
+}
+
+main()
+{
+    grow();
+    print(br);
+    fill(2.5);
+    print(ar);
+    fill(3.0);
+    print(ar);
+    fill(4);
+    print(ar);
+}
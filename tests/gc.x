@@ -0,0 +1,104 @@
+# 分配大量短命的字符串, 数组和键值对时, 仍被引用的对象必须在回收后保持不变; 期望的输出在 gc.out 中
+keep = [0];
+other = [0];
+m = {"z": 0};
+cfg = {"name": "x", "tag": 0};
+nest = [0];
+out = [0];
+ts = [0];
+nums = [0];
+strs = [0];
+trash = "";
+
+# 只产生垃圾
+function junk(n)
+{
+    s = "";
+    for (i: 0, n)
+    {
+        s = "j" + i;
+        s = s + s;
+    }
+    return s;
+}
+
+# 任务的结果和写入全局数组的字符串要活到 await 之后
+function work(k)
+{
+    last = "";
+    for (i: 0, 300)
+    {
+        last = "t" + k + ":" + i;
+        out[(k * 300) + i] = last;
+    }
+    return last;
+}
+
+function tag(x)
+{
+    return "n" + x;
+}
+
+function big(x)
+{
+    return x > 2990;
+}
+
+main()
+{
+    # 老年代的数组和键值对引用新分配的字符串
+    nest[0] = keep;
+    nest[1] = m;
+    for (i: 0, 20000)
+    {
+        keep[i] = "s" + i;
+        if (i > 10000)
+        {
+            other[i - 10000] = keep[i - 1] + "/" + keep[i - 5000];
+        }
+        cfg["tag"] = "t" + i;
+        trash = junk(100);
+    }
+    print(keep[19999], keep[5], other[9998], other[1], cfg);
+    for (i: 0, 5000)
+    {
+        m["k" + i] = "a" + i;
+        trash = junk(20);
+    }
+    s = 0;
+    for (i: 0, 5000)
+    {
+        if (m["k" + i] == ("a" + i))
+        {
+            s = s + i;
+        }
+    }
+    a = nest[0];
+    b = nest[1];
+    print(s, m["k4999"], junk(10), a[19998], b["k7"]);
+
+    for (k: 0, 40)
+    {
+        ts[k] = spawn work(k);
+    }
+    last = "";
+    for (k: 0, 40)
+    {
+        trash = junk(2000);
+        last = last + (await ts[k]) + " ";
+    }
+    print(last);
+    print(out[7], out[11999]);
+
+    for (i: 0, 3000)
+    {
+        nums[i] = i;
+    }
+    for (r: 0, 20)
+    {
+        strs = pmap(nums, tag);
+        kept = pfilter(nums, big);
+        trash = junk(2000);
+    }
+    print(strs[0], strs[2999], kept);
+}
@@ -0,0 +1,62 @@
+# 迭代之间没有依赖的循环由线程池分块执行, 有依赖的循环顺序执行; 期望的输出在 parallel_for.out 中
+out = [0];
+src = [0];
+
+function fill(n)
+{
+    for (i: 0, n)
+    {
+        src[i] = (i * 7) - (((i * 7) / 13) * 13);
+        out[i] = 0;
+    }
+    return 0;
+}
+
+# 每次迭代只写 out[i], 可以并行; 返回循环变量的终值
+function work(n, m)
+{
+    scale = 3;
+    for (i: 0, n)
+    {
+        acc = 0;
+        for (j: 0, m)
+        {
+            t = (src[i] * j) + scale;
+            if ((t - ((t / 2) * 2)) == 0)
+            {
+                acc = acc + t;
+            }
+            else
+            {
+                acc = acc - 1;
+            }
+        }
+        out[i] = acc;
+    }
+    return i;
+}
+
+# s 在迭代之间传递, 只能顺序执行
+function prefix(n)
+{
+    s = 0;
+    for (i: 0, n)
+    {
+        s = s + i;
+        out[i] = s;
+    }
+    return s;
+}
+
+main()
+{
+    fill(5000);
+    print(work(5000, 300));
+    total = 0;
+    for (i: 0, 5000)
+    {
+        total = total + out[i];
+    }
+    print(total, out[0], out[4999]);
+    print(prefix(100), out[99]);
+}
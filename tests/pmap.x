@@ -0,0 +1,90 @@
+# pmap / pfilter / preduce: 没有副作用的函数并行执行, 有副作用时顺序执行, 结果都按元素的顺序; preduce 的合并函数满足结合律; 期望的输出在 pmap.out 中
+a = [0];
+b = [0];
+counter = 0;
+
+function square(x)
+{
+    return x * x;
+}
+
+function add(acc, x)
+{
+    return acc + x;
+}
+
+function even(x)
+{
+    return x == (x / 2) * 2;
+}
+
+function collatz(n)
+{
+    steps = 0;
+    for (k: 0, 1000)
+    {
+        if (n > 1)
+        {
+            if (n == (n / 2) * 2)
+            {
+                n = n / 2;
+            }
+            else
+            {
+                n = (3 * n) + 1;
+            }
+            steps = steps + 1;
+        }
+    }
+    return steps;
+}
+
+# 写全局变量, 只能顺序执行
+function noisy(x)
+{
+    counter = counter + 1;
+    return x + counter;
+}
+
+function half(x)
+{
+    return x / 2.0;
+}
+
+function bigger(acc, x)
+{
+    if (x > acc)
+    {
+        return x;
+    }
+    return acc;
+}
+
+function one(x)
+{
+    return 1;
+}
+
+main()
+{
+    for (i: 0, 5000)
+    {
+        a[i] = i;
+    }
+    s = pmap(a, square);
+    print(s[0], s[1], s[4999], preduce(pmap(s, one), add, 0));
+    print(preduce(s, add, 0));
+    e = pfilter(a, even);
+    print(preduce(pmap(e, one), add, 0), e[0], e[1], e[2499]);
+    c = pmap(a, collatz);
+    print(preduce(c, bigger, 0), c[27]);
+    n = pmap(a, noisy);
+    print(n[0], n[4999], counter);
+    h = pmap(a, half);
+    print(h[3], preduce(h, add, 0.0));
+    for (i: 0, 10)
+    {
+        b[i] = i;
+    }
+    print(pmap(b, square), pfilter(b, even), preduce(b, add, 100));
+}
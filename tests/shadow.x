@@ -0,0 +1,52 @@
+# 形参与全局变量同名: 函数中读写的是形参, 全局变量不变; 期望的输出在 shadow.out 中
+x = 1;
+acc = 0;
+a = 100;
+
+function f(x)
+{
+    return x + 10;
+}
+
+function g(a)
+{
+    a = a + 1;
+    return a;
+}
+
+# 尾调用把实参存回形参, 不能写到全局变量中
+function sum(x, acc)
+{
+    if (x < 1)
+        return acc;
+    return sum(x - 1, acc + x);
+}
+
+function count(x)
+{
+    if (x < 1)
+        return 0;
+    return 1 + count(x - 1);
+}
+
+function loop(x)
+{
+    s = 0;
+    for (x: 0, 4)
+    {
+        s = s + x;
+    }
+    return s;
+}
+
+main()
+{
+    print(f(5));
+    print(g(7));
+    print(sum(10, 0));
+    print(count(5));
+    print(loop(7));
+    print(x);
+    print(acc);
+    print(a);
+}
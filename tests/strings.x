@@ -0,0 +1,108 @@
+# 循环中的 s = s + x 原地追加 (字符串构建器), 结果与逐次复制相同; 期望的输出在 strings.out 中
+snaps = [0];
+m = {"abc": 1, "k1": 2};
+s = "global";
+
+function digits(n)
+{
+    d = "";
+    for (i: 0, n)
+    {
+        d = d + i;
+    }
+    return d;
+}
+
+# 进入循环时复制为构建器, 原来的字符串不变
+function suffix(t, n)
+{
+    u = t;
+    for (i: 0, n)
+    {
+        u = u + "x";
+    }
+    return t + " " + u;
+}
+
+# 内层循环沿用外层循环的构建器
+function grid(rows, cols)
+{
+    g = "";
+    for (r: 0, rows)
+    {
+        for (c: 0, cols)
+        {
+            g = g + r + c + " ";
+        }
+        g = g + "|";
+    }
+    return g;
+}
+
+# 循环中读取了 w, 不能原地修改: 每次保存的都是当时的值
+function snapshots(n)
+{
+    w = "a";
+    for (i: 0, n)
+    {
+        snaps[i] = w;
+        w = w + "b";
+    }
+    return w;
+}
+
+# 不同类型的值追加到字符串
+function mixed()
+{
+    v = "v";
+    for (i: 0, 3)
+    {
+        v = v + 1.5 + i;
+    }
+    return v;
+}
+
+# 数字的累加不是字符串
+function total(n)
+{
+    sum = 0;
+    for (i: 0, n)
+    {
+        sum = sum + i;
+    }
+    return sum;
+}
+
+# 形参与全局变量 s 同名
+function repeat(s, n)
+{
+    for (i: 0, n)
+    {
+        s = s + s;
+    }
+    return s;
+}
+
+function key(n)
+{
+    k = "";
+    for (i: 0, n)
+    {
+        k = k + "k";
+    }
+    return k + n;
+}
+
+main()
+{
+    print(digits(15));
+    print(suffix("ab", 5));
+    print(grid(3, 3));
+    print(snapshots(4), snaps);
+    print(mixed());
+    print(total(100000));
+    print(repeat("xy", 3), s);
+    big = digits(20000);
+    print(big == digits(20000), big == digits(19999));
+    print(m[key(1)], m["a" + "bc"], key(1) == "k1");
+}
@@ -0,0 +1,61 @@
+# spawn 创建任务, await 等待任务结束并得到返回值; 只在 await 之后由 main 打印, 期望的输出在 tasks.out 中
+tasks = [0, 0, 0, 0, 0, 0, 0, 0, 0, 0];
+r = [0];
+
+function square(x)
+{
+    return x * x;
+}
+
+function sum(n)
+{
+    s = 0;
+    for (i: 0, n)
+    {
+        s = s + i;
+    }
+    return s;
+}
+
+# 任务中再创建任务并等待
+function fib(n)
+{
+    if (n < 2)
+    {
+        return n;
+    }
+    a = spawn fib(n - 1);
+    b = fib(n - 2);
+    return (await a) + b;
+}
+
+# 返回数组: 两次 await 同一个任务得到同一个数组
+function range(n)
+{
+    for (i: 0, n)
+    {
+        r[i] = i * 10;
+    }
+    return r;
+}
+
+main()
+{
+    for (i: 0, 10)
+    {
+        tasks[i] = spawn square(i);
+    }
+    total = 0;
+    for (i: 0, 10)
+    {
+        total = total + (await tasks[i]);
+    }
+    print(total);
+    t = spawn sum(100000);
+    print(await t);
+    print(fib(16));
+    t = spawn range(5);
+    a = await t;
+    b = await t;
+    print(a, b[4]);
+}
@@ -0,0 +1,30 @@
+# 用户变量名与临时变量的旧名字 (t1, t2, ...) 相同; 期望的输出在 temps.out 中
+t1 = 5;
+t2 = [1, 2, 3];
+
+function f(t3)
+{
+    t4 = t3 * 2;
+    t1 = t1 + t4;
+    return t4 + 1;
+}
+
+function g(t5)
+{
+    t6 = 0;
+    for (t7: 0, t5)
+    {
+        t6 = t6 + t2[t7];
+    }
+    return t6;
+}
+
+main()
+{
+    t8 = f(10);
+    print(t8);
+    print(t1);
+    print(g(3));
+    t9 = "t1";
+    print(t9 + t8);
+}
@@ -0,0 +1,2119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// 运行时的值 (带标签的联合体)
+typedef enum
+{
+    VAL_NIL,    // 空值
+    VAL_INT,    // 整数
+    VAL_FLOAT,  // 浮点数
+    VAL_STRING, // 字符串
+    VAL_ARRAY,  // 数组
+    VAL_MAP,    // 键值对
+    VAL_TASK    // spawn 创建的任务 (见 task.c)
+} ValueType;
+
+typedef struct Array Array;
+typedef struct Map Map;
+typedef struct Shape Shape;
+typedef struct Task Task;
+
+typedef struct
+{
+    ValueType type;
+    union
+    {
+        long long i;
+        double f;
+        char *s;
+        Array *array;
+        Map *map;
+        Task *task;
+    } as;
+} Value;
+
+// 数组只会增长, 写入末尾之后的位置时按倍数扩展, 中间补 nil
+// 元素全是整数或全是浮点数时紧凑存放, 每个元素 8 字节, 可以用 SIMD 处理;
+// 写入其他类型的元素后转为装箱的 Value 数组, 不再转回 (并行循环临时装箱的除外). 空数组采用第一个元素的类型
+// 紧凑数组的 kind 等于元素的类型标签, 机器码用它直接拼出读到的 Value
+typedef enum
+{
+    ARRAY_BOXED = VAL_NIL,
+    ARRAY_INT = VAL_INT,
+    ARRAY_FLOAT = VAL_FLOAT
+} ArrayKind;
+
+struct Array
+{
+    void *data; // ARRAY_BOXED 时是 Value[], 否则是 long long[] 或 double[]
+    int length;
+    int capacity;
+    int kind;
+};
+
+// 键值对: 条目按插入顺序保存在 keys / values 中, 查找通过 SwissTable 式的开放寻址索引
+// 索引的每个位置有一个控制字节和一个条目下标, 16 个位置为一组; 控制字节为 MAP_EMPTY 或哈希值的低 7 位,
+// 查找时用一条 SIMD 比较得到整组中控制字节匹配的位置, 只有这些位置才比较键
+struct Map
+{
+    Value *keys;
+    Value *values;
+    unsigned long long *hashes; // 条目的哈希值, 扩容时不重新计算, 查找时先比较哈希值再比较键
+    int count;
+    int capacity;
+    signed char *control;
+    int *slots;
+    int bucket_count; // 索引的位置数, 0 或 2 的幂且至少一组
+    Shape *shape;     // 键全是字符串时的形状, 否则为 NULL (字典模式)
+};
+
+// 形状 (隐藏类): 按插入顺序排列的字符串键, 第 i 个键的值在 values[i]
+// 形状组成一棵转移树, 从空形状开始依次加入相同键的键值对共享同一个形状,
+// 访问常量键的指令据此缓存 形状 -> 槽位, 命中时只需比较一次指针再按下标读取
+struct Shape
+{
+    Shape *parent;
+    char *key;   // 最后加入的键, 槽位是 count - 1
+    int count;   // 键的个数
+    Shape **transitions;
+    int transition_count;
+};
+
+// 字段访问指令的内联缓存: 最多记住 FIELD_CACHE_WAYS 个形状 (单态 / 多态), 满了以后不再填充 (超态)
+#define FIELD_CACHE_WAYS 4
+
+typedef struct
+{
+    Shape *shapes[FIELD_CACHE_WAYS];
+    int slots[FIELD_CACHE_WAYS];
+    int count;
+} FieldCache;
+
+// 运行时错误: 打印信息并退出
+void runtime_error(const char *message, const char *detail)
+{
+    fprintf(stderr, "Runtime error: %s%s%s\n", message, detail ? " " : "", detail ? detail : "");
+    exit(1);
+}
+
+// ---------------- 垃圾回收 ----------------
+
+// 字符串, 数组和键值对由回收器管理, 对象前面有 8 字节的头部; 数组的元素和键值对的条目另外 malloc, 随对象释放
+// 分代回收:
+//   - 新对象在新生代中分配: 一整块内存, 原子地移动指针即可分配, 并行循环的线程也可以同时分配
+//   - 新生代满了以后在下一个安全点做次要回收: 把从根和记忆集可达的对象复制到老年代, 更新引用, 新生代整块复用
+//   - 老年代的对象各自 malloc, 超过上次完全回收后存活量的 gc_major_factor 倍时做完全回收 (标记清除)
+//   - 老年代的数组和键值对写入新生代的对象时, 写屏障把容器记入记忆集, 次要回收时把它们也当作根
+// 根由执行引擎提供 (gc_roots, 见 vm.c 的 vm_gc_roots): 虚拟机的栈帧, 实参区, 全局变量和还没有开始的任务;
+// 任务的结果由 gc_remember_slot 和 gc_task_result 处理
+// 回收只在安全点 (函数调用, 循环回跳, 机器码的慢速路径执行完一条指令后) 进行, 这时存活的值都在根中,
+// 运行时的 C 函数的局部变量里没有只由它们引用的对象; 并行循环和 pmap 执行期间不回收 (gc_inhibit)
+// 只有虚拟机执行程序时打开回收 (vm_run); 关闭时分配的对象 (编译出的常量, 其他执行引擎的对象) 是永久的
+
+typedef struct
+{
+    unsigned int size; // 对象的字节数, 不含头部
+    unsigned char kind;
+    unsigned char flags;
+} GCHeader;
+
+enum
+{
+    GC_STRING,
+    GC_ARRAY,
+    GC_MAP
+};
+
+enum
+{
+    GC_PERMANENT = 1,  // 回收关闭时分配, 不回收
+    GC_OLD = 2,        // 在老年代中
+    GC_MARKED = 4,     // 完全回收中已标记
+    GC_FORWARDED = 8,  // 次要回收中已复制到老年代, 对象的前 8 字节是新的地址
+    GC_REMEMBERED = 16 // 已在记忆集中
+};
+
+#define GC_HEADER(p) ((GCHeader *)(p) - 1)
+// 不小于这个大小的对象直接在老年代中分配, 次要回收不复制它们
+#define GC_LARGE_OBJECT 4096
+
+// 新生代的大小; 完全回收的时机: 老年代超过上次完全回收后存活量的 gc_major_factor 倍, 且不少于 gc_major_minimum
+size_t gc_nursery_size = 8 << 20;
+size_t gc_major_factor = 2;
+size_t gc_major_minimum = 32 << 20;
+
+// 统计, 见 gc_print_stats
+typedef struct
+{
+    long long minor_count;
+    long long major_count;
+    double minor_seconds;
+    double major_seconds;
+    double max_pause;
+    unsigned long long allocated_bytes;
+    unsigned long long promoted_bytes;
+    unsigned long long freed_bytes;
+} GCStats;
+
+GCStats gc_stats;
+
+typedef struct
+{
+    void **items;
+    size_t count;
+    size_t capacity;
+} GCList;
+
+int gc_enabled = 0;
+int gc_inhibit = 0;   // 大于 0 时不回收, 由并行循环和 pmap 增减
+int gc_requested = 0; // 新生代满了或老年代超过了阈值, 下一个安全点回收
+int gc_epoch = 0;     // 每次完全回收加一, 任务据此判断本次是否已经访问过
+
+char *gc_nursery = NULL;
+size_t gc_nursery_capacity = 0; // 没有新生代时为 0, gc_is_young 总是为假
+size_t gc_nursery_used = 0;
+// 新生代中的数组和键值对, 次要回收后释放死亡对象的元素和条目; 按新生代能容纳的最多个数预先分配
+void **gc_young_containers = NULL;
+size_t gc_young_container_count = 0;
+
+GCList gc_old;         // 老年代的所有对象 (头部)
+GCList gc_remembered;  // 记忆集
+GCList gc_slots;       // 引用新生代对象的, 不由回收器管理的槽 (任务的结果), 次要回收时当作根
+GCList gc_gray;        // 复制或标记之后还没有扫描的容器
+size_t gc_old_bytes = 0;
+size_t gc_major_threshold = 0;
+pthread_mutex_t gc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// 执行引擎提供的根: 对每个根调用 visit
+void (*gc_roots)(void (*visit)(Value *slot)) = NULL;
+// 任务的结果所在的槽, 本次完全回收已经访问过时返回 NULL (任务不由回收器管理, 见 task.c)
+Value *(*gc_task_result)(Task *task) = NULL;
+
+void gc_list_push(GCList *list, void *item)
+{
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity == 0 ? 256 : list->capacity * 2;
+        list->items = realloc(list->items, sizeof(void *) * list->capacity);
+    }
+    list->items[list->count++] = item;
+}
+
+static inline int gc_is_young(const void *p)
+{
+    return (size_t)((const char *)p - gc_nursery) < gc_nursery_capacity;
+}
+
+static inline int gc_is_object(Value v)
+{
+    return v.type == VAL_STRING || v.type == VAL_ARRAY || v.type == VAL_MAP;
+}
+
+// 数组的元素和键值对的条目占用的字节数
+size_t gc_buffer_bytes(GCHeader *h)
+{
+    if (h->kind == GC_ARRAY)
+    {
+        Array *array = (Array *)(h + 1);
+        return (size_t)array->capacity * (array->kind == ARRAY_BOXED ? sizeof(Value) : sizeof(long long));
+    }
+    if (h->kind == GC_MAP)
+    {
+        Map *map = (Map *)(h + 1);
+        return (size_t)map->capacity * (2 * sizeof(Value) + sizeof(unsigned long long)) +
+               (size_t)map->bucket_count * (1 + sizeof(int));
+    }
+    return 0;
+}
+
+void gc_free_buffers(GCHeader *h)
+{
+    if (h->kind == GC_ARRAY)
+        free(((Array *)(h + 1))->data);
+    else if (h->kind == GC_MAP)
+    {
+        Map *map = (Map *)(h + 1);
+        free(map->keys);
+        free(map->values);
+        free(map->hashes);
+        free(map->control);
+        free(map->slots);
+    }
+}
+
+// 在老年代中登记一个对象, 超过阈值时请求回收
+void gc_add_old(GCHeader *h, size_t bytes)
+{
+    pthread_mutex_lock(&gc_lock);
+    gc_list_push(&gc_old, h);
+    gc_old_bytes += bytes;
+    if (gc_old_bytes > gc_major_threshold)
+        __atomic_store_n(&gc_requested, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&gc_lock);
+}
+
+// 分配 size 字节的对象, 返回头部之后的地址; 内容未初始化
+void *gc_alloc(int kind, size_t size)
+{
+    // 头部之后的前 8 字节在复制后保存新地址
+    size_t total = (sizeof(GCHeader) + (size < 8 ? 8 : size) + 7) & ~(size_t)7;
+    GCHeader *h = NULL;
+    if (gc_enabled && total < GC_LARGE_OBJECT)
+    {
+        size_t offset = __atomic_fetch_add(&gc_nursery_used, total, __ATOMIC_RELAXED);
+        if (offset + total <= gc_nursery_capacity)
+        {
+            h = (GCHeader *)(gc_nursery + offset);
+            h->flags = 0;
+            if (kind != GC_STRING)
+                gc_young_containers[__atomic_fetch_add(&gc_young_container_count, 1, __ATOMIC_RELAXED)] = h + 1;
+        }
+        else
+            __atomic_store_n(&gc_requested, 1, __ATOMIC_RELAXED);
+    }
+    if (h == NULL)
+    {
+        // 新生代满了 (回收之前), 大对象, 或者回收关闭
+        h = malloc(total);
+        if (h == NULL)
+            runtime_error("out of memory", NULL);
+        h->flags = gc_enabled ? GC_OLD : GC_PERMANENT;
+        if (gc_enabled)
+            gc_add_old(h, total);
+    }
+    h->size = (unsigned int)(total - sizeof(GCHeader));
+    h->kind = (unsigned char)kind;
+    __atomic_fetch_add(&gc_stats.allocated_bytes, total, __ATOMIC_RELAXED);
+    return h + 1;
+}
+
+// 把容器记入记忆集; 并行循环的线程可能同时写入同一个容器
+void gc_remember(void *container)
+{
+    GCHeader *h = GC_HEADER(container);
+    if (__atomic_fetch_or(&h->flags, GC_REMEMBERED, __ATOMIC_RELAXED) & GC_REMEMBERED)
+        return;
+    pthread_mutex_lock(&gc_lock);
+    gc_list_push(&gc_remembered, container);
+    pthread_mutex_unlock(&gc_lock);
+}
+
+// 写屏障: 把 v 写入容器之后调用
+static inline void gc_barrier(void *container, Value v)
+{
+    if (gc_is_object(v) && gc_is_young(v.as.s) && !gc_is_young(container))
+        gc_remember(container);
+}
+
+// 一次写入多个元素 (整段复制, 并行线程直接写入) 之后调用, 不逐个检查
+static inline void gc_barrier_all(void *container)
+{
+    if (gc_enabled && !gc_is_young(container))
+        gc_remember(container);
+}
+
+// 把 v 写入不由回收器管理的槽 slot 之后调用
+void gc_remember_slot(Value *slot)
+{
+    if (!gc_is_object(*slot) || !gc_is_young(slot->as.s))
+        return;
+    pthread_mutex_lock(&gc_lock);
+    gc_list_push(&gc_slots, slot);
+    pthread_mutex_unlock(&gc_lock);
+}
+
+// 对容器中的每个值调用 visit
+void gc_scan(void *container, void (*visit)(Value *slot))
+{
+    GCHeader *h = GC_HEADER(container);
+    if (h->kind == GC_ARRAY)
+    {
+        Array *array = container;
+        if (array->kind == ARRAY_BOXED)
+        {
+            for (int i = 0; i < array->length; i++)
+                visit(&((Value *)array->data)[i]);
+        }
+    }
+    else if (h->kind == GC_MAP)
+    {
+        Map *map = container;
+        for (int i = 0; i < map->count; i++)
+        {
+            visit(&map->keys[i]);
+            visit(&map->values[i]);
+        }
+    }
+}
+
+// 次要回收: 新生代的对象复制到老年代, 槽改为指向新的地址
+void gc_evacuate(Value *slot)
+{
+    if (!gc_is_object(*slot) || !gc_is_young(slot->as.s))
+        return;
+    GCHeader *h = GC_HEADER(slot->as.s);
+    void *to;
+    if (h->flags & GC_FORWARDED)
+        to = *(void **)(h + 1);
+    else
+    {
+        size_t total = sizeof(GCHeader) + h->size;
+        GCHeader *copy = malloc(total);
+        if (copy == NULL)
+            runtime_error("out of memory", NULL);
+        memcpy(copy, h, total);
+        copy->flags = GC_OLD;
+        to = copy + 1;
+        gc_list_push(&gc_old, copy);
+        gc_old_bytes += total + gc_buffer_bytes(copy);
+        gc_stats.promoted_bytes += total;
+        h->flags |= GC_FORWARDED;
+        *(void **)(h + 1) = to;
+        if (copy->kind != GC_STRING)
+            gc_list_push(&gc_gray, to);
+    }
+    slot->as.s = to;
+}
+
+// 完全回收: 标记可达的老年代对象, 任务的结果随任务一起标记
+void gc_mark(Value *slot)
+{
+    if (slot->type == VAL_TASK)
+    {
+        Value *result = gc_task_result != NULL ? gc_task_result(slot->as.task) : NULL;
+        if (result != NULL)
+            gc_mark(result);
+        return;
+    }
+    if (!gc_is_object(*slot))
+        return;
+    GCHeader *h = GC_HEADER(slot->as.s);
+    if (h->flags & (GC_MARKED | GC_PERMANENT))
+        return;
+    h->flags |= GC_MARKED;
+    if (h->kind != GC_STRING)
+        gc_list_push(&gc_gray, slot->as.s);
+}
+
+void gc_drain(void (*visit)(Value *slot))
+{
+    while (gc_gray.count > 0)
+        gc_scan(gc_gray.items[--gc_gray.count], visit);
+}
+
+double gc_now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+void gc_pause(double start, double *seconds)
+{
+    double pause = gc_now() - start;
+    *seconds += pause;
+    if (pause > gc_stats.max_pause)
+        gc_stats.max_pause = pause;
+}
+
+void gc_minor()
+{
+    double start = gc_now();
+    unsigned long long promoted = gc_stats.promoted_bytes;
+    if (gc_roots != NULL)
+        gc_roots(gc_evacuate);
+    for (size_t i = 0; i < gc_remembered.count; i++)
+    {
+        GC_HEADER(gc_remembered.items[i])->flags &= ~GC_REMEMBERED;
+        gc_scan(gc_remembered.items[i], gc_evacuate);
+    }
+    gc_remembered.count = 0;
+    for (size_t i = 0; i < gc_slots.count; i++)
+        gc_evacuate(gc_slots.items[i]);
+    gc_slots.count = 0;
+    gc_drain(gc_evacuate);
+
+    // 没有复制的数组和键值对已经死亡, 释放它们的元素和条目
+    for (size_t i = 0; i < gc_young_container_count; i++)
+    {
+        GCHeader *h = GC_HEADER(gc_young_containers[i]);
+        if (!(h->flags & GC_FORWARDED))
+            gc_free_buffers(h);
+    }
+    size_t used = gc_nursery_used < gc_nursery_capacity ? gc_nursery_used : gc_nursery_capacity;
+    gc_stats.freed_bytes += used - (gc_stats.promoted_bytes - promoted);
+    gc_young_container_count = 0;
+    gc_nursery_used = 0;
+    gc_stats.minor_count++;
+    gc_pause(start, &gc_stats.minor_seconds);
+}
+
+void gc_major()
+{
+    double start = gc_now();
+    gc_epoch++;
+    if (gc_roots != NULL)
+        gc_roots(gc_mark);
+    gc_drain(gc_mark);
+
+    size_t kept = 0;
+    size_t live = 0;
+    for (size_t i = 0; i < gc_old.count; i++)
+    {
+        GCHeader *h = gc_old.items[i];
+        size_t bytes = sizeof(GCHeader) + h->size + gc_buffer_bytes(h);
+        if (h->flags & GC_MARKED)
+        {
+            h->flags &= ~GC_MARKED;
+            gc_old.items[kept++] = h;
+            live += bytes;
+        }
+        else
+        {
+            gc_stats.freed_bytes += sizeof(GCHeader) + h->size;
+            gc_free_buffers(h);
+            free(h);
+        }
+    }
+    gc_old.count = kept;
+    gc_old_bytes = live;
+    gc_major_threshold = live * gc_major_factor > gc_major_minimum ? live * gc_major_factor : gc_major_minimum;
+    gc_stats.major_count++;
+    gc_pause(start, &gc_stats.major_seconds);
+}
+
+// 回收: 先做次要回收, 老年代超过阈值或 full 时再做完全回收; 新生代总是在完全回收之前清空
+void gc_collect(int full)
+{
+    gc_minor();
+    if (full || gc_old_bytes > gc_major_threshold)
+        gc_major();
+    __atomic_store_n(&gc_requested, 0, __ATOMIC_RELAXED);
+}
+
+// 安全点: 有回收请求时回收
+static inline void gc_safepoint()
+{
+    if (__atomic_load_n(&gc_requested, __ATOMIC_RELAXED) && gc_enabled &&
+        __atomic_load_n(&gc_inhibit, __ATOMIC_RELAXED) == 0)
+        gc_collect(0);
+}
+
+// 打开回收, roots 和 task_result 的含义见 gc_roots 和 gc_task_result
+void gc_start(void (*roots)(void (*visit)(Value *slot)), Value *(*task_result)(Task *task))
+{
+    if (gc_nursery_capacity != gc_nursery_size)
+    {
+        free(gc_nursery);
+        free(gc_young_containers);
+        gc_nursery = malloc(gc_nursery_size);
+        gc_young_containers = malloc(sizeof(void *) * (gc_nursery_size / (sizeof(GCHeader) + sizeof(Array)) + 1));
+        if (gc_nursery == NULL || gc_young_containers == NULL)
+            runtime_error("out of memory", NULL);
+        gc_nursery_capacity = gc_nursery_size;
+    }
+    gc_roots = roots;
+    gc_task_result = task_result;
+    gc_major_threshold = gc_old_bytes * gc_major_factor > gc_major_minimum ? gc_old_bytes * gc_major_factor : gc_major_minimum;
+    gc_enabled = 1;
+}
+
+// 关闭回收, 本次执行分配的对象都已经不再使用, 全部释放
+void gc_stop()
+{
+    gc_roots = NULL;
+    gc_collect(1);
+    gc_enabled = 0;
+}
+
+void gc_print_stats(FILE *out)
+{
+    GCStats *s = &gc_stats;
+    double seconds = s->minor_seconds + s->major_seconds;
+    long long count = s->minor_count + s->major_count;
+    fprintf(out, "GC: %lld minor, %lld major, pause total %.3f ms, average %.3f ms, max %.3f ms\n", s->minor_count,
+            s->major_count, seconds * 1e3, count > 0 ? seconds * 1e3 / count : 0.0, s->max_pause * 1e3);
+    fprintf(out, "GC: allocated %llu KB, promoted %llu KB, freed %llu KB, old space %zu KB\n", s->allocated_bytes >> 10,
+            s->promoted_bytes >> 10, s->freed_bytes >> 10, gc_old_bytes >> 10);
+}
+
+Value value_nil()
+{
+    Value v;
+    v.type = VAL_NIL;
+    v.as.i = 0;
+    return v;
+}
+
+Value value_int(long long i)
+{
+    Value v;
+    v.type = VAL_INT;
+    v.as.i = i;
+    return v;
+}
+
+Value value_float(double f)
+{
+    Value v;
+    v.type = VAL_FLOAT;
+    v.as.f = f;
+    return v;
+}
+
+Value value_string(char *s)
+{
+    Value v;
+    v.type = VAL_STRING;
+    v.as.s = s;
+    return v;
+}
+
+// 由回收器管理的字符串, 可以写入 length 个字符和结尾的 '\0'
+char *string_new(size_t length)
+{
+    return gc_alloc(GC_STRING, length + 1);
+}
+
+char *string_copy(const char *s)
+{
+    size_t length = strlen(s);
+    char *copy = string_new(length);
+    memcpy(copy, s, length + 1);
+    return copy;
+}
+
+// ---------------- 字符串驻留 ----------------
+
+// 字符串常量和形状的键 (见 shape_add) 在驻留表中只保存一份, 内容相同的驻留字符串地址相同;
+// 键值对的条目使用形状中的键, 以常量为键的查找比较哈希值之后只需比较指针 (value_equals 的快速路径)
+// 驻留的字符串是永久对象, 不论回收是否打开都不回收; 运行时创建的其他字符串不驻留, 比较时照常比较内容
+
+unsigned long long value_hash_string(const char *s);
+
+char **intern_slots = NULL; // 开放寻址, 装载率不超过 1/2
+size_t intern_capacity = 0;
+size_t intern_count = 0;
+pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+char *string_permanent(const char *s)
+{
+    size_t length = strlen(s);
+    GCHeader *h = malloc(sizeof(GCHeader) + length + 1);
+    if (h == NULL)
+        runtime_error("out of memory", NULL);
+    h->size = (unsigned int)(length + 1);
+    h->kind = GC_STRING;
+    h->flags = GC_PERMANENT;
+    memcpy(h + 1, s, length + 1);
+    return (char *)(h + 1);
+}
+
+void intern_insert(char **slots, size_t capacity, char *s)
+{
+    size_t i = value_hash_string(s) & (capacity - 1);
+    while (slots[i] != NULL)
+        i = (i + 1) & (capacity - 1);
+    slots[i] = s;
+}
+
+// 与 s 内容相同的驻留字符串
+char *string_intern(const char *s)
+{
+    pthread_mutex_lock(&intern_lock);
+    if (2 * (intern_count + 1) > intern_capacity)
+    {
+        size_t capacity = intern_capacity == 0 ? 256 : intern_capacity * 2;
+        char **slots = calloc(capacity, sizeof(char *));
+        if (slots == NULL)
+            runtime_error("out of memory", NULL);
+        for (size_t k = 0; k < intern_capacity; k++)
+        {
+            if (intern_slots[k] != NULL)
+                intern_insert(slots, capacity, intern_slots[k]);
+        }
+        free(intern_slots);
+        intern_slots = slots;
+        intern_capacity = capacity;
+    }
+    size_t i = value_hash_string(s) & (intern_capacity - 1);
+    while (intern_slots[i] != NULL && strcmp(intern_slots[i], s) != 0)
+        i = (i + 1) & (intern_capacity - 1);
+    if (intern_slots[i] == NULL)
+    {
+        intern_slots[i] = string_permanent(s);
+        intern_count++;
+    }
+    char *interned = intern_slots[i];
+    pthread_mutex_unlock(&intern_lock);
+    return interned;
+}
+
+// 源码中的字符串字面量, 处理 \n \t \" \\ 转义; 结果是驻留的字符串, 解释器每次求值不再分配
+Value value_string_literal(const char *text, int length)
+{
+    char *s = malloc(length + 1);
+    if (s == NULL)
+        runtime_error("out of memory", NULL);
+    int n = 0;
+    for (int i = 0; i < length; i++)
+    {
+        if (text[i] == '\\' && i + 1 < length)
+        {
+            i++;
+            s[n++] = text[i] == 'n' ? '\n' : text[i] == 't' ? '\t' : text[i];
+        }
+        else
+        {
+            s[n++] = text[i];
+        }
+    }
+    s[n] = '\0';
+    char *interned = string_intern(s);
+    free(s);
+    return value_string(interned);
+}
+
+// IR 常量的文本: 带引号的字符串, nil, 含小数点的浮点数, 其余为整数
+Value value_from_constant(const char *text)
+{
+    if (text[0] == '"')
+        return value_string_literal(text + 1, strlen(text) - 2);
+    if (strcmp(text, "nil") == 0)
+        return value_nil();
+    if (strchr(text, '.') != NULL)
+        return value_float(atof(text));
+    return value_int(atoll(text));
+}
+
+Value value_new_array(int capacity)
+{
+    Array *array = gc_alloc(GC_ARRAY, sizeof(Array));
+    array->capacity = capacity > 0 ? capacity : 4;
+    array->kind = ARRAY_INT;
+    array->data = malloc(sizeof(long long) * array->capacity);
+    array->length = 0;
+    Value v;
+    v.type = VAL_ARRAY;
+    v.as.array = array;
+    return v;
+}
+
+static inline int array_element_size(int kind)
+{
+    return kind == ARRAY_BOXED ? (int)sizeof(Value) : (int)sizeof(long long);
+}
+
+// 第 i 个元素, i 在 [0, length) 内
+static inline Value array_get(Array *array, long long i)
+{
+    if (array->kind == ARRAY_BOXED)
+        return ((Value *)array->data)[i];
+    Value v;
+    v.type = (ValueType)array->kind;
+    v.as.i = ((long long *)array->data)[i];
+    return v;
+}
+
+void array_box(Array *array);
+
+// 写入第 i 个元素, i 在 [0, length) 内; 类型与紧凑数组不同时先转为装箱数组
+static inline void array_put(Array *array, long long i, Value value)
+{
+    if (array->kind != ARRAY_BOXED && (int)value.type == array->kind)
+    {
+        ((long long *)array->data)[i] = value.as.i;
+        return;
+    }
+    array_box(array);
+    ((Value *)array->data)[i] = value;
+    gc_barrier(array, value);
+}
+
+void map_reserve(Map *map, int capacity);
+
+// 所有键值对从空形状开始
+Shape shape_root;
+
+// capacity 为预计的条目数, 常量字面量按键值对的个数预先分配, 构造时不再扩容
+Value value_new_map(int capacity)
+{
+    Map *map = gc_alloc(GC_MAP, sizeof(Map));
+    memset(map, 0, sizeof(Map));
+    map->shape = &shape_root;
+    if (capacity > 0)
+        map_reserve(map, capacity);
+    Value v;
+    v.type = VAL_MAP;
+    v.as.map = map;
+    return v;
+}
+
+int value_is_number(Value v)
+{
+    return v.type == VAL_INT || v.type == VAL_FLOAT;
+}
+
+double value_to_double(Value v)
+{
+    return v.type == VAL_INT ? (double)v.as.i : v.as.f;
+}
+
+// 条件判断: nil 和数值 0 为假
+int value_truthy(Value v)
+{
+    switch (v.type)
+    {
+    case VAL_NIL:
+        return 0;
+    case VAL_INT:
+        return v.as.i != 0;
+    case VAL_FLOAT:
+        return v.as.f != 0;
+    default:
+        return 1;
+    }
+}
+
+// 浮点数的最短往返表示, 整数值保留 .0
+void format_double(double f, char *buffer)
+{
+    sprintf(buffer, "%.15g", f);
+    if (strtod(buffer, NULL) != f)
+        sprintf(buffer, "%.17g", f);
+    if (strchr(buffer, '.') == NULL && strchr(buffer, 'e') == NULL && strchr(buffer, 'n') == NULL &&
+        strchr(buffer, 'i') == NULL)
+        strcat(buffer, ".0");
+}
+
+void value_print(FILE *out, Value v)
+{
+    char buffer[64];
+    switch (v.type)
+    {
+    case VAL_NIL:
+        fputs("nil", out);
+        break;
+    case VAL_INT:
+        fprintf(out, "%lld", v.as.i);
+        break;
+    case VAL_FLOAT:
+        format_double(v.as.f, buffer);
+        fputs(buffer, out);
+        break;
+    case VAL_STRING:
+        fputs(v.as.s, out);
+        break;
+    case VAL_ARRAY:
+        fputc('[', out);
+        for (int i = 0; i < v.as.array->length; i++)
+        {
+            if (i > 0)
+                fputs(", ", out);
+            value_print(out, array_get(v.as.array, i));
+        }
+        fputc(']', out);
+        break;
+    case VAL_MAP:
+        fputc('{', out);
+        for (int i = 0; i < v.as.map->count; i++)
+        {
+            if (i > 0)
+                fputs(", ", out);
+            value_print(out, v.as.map->keys[i]);
+            fputs(": ", out);
+            value_print(out, v.as.map->values[i]);
+        }
+        fputc('}', out);
+        break;
+    case VAL_TASK:
+        fputs("<task>", out);
+        break;
+    }
+}
+
+// 值的文本形式 (用于字符串拼接), 数值写入 buffer (至少 64 字节)
+const char *value_to_string(Value v, char *buffer)
+{
+    switch (v.type)
+    {
+    case VAL_STRING:
+        return v.as.s;
+    case VAL_INT:
+        sprintf(buffer, "%lld", v.as.i);
+        return buffer;
+    case VAL_FLOAT:
+        format_double(v.as.f, buffer);
+        return buffer;
+    case VAL_NIL:
+        return "nil";
+    default:
+        return v.type == VAL_ARRAY ? "[array]" : v.type == VAL_MAP ? "{map}" : "<task>";
+    }
+}
+
+int value_equals(Value a, Value b)
+{
+    if (value_is_number(a) && value_is_number(b))
+    {
+        if (a.type == VAL_INT && b.type == VAL_INT)
+            return a.as.i == b.as.i;
+        return value_to_double(a) == value_to_double(b);
+    }
+    if (a.type != b.type)
+        return 0;
+    switch (a.type)
+    {
+    case VAL_NIL:
+        return 1;
+    case VAL_STRING:
+        return a.as.s == b.as.s || strcmp(a.as.s, b.as.s) == 0;
+    case VAL_ARRAY:
+        return a.as.array == b.as.array;
+    case VAL_MAP:
+        return a.as.map == b.as.map;
+    case VAL_TASK:
+        return a.as.task == b.as.task;
+    default:
+        return 0;
+    }
+}
+
+// 字符串拼接, 另一边转为字符串
+Value value_concat(Value a, Value b)
+{
+    char buffer_x[64];
+    char buffer_y[64];
+    const char *x = value_to_string(a, buffer_x);
+    const char *y = value_to_string(b, buffer_y);
+    size_t n = strlen(x);
+    size_t m = strlen(y);
+    char *s = string_new(n + m);
+    memcpy(s, x, n);
+    memcpy(s + n, y, m + 1);
+    return value_string(s);
+}
+
+// 算术和比较不会出错, 类型不匹配时结果为 nil / 0; 只有整数除以 0 是运行时错误
+Value value_add(Value a, Value b)
+{
+    if (a.type == VAL_INT && b.type == VAL_INT)
+        return value_int((long long)((unsigned long long)a.as.i + (unsigned long long)b.as.i));
+    if (value_is_number(a) && value_is_number(b))
+        return value_float(value_to_double(a) + value_to_double(b));
+    if (a.type == VAL_STRING || b.type == VAL_STRING)
+        return value_concat(a, b);
+    return value_nil();
+}
+
+// 字符串构建器: 循环中反复执行的 s = s + x 原地追加 (见 pseudo.c 的 string_builder_names)
+// 进入循环时把 s 复制为构建器 (string_builder), 构建器留有空闲容量, 对象最后 8 字节记录内容的长度;
+// 编译器保证循环中 s 只被这些语句读取, 构建器没有其他引用, 追加 (string_append) 直接写在内容之后,
+// 容量不够时按两倍扩展, n 次追加的总代价是 O(n); 循环结束后它就是普通的字符串, 不再修改
+static inline size_t *string_builder_length(char *s)
+{
+    return (size_t *)(s + GC_HEADER(s)->size - sizeof(size_t));
+}
+
+char *string_builder_new(size_t length, size_t capacity)
+{
+    char *s = gc_alloc(GC_STRING, capacity + 1 + sizeof(size_t));
+    *string_builder_length(s) = length;
+    return s;
+}
+
+// s 是字符串时复制为构建器, 其他值原样返回
+Value string_builder(Value s)
+{
+    if (s.type != VAL_STRING)
+        return s;
+    size_t length = strlen(s.as.s);
+    char *b = string_builder_new(length, length + 32);
+    memcpy(b, s.as.s, length + 1);
+    return value_string(b);
+}
+
+// a + b, a 是字符串时一定是构建器, 追加到它后面; 结果是字符串时总是构建器
+Value string_append(Value a, Value b)
+{
+    if (a.type != VAL_STRING)
+        return string_builder(value_add(a, b));
+    char buffer[64];
+    const char *y = value_to_string(b, buffer);
+    size_t m = strlen(y);
+    char *s = a.as.s;
+    size_t length = *string_builder_length(s);
+    if (length + m + 1 + sizeof(size_t) > GC_HEADER(s)->size)
+    {
+        char *grown = string_builder_new(length, (length + m) * 2);
+        memcpy(grown, s, length);
+        s = grown;
+    }
+    memcpy(s + length, y, m + 1);
+    *string_builder_length(s) = length + m;
+    return value_string(s);
+}
+
+Value value_sub(Value a, Value b)
+{
+    if (a.type == VAL_INT && b.type == VAL_INT)
+        return value_int((long long)((unsigned long long)a.as.i - (unsigned long long)b.as.i));
+    if (value_is_number(a) && value_is_number(b))
+        return value_float(value_to_double(a) - value_to_double(b));
+    return value_nil();
+}
+
+Value value_mul(Value a, Value b)
+{
+    if (a.type == VAL_INT && b.type == VAL_INT)
+        return value_int((long long)((unsigned long long)a.as.i * (unsigned long long)b.as.i));
+    if (value_is_number(a) && value_is_number(b))
+        return value_float(value_to_double(a) * value_to_double(b));
+    return value_nil();
+}
+
+Value value_div(Value a, Value b)
+{
+    if (a.type == VAL_INT && b.type == VAL_INT)
+    {
+        if (b.as.i == 0)
+            runtime_error("division by zero", NULL);
+        if (b.as.i == -1)
+            return value_int((long long)(0ULL - (unsigned long long)a.as.i));
+        return value_int(a.as.i / b.as.i);
+    }
+    if (value_is_number(a) && value_is_number(b))
+        return value_float(value_to_double(a) / value_to_double(b));
+    return value_nil();
+}
+
+// 比较: 数值按大小, 字符串按字典序, 其他类型返回 0; 结果为 -1 / 0 / 1, 不可比较时为 2
+int value_compare(Value a, Value b)
+{
+    if (a.type == VAL_INT && b.type == VAL_INT)
+        return (a.as.i > b.as.i) - (a.as.i < b.as.i);
+    if (value_is_number(a) && value_is_number(b))
+    {
+        double x = value_to_double(a);
+        double y = value_to_double(b);
+        return x < y ? -1 : x > y ? 1 : x == y ? 0 : 2;
+    }
+    if (a.type == VAL_STRING && b.type == VAL_STRING)
+    {
+        int c = strcmp(a.as.s, b.as.s);
+        return (c > 0) - (c < 0);
+    }
+    return 2;
+}
+
+Value value_lt(Value a, Value b)
+{
+    return value_int(value_compare(a, b) == -1);
+}
+
+Value value_gt(Value a, Value b)
+{
+    return value_int(value_compare(a, b) == 1);
+}
+
+Value value_le(Value a, Value b)
+{
+    int c = value_compare(a, b);
+    return value_int(c == -1 || c == 0);
+}
+
+Value value_ge(Value a, Value b)
+{
+    int c = value_compare(a, b);
+    return value_int(c == 1 || c == 0);
+}
+
+Value value_eq(Value a, Value b)
+{
+    return value_int(value_equals(a, b));
+}
+
+// 数组下标: 整数或整数值的浮点数
+int value_index(Value index, long long *out)
+{
+    if (index.type == VAL_INT)
+    {
+        *out = index.as.i;
+        return 1;
+    }
+    if (index.type == VAL_FLOAT && index.as.f == (double)(long long)index.as.f)
+    {
+        *out = (long long)index.as.f;
+        return 1;
+    }
+    return 0;
+}
+
+void array_reserve(Array *array, int capacity)
+{
+    if (capacity <= array->capacity)
+        return;
+    int grown = array->capacity * 2;
+    array->capacity = grown > capacity ? grown : capacity;
+    array->data = realloc(array->data, array_element_size(array->kind) * array->capacity);
+}
+
+// 紧凑数组转为装箱数组
+void array_box(Array *array)
+{
+    if (array->kind == ARRAY_BOXED)
+        return;
+    Value *items = malloc(sizeof(Value) * array->capacity);
+    for (int i = 0; i < array->length; i++)
+        items[i] = array_get(array, i);
+    free(array->data);
+    array->data = items;
+    array->kind = ARRAY_BOXED;
+}
+
+// 装箱数组的元素全是 kind 类型时转回紧凑数组, 返回是否转换
+// 并行循环执行前把写入的数组装箱, 执行后用它恢复原来的表示 (见 parallel.c)
+int array_pack(Array *array, int kind)
+{
+    if (array->kind != ARRAY_BOXED || (kind != ARRAY_INT && kind != ARRAY_FLOAT))
+        return 0;
+    Value *items = array->data;
+    for (int i = 0; i < array->length; i++)
+    {
+        if ((int)items[i].type != kind)
+            return 0;
+    }
+    long long *packed = malloc(sizeof(long long) * (array->capacity > 0 ? array->capacity : 1));
+    for (int i = 0; i < array->length; i++)
+        packed[i] = items[i].as.i;
+    free(items);
+    array->data = packed;
+    array->kind = kind;
+    return 1;
+}
+
+// 空的紧凑数组改为 value 的类型, 元素大小相同, 不需要重新分配
+static inline void array_adopt(Array *array, Value value)
+{
+    if (array->length == 0 && array->kind != ARRAY_BOXED && (value.type == VAL_INT || value.type == VAL_FLOAT))
+        array->kind = value.type;
+}
+
+void array_fill(Array *array, long long start, long long end, Value value);
+
+void array_set(Array *array, long long index, Value value)
+{
+    if (index < 0 || index > 0x3fffffff)
+        runtime_error("array index out of range", NULL);
+    array_adopt(array, value);
+    if (index >= array->length)
+    {
+        // 中间的空位补 nil, 紧凑数组放不下 nil
+        if (index > array->length)
+            array_fill(array, array->length, index, value_nil());
+        array_reserve(array, (int)index + 1);
+        array->length = (int)index + 1;
+    }
+    array_put(array, index, value);
+}
+
+// ---------------- 数组的 SIMD 内核 ----------------
+
+// 紧凑数组按 8 字节的元素整段处理, 有 SSE2 时每次处理两个元素; 装箱数组逐个处理
+// 结果与逐个元素执行 value.c 的运算完全相同
+
+// [start, end) 置为 value, start 不超过数组长度, 需要时扩展数组
+void array_fill(Array *array, long long start, long long end, Value value)
+{
+    if (start < 0 || end > 0x40000000 || start > array->length)
+        runtime_error("array index out of range", NULL);
+    if (end <= start)
+        return;
+    array_adopt(array, value);
+    if (array->kind != ARRAY_BOXED && (int)value.type != array->kind)
+        array_box(array);
+    array_reserve(array, (int)end);
+    long long i = start;
+    if (array->kind == ARRAY_BOXED)
+    {
+        Value *items = array->data;
+        for (; i < end; i++)
+            items[i] = value;
+        gc_barrier(array, value);
+    }
+    else
+    {
+        long long *items = array->data;
+#ifdef __SSE2__
+        __m128i pair = _mm_set1_epi64x(value.as.i);
+        for (; i + 2 <= end; i += 2)
+            _mm_storeu_si128((__m128i *)(items + i), pair);
+#endif
+        for (; i < end; i++)
+            items[i] = value.as.i;
+    }
+    if (end > array->length)
+        array->length = (int)end;
+}
+
+// dst[dst_start + k] = src[start + k], k 取 [0, end - start); 下标从 start 开始连续, dst_start 不超过 dst 的长度
+// 同一个数组时区间不能重叠; 源区间超出 src 的部分按 nil 处理
+void array_copy(Array *dst, long long dst_start, Array *src, long long start, long long end)
+{
+    long long count = end - start;
+    if (count <= 0)
+        return;
+    if (start < 0 || end > src->length)
+    {
+        for (long long k = 0; k < count; k++)
+        {
+            long long i = start + k;
+            array_set(dst, dst_start + k, i >= 0 && i < src->length ? array_get(src, i) : value_nil());
+        }
+        return;
+    }
+    if (dst_start < 0 || dst_start + count > 0x40000000 || dst_start > dst->length)
+        runtime_error("array index out of range", NULL);
+    if (dst->length == 0 && dst->kind != ARRAY_BOXED)
+        dst->kind = src->kind == ARRAY_BOXED ? ARRAY_INT : src->kind;
+    if (dst->kind != src->kind)
+    {
+        // 类型不同时逐个写入, 写入过程中 dst 可能转为装箱数组
+        for (long long k = 0; k < count; k++)
+            array_set(dst, dst_start + k, array_get(src, start + k));
+        return;
+    }
+    // 元素类型相同时整段复制, memcpy 本身按 SIMD 实现; 装箱数组不逐个检查, 直接记入记忆集
+    array_reserve(dst, (int)(dst_start + count));
+    size_t size = array_element_size(src->kind);
+    memcpy((char *)dst->data + dst_start * size, (char *)src->data + start * size, count * size);
+    if (src->kind == ARRAY_BOXED)
+        gc_barrier_all(dst);
+    if (dst_start + count > dst->length)
+        dst->length = (int)(dst_start + count);
+}
+
+// initial + array[start] + ... + array[end - 1], 按下标顺序累加
+// 整数按 64 位补码回绕, 加法满足结合律, 可以分成两路并行累加; 浮点数的加法不满足结合律, 按顺序累加
+Value array_sum(Array *array, Value initial, long long start, long long end)
+{
+    if (start < 0)
+        start = 0;
+    if (end > array->length)
+        end = array->length;
+    long long i = start;
+    if (array->kind == ARRAY_INT && initial.type == VAL_INT)
+    {
+        const long long *items = array->data;
+        unsigned long long sum = (unsigned long long)initial.as.i;
+#ifdef __SSE2__
+        __m128i pair = _mm_setzero_si128();
+        for (; i + 2 <= end; i += 2)
+            pair = _mm_add_epi64(pair, _mm_loadu_si128((const __m128i *)(items + i)));
+        unsigned long long lanes[2];
+        _mm_storeu_si128((__m128i *)lanes, pair);
+        sum += lanes[0] + lanes[1];
+#endif
+        for (; i < end; i++)
+            sum += (unsigned long long)items[i];
+        return value_int((long long)sum);
+    }
+    if (array->kind == ARRAY_FLOAT && value_is_number(initial))
+    {
+        const double *items = array->data;
+        double sum = value_to_double(initial);
+        for (; i < end; i++)
+            sum += items[i];
+        return value_float(sum);
+    }
+    Value sum = initial;
+    for (; i < end; i++)
+        sum = value_add(sum, array_get(array, i));
+    return sum;
+}
+
+// a[a_start + k] == b[b_start + k] 对 [0, count) 都成立时返回 1, 比较规则与 value_equals 相同
+int array_compare(Array *a, long long a_start, Array *b, long long b_start, long long count)
+{
+    if (count <= 0)
+        return 1;
+    if (a_start < 0 || b_start < 0 || a_start + count > a->length || b_start + count > b->length)
+        runtime_error("array index out of range", NULL);
+    long long k = 0;
+    if (a->kind == ARRAY_INT && b->kind == ARRAY_INT)
+    {
+        const long long *x = (const long long *)a->data + a_start;
+        const long long *y = (const long long *)b->data + b_start;
+#ifdef __SSE2__
+        // 没有 64 位的相等比较, 两个 32 位的半边都相等即可
+        for (; k + 2 <= count; k += 2)
+        {
+            __m128i equal = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(x + k)), _mm_loadu_si128((const __m128i *)(y + k)));
+            if (_mm_movemask_epi8(equal) != 0xffff)
+                return 0;
+        }
+#endif
+        for (; k < count; k++)
+        {
+            if (x[k] != y[k])
+                return 0;
+        }
+        return 1;
+    }
+    if (a->kind == ARRAY_FLOAT && b->kind == ARRAY_FLOAT)
+    {
+        const double *x = (const double *)a->data + a_start;
+        const double *y = (const double *)b->data + b_start;
+#ifdef __SSE2__
+        for (; k + 2 <= count; k += 2)
+        {
+            if (_mm_movemask_pd(_mm_cmpeq_pd(_mm_loadu_pd(x + k), _mm_loadu_pd(y + k))) != 3)
+                return 0;
+        }
+#endif
+        for (; k < count; k++)
+        {
+            if (x[k] != y[k])
+                return 0;
+        }
+        return 1;
+    }
+    for (; k < count; k++)
+    {
+        if (!value_equals(array_get(a, a_start + k), array_get(b, b_start + k)))
+            return 0;
+    }
+    return 1;
+}
+
+// ---------------- 形状 ----------------
+
+// 键很多的键值对通常是字典, 超过这个数目后转为字典模式, 转移树不会无限增长
+#define SHAPE_MAX_KEYS 64
+
+// 在 shape 之后加入 key 得到的形状, 相同的转移只创建一次; 形状的键是驻留的字符串
+Shape *shape_add(Shape *shape, const char *key)
+{
+    if (shape->count == SHAPE_MAX_KEYS)
+        return NULL;
+    for (int i = 0; i < shape->transition_count; i++)
+    {
+        if (shape->transitions[i]->key == key || strcmp(shape->transitions[i]->key, key) == 0)
+            return shape->transitions[i];
+    }
+    Shape *next = calloc(1, sizeof(Shape));
+    next->parent = shape;
+    next->key = string_intern(key);
+    next->count = shape->count + 1;
+    shape->transitions = realloc(shape->transitions, sizeof(Shape *) * (shape->transition_count + 1));
+    shape->transitions[shape->transition_count++] = next;
+    return next;
+}
+
+// key 在形状中的槽位, 不存在时返回 -1
+int shape_lookup(Shape *shape, const char *key)
+{
+    for (; shape->count > 0; shape = shape->parent)
+    {
+        if (shape->key == key || strcmp(shape->key, key) == 0)
+            return shape->count - 1;
+    }
+    return -1;
+}
+
+// ---------------- 键值对的哈希索引 ----------------
+
+#define MAP_GROUP 16
+#define MAP_EMPTY (-128)
+
+unsigned long long value_hash_mix(unsigned long long h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+unsigned long long value_hash_string(const char *s)
+{
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    for (; *s; s++)
+        h = (h ^ (unsigned char)*s) * 0x100000001b3ULL;
+    return value_hash_mix(h);
+}
+
+// 与 value_equals 一致: 相等的整数和浮点数 (1 与 1.0) 哈希值相同, 因此数值按转换成 double 后的值计算
+unsigned long long value_hash(Value v)
+{
+    double f;
+    unsigned long long bits;
+    switch (v.type)
+    {
+    case VAL_INT:
+    case VAL_FLOAT:
+        f = value_to_double(v);
+        if (f >= -9223372036854775808.0 && f < 9223372036854775808.0 && f == (double)(long long)f)
+            return value_hash_mix((unsigned long long)(long long)f);
+        memcpy(&bits, &f, sizeof(bits));
+        return value_hash_mix(bits);
+    case VAL_STRING:
+        return value_hash_string(v.as.s);
+    case VAL_ARRAY:
+    case VAL_MAP:
+    case VAL_TASK:
+        return value_hash_mix((unsigned long long)(size_t)v.as.array);
+    default:
+        return 0;
+    }
+}
+
+// 一组控制字节中等于 tag 的位置, 第 i 位对应组内第 i 个位置
+static inline unsigned map_match(const signed char *group, signed char tag)
+{
+#ifdef __SSE2__
+    __m128i bytes = _mm_loadu_si128((const __m128i *)group);
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(tag)));
+#else
+    unsigned mask = 0;
+    for (int i = 0; i < MAP_GROUP; i++)
+    {
+        if (group[i] == tag)
+            mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+// 按组探测: 从哈希值高位选出的组开始, 步长依次加 1; 组数是 2 的幂, 这样会遍历所有组
+int map_find_hashed(Map *map, Value key, unsigned long long hash)
+{
+    if (map->bucket_count == 0)
+        return -1;
+    signed char tag = (signed char)(hash & 0x7f);
+    int group_mask = map->bucket_count / MAP_GROUP - 1;
+    int group = (int)(hash >> 7) & group_mask;
+    for (int step = 1;; step++)
+    {
+        const signed char *control = map->control + group * MAP_GROUP;
+        unsigned match = map_match(control, tag);
+        while (match != 0)
+        {
+            int entry = map->slots[group * MAP_GROUP + __builtin_ctz(match)];
+            if (map->hashes[entry] == hash && value_equals(map->keys[entry], key))
+                return entry;
+            match &= match - 1;
+        }
+        // 键只会插入到探测序列上第一个空位置, 组中还有空位置说明键不存在
+        if (map_match(control, MAP_EMPTY) != 0)
+            return -1;
+        group = (group + step) & group_mask;
+    }
+}
+
+int map_find(Map *map, Value key)
+{
+    if (map->count == 0)
+        return -1;
+    return map_find_hashed(map, key, value_hash(key));
+}
+
+// 把条目 entry 放到索引中探测序列上的第一个空位置
+void map_index_entry(Map *map, int entry)
+{
+    unsigned long long hash = map->hashes[entry];
+    int group_mask = map->bucket_count / MAP_GROUP - 1;
+    int group = (int)(hash >> 7) & group_mask;
+    for (int step = 1;; step++)
+    {
+        unsigned empty = map_match(map->control + group * MAP_GROUP, MAP_EMPTY);
+        if (empty != 0)
+        {
+            int slot = group * MAP_GROUP + __builtin_ctz(empty);
+            map->control[slot] = (signed char)(hash & 0x7f);
+            map->slots[slot] = entry;
+            return;
+        }
+        group = (group + step) & group_mask;
+    }
+}
+
+// 保证能容纳 capacity 个条目; 索引的装载率不超过 7/8, 不够时按新大小重建
+void map_reserve(Map *map, int capacity)
+{
+    if (capacity > map->capacity)
+    {
+        map->capacity = capacity;
+        map->keys = realloc(map->keys, sizeof(Value) * capacity);
+        map->values = realloc(map->values, sizeof(Value) * capacity);
+        map->hashes = realloc(map->hashes, sizeof(unsigned long long) * capacity);
+    }
+    int bucket_count = MAP_GROUP;
+    while (bucket_count / 8 * 7 < capacity)
+        bucket_count *= 2;
+    if (bucket_count <= map->bucket_count)
+        return;
+    free(map->control);
+    free(map->slots);
+    map->bucket_count = bucket_count;
+    map->control = malloc(bucket_count);
+    map->slots = malloc(sizeof(int) * bucket_count);
+    memset(map->control, MAP_EMPTY, bucket_count);
+    for (int i = 0; i < map->count; i++)
+        map_index_entry(map, i);
+}
+
+void map_set(Map *map, Value key, Value value)
+{
+    unsigned long long hash = value_hash(key);
+    int i = map_find_hashed(map, key, hash);
+    if (i >= 0)
+    {
+        map->values[i] = value;
+        gc_barrier(map, value);
+        return;
+    }
+    if (map->count == map->capacity)
+        map_reserve(map, map->capacity == 0 ? 4 : map->capacity * 2);
+    // 形状模式下条目的键换成形状中驻留的键
+    if (map->shape != NULL)
+        map->shape = key.type == VAL_STRING ? shape_add(map->shape, key.as.s) : NULL;
+    if (map->shape != NULL)
+        key.as.s = map->shape->key;
+    map->keys[map->count] = key;
+    map->values[map->count] = value;
+    map->hashes[map->count] = hash;
+    gc_barrier(map, key);
+    gc_barrier(map, value);
+    map_index_entry(map, map->count);
+    map->count++;
+}
+
+// container[index], 越界或不存在的键返回 nil
+Value value_get_index(Value container, Value index)
+{
+    long long i;
+    if (container.type == VAL_ARRAY)
+    {
+        if (value_index(index, &i) && i >= 0 && i < container.as.array->length)
+            return array_get(container.as.array, i);
+        return value_nil();
+    }
+    if (container.type == VAL_MAP)
+    {
+        int found = map_find(container.as.map, index);
+        return found >= 0 ? container.as.map->values[found] : value_nil();
+    }
+    runtime_error("value is not indexable", NULL);
+    return value_nil();
+}
+
+// container[index] = value
+void value_set_index(Value container, Value index, Value value)
+{
+    long long i;
+    if (container.type == VAL_ARRAY)
+    {
+        if (!value_index(index, &i))
+            runtime_error("array index must be an integer", NULL);
+        array_set(container.as.array, i, value);
+    }
+    else if (container.type == VAL_MAP)
+    {
+        map_set(container.as.map, index, value);
+    }
+    else
+    {
+        runtime_error("value is not indexable", NULL);
+    }
+}
+
+// ---------------- 向量化循环 ----------------
+
+// 优化器把只做逐元素运算的计数循环改写为一次内置函数 $vector 的调用 (见 optimizer.c 的循环向量化)
+// 实参依次为: 循环体用到的数组和不变量, 循环变量的初值, 终值, 描述循环体的程序文本
+// 程序由分号分隔的步骤组成, 第 s 步的结果放在寄存器 s 中:
+//   index        当前下标
+//   const a      第 a 个实参
+//   load a       数组实参 a 在当前下标的元素
+//   add x y      寄存器 x, y 逐元素相加, sub mul div lt gt le ge eq 同理
+//   store a x    寄存器 x 写入数组实参 a 的当前下标
+// 循环按每段 VECTOR_STRIP 个下标执行, 段内依次对整段执行每一步; 所有读写的下标都是循环变量本身,
+// 不同下标之间没有依赖, 同一下标上各步的先后次序与原循环相同, 因此数组别名不影响结果
+#define VECTOR_MAX_STEPS 64
+#define VECTOR_STRIP 256
+
+typedef enum
+{
+    VEC_INDEX,
+    VEC_CONST,
+    VEC_LOAD,
+    VEC_STORE,
+    VEC_ADD,
+    VEC_SUB,
+    VEC_MUL,
+    VEC_DIV,
+    VEC_LT,
+    VEC_GT,
+    VEC_LE,
+    VEC_GE,
+    VEC_EQ
+} VectorOp;
+
+const char *vector_op_names[] = {"index", "const", "load", "store", "add", "sub", "mul",
+                                 "div",   "lt",    "gt",   "le",    "ge",  "eq"};
+
+typedef struct
+{
+    int op;
+    int a;
+    int b;
+} VectorStep;
+
+// 一段下标上的寄存器, 与数组一样按 kind 存放 8 字节的整数 / 浮点数或装箱的 Value
+typedef struct
+{
+    int kind;
+    void *data;
+} VectorRegister;
+
+// 寄存器编号指向前面产生值的步骤
+static inline int vector_register_ok(VectorStep *steps, int count, int reg)
+{
+    return reg >= 0 && reg < count && steps[reg].op != VEC_STORE;
+}
+
+// 解析程序文本, 返回步数; 程序来自字节码文件时可能不合法, 检查每个编号
+int vector_parse(const char *text, VectorStep *steps, int operand_count)
+{
+    int count = 0;
+    char name[16];
+    int length;
+    // 步名后面可能直接是分号 (index 没有操作数)
+    while (sscanf(text, " %15[a-z]%n", name, &length) == 1)
+    {
+        text += length;
+        int op = 0;
+        while (op <= VEC_EQ && strcmp(vector_op_names[op], name) != 0)
+            op++;
+        if (op > VEC_EQ || count == VECTOR_MAX_STEPS)
+            return -1;
+
+        VectorStep *step = &steps[count];
+        step->a = -1;
+        step->b = -1;
+        length = 0;
+        if (op == VEC_CONST || op == VEC_LOAD)
+            sscanf(text, "%d%n", &step->a, &length);
+        else if (op != VEC_INDEX)
+            sscanf(text, "%d %d%n", &step->a, &step->b, &length);
+        text += length;
+        while (*text == ' ')
+            text++;
+        if (*text == ';')
+            text++;
+        else if (*text != '\0')
+            return -1;
+
+        if (op == VEC_CONST || op == VEC_LOAD || op == VEC_STORE)
+        {
+            if (step->a < 0 || step->a >= operand_count)
+                return -1;
+        }
+        else if (op != VEC_INDEX && !vector_register_ok(steps, count, step->a))
+            return -1;
+        if (op >= VEC_STORE && !vector_register_ok(steps, count, step->b))
+            return -1;
+        step->op = op;
+        count++;
+    }
+    return count;
+}
+
+Value vector_scalar(int op, Value x, Value y)
+{
+    switch (op)
+    {
+    case VEC_ADD:
+        return value_add(x, y);
+    case VEC_SUB:
+        return value_sub(x, y);
+    case VEC_MUL:
+        return value_mul(x, y);
+    case VEC_DIV:
+        return value_div(x, y);
+    case VEC_LT:
+        return value_lt(x, y);
+    case VEC_GT:
+        return value_gt(x, y);
+    case VEC_LE:
+        return value_le(x, y);
+    case VEC_GE:
+        return value_ge(x, y);
+    default:
+        return value_eq(x, y);
+    }
+}
+
+// 通用路径: 与原来的标量循环逐条对应, 用于数组实参不是数组或下标不是整数等少见情况
+Value vector_generic(VectorStep *steps, int count, Value *operands, Value start, Value end)
+{
+    Value regs[VECTOR_MAX_STEPS];
+    Value i = start;
+    while (value_truthy(value_lt(i, end)))
+    {
+        for (int s = 0; s < count; s++)
+        {
+            VectorStep *step = &steps[s];
+            switch (step->op)
+            {
+            case VEC_INDEX:
+                regs[s] = i;
+                break;
+            case VEC_CONST:
+                regs[s] = operands[step->a];
+                break;
+            case VEC_LOAD:
+                regs[s] = value_get_index(operands[step->a], i);
+                break;
+            case VEC_STORE:
+                value_set_index(operands[step->a], i, regs[step->b]);
+                break;
+            default:
+                regs[s] = vector_scalar(step->op, regs[step->a], regs[step->b]);
+                break;
+            }
+        }
+        i = value_add(i, value_int(1));
+    }
+    return i;
+}
+
+// 运行时选择指令集: 有 AVX2 时每次处理 4 个元素, 否则用 SSE2 每次处理 2 个, 余下的元素逐个处理
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define VECTOR_AVX2 1
+
+int vector_has_avx2 = -1;
+
+int vector_avx2()
+{
+    if (vector_has_avx2 < 0)
+    {
+        __builtin_cpu_init();
+        vector_has_avx2 = __builtin_cpu_supports("avx2") != 0;
+    }
+    return vector_has_avx2;
+}
+
+// 整数只有加减可以用 SIMD (没有 64 位的乘法和除法), 返回已处理的元素数
+__attribute__((target("avx2"))) int vector_int_avx2(int op, const long long *x, const long long *y, long long *out, int n)
+{
+    int k = 0;
+    for (; k + 4 <= n; k += 4)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(x + k));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(y + k));
+        _mm256_storeu_si256((__m256i *)(out + k), op == VEC_ADD ? _mm256_add_epi64(a, b) : _mm256_sub_epi64(a, b));
+    }
+    return k;
+}
+
+__attribute__((target("avx2"))) int vector_float_avx2(int op, const double *x, const double *y, double *out, int n)
+{
+    int k = 0;
+    for (; k + 4 <= n; k += 4)
+    {
+        __m256d a = _mm256_loadu_pd(x + k);
+        __m256d b = _mm256_loadu_pd(y + k);
+        __m256d c = op == VEC_ADD ? _mm256_add_pd(a, b)
+                    : op == VEC_SUB ? _mm256_sub_pd(a, b)
+                    : op == VEC_MUL ? _mm256_mul_pd(a, b)
+                                    : _mm256_div_pd(a, b);
+        _mm256_storeu_pd(out + k, c);
+    }
+    return k;
+}
+#endif
+
+int vector_int_simd(int op, const long long *x, const long long *y, long long *out, int n)
+{
+    int k = 0;
+#ifdef VECTOR_AVX2
+    if (vector_avx2())
+        return vector_int_avx2(op, x, y, out, n);
+#endif
+#ifdef __SSE2__
+    for (; k + 2 <= n; k += 2)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(x + k));
+        __m128i b = _mm_loadu_si128((const __m128i *)(y + k));
+        _mm_storeu_si128((__m128i *)(out + k), op == VEC_ADD ? _mm_add_epi64(a, b) : _mm_sub_epi64(a, b));
+    }
+#endif
+    return k;
+}
+
+int vector_float_simd(int op, const double *x, const double *y, double *out, int n)
+{
+    int k = 0;
+#ifdef VECTOR_AVX2
+    if (vector_avx2())
+        return vector_float_avx2(op, x, y, out, n);
+#endif
+#ifdef __SSE2__
+    for (; k + 2 <= n; k += 2)
+    {
+        __m128d a = _mm_loadu_pd(x + k);
+        __m128d b = _mm_loadu_pd(y + k);
+        __m128d c = op == VEC_ADD ? _mm_add_pd(a, b) : op == VEC_SUB ? _mm_sub_pd(a, b) : op == VEC_MUL ? _mm_mul_pd(a, b) : _mm_div_pd(a, b);
+        _mm_storeu_pd(out + k, c);
+    }
+#endif
+    return k;
+}
+
+// 两个整数段的运算, 规则与 value.c 的整数运算相同
+void vector_int(int op, const long long *x, const long long *y, long long *out, int n)
+{
+    int k = op == VEC_ADD || op == VEC_SUB ? vector_int_simd(op, x, y, out, n) : 0;
+    for (; k < n; k++)
+    {
+        unsigned long long a = (unsigned long long)x[k];
+        unsigned long long b = (unsigned long long)y[k];
+        switch (op)
+        {
+        case VEC_ADD:
+            out[k] = (long long)(a + b);
+            break;
+        case VEC_SUB:
+            out[k] = (long long)(a - b);
+            break;
+        case VEC_MUL:
+            out[k] = (long long)(a * b);
+            break;
+        case VEC_DIV:
+            if (y[k] == 0)
+                runtime_error("division by zero", NULL);
+            out[k] = y[k] == -1 ? (long long)(0ULL - a) : x[k] / y[k];
+            break;
+        case VEC_LT:
+            out[k] = x[k] < y[k];
+            break;
+        case VEC_GT:
+            out[k] = x[k] > y[k];
+            break;
+        case VEC_LE:
+            out[k] = x[k] <= y[k];
+            break;
+        case VEC_GE:
+            out[k] = x[k] >= y[k];
+            break;
+        default:
+            out[k] = x[k] == y[k];
+            break;
+        }
+    }
+}
+
+// 两个浮点数段的运算, 比较的结果是整数 0 / 1 (NaN 与任何数比较都为假)
+void vector_float(int op, const double *x, const double *y, void *out, int n)
+{
+    int k = op <= VEC_DIV ? vector_float_simd(op, x, y, out, n) : 0;
+    double *f = out;
+    long long *i = out;
+    for (; k < n; k++)
+    {
+        switch (op)
+        {
+        case VEC_ADD:
+            f[k] = x[k] + y[k];
+            break;
+        case VEC_SUB:
+            f[k] = x[k] - y[k];
+            break;
+        case VEC_MUL:
+            f[k] = x[k] * y[k];
+            break;
+        case VEC_DIV:
+            f[k] = x[k] / y[k];
+            break;
+        case VEC_LT:
+            i[k] = x[k] < y[k];
+            break;
+        case VEC_GT:
+            i[k] = x[k] > y[k];
+            break;
+        case VEC_LE:
+            i[k] = x[k] <= y[k];
+            break;
+        case VEC_GE:
+            i[k] = x[k] >= y[k];
+            break;
+        default:
+            i[k] = x[k] == y[k];
+            break;
+        }
+    }
+}
+
+static inline Value vector_get(VectorRegister *reg, int k)
+{
+    if (reg->kind == ARRAY_BOXED)
+        return ((Value *)reg->data)[k];
+    Value v;
+    v.type = (ValueType)reg->kind;
+    v.as.i = ((long long *)reg->data)[k];
+    return v;
+}
+
+// 整数段转为浮点数, 浮点数段直接使用
+const double *vector_doubles(VectorRegister *reg, double *scratch, int n)
+{
+    if (reg->kind == ARRAY_FLOAT)
+        return reg->data;
+    const long long *items = reg->data;
+    for (int k = 0; k < n; k++)
+        scratch[k] = (double)items[k];
+    return scratch;
+}
+
+void vector_binary(int op, VectorRegister *x, VectorRegister *y, VectorRegister *out, double *scratch, int n)
+{
+    if (x->kind == ARRAY_INT && y->kind == ARRAY_INT)
+    {
+        out->kind = ARRAY_INT;
+        vector_int(op, x->data, y->data, out->data, n);
+    }
+    else if (x->kind != ARRAY_BOXED && y->kind != ARRAY_BOXED)
+    {
+        // 整数与浮点数混合时与 value.c 一样按浮点数计算
+        out->kind = op <= VEC_DIV ? ARRAY_FLOAT : ARRAY_INT;
+        vector_float(op, vector_doubles(x, scratch, n), vector_doubles(y, scratch + VECTOR_STRIP, n), out->data, n);
+    }
+    else
+    {
+        out->kind = ARRAY_BOXED;
+        for (int k = 0; k < n; k++)
+            ((Value *)out->data)[k] = vector_scalar(op, vector_get(x, k), vector_get(y, k));
+    }
+}
+
+// 装箱数组的一段: 元素全是整数或全是浮点数时按紧凑的段读出, 后面的运算仍可以用 SIMD
+void vector_load_boxed(VectorRegister *reg, const Value *items, int n)
+{
+    int kind = n > 0 && (items[0].type == VAL_INT || items[0].type == VAL_FLOAT) ? items[0].type : ARRAY_BOXED;
+    for (int k = 1; k < n && kind != ARRAY_BOXED; k++)
+    {
+        if ((int)items[k].type != kind)
+            kind = ARRAY_BOXED;
+    }
+    reg->kind = kind;
+    if (kind == ARRAY_BOXED)
+    {
+        memcpy(reg->data, items, n * sizeof(Value));
+        return;
+    }
+    long long *out = reg->data;
+    for (int k = 0; k < n; k++)
+        out[k] = items[k].as.i;
+}
+
+// 循环变量从整数 start 开始时的终止下标; 数组不够长 (只可能来自不合法的字节码) 或不是数组时返回 0 走通用路径
+int vector_stop(VectorStep *steps, int count, Value *operands, Value start, Value end, long long *stop)
+{
+    if (start.type != VAL_INT)
+        return 0;
+    if (end.type == VAL_INT)
+        *stop = end.as.i;
+    else if (end.type == VAL_FLOAT && end.as.f > -0x40000000 && end.as.f < 0x40000000)
+    {
+        // 整数 i < 浮点数 end 按浮点数比较, 循环到 end 向上取整为止
+        *stop = (long long)end.as.f;
+        if ((double)*stop < end.as.f)
+            (*stop)++;
+    }
+    else
+        return 0;
+    if (*stop < start.as.i)
+        *stop = start.as.i;
+    for (int s = 0; s < count; s++)
+    {
+        if (steps[s].op != VEC_LOAD && steps[s].op != VEC_STORE)
+            continue;
+        Value array = operands[steps[s].a];
+        if (array.type != VAL_ARRAY || start.as.i < 0 || *stop > array.as.array->length)
+            return 0;
+    }
+    return 1;
+}
+
+// 执行向量化的循环, 返回循环结束时循环变量的值; args 为实参区中的 argc 个值
+Value vector_loop(Value *args, int argc)
+{
+    VectorStep steps[VECTOR_MAX_STEPS];
+    int count = argc >= 3 && args[argc - 1].type == VAL_STRING ? vector_parse(args[argc - 1].as.s, steps, argc - 3) : -1;
+    if (count < 0)
+        runtime_error("invalid vector loop", NULL);
+    Value start = args[argc - 3];
+    Value end = args[argc - 2];
+    long long stop;
+    if (!vector_stop(steps, count, args, start, end, &stop))
+        return vector_generic(steps, count, args, start, end);
+    if (stop == start.as.i)
+        return start;
+
+    // 每个寄存器一段, 再加上整数转浮点数用的两段; 每段按 32 字节对齐, SIMD 的读写不跨越缓存行
+    long long total = stop - start.as.i;
+    int strip = total < VECTOR_STRIP ? (int)((total + 3) & ~3LL) : VECTOR_STRIP;
+    size_t size = (size_t)strip * sizeof(Value);
+    char *block = malloc(size * count + sizeof(double) * 2 * VECTOR_STRIP + 32);
+    char *aligned = block + ((32 - ((size_t)block & 31)) & 31);
+    double *scratch = (double *)(aligned + size * count);
+    VectorRegister regs[VECTOR_MAX_STEPS];
+    for (int s = 0; s < count; s++)
+    {
+        regs[s].data = aligned + size * s;
+        regs[s].kind = ARRAY_BOXED;
+        // 不变量在整段中都相同, 只需填充一次
+        if (steps[s].op == VEC_CONST)
+        {
+            Value v = args[steps[s].a];
+            regs[s].kind = v.type == VAL_INT || v.type == VAL_FLOAT ? v.type : ARRAY_BOXED;
+            for (int k = 0; k < strip; k++)
+            {
+                if (regs[s].kind == ARRAY_BOXED)
+                    ((Value *)regs[s].data)[k] = v;
+                else
+                    ((long long *)regs[s].data)[k] = v.as.i;
+            }
+        }
+    }
+
+    for (long long base = start.as.i; base < stop; base += strip)
+    {
+        int n = stop - base < strip ? (int)(stop - base) : strip;
+        for (int s = 0; s < count; s++)
+        {
+            VectorStep *step = &steps[s];
+            VectorRegister *reg = &regs[s];
+            switch (step->op)
+            {
+            case VEC_INDEX:
+                reg->kind = ARRAY_INT;
+                for (int k = 0; k < n; k++)
+                    ((long long *)reg->data)[k] = base + k;
+                break;
+            case VEC_CONST:
+                break;
+            case VEC_LOAD:
+            {
+                // 复制出来而不是直接指向数组, 后面的步骤写入同一个数组时不影响已读出的值
+                Array *array = args[step->a].as.array;
+                if (array->kind == ARRAY_BOXED)
+                    vector_load_boxed(reg, (Value *)array->data + base, n);
+                else
+                {
+                    reg->kind = array->kind;
+                    memcpy(reg->data, (long long *)array->data + base, n * sizeof(long long));
+                }
+                break;
+            }
+            case VEC_STORE:
+            {
+                Array *array = args[step->a].as.array;
+                VectorRegister *value = &regs[step->b];
+                if (array->kind != ARRAY_BOXED && array->kind == value->kind)
+                    memcpy((long long *)array->data + base, value->data, n * sizeof(long long));
+                else
+                {
+                    // 类型不同时逐个写入, 紧凑数组可能在中途转为装箱数组
+                    for (int k = 0; k < n; k++)
+                        array_put(array, base + k, vector_get(value, k));
+                }
+                break;
+            }
+            default:
+                vector_binary(step->op, &regs[step->a], &regs[step->b], reg, scratch, n);
+                break;
+            }
+        }
+    }
+    free(block);
+    return value_int(stop);
+}
+
+// ---------------- 内联缓存 ----------------
+
+// 缓存未命中: 沿形状链查找键的槽位并记入缓存, 键不存在 (-1) 也记入, 形状不会改变所以缓存一直有效
+// 返回 -1 时由调用者走哈希查找; 缓存已满时不再沿形状链查找
+int field_cache_miss(FieldCache *cache, Shape *shape, const char *key)
+{
+    if (cache->count == FIELD_CACHE_WAYS)
+        return -1;
+    int slot = shape_lookup(shape, key);
+    cache->shapes[cache->count] = shape;
+    cache->slots[cache->count++] = slot;
+    return slot;
+}
+
+// 有形状的键值对在缓存中查找槽位, 其余情况返回 -1
+static inline int field_slot(Value container, const char *key, FieldCache *cache)
+{
+    if (container.type != VAL_MAP || container.as.map->shape == NULL)
+        return -1;
+    Shape *shape = container.as.map->shape;
+    for (int i = 0; i < cache->count; i++)
+    {
+        if (cache->shapes[i] == shape)
+            return cache->slots[i];
+    }
+    return field_cache_miss(cache, shape, key);
+}
+
+// container["key"], 键是常量字符串; 每个访问位置有自己的缓存
+Value map_get_field(Value container, const char *key, FieldCache *cache)
+{
+    int slot = field_slot(container, key, cache);
+    if (slot >= 0)
+        return container.as.map->values[slot];
+    return value_get_index(container, value_string((char *)key));
+}
+
+// container["key"] = value, 键已存在时直接写入槽位, 新加入的键改变形状, 下次访问再记入缓存
+void map_set_field(Value container, const char *key, FieldCache *cache, Value value)
+{
+    int slot = field_slot(container, key, cache);
+    if (slot >= 0)
+    {
+        container.as.map->values[slot] = value;
+        gc_barrier(container.as.map, value);
+    }
+    else
+        value_set_index(container, value_string((char *)key), value);
+}
+
+// 数组长度, 其他类型为 -1 (越界检查消除的守卫据此回到带检查的循环)
+Value value_length(Value v)
+{
+    return value_int(v.type == VAL_ARRAY ? v.as.array->length : -1);
+}
+
+// // 测试输入
+// int main()
+// {
+//     Value array = value_new_array(0);
+//     value_set_index(array, value_int(3), value_float(2.5));
+//     value_set_index(array, value_int(0), value_add(value_string("x = "), value_int(1)));
+//     value_print(stdout, array);
+//     printf("\n");
+//     return 0;
+// }
\ No newline at end of file
@@ -0,0 +1,1386 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "regalloc.c"
+#include "task.c"
+
+// ---------------- 寄存器字节码 ----------------
+
+// 操作码, 注释中 R[x] 是当前栈帧的第 x 个槽, K[x] 是常量, G[x] 是全局变量
+typedef enum
+{
+    OP_NOP,
+    OP_LOADK,              // R[a] = K[b]
+    OP_MOVE,               // R[a] = R[b]
+    OP_GETGLOBAL,          // R[a] = G[b]
+    OP_SETGLOBAL,          // G[b] = R[a]
+    OP_ADD,                // R[a] = R[b] + R[c]
+    OP_SUB,                // R[a] = R[b] - R[c]
+    OP_MUL,                // R[a] = R[b] * R[c]
+    OP_DIV,                // R[a] = R[b] / R[c]
+    OP_LT,                 // R[a] = R[b] < R[c]
+    OP_GT,                 // R[a] = R[b] > R[c]
+    OP_LE,                 // R[a] = R[b] <= R[c]
+    OP_GE,                 // R[a] = R[b] >= R[c]
+    OP_EQ,                 // R[a] = R[b] == R[c]
+    OP_ADD_I64,            // 以下是类型推断改写出的专用指令, 操作数类型已确定, 不检查类型标签
+    OP_SUB_I64,            // R[a] = R[b] op R[c], 整数
+    OP_MUL_I64,
+    OP_LT_I64,
+    OP_GT_I64,
+    OP_LE_I64,
+    OP_GE_I64,
+    OP_EQ_I64,
+    OP_ADD_F64,            // R[a] = R[b] op R[c], 浮点数
+    OP_SUB_F64,
+    OP_MUL_F64,
+    OP_DIV_F64,
+    OP_CONCAT,             // R[a] = R[b] 和 R[c] 拼接, 至少一边是字符串
+    OP_BUILDER,            // R[a] = R[b] 复制为字符串构建器 (见 value.c 的 string_builder)
+    OP_APPEND,             // R[a] = R[b] + R[c], R[b] 是字符串时是构建器, 原地追加
+    OP_NEWARRAY,           // R[a] = 容量为 b 的新数组
+    OP_NEWMAP,             // R[a] = 预留 b 个条目的新键值对
+    OP_GETINDEX,           // R[a] = R[b][R[c]]
+    OP_GETINDEX_UNCHECKED, // 同上, 下标已证明不越界
+    OP_SETINDEX,           // R[a][R[b]] = R[c]
+    OP_SETINDEX_UNCHECKED, // 同上, 下标已证明不越界
+    OP_GETFIELD,           // R[a] = R[b][K[c]], K[c] 是字符串, 带内联缓存
+    OP_SETFIELD,           // R[a][K[b]] = R[c], K[b] 是字符串, 带内联缓存
+    OP_LEN,                // R[a] = R[b] 的长度
+    OP_ARG,                // 实参区压入 R[a]
+    OP_CALL,               // R[a] = 函数 b (取实参区最后 c 个值)
+    OP_BUILTIN,            // R[a] = 内置函数 b (取实参区最后 c 个值)
+    OP_TAILCALL,           // 复用当前栈帧调用函数 b
+    OP_PARALLEL,           // R[a] = 并行循环, 循环体是函数 b (取实参区最后 c 个值, 见 parallel.c)
+    OP_APPLY,              // R[a] = pmap / pfilter / preduce, 对每个元素调用函数 b (取实参区最后 c 个值)
+    OP_SPAWN,              // R[a] = 执行函数 b 的新任务 (取实参区最后 c 个值, 见 task.c)
+    OP_AWAIT,              // R[a] = 等待任务 R[b] 结束得到的返回值
+    OP_JMP,                // 跳到 b
+    OP_JMPF,               // R[a] 为假时跳到 b
+    OP_RET,                // 返回 R[a]
+    OP_RETNIL,             // 返回 nil
+    OP_COUNT
+} OpCode;
+
+const char *opcode_names[OP_COUNT] = {
+    "NOP", "LOADK", "MOVE", "GETGLOBAL", "SETGLOBAL", "ADD", "SUB", "MUL", "DIV", "LT", "GT", "LE", "GE", "EQ",
+    "ADD_I64", "SUB_I64", "MUL_I64", "LT_I64", "GT_I64", "LE_I64", "GE_I64", "EQ_I64", "ADD_F64", "SUB_F64",
+    "MUL_F64", "DIV_F64", "CONCAT", "BUILDER", "APPEND",
+    "NEWARRAY", "NEWMAP", "GETINDEX", "GETINDEX_UNCHECKED", "SETINDEX", "SETINDEX_UNCHECKED", "GETFIELD",
+    "SETFIELD", "LEN", "ARG",
+    "CALL", "BUILTIN", "TAILCALL", "PARALLEL", "APPLY", "SPAWN", "AWAIT", "JMP", "JMPF", "RET", "RETNIL"};
+
+// 内置函数
+enum
+{
+    BUILTIN_PRINT,
+    BUILTIN_READ,
+    BUILTIN_VECTOR // 优化器生成的向量化循环, 源程序中不能调用
+};
+
+// 一条指令 8 字节
+typedef struct
+{
+    unsigned short op;
+    unsigned short a;
+    unsigned short b;
+    unsigned short c;
+} Instruction;
+
+// 直接线索化后的指令: 操作码换成处理代码的地址
+typedef struct
+{
+    const void *handler;
+    unsigned short a;
+    unsigned short b;
+    unsigned short c;
+} ThreadedInstruction;
+
+// 函数的栈帧布局固定: [形参 | 局部变量 | 寄存器 | 溢出槽]
+typedef struct
+{
+    char *name;
+    int param_count;
+    int local_count;    // 包括形参
+    int register_count; // 寄存器分配用到的寄存器数
+    int spill_count;
+    int frame_size;
+    Instruction *code;
+    int code_length;
+    ThreadedInstruction *threaded;
+    // 分层执行: 调用次数或循环回跳次数达到阈值后交给 JIT 编译
+    int call_count;
+    int loop_count;
+    int jit_failed;
+    void *native;           // JIT 生成的机器码, 没有时为 NULL
+    const void **native_pc; // 每条指令对应的机器码地址, 用于从循环中途进入
+    FieldCache *caches;     // 每条指令一项, 供 GETFIELD / SETFIELD 使用
+} VMFunction;
+
+typedef struct
+{
+    Value *constants;
+    int constant_count;
+    VMFunction *functions;
+    int function_count;
+    char **global_names;
+    int global_count;
+    int entry;         // 全局代码, 没有时为 -1
+    int main_function; // main, 没有时为 -1
+} VMModule;
+
+// 虚拟机使用的寄存器数, 指令的操作数是 16 位, 一个栈帧最多 65535 个槽
+int vm_register_count = 200;
+
+// print 的输出位置
+FILE *vm_output = NULL;
+
+// ---------------- 从 IR 生成字节码 ----------------
+
+typedef struct
+{
+    VMModule *module;
+    StringMap constants; // 常量文本 -> 下标
+    StringMap globals;   // 全局变量 -> 下标
+    StringMap functions; // 函数名 -> 下标
+    VMFunction *function;
+    StringMap locals;    // 局部变量 -> 槽
+    StringMap labels;    // 标签 -> 指令位置
+    StringMap keys;      // 字符串常量临时变量 -> load_const 的位置
+    int *patches;        // 需要回填跳转目标的指令
+    char **patch_labels;
+    int patch_count;
+} VMCompiler;
+
+void vm_emit(VMFunction *f, int op, int a, int b, int c)
+{
+    if (a > 0xffff || b > 0xffff || c > 0xffff)
+    {
+        fprintf(stderr, "Compile error: operand out of range in function %s\n", f->name);
+        exit(1);
+    }
+    f->code = realloc(f->code, sizeof(Instruction) * (f->code_length + 1));
+    Instruction *ins = &f->code[f->code_length++];
+    ins->op = op;
+    ins->a = a;
+    ins->b = b;
+    ins->c = c;
+}
+
+int vm_constant(VMCompiler *compiler, const char *text)
+{
+    int index = string_map_get(&compiler->constants, text);
+    if (index >= 0)
+        return index;
+    VMModule *m = compiler->module;
+    m->constants = realloc(m->constants, sizeof(Value) * (m->constant_count + 1));
+    m->constants[m->constant_count] = value_from_constant(text);
+    string_map_put(&compiler->constants, text, m->constant_count);
+    return m->constant_count++;
+}
+
+// 临时变量所在的槽, 定义后从不使用的临时变量没有寄存器, 写到栈帧最后的暂存槽
+int vm_temp_slot(VMCompiler *compiler, const char *temp)
+{
+    VMFunction *f = compiler->function;
+    int t = temp_index(temp);
+    if (t >= temp_register_capacity || temp_register[t] < 0)
+        return f->local_count + f->register_count + f->spill_count;
+    return f->local_count + temp_register[t];
+}
+
+int vm_local_slot(VMCompiler *compiler, const char *name)
+{
+    int slot = string_map_get(&compiler->locals, name);
+    if (slot < 0)
+    {
+        slot = compiler->function->local_count++;
+        string_map_put(&compiler->locals, name, slot);
+    }
+    return slot;
+}
+
+// 溢出槽 sN
+int vm_spill_slot(VMCompiler *compiler, const char *slot)
+{
+    return compiler->function->local_count + compiler->function->register_count + atoi(slot + 1);
+}
+
+int vm_function_index(VMCompiler *compiler, const char *name)
+{
+    return string_map_get(&compiler->functions, name);
+}
+
+int vm_builtin_index(const char *name)
+{
+    if (strcmp(name, "print") == 0)
+        return BUILTIN_PRINT;
+    if (strcmp(name, "read") == 0)
+        return BUILTIN_READ;
+    if (strcmp(name, "$vector") == 0)
+        return BUILTIN_VECTOR;
+    return -1;
+}
+
+void vm_jump(VMCompiler *compiler, int op, int a, const char *label)
+{
+    compiler->patches = realloc(compiler->patches, sizeof(int) * (compiler->patch_count + 1));
+    compiler->patch_labels = realloc(compiler->patch_labels, sizeof(char *) * (compiler->patch_count + 1));
+    compiler->patches[compiler->patch_count] = compiler->function->code_length;
+    compiler->patch_labels[compiler->patch_count++] = (char *)label;
+    vm_emit(compiler->function, op, a, 0, 0);
+}
+
+// 把 IR 区间 [start, end) 编译为函数 index
+void vm_compile_range(VMCompiler *compiler, int index, int start, int end)
+{
+    VMFunction *f = &compiler->module->functions[index];
+    compiler->function = f;
+    string_map_init(&compiler->locals, 16);
+    string_map_init(&compiler->labels, 16);
+    string_constant_temps(&compiler->keys, start, end);
+    compiler->patch_count = 0;
+
+    // 先确定局部变量的槽, 形参在最前面
+    int registers = 0;
+    int spills = 0;
+    for (int i = start; i < end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (ir_is(ins, "param"))
+        {
+            vm_local_slot(compiler, ins->arg1);
+            f->param_count++;
+        }
+        char **fields[3];
+        int uses = instruction_uses(ins, fields);
+        for (int k = 0; k < uses; k++)
+        {
+            int t = temp_index(*fields[k]);
+            if (t < temp_register_capacity && temp_register[t] + 1 > registers)
+                registers = temp_register[t] + 1;
+        }
+        if (ir_has_def(ins->op) && is_temp(ins->result))
+        {
+            int t = temp_index(ins->result);
+            if (t < temp_register_capacity && temp_register[t] + 1 > registers)
+                registers = temp_register[t] + 1;
+        }
+        if (ir_is(ins, "spill") && atoi(ins->result + 1) + 1 > spills)
+            spills = atoi(ins->result + 1) + 1;
+    }
+    for (int i = start; i < end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (ir_is(ins, "load") && string_map_get(&compiler->globals, ins->arg1) < 0)
+            vm_local_slot(compiler, ins->arg1);
+        else if (ir_is(ins, "store") && string_map_get(&compiler->globals, ins->result) < 0)
+            vm_local_slot(compiler, ins->result);
+    }
+    f->register_count = registers;
+    f->spill_count = spills;
+    f->frame_size = f->local_count + registers + spills + 1;
+
+    for (int i = start; i < end; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        const char *op = ins->op;
+        int key;
+
+        if (strcmp(op, "load_const") == 0)
+            vm_emit(f, OP_LOADK, vm_temp_slot(compiler, ins->result), vm_constant(compiler, ins->arg1), 0);
+        else if (strcmp(op, "load") == 0)
+        {
+            int global = string_map_get(&compiler->globals, ins->arg1);
+            if (global >= 0)
+                vm_emit(f, OP_GETGLOBAL, vm_temp_slot(compiler, ins->result), global, 0);
+            else
+                vm_emit(f, OP_MOVE, vm_temp_slot(compiler, ins->result), vm_local_slot(compiler, ins->arg1), 0);
+        }
+        else if (strcmp(op, "store") == 0)
+        {
+            int global = string_map_get(&compiler->globals, ins->result);
+            if (global >= 0)
+                vm_emit(f, OP_SETGLOBAL, vm_temp_slot(compiler, ins->arg1), global, 0);
+            else
+                vm_emit(f, OP_MOVE, vm_local_slot(compiler, ins->result), vm_temp_slot(compiler, ins->arg1), 0);
+        }
+        else if (ir_is_binary(op))
+        {
+            static const char *names[] = {"add",     "sub",     "mul",     "div",     "lt",      "gt",
+                                          "le",      "ge",      "eq",      "add_i64", "sub_i64", "mul_i64",
+                                          "lt_i64",  "gt_i64",  "le_i64",  "ge_i64",  "eq_i64",  "add_f64",
+                                          "sub_f64", "mul_f64", "div_f64", "concat"};
+            static const int codes[] = {OP_ADD,     OP_SUB,     OP_MUL,     OP_DIV,     OP_LT,      OP_GT,
+                                        OP_LE,      OP_GE,      OP_EQ,      OP_ADD_I64, OP_SUB_I64, OP_MUL_I64,
+                                        OP_LT_I64,  OP_GT_I64,  OP_LE_I64,  OP_GE_I64,  OP_EQ_I64,  OP_ADD_F64,
+                                        OP_SUB_F64, OP_MUL_F64, OP_DIV_F64, OP_CONCAT};
+            int code = OP_NOP;
+            for (int k = 0; k < 22; k++)
+            {
+                if (strcmp(op, names[k]) == 0)
+                    code = codes[k];
+            }
+            vm_emit(f, code, vm_temp_slot(compiler, ins->result), vm_temp_slot(compiler, ins->arg1),
+                    vm_temp_slot(compiler, ins->arg2));
+        }
+        else if (strcmp(op, "move") == 0)
+            vm_emit(f, OP_MOVE, vm_temp_slot(compiler, ins->result), vm_temp_slot(compiler, ins->arg1), 0);
+        else if (strcmp(op, "string_builder") == 0)
+            vm_emit(f, OP_BUILDER, vm_temp_slot(compiler, ins->result), vm_temp_slot(compiler, ins->arg1), 0);
+        else if (strcmp(op, "string_append") == 0)
+            vm_emit(f, OP_APPEND, vm_temp_slot(compiler, ins->result), vm_temp_slot(compiler, ins->arg1),
+                    vm_temp_slot(compiler, ins->arg2));
+        else if (strcmp(op, "spill") == 0)
+            vm_emit(f, OP_MOVE, vm_spill_slot(compiler, ins->result), vm_temp_slot(compiler, ins->arg1), 0);
+        else if (strcmp(op, "reload") == 0)
+            vm_emit(f, OP_MOVE, vm_temp_slot(compiler, ins->result), vm_spill_slot(compiler, ins->arg1), 0);
+        else if (strcmp(op, "new_array") == 0)
+            vm_emit(f, OP_NEWARRAY, vm_temp_slot(compiler, ins->result), atoi(ins->arg1), 0);
+        else if (strcmp(op, "new_map") == 0)
+            vm_emit(f, OP_NEWMAP, vm_temp_slot(compiler, ins->result), atoi(ins->arg1), 0);
+        else if ((strcmp(op, "array_store") == 0 || strcmp(op, "key_value_pair") == 0) &&
+                 (key = string_map_get(&compiler->keys, ins->arg1)) >= 0)
+            vm_emit(f, OP_SETFIELD, vm_temp_slot(compiler, ins->result), vm_constant(compiler, ir_code[key].arg1),
+                    vm_temp_slot(compiler, ins->arg2));
+        else if (strcmp(op, "array_access") == 0 && (key = string_map_get(&compiler->keys, ins->arg2)) >= 0)
+            vm_emit(f, OP_GETFIELD, vm_temp_slot(compiler, ins->result), vm_temp_slot(compiler, ins->arg1),
+                    vm_constant(compiler, ir_code[key].arg1));
+        else if (strcmp(op, "array_store") == 0 || strcmp(op, "array_store_unchecked") == 0)
+            vm_emit(f, strcmp(op, "array_store") == 0 ? OP_SETINDEX : OP_SETINDEX_UNCHECKED,
+                    vm_temp_slot(compiler, ins->result), vm_temp_slot(compiler, ins->arg1), vm_temp_slot(compiler, ins->arg2));
+        else if (strcmp(op, "key_value_pair") == 0)
+            vm_emit(f, OP_SETINDEX, vm_temp_slot(compiler, ins->result), vm_temp_slot(compiler, ins->arg1),
+                    vm_temp_slot(compiler, ins->arg2));
+        else if (ir_is_array_load(op))
+            vm_emit(f, strcmp(op, "array_access") == 0 ? OP_GETINDEX : OP_GETINDEX_UNCHECKED,
+                    vm_temp_slot(compiler, ins->result), vm_temp_slot(compiler, ins->arg1), vm_temp_slot(compiler, ins->arg2));
+        else if (strcmp(op, "array_length") == 0)
+            vm_emit(f, OP_LEN, vm_temp_slot(compiler, ins->result), vm_temp_slot(compiler, ins->arg1), 0);
+        else if (strcmp(op, "arg") == 0)
+            vm_emit(f, OP_ARG, vm_temp_slot(compiler, ins->arg1), 0, 0);
+        else if (strcmp(op, "call_function") == 0 || strcmp(op, "tail_call") == 0)
+        {
+            int tail = strcmp(op, "tail_call") == 0;
+            int builtin = vm_builtin_index(ins->arg1);
+            int callee = vm_function_index(compiler, ins->arg1);
+            int dest = tail ? 0 : vm_temp_slot(compiler, ins->result);
+            if (builtin >= 0)
+            {
+                // 内置函数没有栈帧, 尾调用按普通调用后返回处理
+                vm_emit(f, OP_BUILTIN, dest, builtin, atoi(ins->arg2));
+                if (tail)
+                    vm_emit(f, OP_RET, dest, 0, 0);
+            }
+            else if (callee >= 0)
+                vm_emit(f, tail ? OP_TAILCALL : OP_CALL, dest, callee, atoi(ins->arg2));
+            else
+            {
+                fprintf(stderr, "Compile error: undefined function %s\n", ins->arg1);
+                exit(1);
+            }
+        }
+        else if (strcmp(op, "parallel_for") == 0)
+        {
+            int callee = vm_function_index(compiler, ins->arg1);
+            if (callee < 0)
+            {
+                fprintf(stderr, "Compile error: undefined function %s\n", ins->arg1);
+                exit(1);
+            }
+            vm_emit(f, OP_PARALLEL, vm_temp_slot(compiler, ins->result), callee, atoi(ins->arg2));
+        }
+        else if (strcmp(op, "parallel_apply") == 0)
+        {
+            int callee = vm_function_index(compiler, ins->arg1);
+            if (callee < 0)
+            {
+                fprintf(stderr, "Compile error: undefined function %s\n", ins->arg1);
+                exit(1);
+            }
+            vm_emit(f, OP_APPLY, vm_temp_slot(compiler, ins->result), callee, atoi(ins->arg2));
+        }
+        else if (strcmp(op, "spawn") == 0)
+        {
+            int callee = vm_function_index(compiler, ins->arg1);
+            if (callee < 0)
+            {
+                fprintf(stderr, "Compile error: %s %s\n",
+                        vm_builtin_index(ins->arg1) >= 0 ? "cannot spawn builtin" : "undefined function", ins->arg1);
+                exit(1);
+            }
+            vm_emit(f, OP_SPAWN, vm_temp_slot(compiler, ins->result), callee, atoi(ins->arg2));
+        }
+        else if (strcmp(op, "await") == 0)
+            vm_emit(f, OP_AWAIT, vm_temp_slot(compiler, ins->result), vm_temp_slot(compiler, ins->arg1), 0);
+        else if (strcmp(op, "label") == 0)
+            string_map_put(&compiler->labels, ins->arg1, f->code_length);
+        else if (strcmp(op, "goto") == 0)
+            vm_jump(compiler, OP_JMP, 0, ins->arg1);
+        else if (strcmp(op, "if_false") == 0)
+            vm_jump(compiler, OP_JMPF, vm_temp_slot(compiler, ins->arg1), ins->arg2);
+        else if (strcmp(op, "return") == 0)
+        {
+            if (ins->arg1 != NULL)
+                vm_emit(f, OP_RET, vm_temp_slot(compiler, ins->arg1), 0, 0);
+            else
+                vm_emit(f, OP_RETNIL, 0, 0, 0);
+        }
+        // param / alloc / nop 不生成代码
+    }
+    vm_emit(f, OP_RETNIL, 0, 0, 0);
+
+    for (int k = 0; k < compiler->patch_count; k++)
+    {
+        int target = string_map_get(&compiler->labels, compiler->patch_labels[k]);
+        if (target < 0)
+        {
+            fprintf(stderr, "Compile error: undefined label %s\n", compiler->patch_labels[k]);
+            exit(1);
+        }
+        f->code[compiler->patches[k]].b = target;
+    }
+    if (f->frame_size > 0xffff)
+    {
+        fprintf(stderr, "Compile error: frame of function %s is too large\n", f->name);
+        exit(1);
+    }
+
+    string_map_free(&compiler->locals);
+    string_map_free(&compiler->labels);
+    string_map_free(&compiler->keys);
+}
+
+VMFunction *vm_add_function(VMModule *m, const char *name)
+{
+    m->functions = realloc(m->functions, sizeof(VMFunction) * (m->function_count + 1));
+    VMFunction *f = &m->functions[m->function_count++];
+    memset(f, 0, sizeof(VMFunction));
+    f->name = strdup(name);
+    return f;
+}
+
+// 把当前的 IR (已经优化) 编译为字节码模块, 寄存器分配在这里进行
+VMModule *vm_compile_ir()
+{
+    RegAllocConfig config = {vm_register_count};
+    allocate_registers(config);
+
+    VMModule *m = calloc(1, sizeof(VMModule));
+    VMCompiler compiler;
+    memset(&compiler, 0, sizeof(compiler));
+    compiler.module = m;
+    string_map_init(&compiler.constants, 16);
+    string_map_init(&compiler.globals, 16);
+    string_map_init(&compiler.functions, 16);
+
+    // 全局变量和函数表
+    int depth = 0;
+    int has_global_code = 0;
+    for (int i = 0; i < ir_count; i++)
+    {
+        IRInstruction *ins = &ir_code[i];
+        if (ir_is(ins, "function"))
+        {
+            depth++;
+            string_map_put(&compiler.functions, ins->arg1, m->function_count);
+            vm_add_function(m, ins->arg1);
+        }
+        else if (ir_is(ins, "end_function"))
+            depth--;
+        else if (depth == 0 && !ir_is(ins, "nop"))
+        {
+            has_global_code = 1;
+            if (ir_is(ins, "alloc") && string_map_get(&compiler.globals, ins->arg1) < 0)
+            {
+                m->global_names = realloc(m->global_names, sizeof(char *) * (m->global_count + 1));
+                m->global_names[m->global_count] = ins->arg1;
+                string_map_put(&compiler.globals, ins->arg1, m->global_count++);
+            }
+        }
+    }
+    m->entry = -1;
+    if (has_global_code)
+    {
+        m->entry = m->function_count;
+        vm_add_function(m, "(global)");
+    }
+    m->main_function = vm_function_index(&compiler, "main");
+
+    // 逐个函数编译, 全局代码是函数之外的所有指令
+    int index = 0;
+    int i = 0;
+    int global_start = -1;
+    while (i < ir_count)
+    {
+        if (ir_is(&ir_code[i], "function"))
+        {
+            int end = find_function_end(i);
+            vm_compile_range(&compiler, index++, i + 1, end);
+            i = end + 1;
+        }
+        else
+        {
+            if (global_start < 0)
+                global_start = i;
+            i++;
+        }
+    }
+    if (m->entry >= 0)
+    {
+        // 全局代码在 IR 的开头, 函数之前
+        int end = global_start;
+        while (end < ir_count && !ir_is(&ir_code[end], "function"))
+            end++;
+        vm_compile_range(&compiler, m->entry, global_start, end);
+    }
+
+    string_map_free(&compiler.constants);
+    string_map_free(&compiler.globals);
+    string_map_free(&compiler.functions);
+    return m;
+}
+
+// 源程序 -> 字节码模块
+VMModule *vm_compile_source(const char *source, int optimize)
+{
+    int token_count = 0;
+    Token *tokens = lexer(source, &token_count);
+    ASTNode *root = parse_program(&tokens, token_count);
+    generateIR(root);
+    if (optimize)
+        optimize_ir();
+    return vm_compile_ir();
+}
+
+// 反汇编
+void vm_disassemble(FILE *out, VMModule *m)
+{
+    for (int k = 0; k < m->constant_count; k++)
+    {
+        fprintf(out, "K[%d] = ", k);
+        value_print(out, m->constants[k]);
+        fprintf(out, "\n");
+    }
+    for (int g = 0; g < m->global_count; g++)
+        fprintf(out, "G[%d] = %s\n", g, m->global_names[g]);
+
+    for (int i = 0; i < m->function_count; i++)
+    {
+        VMFunction *f = &m->functions[i];
+        fprintf(out, "\nfunction %s: params %d, locals %d, registers %d, spills %d, frame %d\n", f->name,
+                f->param_count, f->local_count, f->register_count, f->spill_count, f->frame_size);
+        for (int pc = 0; pc < f->code_length; pc++)
+        {
+            Instruction *ins = &f->code[pc];
+            fprintf(out, "%4d  %-20s %d %d %d\n", pc, opcode_names[ins->op], ins->a, ins->b, ins->c);
+        }
+    }
+}
+
+// ---------------- 虚拟机 ----------------
+
+#define VM_STACK_SIZE (1 << 20)
+#define VM_MAX_FRAMES 100000
+#define VM_MAX_ARGS 4096
+
+typedef struct
+{
+    VMFunction *function;
+    ThreadedInstruction *return_ip;
+    Value *base;
+    int dest; // 返回值写入调用者的槽
+} CallFrame;
+
+typedef struct
+{
+    VMModule *module;
+    Value *stack;
+    Value *stack_high; // 栈中写入过的最高位置, 回收时把当前栈顶以上的部分清为 nil
+    Value *globals;
+    CallFrame *frames;
+    int frame_count;
+    Value args[VM_MAX_ARGS];
+    int arg_count;
+    int native_depth;       // 正在执行的机器码层数
+    VMFunction *tail_call;  // 机器码中的尾调用, 由 vm_invoke 接着执行
+} VM;
+
+// 机器码的入口: 在 base 处的栈帧上从 entry 开始执行
+typedef Value (*NativeCode)(VM *vm, Value *base, const void *entry);
+
+// JIT 编译器, 由 jit.c 设置; 为 NULL 时只解释执行
+int (*vm_jit_compile)(VMModule *m, VMFunction *f) = NULL;
+int vm_jit_call_threshold = 50;
+int vm_jit_loop_threshold = 500;
+
+// 机器码之间的调用占用 C 栈, 嵌套超过这个深度时留在解释器中
+#define VM_MAX_NATIVE_DEPTH 4000
+
+// GCC / Clang 用 computed goto 做直接线索化分派, 其他编译器或定义了 VM_NO_THREADING 时退回 switch
+#if defined(__GNUC__) && !defined(VM_NO_THREADING)
+#define VM_THREADED 1
+#endif
+
+Value vm_builtin(VM *vm, int builtin, int argc)
+{
+    if (argc > vm->arg_count)
+        runtime_error("missing arguments for builtin", NULL);
+    Value *args = &vm->args[vm->arg_count - argc];
+    vm->arg_count -= argc;
+    if (builtin == BUILTIN_PRINT)
+    {
+        io_print(vm_output, args, argc);
+        return value_nil();
+    }
+    if (builtin == BUILTIN_VECTOR)
+        return vector_loop(args, argc);
+    // 阻塞期间其他任务可以执行
+    return io_read();
+}
+
+// 在 base 处建立 f 的栈帧, 实参取自实参区, 多余的实参丢弃, 缺少的为 nil
+// 只有局部变量需要初始化为 nil, 临时变量总是先定义后使用
+void vm_enter(VM *vm, VMFunction *f, Value *base, int argc)
+{
+    // 函数调用是安全点: 调用者的值都在栈帧中, 实参在实参区
+    gc_safepoint();
+    if (base + f->frame_size > vm->stack + VM_STACK_SIZE)
+        runtime_error("stack overflow in", f->name);
+    if (base + f->frame_size > vm->stack_high)
+        vm->stack_high = base + f->frame_size;
+    // 从 .xbc 加载的代码没有经过编译器, 实参个数在这里检查
+    if (argc > vm->arg_count)
+        runtime_error("missing arguments for", f->name);
+    Value *args = &vm->args[vm->arg_count - argc];
+    int n = argc < f->param_count ? argc : f->param_count;
+    for (int i = 0; i < n; i++)
+        base[i] = args[i];
+    for (int i = n; i < f->local_count; i++)
+        base[i] = value_nil();
+    vm->arg_count -= argc;
+}
+
+Value vm_interpret(VM *vm, VMFunction *function, Value *base);
+
+// 统计一次调用, 函数足够热时编译; 返回可以进入的机器码入口, 没有时为 NULL
+const void *vm_native_entry(VM *vm, VMFunction *f)
+{
+    if (f->native == NULL && !f->jit_failed && ++f->call_count >= vm_jit_call_threshold)
+        f->jit_failed = !vm_jit_compile(vm->module, f);
+    return f->native != NULL && vm->native_depth < VM_MAX_NATIVE_DEPTH ? f->native_pc[0] : NULL;
+}
+
+// 执行已经建立好栈帧的 f, entry 不为 NULL 时从该处执行机器码, 否则解释执行
+Value vm_invoke(VM *vm, VMFunction *f, Value *base, const void *entry)
+{
+    for (;;)
+    {
+        Value result;
+        if (entry != NULL)
+        {
+            // 机器码的栈帧也要记录, 回收时据此确定栈顶
+            vm->native_depth++;
+            vm->frames[vm->frame_count].function = f;
+            vm->frames[vm->frame_count].base = base;
+            vm->frame_count++;
+            result = ((NativeCode)f->native)(vm, base, entry);
+            vm->frame_count--;
+            vm->native_depth--;
+        }
+        else
+            result = vm_interpret(vm, f, base);
+
+        // 机器码中的尾调用已经在同一个栈帧上建立了被调函数的参数
+        if (vm->tail_call == NULL)
+            return result;
+        f = vm->tail_call;
+        vm->tail_call = NULL;
+        entry = vm_native_entry(vm, f);
+    }
+}
+
+// 回收器的根所在的虚拟机: 主虚拟机和正在执行的任务的虚拟机
+// 并行循环和 pmap 的线程的虚拟机只在不回收时使用 (gc_inhibit), 不需要登记
+VM **vm_active = NULL;
+int vm_active_count = 0;
+
+void vm_activate(VM *vm)
+{
+    vm_active = realloc(vm_active, sizeof(VM *) * (vm_active_count + 1));
+    vm_active[vm_active_count++] = vm;
+}
+
+void vm_deactivate(VM *vm)
+{
+    for (int i = 0; i < vm_active_count; i++)
+    {
+        if (vm_active[i] == vm)
+        {
+            vm_active[i] = vm_active[--vm_active_count];
+            return;
+        }
+    }
+}
+
+// 并行循环的每个线程用自己的虚拟机执行循环体, 与调用者共享模块和全局变量 (循环体不写全局变量)
+// 线程池的线程常驻, 按线程编号保留虚拟机
+VM *vm_workers[PARALLEL_MAX_THREADS];
+
+VM *vm_worker(VM *vm, int worker)
+{
+    VM *w = vm_workers[worker];
+    if (w == NULL)
+    {
+        w = calloc(1, sizeof(VM));
+        w->stack = calloc(VM_STACK_SIZE, sizeof(Value));
+        w->stack_high = w->stack;
+        w->frames = malloc(sizeof(CallFrame) * VM_MAX_FRAMES);
+        vm_workers[worker] = w;
+    }
+    w->module = vm->module;
+    w->globals = vm->globals;
+    return w;
+}
+
+typedef struct
+{
+    VMFunction *body;
+    Value *args; // start, end 和捕获的变量
+    int argc;
+} VMParallelLoop;
+
+// 在一个线程中对 [lo, hi) 调用循环体; 循环体已经编译好或者确定不能编译, 线程中不会触发编译
+void vm_parallel_task(void *context, int worker, long long lo, long long hi)
+{
+    VMParallelLoop *loop = context;
+    VM *vm = vm_workers[worker];
+    vm->args[0] = value_int(lo);
+    vm->args[1] = value_int(hi);
+    memcpy(&vm->args[2], &loop->args[2], sizeof(Value) * (loop->argc - 2));
+    vm->arg_count = loop->argc;
+    vm_enter(vm, loop->body, vm->stack, loop->argc);
+    vm_invoke(vm, loop->body, vm->stack, loop->body->native != NULL ? loop->body->native_pc[0] : NULL);
+}
+
+// 执行 parallel_for: 循环体是函数 index, 实参在实参区的最后 argc 个值, base 是顺序执行时的栈帧
+// 返回循环变量的终值: 并行时是 end, 顺序执行时是循环体函数的返回值
+Value vm_parallel_for(VM *vm, int index, int argc, Value *base)
+{
+    VMFunction *body = &vm->module->functions[index];
+    if (argc > vm->arg_count)
+        runtime_error("missing arguments for", body->name);
+    ParallelLoop loop;
+    if (parallel_prepare(&loop, &vm->args[vm->arg_count - argc], argc) <= 1)
+    {
+        // 与普通调用相同, 一次调用执行整个循环
+        if (vm->frame_count == VM_MAX_FRAMES)
+            runtime_error("stack overflow in", body->name);
+        vm_enter(vm, body, base, argc);
+        const void *entry = vm_jit_compile != NULL ? vm_native_entry(vm, body) : NULL;
+        return vm_invoke(vm, body, base, entry);
+    }
+
+    // 线程中不能修改函数的状态: 先生成线索化代码, 有 JIT 时先编译循环体
+    if (body->threaded == NULL)
+        vm_interpret(vm, NULL, NULL);
+    if (vm_jit_compile != NULL && body->native == NULL && !body->jit_failed)
+        body->jit_failed = !vm_jit_compile(vm->module, body);
+    for (int w = 0; w < loop.workers; w++)
+        vm_worker(vm, w);
+
+    VMParallelLoop context = {body, &vm->args[vm->arg_count - argc], loop.argc};
+    parallel_run(vm_parallel_task, &context, loop.start, loop.end, loop.workers);
+    vm->arg_count -= argc;
+    parallel_finish(&loop);
+    return value_int(loop.end);
+}
+
+// 线程中不能修改函数的状态: 有 JIT 时先编译 f 和它能调用到的函数, 线程中不会再触发编译
+void vm_compile_reachable(VM *vm, VMFunction *f, char *seen)
+{
+    VMModule *m = vm->module;
+    if (seen[f - m->functions])
+        return;
+    seen[f - m->functions] = 1;
+    if (f->native == NULL && !f->jit_failed)
+        f->jit_failed = !vm_jit_compile(m, f);
+    for (int pc = 0; pc < f->code_length; pc++)
+    {
+        int op = f->code[pc].op;
+        if (op == OP_CALL || op == OP_TAILCALL || op == OP_PARALLEL || op == OP_APPLY)
+            vm_compile_reachable(vm, &m->functions[f->code[pc].b], seen);
+    }
+}
+
+typedef struct
+{
+    VM *vm;
+    VMFunction *function;
+    Value *base; // 在调用者自己的虚拟机中调用时的栈帧
+} VMApply;
+
+Value vm_apply_call(void *context, int worker, Value *args, int argc)
+{
+    VMApply *apply = context;
+    VMFunction *f = apply->function;
+    VM *vm = worker < 0 ? apply->vm : vm_workers[worker];
+    Value *base = worker < 0 ? apply->base : vm->stack;
+    if (vm->arg_count + argc > VM_MAX_ARGS)
+        runtime_error("too many arguments", NULL);
+    if (vm->frame_count == VM_MAX_FRAMES)
+        runtime_error("stack overflow in", f->name);
+    memcpy(&vm->args[vm->arg_count], args, sizeof(Value) * argc);
+    vm->arg_count += argc;
+    vm_enter(vm, f, base, argc);
+    const void *entry = NULL;
+    if (worker < 0 && vm_jit_compile != NULL)
+        entry = vm_native_entry(vm, f);
+    else if (f->native != NULL && vm->native_depth < VM_MAX_NATIVE_DEPTH)
+        entry = f->native_pc[0];
+    return vm_invoke(vm, f, base, entry);
+}
+
+// 执行 pmap / pfilter / preduce: 函数 index, 实参在实参区的最后 argc 个值, base 是在调用者中调用时的栈帧
+Value vm_parallel_apply(VM *vm, int index, int argc, Value *base)
+{
+    VMFunction *f = &vm->module->functions[index];
+    if (argc > vm->arg_count)
+        runtime_error("missing arguments for", f->name);
+    ParallelApply apply;
+    int workers = parallel_apply_prepare(&apply, &vm->args[vm->arg_count - argc], argc);
+    vm->arg_count -= argc;
+    if (workers > 1)
+    {
+        if (f->threaded == NULL)
+            vm_interpret(vm, NULL, NULL);
+        if (vm_jit_compile != NULL)
+        {
+            char *seen = calloc(vm->module->function_count, 1);
+            vm_compile_reachable(vm, f, seen);
+            free(seen);
+        }
+        for (int w = 0; w < workers; w++)
+            vm_worker(vm, w);
+    }
+    VMApply context = {vm, f, base};
+    return parallel_apply(&apply, workers, vm_apply_call, &context);
+}
+
+// 每个任务用自己的虚拟机执行, 与创建它的虚拟机共享模块和全局变量; 任务结束后虚拟机留给以后的任务
+typedef struct
+{
+    VMModule *module;
+    Value *globals;
+    VMFunction *function;
+    int argc;
+    Value args[];
+} VMTask;
+
+VM **vm_free_tasks = NULL;
+int vm_free_task_count = 0;
+
+Value vm_task_body(void *data)
+{
+    VMTask *task = data;
+    VM *vm = vm_free_task_count > 0 ? vm_free_tasks[--vm_free_task_count] : NULL;
+    if (vm == NULL)
+    {
+        vm = calloc(1, sizeof(VM));
+        vm->stack = calloc(VM_STACK_SIZE, sizeof(Value));
+        vm->stack_high = vm->stack;
+        vm->frames = malloc(sizeof(CallFrame) * VM_MAX_FRAMES);
+    }
+    vm->module = task->module;
+    vm->globals = task->globals;
+    memcpy(vm->args, task->args, sizeof(Value) * task->argc);
+    vm->arg_count = task->argc;
+    vm_activate(vm);
+
+    VMFunction *f = task->function;
+    vm_enter(vm, f, vm->stack, task->argc);
+    const void *entry = vm_jit_compile != NULL ? vm_native_entry(vm, f) : NULL;
+    Value result = vm_invoke(vm, f, vm->stack, entry);
+
+    // 留给以后的任务之前清空用过的栈, 栈中不留已经释放的对象
+    vm_deactivate(vm);
+    for (Value *slot = vm->stack; slot < vm->stack_high; slot++)
+        *slot = value_nil();
+    vm->stack_high = vm->stack;
+    vm_free_tasks = realloc(vm_free_tasks, sizeof(VM *) * (vm_free_task_count + 1));
+    vm_free_tasks[vm_free_task_count++] = vm;
+    free(task);
+    return result;
+}
+
+// spawn: 取走实参区最后 argc 个值, 创建执行函数 index 的任务
+Value vm_spawn(VM *vm, int index, int argc)
+{
+    VMFunction *f = &vm->module->functions[index];
+    if (argc > vm->arg_count)
+        runtime_error("missing arguments for", f->name);
+    VMTask *task = malloc(sizeof(VMTask) + sizeof(Value) * (argc + 1));
+    task->module = vm->module;
+    task->globals = vm->globals;
+    task->function = f;
+    task->argc = argc;
+    vm->arg_count -= argc;
+    memcpy(task->args, &vm->args[vm->arg_count], sizeof(Value) * argc);
+    return value_task(task_spawn(vm_task_body, task));
+}
+
+// 还没有开始执行的任务的实参
+void vm_gc_task_args(TaskQueue *queue, void (*visit)(Value *slot))
+{
+    for (Task *task = queue->head; task != NULL; task = task->next)
+    {
+        if (task->worker < 0)
+        {
+            VMTask *data = task->data;
+            for (int i = 0; i < data->argc; i++)
+                visit(&data->args[i]);
+        }
+    }
+}
+
+// 回收器的根: 各虚拟机栈中当前栈顶以下的槽, 实参区, 全局变量, 以及还没有开始执行的任务的实参
+// 回收只在安全点进行, 栈顶由最内层的栈帧确定 (解释执行和机器码的栈帧都有记录)
+void vm_gc_roots(void (*visit)(Value *slot))
+{
+    // 长字符串在输出缓冲区中只保存指针, 回收之前写出
+    io_flush_all();
+    for (int k = 0; k < vm_active_count; k++)
+    {
+        VM *vm = vm_active[k];
+        Value *top = vm->stack;
+        if (vm->frame_count > 0)
+        {
+            CallFrame *frame = &vm->frames[vm->frame_count - 1];
+            top = frame->base + frame->function->frame_size;
+        }
+        for (Value *slot = vm->stack; slot < top; slot++)
+            visit(slot);
+        // 栈顶以上是已经返回的栈帧, 清为 nil, 以后不会读到回收后的对象
+        for (Value *slot = top; slot < vm->stack_high; slot++)
+            *slot = value_nil();
+        if (vm->stack_high > top)
+            vm->stack_high = top;
+        for (int i = 0; i < vm->arg_count; i++)
+            visit(&vm->args[i]);
+        for (int g = 0; g < vm->module->global_count; g++)
+            visit(&vm->globals[g]);
+    }
+    TaskScheduler *s = &task_scheduler;
+    vm_gc_task_args(&s->global, visit);
+    for (int w = 0; w < s->worker_count; w++)
+        vm_gc_task_args(&s->queues[w], visit);
+}
+
+// 解释执行 f, 栈帧已经在 base 处建立
+Value vm_interpret(VM *vm, VMFunction *function, Value *base)
+{
+#ifdef VM_THREADED
+    static const void *labels[OP_COUNT] = {
+        &&op_NOP, &&op_LOADK, &&op_MOVE, &&op_GETGLOBAL, &&op_SETGLOBAL, &&op_ADD, &&op_SUB, &&op_MUL, &&op_DIV,
+        &&op_LT, &&op_GT, &&op_LE, &&op_GE, &&op_EQ, &&op_ADD_I64, &&op_SUB_I64, &&op_MUL_I64, &&op_LT_I64,
+        &&op_GT_I64, &&op_LE_I64, &&op_GE_I64, &&op_EQ_I64, &&op_ADD_F64, &&op_SUB_F64, &&op_MUL_F64, &&op_DIV_F64,
+        &&op_CONCAT, &&op_BUILDER, &&op_APPEND, &&op_NEWARRAY, &&op_NEWMAP, &&op_GETINDEX,
+        &&op_GETINDEX_UNCHECKED, &&op_SETINDEX, &&op_SETINDEX_UNCHECKED, &&op_GETFIELD, &&op_SETFIELD, &&op_LEN,
+        &&op_ARG, &&op_CALL, &&op_BUILTIN, &&op_TAILCALL, &&op_PARALLEL, &&op_APPLY, &&op_SPAWN, &&op_AWAIT, &&op_JMP, &&op_JMPF, &&op_RET, &&op_RETNIL};
+#define VM_CASE(name) op_##name:
+#define VM_DISPATCH() goto *ip->handler
+#define VM_NEXT() goto *(++ip)->handler
+#else
+#define VM_CASE(name) case OP_##name:
+#define VM_DISPATCH() continue
+#define VM_NEXT() \
+    {             \
+        ip++;     \
+        continue; \
+    }
+#endif
+#define R(x) base[x]
+
+    // function 为 NULL 时只为所有函数生成线索化代码, 并行循环在启动线程之前调用
+    VMModule *m = vm->module;
+    for (int i = 0; i < m->function_count && (function == NULL || function->threaded == NULL); i++)
+    {
+        VMFunction *f = &m->functions[i];
+        if (f->threaded != NULL)
+            continue;
+        f->threaded = malloc(sizeof(ThreadedInstruction) * (f->code_length + 1));
+        for (int pc = 0; pc < f->code_length; pc++)
+        {
+#ifdef VM_THREADED
+            f->threaded[pc].handler = labels[f->code[pc].op];
+#else
+            f->threaded[pc].handler = (const void *)(size_t)f->code[pc].op;
+#endif
+            f->threaded[pc].a = f->code[pc].a;
+            f->threaded[pc].b = f->code[pc].b;
+            f->threaded[pc].c = f->code[pc].c;
+        }
+    }
+    if (function == NULL)
+        return value_nil();
+
+    if (vm->frame_count == VM_MAX_FRAMES)
+        runtime_error("stack overflow in", function->name);
+    CallFrame *frame = &vm->frames[vm->frame_count++];
+    frame->function = function;
+    frame->base = base;
+    frame->return_ip = NULL;
+    frame->dest = 0;
+    ThreadedInstruction *ip = function->threaded;
+    ThreadedInstruction *code = function->threaded;
+    Value result;
+
+#ifdef VM_THREADED
+    VM_DISPATCH();
+#else
+    for (;;)
+    {
+        switch ((int)(size_t)ip->handler)
+        {
+#endif
+
+    VM_CASE(NOP)
+    VM_NEXT();
+    VM_CASE(LOADK)
+    R(ip->a) = m->constants[ip->b];
+    VM_NEXT();
+    VM_CASE(MOVE)
+    R(ip->a) = R(ip->b);
+    VM_NEXT();
+    VM_CASE(GETGLOBAL)
+    R(ip->a) = vm->globals[ip->b];
+    VM_NEXT();
+    VM_CASE(SETGLOBAL)
+    vm->globals[ip->b] = R(ip->a);
+    VM_NEXT();
+    VM_CASE(ADD)
+    if (R(ip->b).type == VAL_INT && R(ip->c).type == VAL_INT)
+        R(ip->a) = value_int((long long)((unsigned long long)R(ip->b).as.i + (unsigned long long)R(ip->c).as.i));
+    else
+        R(ip->a) = value_add(R(ip->b), R(ip->c));
+    VM_NEXT();
+    VM_CASE(SUB)
+    if (R(ip->b).type == VAL_INT && R(ip->c).type == VAL_INT)
+        R(ip->a) = value_int((long long)((unsigned long long)R(ip->b).as.i - (unsigned long long)R(ip->c).as.i));
+    else
+        R(ip->a) = value_sub(R(ip->b), R(ip->c));
+    VM_NEXT();
+    VM_CASE(MUL)
+    R(ip->a) = value_mul(R(ip->b), R(ip->c));
+    VM_NEXT();
+    VM_CASE(DIV)
+    R(ip->a) = value_div(R(ip->b), R(ip->c));
+    VM_NEXT();
+    VM_CASE(LT)
+    if (R(ip->b).type == VAL_INT && R(ip->c).type == VAL_INT)
+        R(ip->a) = value_int(R(ip->b).as.i < R(ip->c).as.i);
+    else
+        R(ip->a) = value_lt(R(ip->b), R(ip->c));
+    VM_NEXT();
+    VM_CASE(GT)
+    R(ip->a) = value_gt(R(ip->b), R(ip->c));
+    VM_NEXT();
+    VM_CASE(LE)
+    R(ip->a) = value_le(R(ip->b), R(ip->c));
+    VM_NEXT();
+    VM_CASE(GE)
+    R(ip->a) = value_ge(R(ip->b), R(ip->c));
+    VM_NEXT();
+    VM_CASE(EQ)
+    R(ip->a) = value_eq(R(ip->b), R(ip->c));
+    VM_NEXT();
+    VM_CASE(ADD_I64)
+    R(ip->a) = value_int((long long)((unsigned long long)R(ip->b).as.i + (unsigned long long)R(ip->c).as.i));
+    VM_NEXT();
+    VM_CASE(SUB_I64)
+    R(ip->a) = value_int((long long)((unsigned long long)R(ip->b).as.i - (unsigned long long)R(ip->c).as.i));
+    VM_NEXT();
+    VM_CASE(MUL_I64)
+    R(ip->a) = value_int((long long)((unsigned long long)R(ip->b).as.i * (unsigned long long)R(ip->c).as.i));
+    VM_NEXT();
+    VM_CASE(LT_I64)
+    R(ip->a) = value_int(R(ip->b).as.i < R(ip->c).as.i);
+    VM_NEXT();
+    VM_CASE(GT_I64)
+    R(ip->a) = value_int(R(ip->b).as.i > R(ip->c).as.i);
+    VM_NEXT();
+    VM_CASE(LE_I64)
+    R(ip->a) = value_int(R(ip->b).as.i <= R(ip->c).as.i);
+    VM_NEXT();
+    VM_CASE(GE_I64)
+    R(ip->a) = value_int(R(ip->b).as.i >= R(ip->c).as.i);
+    VM_NEXT();
+    VM_CASE(EQ_I64)
+    R(ip->a) = value_int(R(ip->b).as.i == R(ip->c).as.i);
+    VM_NEXT();
+    VM_CASE(ADD_F64)
+    R(ip->a) = value_float(R(ip->b).as.f + R(ip->c).as.f);
+    VM_NEXT();
+    VM_CASE(SUB_F64)
+    R(ip->a) = value_float(R(ip->b).as.f - R(ip->c).as.f);
+    VM_NEXT();
+    VM_CASE(MUL_F64)
+    R(ip->a) = value_float(R(ip->b).as.f * R(ip->c).as.f);
+    VM_NEXT();
+    VM_CASE(DIV_F64)
+    R(ip->a) = value_float(R(ip->b).as.f / R(ip->c).as.f);
+    VM_NEXT();
+    VM_CASE(CONCAT)
+    R(ip->a) = value_concat(R(ip->b), R(ip->c));
+    VM_NEXT();
+    VM_CASE(BUILDER)
+    R(ip->a) = string_builder(R(ip->b));
+    VM_NEXT();
+    VM_CASE(APPEND)
+    R(ip->a) = string_append(R(ip->b), R(ip->c));
+    VM_NEXT();
+    VM_CASE(NEWARRAY)
+    R(ip->a) = value_new_array(ip->b);
+    VM_NEXT();
+    VM_CASE(NEWMAP)
+    R(ip->a) = value_new_map(ip->b);
+    VM_NEXT();
+    VM_CASE(GETINDEX)
+    R(ip->a) = value_get_index(R(ip->b), R(ip->c));
+    VM_NEXT();
+    VM_CASE(GETINDEX_UNCHECKED)
+    if (R(ip->b).type == VAL_ARRAY && R(ip->c).type == VAL_INT)
+        R(ip->a) = array_get(R(ip->b).as.array, R(ip->c).as.i);
+    else
+        R(ip->a) = value_get_index(R(ip->b), R(ip->c));
+    VM_NEXT();
+    VM_CASE(SETINDEX)
+    value_set_index(R(ip->a), R(ip->b), R(ip->c));
+    VM_NEXT();
+    VM_CASE(SETINDEX_UNCHECKED)
+    if (R(ip->a).type == VAL_ARRAY && R(ip->b).type == VAL_INT)
+        array_put(R(ip->a).as.array, R(ip->b).as.i, R(ip->c));
+    else
+        value_set_index(R(ip->a), R(ip->b), R(ip->c));
+    VM_NEXT();
+    VM_CASE(GETFIELD)
+    R(ip->a) = map_get_field(R(ip->b), m->constants[ip->c].as.s, &function->caches[ip - code]);
+    VM_NEXT();
+    VM_CASE(SETFIELD)
+    map_set_field(R(ip->a), m->constants[ip->b].as.s, &function->caches[ip - code], R(ip->c));
+    VM_NEXT();
+    VM_CASE(LEN)
+    R(ip->a) = value_length(R(ip->b));
+    VM_NEXT();
+    VM_CASE(ARG)
+    if (vm->arg_count == VM_MAX_ARGS)
+        runtime_error("too many arguments", NULL);
+    vm->args[vm->arg_count++] = R(ip->a);
+    VM_NEXT();
+    VM_CASE(CALL)
+    {
+        VMFunction *callee = &m->functions[ip->b];
+        Value *callee_base = base + function->frame_size;
+        if (vm->frame_count == VM_MAX_FRAMES)
+            runtime_error("stack overflow in", callee->name);
+        vm_enter(vm, callee, callee_base, ip->c);
+        if (vm_jit_compile != NULL)
+        {
+            const void *entry = vm_native_entry(vm, callee);
+            if (entry != NULL)
+            {
+                Value value = vm_invoke(vm, callee, callee_base, entry);
+                R(ip->a) = value;
+                VM_NEXT();
+            }
+        }
+        frame = &vm->frames[vm->frame_count++];
+        frame->function = callee;
+        frame->base = callee_base;
+        frame->return_ip = ip + 1;
+        frame->dest = ip->a;
+        function = callee;
+        base = callee_base;
+        code = callee->threaded;
+        ip = code;
+        VM_DISPATCH();
+    }
+    VM_CASE(BUILTIN)
+    {
+        Value value = vm_builtin(vm, ip->b, ip->c);
+        R(ip->a) = value;
+        VM_NEXT();
+    }
+    VM_CASE(TAILCALL)
+    {
+        VMFunction *callee = &m->functions[ip->b];
+        vm_enter(vm, callee, base, ip->c);
+        frame->function = callee;
+        function = callee;
+        code = callee->threaded;
+        ip = code;
+        VM_DISPATCH();
+    }
+    VM_CASE(PARALLEL)
+    {
+        Value value = vm_parallel_for(vm, ip->b, ip->c, base + function->frame_size);
+        R(ip->a) = value;
+        VM_NEXT();
+    }
+    VM_CASE(APPLY)
+    {
+        Value value = vm_parallel_apply(vm, ip->b, ip->c, base + function->frame_size);
+        R(ip->a) = value;
+        VM_NEXT();
+    }
+    VM_CASE(SPAWN)
+    {
+        Value value = vm_spawn(vm, ip->b, ip->c);
+        R(ip->a) = value;
+        VM_NEXT();
+    }
+    VM_CASE(AWAIT)
+    {
+        Value value = task_await(R(ip->b));
+        R(ip->a) = value;
+        VM_NEXT();
+    }
+    VM_CASE(JMP)
+    if (ip->b <= ip - code)
+        gc_safepoint();
+    if (vm_jit_compile != NULL && ip->b <= ip - code)
+    {
+        // 循环回跳: 循环足够热时编译当前函数, 从循环头进入机器码执行完这次调用
+        if (function->native == NULL && !function->jit_failed && ++function->loop_count >= vm_jit_loop_threshold)
+            function->jit_failed = !vm_jit_compile(m, function);
+        if (function->native != NULL && vm->native_depth < VM_MAX_NATIVE_DEPTH)
+        {
+            // 机器码的执行自己占一层, 期间嵌套的解释执行会覆盖当前栈帧的记录
+            CallFrame saved = *frame;
+            vm->frame_count--;
+            result = vm_invoke(vm, function, base, function->native_pc[ip->b]);
+            vm->frame_count++;
+            *frame = saved;
+            goto do_return;
+        }
+    }
+    ip = code + ip->b;
+    VM_DISPATCH();
+    VM_CASE(JMPF)
+    if (!value_truthy(R(ip->a)))
+        ip = code + ip->b;
+    else
+        ip++;
+    VM_DISPATCH();
+    VM_CASE(RET)
+    result = R(ip->a);
+    goto do_return;
+    VM_CASE(RETNIL)
+    result = value_nil();
+    // 回到调用者的栈帧, 放在分派循环内, switch 分派时 VM_DISPATCH 才能 continue
+do_return:
+    {
+        ThreadedInstruction *return_ip = frame->return_ip;
+        int dest = frame->dest;
+        vm->frame_count--;
+        if (return_ip == NULL)
+            return result;
+        frame = &vm->frames[vm->frame_count - 1];
+        function = frame->function;
+        base = frame->base;
+        code = function->threaded;
+        base[dest] = result;
+        ip = return_ip;
+        VM_DISPATCH();
+    }
+
+#ifndef VM_THREADED
+        default:
+            runtime_error("bad opcode", NULL);
+        }
+    }
+#endif
+
+#undef R
+#undef VM_NEXT
+#undef VM_DISPATCH
+#undef VM_CASE
+}
+
+// 从栈底开始执行函数 (全局代码或 main)
+Value vm_execute(VM *vm, int function_index)
+{
+    VMFunction *function = &vm->module->functions[function_index];
+    vm_enter(vm, function, vm->stack, 0);
+    const void *entry = vm_jit_compile != NULL ? vm_native_entry(vm, function) : NULL;
+    return vm_invoke(vm, function, vm->stack, entry);
+}
+
+VM *vm_new(VMModule *m)
+{
+    VM *vm = calloc(1, sizeof(VM));
+    vm->module = m;
+    // 栈清零, 槽中总是合法的值 (包括从 .xbc 加载的代码读到的未定义的临时变量)
+    vm->stack = calloc(VM_STACK_SIZE, sizeof(Value));
+    vm->stack_high = vm->stack;
+    vm->frames = malloc(sizeof(CallFrame) * VM_MAX_FRAMES);
+    vm->globals = malloc(sizeof(Value) * (m->global_count + 1));
+    for (int g = 0; g < m->global_count; g++)
+        vm->globals[g] = value_nil();
+    for (int i = 0; i < m->function_count; i++)
+    {
+        if (m->functions[i].caches == NULL)
+            m->functions[i].caches = calloc(m->functions[i].code_length + 1, sizeof(FieldCache));
+    }
+    if (vm_output == NULL)
+        vm_output = stdout;
+    vm_activate(vm);
+    return vm;
+}
+
+void vm_free(VM *vm)
+{
+    vm_deactivate(vm);
+    free(vm->stack);
+    free(vm->frames);
+    free(vm->globals);
+    free(vm);
+}
+
+// 执行全局代码, 然后调用 main; 执行期间打开垃圾回收, 设置环境变量 X_GC_STATS 时结束后打印回收的统计
+void vm_run(VMModule *m)
+{
+    VM *vm = vm_new(m);
+    gc_start(vm_gc_roots, task_gc_result);
+    if (m->entry >= 0)
+        vm_execute(vm, m->entry);
+    if (m->main_function >= 0)
+        vm_execute(vm, m->main_function);
+    // 任务共享这个虚拟机的全局变量, 全部结束后才能释放
+    task_wait_all();
+    io_flush_all();
+    fflush(vm_output);
+    if (getenv("X_GC_STATS") != NULL)
+        gc_print_stats(stderr);
+    gc_stop();
+    vm_free(vm);
+}
+
+// // 测试输入
+// int main()
+// {
+//     freopen("input.txt", "r", stdin);
+//     int fsize = 1000;
+
+//     char source[1000] = {0};
+//     fread(source, 1, fsize, stdin);
+
+//     VMModule *module = vm_compile_source(source, 1);
+
+//     freopen("output_vm.txt", "w", stdout);
+//     vm_disassemble(stdout, module);
+//     vm_run(module);
+
+//     return 0;
+// }
\ No newline at end of file